@@ -0,0 +1,1280 @@
+#ifndef CDOCKER_BENCH_H
+#define CDOCKER_BENCH_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/prctl.h>
+
+#include "container.h"
+#include "launcher.h"
+#include "utility/timing.h"
+#include "utility/cd_signal.h"
+
+/*
+ * cdocker bench
+ *
+ * Launch count containers, concurrency at a time, and report p50/p99/max
+ * for every timing span. Launches run on the launch_pool() workers; results
+ * land in MAP_SHARED arrays that the workers and their containers write
+ * into.
+ */
+
+static int cmp_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of a sorted array
+static int64_t percentile(const int64_t *v, int n, int pct)
+{
+    int rank = (pct * n + 99) / 100;
+    if (rank < 1) rank = 1;
+    return v[rank - 1];
+}
+
+void bench_report(FILE *out, const struct launch_timing *timing, int count)
+{
+    int64_t *v = malloc(sizeof(*v) * count);
+    if (!v)
+    {
+        perror("malloc");
+        return;
+    }
+
+    fprintf(out, "%-10s %8s %10s %10s %10s %10s\n",
+            "phase", "n", "mean(ms)", "p50(ms)", "p99(ms)", "max(ms)");
+
+    for (int s = 0; s < TIMING_SPANS; s++)
+    {
+        int n = 0;
+        double sum = 0;
+        for (int i = 0; i < count; i++)
+        {
+            int64_t ns = timing_span_ns(&timing[i], s);
+            if (ns >= 0)
+            {
+                v[n++] = ns;
+                sum += ns;
+            }
+        }
+
+        if (n == 0)
+        {
+            fprintf(out, "%-10s %8d %10s %10s %10s %10s\n",
+                    timing_spans[s].name, 0, "-", "-", "-", "-");
+            continue;
+        }
+
+        qsort(v, n, sizeof(*v), cmp_i64);
+        fprintf(out, "%-10s %8d %10.3f %10.3f %10.3f %10.3f\n",
+                timing_spans[s].name, n, sum / n / 1e6,
+                percentile(v, n, 50) / 1e6, percentile(v, n, 99) / 1e6,
+                v[n - 1] / 1e6);
+    }
+
+    free(v);
+}
+
+// Point stdout at /dev/null; returns what to hand stdout_restore()
+static int stdout_mute(void)
+{
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (devnull >= 0)
+    {
+        dup2(devnull, STDOUT_FILENO);
+        close(devnull);
+    }
+    return saved;
+}
+
+static void stdout_restore(int saved)
+{
+    fflush(stdout);
+    if (saved >= 0)
+    {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+}
+
+int run_bench(const struct container_config *cfg, int count, int concurrency)
+{
+    if (count < 1) count = 1;
+    if (concurrency < 1) concurrency = 1;
+    if (concurrency > count) concurrency = count;
+
+    struct launch_timing *timing = timing_alloc(count);
+    int *status = mmap(NULL, sizeof(int) * count, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (!timing || status == MAP_FAILED)
+    {
+        perror("mmap bench");
+        timing_free(timing, count);
+        return 1;
+    }
+
+    // The launch path is chatty; keep the report readable
+    int saved_stdout = stdout_mute();
+    uint64_t start = now_ns();
+    int failed = launch_pool(cfg, count, concurrency, timing, status);
+    uint64_t elapsed = now_ns() - start;
+    stdout_restore(saved_stdout);
+
+    printf("%d launches, concurrency %d, %s handshake%s%s, %d failed, %.3fs wall, %.1f launches/s\n",
+           count, concurrency, cfg->sync == CD_SYNC_PIPE ? "pipe" : "futex",
+           cfg->zygote ? ", zygote" : "", cfg->network && cfg->netns_pool ? ", netns pool" : "",
+           failed, elapsed / 1e9, count / (elapsed / 1e9));
+    bench_report(stdout, timing, count);
+
+    munmap(status, sizeof(int) * count);
+    timing_free(timing, count);
+    return failed ? 1 : 0;
+}
+
+/*
+ * cdocker bench sync
+ *
+ * The handshake on its own: a forked child and the parent bounce a phase
+ * counter back and forth through cd_sync, once with futex wakes and once
+ * with pipe wakes, and report the round trip. A launch does one handoff
+ * each way, so this is the latency each kind adds per launch phase.
+ */
+
+static int64_t bench_sync_kind(enum cd_sync_kind kind, int rounds, int64_t *rtt)
+{
+    struct cd_sync sync;
+    if (cd_sync_init(&sync, kind) < 0)
+        return -1;
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        cd_sync_close(&sync);
+        return -1;
+    }
+    if (pid == 0)
+    {
+        cd_sync_child(&sync);
+        for (int i = 1; i <= rounds; i++)
+        {
+            if (cd_sync_wait(&sync, i) < 0)
+                _exit(1);
+            cd_sync_post(&sync, i);
+        }
+        _exit(0);
+    }
+
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+    cd_sync_parent(&sync, pidfd);
+
+    int ret = 0;
+    for (int i = 1; i <= rounds; i++)
+    {
+        uint64_t t0 = now_ns();
+        cd_sync_post(&sync, i);
+        if (cd_sync_wait(&sync, i) < 0)
+        {
+            perror("cd_sync_wait");
+            ret = -1;
+            break;
+        }
+        rtt[i - 1] = now_ns() - t0;
+    }
+
+    waitpid(pid, NULL, 0);
+    if (pidfd >= 0)
+        close(pidfd);
+    cd_sync_close(&sync);
+    return ret;
+}
+
+int run_sync_bench(int rounds)
+{
+    if (rounds < 1) rounds = 1;
+    int64_t *rtt = malloc(sizeof(*rtt) * rounds);
+    if (!rtt)
+    {
+        perror("malloc");
+        return 1;
+    }
+
+    static const struct { const char *name; enum cd_sync_kind kind; } kinds[] = {
+        { "futex", CD_SYNC_FUTEX },
+        { "pipe",  CD_SYNC_PIPE },
+    };
+
+    printf("%d round trips\n", rounds);
+    printf("%-10s %10s %10s %10s %10s\n", "handshake", "mean(us)", "p50(us)", "p99(us)", "max(us)");
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++)
+    {
+        if (bench_sync_kind(kinds[k].kind, rounds, rtt) < 0)
+        {
+            free(rtt);
+            return 1;
+        }
+
+        double sum = 0;
+        for (int i = 0; i < rounds; i++)
+            sum += rtt[i];
+        qsort(rtt, rounds, sizeof(*rtt), cmp_i64);
+        printf("%-10s %10.2f %10.2f %10.2f %10.2f\n", kinds[k].name, sum / rounds / 1e3,
+               percentile(rtt, rounds, 50) / 1e3, percentile(rtt, rounds, 99) / 1e3,
+               rtt[rounds - 1] / 1e3);
+    }
+
+    free(rtt);
+    return 0;
+}
+
+/*
+ * cdocker bench net
+ *
+ * What each network mode costs per packet. A "remote" namespace stands
+ * in for another machine at the far end of a veth pair, the wire. The
+ * wire's host end (cdkwire) is also the parent for the macvlan/ipvlan
+ * modes. For each mode, a client namespace is wired up the same way
+ * setup_network() wires a container, and measures UDP round trips and a
+ * TCP stream to a server in the remote:
+ *
+ *   routed, bridge      eth0 -> veth -> host forwarding + NAT -> wire
+ *   macvlan, ipvlan(-l3)  eth0 -> parent -> wire
+ *
+ * The veth modes reach the remote at 192.0.2.2, behind the host's
+ * 192.0.2.1. The lower-device modes use their own subnet (198.18.0.0/24),
+ * which the remote is on itself, as the gateway at .1.
+ */
+
+#define BENCH_NET_WIRE      VETH_PREFIX "wire"
+#define BENCH_NET_HOST      "192.0.2.1"
+#define BENCH_NET_REMOTE    "192.0.2.2"
+#define BENCH_NET_LAN       "198.18.0.0/24"
+#define BENCH_NET_PORT      7007
+#define BENCH_NET_STREAM_NS 1000000000LL    // TCP stream length per mode
+#define BENCH_NET_CHUNK     65536
+
+// Filled in by the client, in shared memory
+struct bench_net_result {
+    int ok;
+    int64_t bytes;          // TCP bytes the server got
+    int64_t stream_ns;
+    int64_t rtt[];          // one per round trip
+};
+
+struct bench_net_proc {
+    int (*fn)(int sock, void *arg);
+    void *arg;
+    int sock;               // the child's end
+};
+
+static int bench_net_proc_main(void *arg)
+{
+    struct bench_net_proc *p = arg;
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+    int back = dup(p->sock);
+    network_child_send(p->sock);
+
+    char go;
+    if (back < 0 || read(back, &go, 1) != 1)
+        return 1;
+    return p->fn(back, p->arg);
+}
+
+// A process cloned into a new netns, like a container, that hands its
+// netlink socket over *sock (see setup_network()) and then waits for a
+// byte on it before running fn
+static pid_t bench_net_spawn(int *sock, int (*fn)(int sock, void *arg), void *arg)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0)
+    {
+        perror("socketpair");
+        return -1;
+    }
+
+    struct bench_net_proc proc = { .fn = fn, .arg = arg, .sock = sv[1] };
+    int pidfd;
+    pid_t pid = spawn_child(bench_net_proc_main, &proc, CLONE_NEWNET, -1, &pidfd);
+    close(sv[1]);
+    if (pid < 0)
+    {
+        perror("clone bench");
+        close(sv[0]);
+        return -1;
+    }
+    close(pidfd);
+    *sock = sv[0];
+    return pid;
+}
+
+// One TCP connection's sink: read to EOF, answer with the count
+static void bench_net_sink(int conn)
+{
+    static char buf[BENCH_NET_CHUNK];
+    int64_t bytes = 0;
+    ssize_t n;
+    while ((n = read(conn, buf, sizeof(buf))) > 0)
+        bytes += n;
+    write(conn, &bytes, sizeof(bytes));
+}
+
+// The remote: UDP echo, and a TCP sink per connection, each in a process
+// of its own so parallel streams are received in parallel
+static int bench_net_server(int sock, void *arg)
+{
+    (void)arg;
+    signal(SIGCHLD, SIG_IGN);
+    struct sockaddr_in sa = {
+        .sin_family = AF_INET,
+        .sin_port = htons(BENCH_NET_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    int one = 1;
+    int udp = socket(AF_INET, SOCK_DGRAM, 0);
+    int lst = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(lst, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (udp < 0 || lst < 0 ||
+        bind(udp, (struct sockaddr *)&sa, sizeof(sa)) != 0 ||
+        bind(lst, (struct sockaddr *)&sa, sizeof(sa)) != 0 || listen(lst, 4) != 0)
+    {
+        perror("bench server");
+        return 1;
+    }
+    write(sock, "r", 1);
+
+    static char buf[BENCH_NET_CHUNK];
+    for (;;)
+    {
+        struct pollfd pfd[2] = {
+            { .fd = udp, .events = POLLIN },
+            { .fd = lst, .events = POLLIN },
+        };
+        if (poll(pfd, 2, -1) < 0)
+            continue;
+
+        if (pfd[0].revents & POLLIN)
+        {
+            struct sockaddr_in from;
+            socklen_t len = sizeof(from);
+            ssize_t n = recvfrom(udp, buf, sizeof(buf), 0, (struct sockaddr *)&from, &len);
+            if (n > 0)
+                sendto(udp, buf, n, 0, (struct sockaddr *)&from, len);
+        }
+        if (pfd[1].revents & POLLIN)
+        {
+            int conn = accept(lst, NULL, NULL);
+            if (conn >= 0 && fork() == 0)
+            {
+                prctl(PR_SET_PDEATHSIG, SIGKILL);
+                close(udp);
+                close(lst);
+                bench_net_sink(conn);
+                _exit(0);
+            }
+            if (conn >= 0)
+                close(conn);
+        }
+    }
+}
+
+// One TCP stream to sa for a fixed time, done once the server has it
+// all. Returns the bytes the server got and the time in *ns, or -1.
+static int64_t bench_net_stream(const struct sockaddr_in *sa, int64_t *ns)
+{
+    static char buf[BENCH_NET_CHUNK];
+    int tcp = socket(AF_INET, SOCK_STREAM, 0);
+    if (tcp < 0 || connect(tcp, (const struct sockaddr *)sa, sizeof(*sa)) != 0)
+    {
+        perror("bench client tcp");
+        return -1;
+    }
+    uint64_t t0 = now_ns();
+    while (now_ns() - t0 < BENCH_NET_STREAM_NS)
+        if (write(tcp, buf, sizeof(buf)) < 0)
+        {
+            perror("bench client stream");
+            close(tcp);
+            return -1;
+        }
+    shutdown(tcp, SHUT_WR);
+    int64_t bytes;
+    if (read(tcp, &bytes, sizeof(bytes)) != sizeof(bytes))
+        bytes = -1;
+    *ns = now_ns() - t0;
+    close(tcp);
+    return bytes;
+}
+
+struct bench_net_client_args {
+    struct in_addr server;
+    int rounds;
+    struct bench_net_result *res;
+};
+
+static int bench_net_client(int sock, void *arg)
+{
+    (void)sock;
+    struct bench_net_client_args *a = arg;
+    struct sockaddr_in sa = {
+        .sin_family = AF_INET,
+        .sin_port = htons(BENCH_NET_PORT),
+        .sin_addr = a->server,
+    };
+    struct timeval tmo = { .tv_sec = 1 };
+
+    // Round trips, one small datagram each; the first few resolve the
+    // neighbour and aren't counted
+    int udp = socket(AF_INET, SOCK_DGRAM, 0);
+    setsockopt(udp, SOL_SOCKET, SO_RCVTIMEO, &tmo, sizeof(tmo));
+    if (udp < 0 || connect(udp, (struct sockaddr *)&sa, sizeof(sa)) != 0)
+    {
+        perror("bench client udp");
+        return 1;
+    }
+    char msg[64] = {0};
+    for (int i = -10; i < a->rounds; i++)
+    {
+        uint64_t t0 = now_ns();
+        if (send(udp, msg, sizeof(msg), 0) < 0 || recv(udp, msg, sizeof(msg), 0) < 0)
+        {
+            if (i < 0 && errno == EAGAIN)
+                continue;
+            perror("bench client round trip");
+            return 1;
+        }
+        if (i >= 0)
+            a->res->rtt[i] = now_ns() - t0;
+    }
+    close(udp);
+
+    a->res->bytes = bench_net_stream(&sa, &a->res->stream_ns);
+    if (a->res->bytes < 0)
+        return 1;
+    a->res->ok = 1;
+    return 0;
+}
+
+// The remote and its end of the wire; returns its pid
+static pid_t bench_net_remote(const char *subnet)
+{
+    int sock;
+    pid_t pid = bench_net_spawn(&sock, bench_net_server, NULL);
+    if (pid < 0)
+        return -1;
+
+    struct net_host *host = net_host_get();
+    char byte;
+    int nl = -1;
+    int ret = -1;
+    if (!host || fd_recvmsg(sock, &byte, 1, &nl, 1) <= 0 || nl < 0)
+        goto out;
+
+    nl_veth_create_in(&host->nl, BENCH_NET_WIRE, "eth0", -1, pid, NULL);
+    nl_session_last(&host->nl)->ignore_error = EEXIST;
+    if (nl_session_flush(&host->nl) < 0)
+        goto out;
+    nl_if_add_addr(&host->nl, BENCH_NET_WIRE, BENCH_NET_HOST "/24");
+    nl_if_up(&host->nl, BENCH_NET_WIRE);
+    if (nl_session_flush(&host->nl) < 0)
+        goto out;
+
+    // The wire's far end: its own address, the lower-device modes'
+    // gateway, and a way back to containers that aren't NATed
+    struct nl_session rnl;
+    if (nl_session_open_fd(&rnl, nl) < 0)
+        goto out;
+    nl = -1;
+    unsigned int eth0 = 0;
+    nl_if_up(&rnl, "lo");
+    nl_link_get_index(&rnl, "eth0", &eth0);
+    char lan_gw[INET_ADDRSTRLEN + 4];
+    if (nl_session_flush(&rnl) == 0 && eth0 && net_pool_open(BENCH_NET_LAN) == 0)
+    {
+        ipam_addr(&net_pool, 1, 1, lan_gw, sizeof(lan_gw));
+        nl_if_add_addr_index(&rnl, eth0, BENCH_NET_REMOTE "/24");
+        nl_if_add_addr_index(&rnl, eth0, lan_gw);
+        nl_if_up(&rnl, "eth0");
+        nl_route_add(&rnl, subnet, BENCH_NET_HOST, eth0);
+        ret = nl_session_flush(&rnl);
+    }
+    nl_session_close(&rnl);
+
+    // Go, and wait for the server to listen
+    if (ret == 0 && (write(sock, "g", 1) != 1 || read(sock, &byte, 1) != 1))
+        ret = -1;
+
+out:
+    if (nl >= 0)
+        close(nl);
+    close(sock);
+    if (ret < 0)
+    {
+        fprintf(stderr, "bench net: setting up the remote failed\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    return pid;
+}
+
+// One mode: a client wired up like a container, its run, and cleanup
+static int bench_net_mode(enum net_mode mode, const char *subnet, int rounds,
+                          struct bench_net_result *res)
+{
+    struct container_net net;
+    if (network_alloc(&net, NET_MODE_LOWER(mode) ? BENCH_NET_LAN : subnet,
+                      mode, BENCH_NET_WIRE, NULL) < 0)
+        return -1;
+
+    // The remote is the lower-device modes' gateway
+    struct bench_net_client_args args = { .rounds = rounds, .res = res };
+    inet_pton(AF_INET, NET_MODE_LOWER(mode) ? net.gateway : BENCH_NET_REMOTE, &args.server);
+    memset(res, 0, sizeof(*res));
+
+    int sock, nl = -1, ret = -1;
+    pid_t pid = bench_net_spawn(&sock, bench_net_client, &args);
+    if (pid < 0)
+    {
+        teardown_network(&net);
+        return -1;
+    }
+
+    if (setup_network(&net, pid, sock, &nl) == 0 && write(sock, "g", 1) == 1)
+    {
+        int status;
+        waitpid(pid, &status, 0);
+        ret = WIFEXITED(status) && WEXITSTATUS(status) == 0 && res->ok ? 0 : -1;
+    }
+    else
+    {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+
+    close(sock);
+    if (nl >= 0)
+        network_release_child(&net, nl);
+    teardown_network(&net);
+    return ret;
+}
+
+int run_net_bench(const struct container_config *cfg, int rounds)
+{
+    if (rounds < 1) rounds = 1;
+    const char *subnet = cfg->subnet ? cfg->subnet : CONTAINER_SUBNET;
+
+    size_t size = sizeof(struct bench_net_result) + sizeof(int64_t) * rounds;
+    struct bench_net_result *res = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (res == MAP_FAILED)
+    {
+        perror("mmap bench");
+        return 1;
+    }
+
+    // Setup is chatty too
+    int saved_stdout = stdout_mute();
+
+    // Forwarding, the bridge and NAT, before the wire: the remote's route
+    // back goes through the host
+    network_host_init(subnet, NET_BRIDGE);
+    network_host_init(subnet, NET_ROUTED);
+    pid_t remote = bench_net_remote(subnet);
+    stdout_restore(saved_stdout);
+    if (remote < 0)
+    {
+        munmap(res, size);
+        return 1;
+    }
+
+    printf("%d round trips (64 bytes UDP) and a %.0fs TCP stream per mode\n",
+           rounds, BENCH_NET_STREAM_NS / 1e9);
+    printf("%-10s %10s %10s %10s %10s %12s\n",
+           "mode", "mean(us)", "p50(us)", "p99(us)", "max(us)", "tcp(Gbit/s)");
+
+    int failed = 0;
+    for (int mode = 0; mode < NET_MODES; mode++)
+    {
+        saved_stdout = stdout_mute();
+        int ret = bench_net_mode(mode, subnet, rounds, res);
+        stdout_restore(saved_stdout);
+
+        if (ret < 0)
+        {
+            printf("%-10s %10s\n", net_mode_names[mode], "failed");
+            failed++;
+            continue;
+        }
+
+        double sum = 0;
+        for (int i = 0; i < rounds; i++)
+            sum += res->rtt[i];
+        qsort(res->rtt, rounds, sizeof(int64_t), cmp_i64);
+        printf("%-10s %10.2f %10.2f %10.2f %10.2f %12.2f\n", net_mode_names[mode],
+               sum / rounds / 1e3, percentile(res->rtt, rounds, 50) / 1e3,
+               percentile(res->rtt, rounds, 99) / 1e3, res->rtt[rounds - 1] / 1e3,
+               res->bytes * 8.0 / res->stream_ns);
+    }
+
+    kill(remote, SIGKILL);
+    waitpid(remote, NULL, 0);
+    struct net_host *host = net_host_get();
+    if (host)
+    {
+        nl_link_del(&host->nl, BENCH_NET_WIRE);
+        nl_session_last(&host->nl)->ignore_error = ENODEV;
+        nl_session_flush(&host->nl);
+    }
+
+    munmap(res, size);
+    return failed ? 1 : 0;
+}
+
+/*
+ * cdocker bench veth
+ *
+ * How a veth pair's throughput scales with its queue count. Two
+ * namespaces are joined by a single veth, with the --veth options and
+ * queues=1, 2, 4, ... up to the stream count, and the client runs that
+ * many TCP streams to the server's sinks in parallel.
+ *
+ * A veth only spreads receive work over its queues in NAPI mode, which
+ * takes GRO on (or XDP); without "gro" every queue count looks the same.
+ * Nor does it scale past the CPUs there are.
+ */
+
+#define BENCH_VETH_CLIENT       "198.18.1.1/30"
+#define BENCH_VETH_SERVER       "198.18.1.2"
+#define BENCH_VETH_STREAMS_MAX  64
+
+// Filled in by the client's streams, in shared memory
+struct bench_veth_result {
+    int64_t bytes[BENCH_VETH_STREAMS_MAX];
+    int64_t ns[BENCH_VETH_STREAMS_MAX];
+};
+
+struct bench_veth_args {
+    int streams;
+    struct bench_veth_result *res;
+};
+
+static int bench_veth_client(int sock, void *arg)
+{
+    (void)sock;
+    struct bench_veth_args *a = arg;
+    struct sockaddr_in sa = {
+        .sin_family = AF_INET,
+        .sin_port = htons(BENCH_NET_PORT),
+    };
+    inet_pton(AF_INET, BENCH_VETH_SERVER, &sa.sin_addr);
+
+    pid_t pids[BENCH_VETH_STREAMS_MAX];
+    for (int i = 0; i < a->streams; i++)
+    {
+        pids[i] = fork();
+        if (pids[i] == 0)
+        {
+            a->res->bytes[i] = bench_net_stream(&sa, &a->res->ns[i]);
+            _exit(a->res->bytes[i] < 0);
+        }
+    }
+
+    int failed = 0;
+    for (int i = 0; i < a->streams; i++)
+    {
+        int status;
+        if (pids[i] < 0 || waitpid(pids[i], &status, 0) < 0 ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+    }
+    return failed;
+}
+
+// Address, lo and eth0 up in one namespace, over its netlink socket
+static int bench_veth_addr(struct nl_session *s, const char *addr, int gro)
+{
+    unsigned int eth0 = 0;
+    nl_link_get_index(s, "eth0", &eth0);
+    if (nl_session_flush(s) < 0 || !eth0)
+        return -1;
+    if (gro && if_set_gro(s->fd, "eth0", 1) < 0)
+        return -1;
+    nl_if_up(s, "lo");
+    nl_if_add_addr_index(s, eth0, addr);
+    nl_if_up(s, "eth0");
+    return nl_session_flush(s);
+}
+
+// One queue count: a fresh client/server pair of namespaces and the veth
+// between them, which goes away with them
+static int bench_veth_run(const struct veth_opts *opts, int streams,
+                          struct bench_veth_result *res)
+{
+    struct bench_veth_args args = { .streams = streams, .res = res };
+    memset(res, 0, sizeof(*res));
+
+    int ssock = -1, csock = -1, snl = -1, cnl = -1, ret = -1;
+    pid_t client = -1;
+    pid_t server = bench_net_spawn(&ssock, bench_net_server, NULL);
+    if (server > 0)
+        client = bench_net_spawn(&csock, bench_veth_client, &args);
+    char byte;
+    if (client < 0 || fd_recvmsg(ssock, &byte, 1, &snl, 1) <= 0 || snl < 0 ||
+        fd_recvmsg(csock, &byte, 1, &cnl, 1) <= 0 || cnl < 0)
+        goto out;
+
+    // Created from the client's side, the server's end straight in its
+    // namespace: both can be eth0
+    struct nl_session cs, ss;
+    if (nl_session_open_fd(&cs, cnl) < 0)
+        goto out;
+    cnl = -1;
+    if (nl_session_open_fd(&ss, snl) < 0)
+    {
+        nl_session_close(&cs);
+        goto out;
+    }
+    snl = -1;
+    nl_veth_create_in(&cs, "eth0", "eth0", -1, server, opts);
+    ret = nl_session_flush(&cs);
+    if (ret == 0)
+        ret = bench_veth_addr(&ss, BENCH_VETH_SERVER "/30", opts->gro);
+    if (ret == 0)
+        ret = bench_veth_addr(&cs, BENCH_VETH_CLIENT, opts->gro);
+    nl_session_close(&cs);
+    nl_session_close(&ss);
+
+    // The server listens, then the client goes
+    if (ret == 0 && (write(ssock, "g", 1) != 1 || read(ssock, &byte, 1) != 1 ||
+                     write(csock, "g", 1) != 1))
+        ret = -1;
+    if (ret == 0)
+    {
+        int status;
+        waitpid(client, &status, 0);
+        client = -1;
+        ret = WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+    }
+
+out:
+    if (snl >= 0)
+        close(snl);
+    if (cnl >= 0)
+        close(cnl);
+    if (ssock >= 0)
+        close(ssock);
+    if (csock >= 0)
+        close(csock);
+    if (client > 0)
+    {
+        kill(client, SIGKILL);
+        waitpid(client, NULL, 0);
+    }
+    if (server > 0)
+    {
+        kill(server, SIGKILL);
+        waitpid(server, NULL, 0);
+    }
+    return ret;
+}
+
+int run_veth_bench(const struct container_config *cfg, int streams)
+{
+    if (streams < 1)
+        streams = sysconf(_SC_NPROCESSORS_ONLN);
+    if (streams < 1)
+        streams = 1;
+    if (streams > BENCH_VETH_STREAMS_MAX)
+        streams = BENCH_VETH_STREAMS_MAX;
+
+    struct bench_veth_result *res = mmap(NULL, sizeof(*res), PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (res == MAP_FAILED)
+    {
+        perror("mmap bench");
+        return 1;
+    }
+
+    struct veth_opts opts = cfg->veth;
+    printf("%d TCP streams for %.0fs over one veth, %ld CPUs, gro %s", streams,
+           BENCH_NET_STREAM_NS / 1e9, sysconf(_SC_NPROCESSORS_ONLN), opts.gro ? "on" : "off");
+    if (opts.mtu)
+        printf(", mtu %u", opts.mtu);
+    printf("\n%-8s %12s %14s\n", "queues", "tcp(Gbit/s)", "stream(Gbit/s)");
+
+    int failed = 0;
+    for (unsigned int queues = 1; queues <= (unsigned int)streams; queues *= 2)
+    {
+        opts.queues = queues;
+        if (bench_veth_run(&opts, streams, res) < 0)
+        {
+            printf("%-8u %12s\n", queues, "failed");
+            failed++;
+            continue;
+        }
+
+        // Aggregate over the longest stream; the mean of the streams
+        int64_t bytes = 0, ns = 1;
+        double per = 0;
+        for (int i = 0; i < streams; i++)
+        {
+            bytes += res->bytes[i];
+            if (res->ns[i] > ns)
+                ns = res->ns[i];
+            per += res->bytes[i] * 8.0 / res->ns[i];
+        }
+        printf("%-8u %12.2f %14.2f\n", queues, bytes * 8.0 / ns, per / streams);
+    }
+
+    munmap(res, sizeof(*res));
+    return failed ? 1 : 0;
+}
+
+/*
+ * cdocker bench stats
+ *
+ * What a scrape of every container's counters costs, with N veth pairs
+ * standing in for N containers: an RTM_GETLINK dump filtered to veths,
+ * the same dump unfiltered, one RTM_GETLINK per host end (batched as the
+ * session does), and the RTM_GETSTATS dump network_stats() samples with.
+ * Runs in a netns of its own, which takes the links with it when we exit.
+ */
+
+#define BENCH_STATS_ROUNDS  20
+
+static int bench_stats_count(const struct nl_link_stats *st, void *arg)
+{
+    (void)st;
+    (*(int *)arg)++;
+    return 0;
+}
+
+// Time rounds of fn; returns ms per round, links seen in *links
+static double bench_stats_time(struct nl_session *s, int n,
+                               int (*fn)(struct nl_session *s, int n, struct nl_link_stats_dump *d),
+                               int *links)
+{
+    struct nl_link_stats_dump d = { .cb = bench_stats_count, .arg = links };
+    uint64_t t0 = now_ns();
+    for (int r = 0; r < BENCH_STATS_ROUNDS; r++)
+    {
+        *links = 0;
+        if (fn(s, n, &d) < 0 || nl_session_flush(s) < 0)
+            return -1;
+    }
+    return (now_ns() - t0) / 1e6 / BENCH_STATS_ROUNDS;
+}
+
+static int bench_stats_veth_dump(struct nl_session *s, int n, struct nl_link_stats_dump *d)
+{
+    (void)n;
+    return nl_link_stats(s, "veth", d);
+}
+
+static int bench_stats_full_dump(struct nl_session *s, int n, struct nl_link_stats_dump *d)
+{
+    (void)n;
+    return nl_link_stats(s, NULL, d);
+}
+
+static int bench_stats_getstats(struct nl_session *s, int n, struct nl_link_stats_dump *d)
+{
+    (void)n;
+    return nl_stats_dump(s, d);
+}
+
+static int bench_stats_per_link(struct nl_session *s, int n, struct nl_link_stats_dump *d)
+{
+    for (int i = 0; i < n; i++)
+    {
+        struct nl_msg *msg = nl_session_msg(s, RTM_GETLINK, NLM_F_ACK, sizeof(struct ifinfomsg));
+        if (!msg)
+            return -1;
+        struct nl_request *req = nl_session_last(s);
+        req->what = "link stats";
+        req->cb = nl_link_stats_parse;
+        req->arg = d;
+
+        char name[IF_NAMESIZE];
+        snprintf(name, sizeof(name), VETH_PREFIX "%x", i);
+        nl_attr_put_str(msg, IFLA_IFNAME, name);
+    }
+    return 0;
+}
+
+int run_stats_bench(int links)
+{
+    if (links < 1)
+        links = 1;
+    // The peers go in a netns of their own, as a container's eth0 would
+    int peers = -1;
+    if (unshare(CLONE_NEWNET) != 0 ||
+        (peers = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC)) < 0 ||
+        unshare(CLONE_NEWNET) != 0)
+    {
+        perror("unshare netns");
+        return 1;
+    }
+
+    struct nl_session s;
+    if (nl_session_open(&s, NETLINK_ROUTE) < 0)
+        return 1;
+
+    // Host ends named like containers', plus their peers; also some
+    // non-veth links to filter out, as a host would have
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < links; i++)
+    {
+        char host_if[IF_NAMESIZE], peer[IF_NAMESIZE];
+        snprintf(host_if, sizeof(host_if), VETH_PREFIX "%x", i);
+        snprintf(peer, sizeof(peer), "p%x", i);
+        nl_veth_create_in(&s, host_if, peer, peers, 0, NULL);
+    }
+    for (int i = 0; i < links / 4; i++)
+    {
+        char name[IF_NAMESIZE];
+        snprintf(name, sizeof(name), "br%x", i);
+        nl_bridge_create(&s, name);
+    }
+    if (nl_session_flush(&s) < 0)
+    {
+        nl_session_close(&s);
+        return 1;
+    }
+    printf("%d veth pairs and %d bridges created in %.0f ms\n", links, links / 4,
+           (now_ns() - t0) / 1e6);
+
+    static const struct {
+        const char *name;
+        int (*fn)(struct nl_session *s, int n, struct nl_link_stats_dump *d);
+    } ways[] = {
+        { "getlink veth",   bench_stats_veth_dump },
+        { "getlink all",    bench_stats_full_dump },
+        { "getlink each",   bench_stats_per_link },
+        { "getstats all",   bench_stats_getstats },
+    };
+
+    printf("%-14s %12s %10s\n", "scrape", "ms/scrape", "links");
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(ways) / sizeof(ways[0]); i++)
+    {
+        int seen = 0;
+        double ms = bench_stats_time(&s, links, ways[i].fn, &seen);
+        if (ms < 0)
+        {
+            printf("%-14s %12s\n", ways[i].name, "failed");
+            failed++;
+            continue;
+        }
+        printf("%-14s %12.3f %10d\n", ways[i].name, ms, seen);
+    }
+
+    nl_session_close(&s);
+    close(peers);
+    return failed ? 1 : 0;
+}
+
+/*
+ * cdocker bench publish
+ *
+ * A published port's two ways against going to the container directly:
+ * connections per second (connect, one byte, the sink's answer, close;
+ * one at a time) and a TCP stream's throughput, from the host to the
+ * bridge address. The server is a bridge-mode namespace like a
+ * container's, answering one connection at a time so forking doesn't
+ * swamp the connection rate.
+ */
+
+#define BENCH_PUBLISH_PORT  7008
+
+static int bench_publish_server(int sock, void *arg)
+{
+    (void)arg;
+    struct sockaddr_in sa = {
+        .sin_family = AF_INET,
+        .sin_port = htons(BENCH_NET_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    int one = 1;
+    int lst = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(lst, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (lst < 0 || bind(lst, (struct sockaddr *)&sa, sizeof(sa)) != 0 ||
+        listen(lst, SOMAXCONN) != 0)
+    {
+        perror("bench server");
+        return 1;
+    }
+    write(sock, "r", 1);
+
+    for (;;)
+    {
+        int conn = accept(lst, NULL, NULL);
+        if (conn < 0)
+            continue;
+        bench_net_sink(conn);
+        close(conn);
+    }
+}
+
+// conns connections one after the other, their times into rtt[]
+static int bench_publish_conns(const struct sockaddr_in *sa, int conns, int64_t *rtt)
+{
+    int one = 1;
+    for (int i = 0; i < conns; i++)
+    {
+        uint64_t t0 = now_ns();
+        int64_t bytes = 0;
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (fd < 0 || connect(fd, (const struct sockaddr *)sa, sizeof(*sa)) != 0 ||
+            write(fd, "x", 1) != 1 || shutdown(fd, SHUT_WR) != 0 ||
+            read(fd, &bytes, sizeof(bytes)) != sizeof(bytes) || bytes != 1)
+        {
+            perror("bench publish connection");
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+        close(fd);
+        rtt[i] = now_ns() - t0;
+    }
+    return 0;
+}
+
+int run_publish_bench(const struct container_config *cfg, int conns)
+{
+    if (conns < 1)
+        conns = 1;
+    const char *subnet = cfg->subnet ? cfg->subnet : CONTAINER_SUBNET;
+    int64_t *rtt = calloc(conns, sizeof(*rtt));
+    if (!rtt)
+        return 1;
+
+    // The server, set up like a bridge-mode container
+    int saved_stdout = stdout_mute();
+    struct container_net net = { .slot = -1 };
+    int sock = -1, nl = -1, ret = -1;
+    pid_t server = -1;
+    char byte;
+    if (network_host_init(subnet, NET_BRIDGE) == 0 &&
+        network_alloc(&net, subnet, NET_BRIDGE, NULL, NULL) == 0)
+    {
+        server = bench_net_spawn(&sock, bench_publish_server, NULL);
+        if (server > 0 && setup_network(&net, server, sock, &nl) == 0 &&
+            write(sock, "g", 1) == 1 && read(sock, &byte, 1) == 1)
+            ret = 0;
+    }
+    stdout_restore(saved_stdout);
+    if (ret < 0)
+    {
+        fprintf(stderr, "bench publish: setting up the server failed\n");
+        goto out;
+    }
+
+    struct sockaddr_in direct = { .sin_family = AF_INET, .sin_port = htons(BENCH_NET_PORT) };
+    struct sockaddr_in published = { .sin_family = AF_INET, .sin_port = htons(BENCH_PUBLISH_PORT) };
+    char ip[INET_ADDRSTRLEN];
+    snprintf(ip, sizeof(ip), "%.*s", (int)strcspn(net.addr, "/"), net.addr);
+    inet_pton(AF_INET, ip, &direct.sin_addr);
+    inet_pton(AF_INET, net.gateway, &published.sin_addr);
+
+    printf("%d connections one at a time and a %.0fs TCP stream, host to %s:%d\n",
+           conns, BENCH_NET_STREAM_NS / 1e9, net.gateway, BENCH_PUBLISH_PORT);
+    printf("%-8s %10s %10s %10s %12s\n", "way", "conn/s", "p50(us)", "p99(us)", "tcp(Gbit/s)");
+
+    static const struct {
+        const char *name;
+        int mode;           // enum publish_mode, or -1: straight to the container
+    } ways[] = {
+        { "direct", -1 },
+        { "nat",    PUBLISH_NAT },
+        { "proxy",  PUBLISH_PROXY },
+    };
+    const struct port_map port = { .host = BENCH_PUBLISH_PORT, .container = BENCH_NET_PORT };
+
+    for (size_t i = 0; i < sizeof(ways) / sizeof(ways[0]); i++)
+    {
+        struct publish pub;
+        const struct sockaddr_in *sa = ways[i].mode < 0 ? &direct : &published;
+        if (ways[i].mode >= 0 && publish_start(&pub, ways[i].mode, &port, 1, net.addr) < 0)
+        {
+            printf("%-8s %10s\n", ways[i].name, "failed");
+            ret = -1;
+            continue;
+        }
+
+        int64_t ns = 0;
+        uint64_t t0 = now_ns();
+        int ok = bench_publish_conns(sa, conns, rtt) == 0;
+        double secs = (now_ns() - t0) / 1e9;
+        int64_t bytes = ok ? bench_net_stream(sa, &ns) : -1;
+        if (ways[i].mode >= 0)
+            publish_stop(&pub);
+        if (bytes < 0)
+        {
+            printf("%-8s %10s\n", ways[i].name, "failed");
+            ret = -1;
+            continue;
+        }
+
+        qsort(rtt, conns, sizeof(int64_t), cmp_i64);
+        printf("%-8s %10.0f %10.2f %10.2f %12.2f\n", ways[i].name, conns / secs,
+               percentile(rtt, conns, 50) / 1e3, percentile(rtt, conns, 99) / 1e3,
+               bytes * 8.0 / ns);
+    }
+
+out:
+    saved_stdout = stdout_mute();
+    if (server > 0)
+    {
+        kill(server, SIGKILL);
+        waitpid(server, NULL, 0);
+    }
+    if (sock >= 0)
+        close(sock);
+    if (nl >= 0)
+        network_release_child(&net, nl);
+    if (net.slot >= 0)
+        teardown_network(&net);
+    stdout_restore(saved_stdout);
+    free(rtt);
+    return ret < 0 ? 1 : 0;
+}
+
+/*
+ * cdocker bench seccomp
+ *
+ * What a filter adds to every syscall: a forked child per filter times a
+ * tight loop of getppid() (never cached by libc, and allowed by any sane
+ * profile) with no filter, the profile compiled as a list of compares,
+ * and as the binary search the containers get. Filters can't be taken
+ * off again, hence the fork; the best of a few rounds counts. "run" is
+ * how many instructions the filter executes for the call.
+ */
+
+#define BENCH_SECCOMP_ROUNDS 5
+
+// Instructions the filter executes for syscall nr of arch
+static int bench_seccomp_steps(const struct sock_fprog *prog, uint32_t arch, uint32_t nr)
+{
+    uint32_t a = 0;
+    int steps = 0;
+    for (int pc = 0; pc < prog->len; pc++)
+    {
+        const struct sock_filter *f = &prog->filter[pc];
+        steps++;
+        if (f->code == (BPF_LD | BPF_W | BPF_ABS))
+            a = f->k == offsetof(struct seccomp_data, arch) ? arch : nr;
+        else if (f->code == (BPF_JMP | BPF_JA))
+            pc += f->k;
+        else if (f->code == (BPF_JMP | BPF_JEQ | BPF_K))
+            pc += a == f->k ? f->jt : f->jf;
+        else if (f->code == (BPF_JMP | BPF_JGE | BPF_K))
+            pc += a >= f->k ? f->jt : f->jf;
+        else
+            break;      // ret
+    }
+    return steps;
+}
+
+// Nanoseconds per getppid() under prog (NULL: none), best round; -1 on failure
+static double bench_seccomp_time(const struct sock_fprog *prog, int calls)
+{
+    int pipefd[2];
+    if (pipe(pipefd) != 0)
+        return -1;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(pipefd[0]);
+        double best = -1;
+        if (!prog || seccomp_install(prog) == 0)
+            for (int r = 0; r < BENCH_SECCOMP_ROUNDS; r++)
+            {
+                uint64_t t0 = now_ns();
+                for (int i = 0; i < calls; i++)
+                    syscall(SYS_getppid);
+                double ns = (double)(now_ns() - t0) / calls;
+                if (best < 0 || ns < best)
+                    best = ns;
+            }
+        _exit(write(pipefd[1], &best, sizeof(best)) == sizeof(best) ? 0 : 1);
+    }
+    close(pipefd[1]);
+
+    double ns = -1;
+    if (pid < 0 || read(pipefd[0], &ns, sizeof(ns)) != sizeof(ns))
+        ns = -1;
+    if (pid > 0)
+        waitpid(pid, NULL, 0);
+    close(pipefd[0]);
+    return ns;
+}
+
+int run_seccomp_bench(const struct container_config *cfg, int calls)
+{
+    if (calls < 1)
+        calls = 1;
+    const char *name = cfg->seccomp ? cfg->seccomp : "default";
+    static struct seccomp_profile profile;
+    struct sock_fprog progs[2] = { { 0 } };
+    if (seccomp_profile_load(name, &profile) < 0 ||
+        seccomp_compile(&profile, 1, &progs[0]) < 0 || seccomp_compile(&profile, 0, &progs[1]) < 0)
+    {
+        free(progs[0].filter);
+        return 1;
+    }
+
+    int rules = 0;
+    for (int i = 0; i < profile.narches; i++)
+        if (profile.arches[i].arch == SECCOMP_ARCH_NATIVE)
+            rules = profile.arches[i].nrules;
+    printf("%d getppid() calls, best of %d, profile %s (%d rules for this arch)\n",
+           calls, BENCH_SECCOMP_ROUNDS, name, rules);
+    printf("%-8s %8s %8s %10s %14s\n", "filter", "insns", "run", "ns/call", "overhead(ns)");
+
+    static const char *const names[] = { "none", "linear", "tree" };
+    double base = -1;
+    int ret = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        const struct sock_fprog *prog = i ? &progs[i - 1] : NULL;
+        double ns = bench_seccomp_time(prog, calls);
+        if (ns < 0)
+        {
+            printf("%-8s %8s\n", names[i], "failed");
+            ret = 1;
+            continue;
+        }
+        if (!prog)
+        {
+            base = ns;
+            printf("%-8s %8s %8s %10.1f %14s\n", names[i], "-", "-", ns, "-");
+            continue;
+        }
+        printf("%-8s %8d %8d %10.1f %14.1f\n", names[i], prog->len,
+               bench_seccomp_steps(prog, SECCOMP_ARCH_NATIVE, SYS_getppid), ns,
+               base < 0 ? 0 : ns - base);
+    }
+
+    free(progs[0].filter);
+    free(progs[1].filter);
+    return ret;
+}
+
+#endif // CDOCKER_BENCH_H
@@ -0,0 +1,588 @@
+#ifndef CDOCKER_CONTAINER_H
+#define CDOCKER_CONTAINER_H
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/prctl.h>
+
+#include "rootfs.h"
+#include "zygote.h"
+#include "utility/ns.h"
+#include "utility/timing.h"
+#include "utility/spawn.h"
+#include "utility/cgroup.h"
+#include "utility/cd_signal.h"
+#include "utility/netns_pool.h"
+#include "utility/publish.h"
+#include "utility/seccomp.h"
+
+// What to run and how; filled in from the command line
+struct container_config {
+    char **argv;        // command to exec inside the container
+    int network;        // set up the veth pair + NAT
+    const char *subnet; // container addresses come from here (CONTAINER_SUBNET)
+    enum net_mode net_mode;     // bridge (default), routed, macvlan, ipvlan(-l3)
+    const char *net_parent;     // macvlan/ipvlan host interface, NULL: uplink
+    struct veth_opts veth;      // veth queues/MTU/offloads (bridge, routed)
+    struct net_shape shape;     // egress/ingress rate limits, 0: none
+    struct port_map ports[PUBLISH_MAX]; // -p host:container (bridge, routed)
+    int nports;
+    enum publish_mode publish_mode;     // DNAT rules, or the splice proxy
+    struct rootfs_opts rootfs;  // image + overlay settings (state_dir unused)
+    struct cgroup_limits limits;    // cgroup v2 resource limits
+    int print_stats;    // print the cgroup's usage when the container exits
+    enum cd_sync_kind sync;     // parent/child handshake: futex, or pipe
+    const int *stdio;   // fds for the container's stdin/out/err, NULL: ours
+    int zygote;         // fork from the image's zygote (plain images, futex sync)
+    int netns_pool;     // keep this many network namespaces ready; 0: off
+    struct userns_map userns;   // run as root of a user namespace; count 0: off
+    const char *seccomp;        // syscall profile: "default" or a file; NULL: none
+};
+
+// Handshake phases (cd_sync_post/cd_sync_wait), one counter per side
+enum {
+    SYNC_CHILD_ROOTFS = 1,  // child: root filesystem is in place
+};
+enum {
+    SYNC_PARENT_GO = 1,     // parent: network done, go ahead and exec
+};
+
+struct child_args {
+    struct cd_sync sync;    // child waits on this until the parent says go
+    const struct container_config *cfg;
+    struct launch_timing *timing;   // shared page, may be NULL
+    struct rootfs_opts rootfs;      // per-launch copy with state_dir filled in
+    struct rootfs_mounts mounts;    // its root and /dev, detached; -1: none
+    sigset_t sigmask;               // mask to restore before exec
+    char hostname[64];
+    int netns;                      // pre-warmed netns to join, or -1
+    int net_sock;                   // to send our netlink socket on, or -1
+    const struct sock_fprog *seccomp;   // installed right before exec, or NULL
+};
+
+// The child's common tail once its root filesystem is in place: report
+// that, wait for the parent's go, then exec
+static int child_exec(struct child_args *cargs)
+{
+    timing_mark(cargs->timing, MARK_ROOTFS_DONE);
+    cd_sync_post(&cargs->sync, SYNC_CHILD_ROOTFS);
+
+    // Nothing wakes a futex waiter whose parent died; only for the wait,
+    // since the signal would otherwise survive exec
+    printf("⭐ [child] Waiting for parent to set up network...\n");
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (cd_sync_wait(&cargs->sync, SYNC_PARENT_GO) < 0)
+    {
+        perror("child wait for parent");
+        return 1;
+    }
+    prctl(PR_SET_PDEATHSIG, 0);
+    timing_mark(cargs->timing, MARK_CHILD_RESUMED);
+
+    // Our maps are in by now
+    if (cargs->cfg->userns.count && userns_enter_root() != 0)
+    {
+        cd_sync_fail(&cargs->sync, "userns root", errno);
+        return 1;
+    }
+
+    // Set up DNS using resolve
+    // write to the resolve.conf ig
+    FILE *resolv = fopen("/etc/resolv.conf", "w");
+    if (resolv) {
+        fprintf(resolv, "nameserver 8.8.8.8\n");
+        fclose(resolv);
+    }
+
+    printf("⭐ About to exec shell...\n");
+    if (sethostname(cargs->hostname, strlen(cargs->hostname)) != 0)
+    {
+        perror("sethostname");
+    }
+
+    // Last, so that nothing of ours has to get past it
+    if (cargs->seccomp && seccomp_install(cargs->seccomp) != 0)
+    {
+        cd_sync_fail(&cargs->sync, "seccomp", errno);
+        perror("seccomp");
+        return 1;
+    }
+
+    timing_mark(cargs->timing, MARK_EXEC);
+    execv(cargs->cfg->argv[0], cargs->cfg->argv);
+    cd_sync_fail(&cargs->sync, "execv", errno);
+    perror("execv failed");
+    return 1;
+}
+
+int child_func(void *arg)
+{
+    struct child_args *cargs = (struct child_args *)arg;
+    timing_mark(cargs->timing, MARK_CHILD_START);
+    cd_sync_child(&cargs->sync);
+    if (cargs->net_sock >= 0)
+        network_child_send(cargs->net_sock);
+
+    if (cargs->cfg->stdio)
+        for (int i = 0; i < 3; i++)
+            if (cargs->cfg->stdio[i] >= 0)
+                dup2(cargs->cfg->stdio[i], i);
+
+    // The parent blocks the signals it forwards; don't inherit that
+    sigprocmask(SIG_SETMASK, &cargs->sigmask, NULL);
+
+    printf("Inside new PID + Mount namespace\n");
+    printf("PID inside container: %d\n", getpid());
+
+    // Before the rootfs: sysfs shows the netns it was mounted in
+    if (cargs->netns >= 0 && setns(cargs->netns, CLONE_NEWNET) != 0)
+    {
+        cd_sync_fail(&cargs->sync, "setns netns", errno);
+        return 1;
+    }
+
+    if (setup_rootfs(&cargs->rootfs, &cargs->mounts) != 0)
+    {
+        cd_sync_fail(&cargs->sync, "setup_rootfs", errno);
+        return 1;
+    }
+    return child_exec(cargs);
+}
+
+/*
+ * A container forked from its image's zygote (zygote.h) starts from a
+ * root filesystem that's already pivoted and mounted. It only needs the
+ * handshake page and stdio handed over, and its own /proc and /sys.
+ */
+
+// Sent to the zygote per container; argv follows as NUL-terminated strings,
+// then the seccomp filter's instructions (aligned)
+struct zygote_child_args {
+    struct launch_timing *timing;   // mapped before the zygote forked, or NULL
+    sigset_t sigmask;
+    char hostname[64];
+    int net_join;       // ZFD_NET is a netns to join, not a net_sock
+    int dev_minimal;    // the zygote's /dev is a minimal one (--dev minimal)
+    int argc;
+    int seccomp_len;    // filter instructions, 0: none
+};
+
+// fds passed along with it; ZFD_NET only with networking
+enum { ZFD_SYNC, ZFD_STDIN, ZFD_STDOUT, ZFD_STDERR, ZFD_COUNT, ZFD_NET = ZFD_COUNT };
+
+#define ZYGOTE_ARGS_ALIGN(off) (((off) + 7) & ~(size_t)7)
+
+static int zygote_child(void *arg, const int *fds)
+{
+    struct zygote_child_args *zargs = arg;
+    struct child_args cargs = { .timing = zargs->timing, .sigmask = zargs->sigmask };
+    memcpy(cargs.hostname, zargs->hostname, sizeof(cargs.hostname));
+
+    timing_mark(cargs.timing, MARK_CHILD_START);
+    if (cd_sync_attach(&cargs.sync, fds[ZFD_SYNC]) < 0)
+        return 1;
+    cd_sync_child(&cargs.sync);
+    if (fds[ZFD_NET] >= 0 && !zargs->net_join)
+        network_child_send(fds[ZFD_NET]);
+
+    for (int i = 0; i < 3; i++)
+        if (fds[ZFD_STDIN + i] >= 0)
+            dup2(fds[ZFD_STDIN + i], i);
+    sigprocmask(SIG_SETMASK, &cargs.sigmask, NULL);
+
+    if (fds[ZFD_NET] >= 0 && zargs->net_join && setns(fds[ZFD_NET], CLONE_NEWNET) != 0)
+    {
+        cd_sync_fail(&cargs.sync, "setns netns", errno);
+        return 1;
+    }
+
+    // The copies from the zygote show its PID and network namespaces
+    if (umount2("/proc", MNT_DETACH) != 0 || mount("proc", "/proc", "proc", 0, "") != 0 ||
+        umount2("/sys", MNT_DETACH) != 0 || mount("sysfs", "/sys", "sysfs", 0, "") != 0)
+    {
+        cd_sync_fail(&cargs.sync, "remount /proc and /sys", errno);
+        return 1;
+    }
+    // and a minimal /dev's pts and shm would be the zygote's, shared with
+    // every other container it forks
+    if (zargs->dev_minimal && rootfs_dev_renew() != 0)
+    {
+        cd_sync_fail(&cargs.sync, "mount /dev/pts and /dev/shm", errno);
+        return 1;
+    }
+
+    char *argv[zargs->argc + 1];
+    char *p = (char *)(zargs + 1);
+    for (int i = 0; i < zargs->argc; i++, p += strlen(p) + 1)
+        argv[i] = p;
+    argv[zargs->argc] = NULL;
+
+    struct sock_fprog seccomp = {
+        .len = zargs->seccomp_len,
+        .filter = (struct sock_filter *)((char *)zargs + ZYGOTE_ARGS_ALIGN(p - (char *)zargs)),
+    };
+    if (zargs->seccomp_len)
+        cargs.seccomp = &seccomp;
+
+    struct container_config cfg = { .argv = argv };
+    cargs.cfg = &cfg;
+    return child_exec(&cargs);
+}
+
+#define CONTAINER_CLONE_FLAGS (CLONE_NEWPID | CLONE_NEWNET | CLONE_NEWNS | CLONE_NEWUTS)
+
+/*
+ * A container's life as seen from the parent: container_create() gets it
+ * ready to exec and parked on the handshake, container_start() lets it
+ * go, and container_finish() cleans up after it has been reaped.
+ * launch_container() runs all three back to back; cdockerd runs them as
+ * separate requests.
+ */
+struct container {
+    char id[32];
+    pid_t pid;
+    int pidfd;
+    struct child_args args;
+    struct container_net net;
+    int netns;                  // from the netns pool, or -1
+    int net_nl;                 // the child's netlink socket, or -1
+    struct net_shape shape;     // rate limits in place
+    struct publish publish;     // published ports
+    struct cgroup cg;
+};
+
+// Set, change or clear the container's rate limits, before it starts or
+// while it runs
+int container_shape(struct container *c, const struct net_shape *shape)
+{
+    if (c->net.slot < 0)
+    {
+        fprintf(stderr, "shape: container has no network\n");
+        return -1;
+    }
+
+    // A failed one can have got halfway, which container_net_release()
+    // has to clear as well
+    int ret = network_shape(&c->net, shape);
+    if (ret == 0 || shape->egress || shape->ingress)
+        c->shape = *shape;
+    return ret;
+}
+
+// Give the container's network back: to the pool it came from, or
+// deleted outright
+static void container_net_release(struct container *c)
+{
+    publish_stop(&c->publish);
+
+    // A pooled namespace goes back unlimited
+    static const struct net_shape none;
+    if (c->netns >= 0 && (c->shape.egress || c->shape.ingress))
+        container_shape(c, &none);
+
+    if (c->net_nl >= 0)
+        network_release_child(&c->net, c->net_nl);
+    c->net_nl = -1;
+
+    if (c->netns >= 0)
+        netns_pool_return(&c->net, c->netns);
+    else
+        teardown_network(&c->net);
+    c->netns = -1;
+}
+
+static pid_t container_spawn_zygote(struct container *c)
+{
+    const struct container_config *cfg = c->args.cfg;
+    struct zygote *z = zygote_get(&cfg->rootfs);
+    if (!z)
+        return -1;
+
+    static char buf[ZYGOTE_MSG_MAX - sizeof(struct zygote_req)];
+    struct zygote_child_args *zargs = (struct zygote_child_args *)buf;
+    zargs->timing = c->args.timing;
+    zargs->sigmask = c->args.sigmask;
+    memcpy(zargs->hostname, c->args.hostname, sizeof(zargs->hostname));
+    zargs->net_join = c->netns >= 0;
+    zargs->dev_minimal = cfg->rootfs.dev == ROOTFS_DEV_MINIMAL;
+    zargs->argc = 0;
+
+    size_t off = sizeof(*zargs);
+    for (char **arg = cfg->argv; *arg; arg++, zargs->argc++)
+    {
+        size_t n = strlen(*arg) + 1;
+        if (off + n > sizeof(buf))
+        {
+            errno = E2BIG;
+            return -1;
+        }
+        memcpy(buf + off, *arg, n);
+        off += n;
+    }
+
+    const struct sock_fprog *seccomp = c->args.seccomp;
+    zargs->seccomp_len = seccomp ? seccomp->len : 0;
+    if (seccomp)
+    {
+        size_t n = seccomp->len * sizeof(struct sock_filter);
+        off = ZYGOTE_ARGS_ALIGN(off);
+        if (off + n > sizeof(buf))
+        {
+            errno = E2BIG;
+            return -1;
+        }
+        memcpy(buf + off, seccomp->filter, n);
+        off += n;
+    }
+
+    // An fd of -1 can't be passed; the zygote sees a missing one as -1
+    int net = c->netns >= 0 ? c->netns : c->args.net_sock;
+    int fds[ZFD_COUNT + 1] = { c->args.sync.page_fd, 0, 1, 2, net };
+    if (cfg->stdio)
+        memcpy(&fds[ZFD_STDIN], cfg->stdio, 3 * sizeof(int));
+    uint64_t flags = CONTAINER_CLONE_FLAGS & ~(c->netns >= 0 ? CLONE_NEWNET : 0);
+    return zygote_spawn(z, zygote_child, buf, off, flags, c->cg.dirfd,
+                        fds, ZFD_COUNT + (net >= 0), &c->pidfd);
+}
+
+int container_finish(struct container *c, int status);
+
+// The child is cloned but can't go ahead: kill it where it's parked and
+// undo the rest as for one that has exited
+static int container_abort(struct container *c)
+{
+    pidfd_send_signal_wrapper(c->pidfd, SIGKILL);
+    container_finish(c, pidfd_reap(c->pidfd));
+    return -1;
+}
+
+// Prepare and clone a container. On success the child is waiting for
+// container_start() with its network in place. child_mask is the signal
+// mask the child restores before exec. Cleans up after itself on failure.
+int container_create(struct container *c, const struct container_config *cfg,
+                     struct launch_timing *timing, const sigset_t *child_mask)
+{
+    memset(c, 0, sizeof(*c));
+    c->pidfd = -1;
+    c->net.slot = -1;
+    c->netns = -1;
+    c->net_nl = -1;
+    c->publish.proxy_pidfd = -1;
+    c->args.netns = -1;
+    c->args.net_sock = -1;
+    c->args.cfg = cfg;
+    c->args.timing = timing;
+    c->args.rootfs = cfg->rootfs;
+    rootfs_mounts_init(&c->args.mounts);
+    c->args.sigmask = *child_mask;
+
+    if (cfg->zygote && (cfg->rootfs.overlay || cfg->sync != CD_SYNC_FUTEX))
+    {
+        fprintf(stderr, "zygote: only plain images (no overlay) with futex sync\n");
+        return -1;
+    }
+    // Both are set up ahead in namespaces the container's root won't own
+    if (cfg->userns.count && (cfg->zygote || cfg->netns_pool))
+    {
+        fprintf(stderr, "userns: not with --zygote or --netns-pool\n");
+        return -1;
+    }
+    c->args.rootfs.idmap = cfg->userns;
+    if (cfg->seccomp && !(c->args.seccomp = seccomp_get(cfg->seccomp)))
+        return -1;
+    // On the LAN already in the lower modes: nothing to publish through
+    if (cfg->nports && (!cfg->network || NET_MODE_LOWER(cfg->net_mode)))
+    {
+        fprintf(stderr, "publish: needs a bridge or routed network\n");
+        return -1;
+    }
+
+    static unsigned int launches;
+    snprintf(c->id, sizeof(c->id), "%d-%u", getpid(), launches++);
+    snprintf(c->args.hostname, sizeof(c->args.hostname), "cdocker-%s", c->id);
+    if ((cfg->zygote ? cd_sync_init_memfd(&c->args.sync)
+                     : cd_sync_init(&c->args.sync, cfg->sync)) < 0)
+        return -1;
+    // A zygote's children start from its root instead
+    if (rootfs_prepare(&c->args.rootfs, c->id) < 0 ||
+        (!cfg->zygote && rootfs_mounts_prepare(&c->args.rootfs, &c->args.mounts) < 0))
+    {
+        cd_sync_close(&c->args.sync);
+        rootfs_cleanup(&c->args.rootfs);
+        return -1;
+    }
+
+    // A ready namespace from the pool if there is one, otherwise the
+    // network is set up inline once the child exists
+    const char *subnet = cfg->subnet ? cfg->subnet : CONTAINER_SUBNET;
+    if (cfg->network && cfg->netns_pool > 0)
+        c->netns = c->args.netns = netns_pool_take(subnet, cfg->net_mode, cfg->net_parent,
+                                                    &cfg->veth, cfg->netns_pool, &c->net);
+    if (cfg->network && c->netns < 0 &&
+        network_alloc(&c->net, subnet, cfg->net_mode, cfg->net_parent, &cfg->veth) < 0)
+    {
+        cd_sync_close(&c->args.sync);
+        rootfs_mounts_close(&c->args.mounts);
+        rootfs_cleanup(&c->args.rootfs);
+        return -1;
+    }
+
+    // Inline setup: the child sends us a netlink socket from its netns on
+    // this (network_child_send())
+    int net_sock[2] = { -1, -1 };
+    if (cfg->network && c->netns < 0 &&
+        socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, net_sock) != 0)
+        perror("socketpair");   // carry on, without networking
+    c->args.net_sock = net_sock[1];
+
+    if (cgroup_create(&c->cg, c->id, &cfg->limits) < 0)
+    {
+        cd_sync_close(&c->args.sync);
+        if (net_sock[0] >= 0)
+        {
+            close(net_sock[0]);
+            close(net_sock[1]);
+        }
+        container_net_release(c);
+        rootfs_mounts_close(&c->args.mounts);
+        rootfs_cleanup(&c->args.rootfs);
+        return -1;
+    }
+
+    timing_mark(timing, MARK_START);
+    if (cfg->zygote)
+        c->pid = container_spawn_zygote(c);
+    else
+        c->pid = spawn_child(child_func, &c->args,
+                             (CONTAINER_CLONE_FLAGS & ~(c->netns >= 0 ? CLONE_NEWNET : 0)) |
+                             (cfg->userns.count ? CLONE_NEWUSER : 0),
+                             c->cg.dirfd, &c->pidfd);
+    timing_mark(timing, MARK_CLONED);
+    rootfs_mounts_close(&c->args.mounts);   // the child has its own
+
+    // The child's copy is all that's left of its end, so we see EOF if it
+    // dies before sending
+    if (net_sock[1] >= 0)
+        close(net_sock[1]);
+    c->args.net_sock = -1;
+
+    if (c->pid < 0)
+    {
+        perror(cfg->zygote ? "zygote spawn" : "clone3");
+        if (net_sock[0] >= 0)
+            close(net_sock[0]);
+        cd_sync_close(&c->args.sync);
+        cgroup_destroy(&c->cg);
+        container_net_release(c);
+        rootfs_cleanup(&c->args.rootfs);
+        return -1;
+    }
+
+    cd_sync_parent(&c->args.sync, c->pidfd);
+
+    printf("[parent] Child PID = %d\n", c->pid);
+
+    // Its namespaces belong to its user namespace, which has no ids until
+    // these are in. Better no container than one running unmapped.
+    if (cfg->userns.count && userns_write_maps(c->pid, &cfg->userns) < 0)
+    {
+        fprintf(stderr, "[parent] User namespace maps failed\n");
+        if (net_sock[0] >= 0)
+            close(net_sock[0]);
+        return container_abort(c);
+    }
+
+    // Set up networking from parent, unless the child has already given up
+    // or joined a pooled namespace that's ready as it is
+    if (net_sock[0] >= 0 && !cd_sync_failed(&c->args.sync) &&
+        setup_network(&c->net, c->pid, net_sock[0], &c->net_nl) < 0)
+    {
+        fprintf(stderr, "[parent] Network setup failed\n");
+        // Continue anyway, container just won't have networking
+    }
+    if (net_sock[0] >= 0)
+        close(net_sock[0]);
+    if ((cfg->shape.egress || cfg->shape.ingress) && container_shape(c, &cfg->shape) < 0)
+    {
+        fprintf(stderr, "[parent] Traffic shaping failed\n");
+        return container_abort(c);
+    }
+    if (cfg->nports && c->net.slot >= 0 &&
+        publish_start(&c->publish, cfg->publish_mode, cfg->ports, cfg->nports, c->net.addr) < 0)
+    {
+        fprintf(stderr, "[parent] Publishing ports failed\n");
+        return container_abort(c);
+    }
+    timing_mark(timing, MARK_NET_DONE);
+    return 0;
+}
+
+// Let a created container go ahead and exec
+void container_start(struct container *c)
+{
+    printf("[parent] Signaling child\n");
+    timing_mark(c->args.timing, MARK_SIGNALLED);
+    cd_sync_post(&c->args.sync, SYNC_PARENT_GO);
+}
+
+// After the container's process has been reaped with the given wait
+// status: report, release everything it held and return the status
+int container_finish(struct container *c, int status)
+{
+    const struct container_config *cfg = c->args.cfg;
+
+    printf("[parent] Child exited, cleaning up\n");
+    if (c->pidfd >= 0)
+        close(c->pidfd);
+    c->pidfd = -1;
+
+    if (cd_sync_failed(&c->args.sync))
+        fprintf(stderr, "[parent] container failed before exec: %s: %s\n",
+                c->args.sync.page->what, strerror(c->args.sync.page->error));
+    cd_sync_close(&c->args.sync);
+
+    struct cgroup_stats stats;
+    if (cfg->print_stats && cgroup_read_stats(&c->cg, &stats) == 0)
+        cgroup_print_stats(stderr, &stats);
+    cgroup_destroy(&c->cg);
+
+    container_net_release(c);
+    rootfs_cleanup(&c->args.rootfs);
+
+    return status;
+}
+
+// Start one container, wait for it and return its wait status (or -1).
+// timing may be NULL; otherwise it must be shared memory (timing_alloc).
+int launch_container(const struct container_config *cfg, struct launch_timing *timing)
+{
+    // Signals aimed at us are passed on to the container via its pidfd
+    sigset_t fwd, old;
+    sigemptyset(&fwd);
+    sigaddset(&fwd, SIGTERM);
+    sigaddset(&fwd, SIGHUP);
+    sigaddset(&fwd, SIGQUIT);
+    sigprocmask(SIG_BLOCK, &fwd, &old);
+
+    struct container c;
+    if (container_create(&c, cfg, timing, &old) < 0)
+    {
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        return -1;
+    }
+    container_start(&c);
+
+    // Wait for child to exit
+    int status = supervise_child(c.pidfd, &fwd);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    return container_finish(&c, status);
+}
+
+#endif // CDOCKER_CONTAINER_H
@@ -0,0 +1,1167 @@
+#ifndef CDOCKER_DAEMON_H
+#define CDOCKER_DAEMON_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "container.h"
+#include "utility/fdpass.h"
+
+/*
+ * cdockerd: cdocker daemon
+ *
+ * One long-lived process that owns the containers and keeps everything a
+ * launch needs warm: the host netns fd and rtnetlink session, the cgroup
+ * parent fd, the IPAM pool mapping, the NAT/bridge setup and, for
+ * create --zygote, each image's zygote and, with --netns-pool, the ready
+ * network namespaces. Clients talk to it over a SOCK_SEQPACKET Unix
+ * socket, one request per packet, and everything (requests, container
+ * exits, stop timeouts, shutdown) is driven from a single epoll loop:
+ * container exits arrive as readable pidfds, and a wait request just
+ * parks the client until then.
+ *
+ *   cdocker create [options] [cmd...]   prints the new container's id
+ *   cdocker start ID
+ *   cdocker stop ID [SIGNAL]            SIGKILL follows after a grace period
+ *   cdocker wait ID                     exits with the container's status
+ *   cdocker list
+ *   cdocker shape ID EGRESS [INGRESS]   change its rate limits
+ *   cdocker stats [INTERVAL]            traffic counters, or rates every INTERVAL s
+ *
+ * create hands the client's stdin/stdout/stderr over with SCM_RIGHTS, so
+ * the container talks to the terminal it was created from.
+ */
+
+#define CDOCKERD_SOCKET     "/run/cdocker/cdockerd.sock"
+#define CD_MSG_MAX          65536
+#define CD_STOP_GRACE_NS    (10ull * 1000000000)
+#define CD_BUCKETS          1024
+
+/*
+ * ============================================================
+ * PART 1: PROTOCOL
+ *
+ * Every packet starts with struct cd_msg; len covers the header and the
+ * payload after it. Each request gets one reply (LIST: one or more) on
+ * the same connection, in order. Host byte order: both ends are always
+ * on the same machine.
+ * ============================================================
+ */
+
+enum cd_msg_type {
+    CD_REQ_CREATE = 1,  // struct cd_create + strings, stdio fds attached; reply value: pid
+    CD_REQ_START,       // id
+    CD_REQ_STOP,        // id; value: signal, 0 for SIGTERM
+    CD_REQ_WAIT,        // id; answered once it has exited, value: wait status
+    CD_REQ_LIST,        // answered with struct cd_list_entry[]
+    CD_REQ_SHAPE,       // id; struct net_shape: the container's new rate limits
+    CD_REQ_STATS,       // answered with struct cd_stats_entry[]
+
+    CD_RESP_OK = 0x100, // id: the container's; payload per request
+    CD_RESP_ERR,        // value: errno; payload: message
+};
+
+#define CD_MSG_MORE 0x1 // another reply packet follows (long lists)
+
+struct cd_msg {
+    uint32_t len;
+    uint16_t type;
+    uint16_t flags;
+    uint32_t id;
+    int32_t value;
+};
+
+// CD_REQ_CREATE payload: this, then CD_CREATE_STRINGS NUL-terminated
+// strings ("" for unset), then argc more for the command line
+struct cd_create {
+    uint8_t network;
+    uint8_t net_mode;
+    uint8_t overlay;
+    uint8_t upper_tmpfs;
+    uint8_t dev;
+    uint8_t sync;
+    uint8_t zygote;
+    uint16_t argc;
+    uint8_t netns_pool;
+    struct veth_opts veth;
+    struct net_shape shape;
+    uint8_t publish_mode;
+    uint8_t nports;
+    struct port_map ports[PUBLISH_MAX];
+    struct userns_map userns;
+};
+
+enum {
+    CS_SUBNET, CS_IMAGE, CS_LOWER, CS_MEMORY, CS_CPU, CS_IO, CS_PIDS, CS_NET_PARENT,
+    CS_SECCOMP,
+    CD_CREATE_STRINGS
+};
+
+enum cd_state {
+    CD_CREATED,
+    CD_RUNNING,
+    CD_EXITED,
+};
+
+struct cd_list_entry {
+    uint32_t id;
+    int32_t pid;
+    uint8_t state;
+    uint8_t pad[3];
+    int32_t status;     // wait status once exited
+};
+
+// Traffic as the container sees it
+struct cd_stats_entry {
+    uint32_t id;
+    uint32_t pad;
+    struct net_stats net;
+};
+
+static const char *cd_state_name(int state)
+{
+    static const char *names[] = { "created", "running", "exited" };
+    return state >= 0 && state <= CD_EXITED ? names[state] : "?";
+}
+
+static const char *cd_socket_path(void)
+{
+    const char *path = getenv("CDOCKERD_SOCKET");
+    return path && *path ? path : CDOCKERD_SOCKET;
+}
+
+// Serialise the parts of cfg a container needs. Returns the length, or
+// -1 if it doesn't fit.
+static int cd_create_encode(const struct container_config *cfg, char *buf, size_t len)
+{
+    struct cd_create *req = (struct cd_create *)buf;
+    memset(req, 0, sizeof(*req));
+    req->network = cfg->network;
+    req->net_mode = cfg->net_mode;
+    req->overlay = cfg->rootfs.overlay;
+    req->upper_tmpfs = cfg->rootfs.upper_tmpfs;
+    req->dev = cfg->rootfs.dev;
+    req->sync = cfg->sync;
+    req->zygote = cfg->zygote;
+    req->netns_pool = cfg->netns_pool > NETNS_POOL_MAX ? NETNS_POOL_MAX : cfg->netns_pool;
+    req->veth = cfg->veth;
+    req->shape = cfg->shape;
+    req->publish_mode = cfg->publish_mode;
+    req->nports = cfg->nports;
+    memcpy(req->ports, cfg->ports, sizeof(req->ports));
+    req->userns = cfg->userns;
+
+    const char *strings[CD_CREATE_STRINGS] = {
+        [CS_SUBNET] = cfg->subnet,
+        [CS_IMAGE] = cfg->rootfs.image,
+        [CS_LOWER] = cfg->rootfs.lower_stack,
+        [CS_MEMORY] = cfg->limits.memory_max,
+        [CS_CPU] = cfg->limits.cpu_max,
+        [CS_IO] = cfg->limits.io_max,
+        [CS_PIDS] = cfg->limits.pids_max,
+        [CS_NET_PARENT] = cfg->net_parent,
+        [CS_SECCOMP] = cfg->seccomp,
+    };
+
+    size_t off = sizeof(*req);
+    for (int i = 0; i < CD_CREATE_STRINGS; i++)
+    {
+        const char *str = strings[i] ? strings[i] : "";
+        size_t n = strlen(str) + 1;
+        if (off + n > len)
+            return -1;
+        memcpy(buf + off, str, n);
+        off += n;
+    }
+
+    for (char **arg = cfg->argv; *arg; arg++, req->argc++)
+    {
+        size_t n = strlen(*arg) + 1;
+        if (off + n > len)
+            return -1;
+        memcpy(buf + off, *arg, n);
+        off += n;
+    }
+    return off;
+}
+
+// The reverse, in place: cfg's strings point into buf, and *argv is a
+// fresh NULL-terminated array the caller frees
+static int cd_create_decode(char *buf, size_t len, struct container_config *cfg, char ***argv)
+{
+    if (len < sizeof(struct cd_create))
+        return -1;
+    struct cd_create *req = (struct cd_create *)buf;
+
+    const char *strings[CD_CREATE_STRINGS];
+    char *p = buf + sizeof(*req), *end = buf + len;
+    for (int i = 0; i < CD_CREATE_STRINGS; i++)
+    {
+        char *nul = memchr(p, '\0', end - p);
+        if (!nul)
+            return -1;
+        strings[i] = *p ? p : NULL;
+        p = nul + 1;
+    }
+
+    if (req->argc == 0 || !(*argv = calloc(req->argc + 1, sizeof(char *))))
+        return -1;
+    for (int i = 0; i < req->argc; i++)
+    {
+        char *nul = memchr(p, '\0', end - p);
+        if (!nul)
+        {
+            free(*argv);
+            return -1;
+        }
+        (*argv)[i] = p;
+        p = nul + 1;
+    }
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->argv = *argv;
+    cfg->network = req->network;
+    cfg->net_mode = req->net_mode < NET_MODES ? req->net_mode : NET_BRIDGE;
+    cfg->net_parent = strings[CS_NET_PARENT];
+    cfg->seccomp = strings[CS_SECCOMP];
+    cfg->veth = req->veth;
+    cfg->shape = req->shape;
+    cfg->publish_mode = req->publish_mode == PUBLISH_PROXY ? PUBLISH_PROXY : PUBLISH_NAT;
+    cfg->nports = req->nports < PUBLISH_MAX ? req->nports : PUBLISH_MAX;
+    memcpy(cfg->ports, req->ports, sizeof(cfg->ports));
+    cfg->sync = req->sync == CD_SYNC_PIPE ? CD_SYNC_PIPE : CD_SYNC_FUTEX;
+    cfg->zygote = req->zygote;
+    cfg->netns_pool = req->netns_pool;
+    if (req->userns.base && req->userns.count)     // never host root
+        cfg->userns = req->userns;
+    cfg->subnet = strings[CS_SUBNET];
+    cfg->rootfs.image = strings[CS_IMAGE];
+    cfg->rootfs.lower_stack = strings[CS_LOWER];
+    cfg->rootfs.overlay = req->overlay;
+    cfg->rootfs.upper_tmpfs = req->upper_tmpfs;
+    cfg->rootfs.dev = req->dev == ROOTFS_DEV_MINIMAL ? ROOTFS_DEV_MINIMAL : ROOTFS_DEV_HOST;
+    cfg->limits.memory_max = strings[CS_MEMORY];
+    cfg->limits.cpu_max = strings[CS_CPU];
+    cfg->limits.io_max = strings[CS_IO];
+    cfg->limits.pids_max = strings[CS_PIDS];
+    return 0;
+}
+
+// One packet; fds (may be NULL) ride along as SCM_RIGHTS
+static int cd_send(int fd, uint16_t type, uint16_t flags, uint32_t id, int32_t value,
+                   const void *payload, size_t len, const int *fds, int nfds)
+{
+    struct cd_msg hdr = {
+        .len = sizeof(hdr) + len, .type = type, .flags = flags, .id = id, .value = value,
+    };
+    struct iovec iov[2] = {
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = (void *)payload, .iov_len = len },
+    };
+    return fd_sendmsg(fd, iov, len ? 2 : 1, fds, nfds);
+}
+
+// Receive one packet into buf. Up to 3 passed fds land in fds (rest -1).
+// Returns the packet length, 0 on EOF, -1 on error or a malformed packet.
+static ssize_t cd_recv(int fd, void *buf, size_t len, int *fds)
+{
+    int ignored[3];
+    ssize_t n = fd_recvmsg(fd, buf, len, fds ? fds : ignored, 3);
+    if (!fds)
+        for (int i = 0; i < 3; i++)
+            if (ignored[i] >= 0)
+                close(ignored[i]);
+    if (n <= 0)
+        return n;
+
+    struct cd_msg *hdr = buf;
+    if ((size_t)n < sizeof(*hdr) || hdr->len != (size_t)n)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+    return n;
+}
+
+/*
+ * ============================================================
+ * PART 2: THE DAEMON
+ * ============================================================
+ */
+
+// epoll data.ptr always points at one of these, tagged by kind
+enum { DOBJ_LISTEN, DOBJ_SIGNAL, DOBJ_CLIENT, DOBJ_CONTAINER };
+
+struct dobj {
+    int kind;
+};
+
+struct dclient {
+    struct dobj obj;
+    int fd;
+};
+
+struct dcontainer {
+    struct dobj obj;
+    uint32_t id;
+    enum cd_state state;
+    int status;
+    uint64_t kill_at;               // SIGKILL if still running by then (ns), 0: no
+    struct container c;
+    struct container_config cfg;    // strings point into req
+    char *req;
+    char **argv;
+    int stdio[3];
+    struct dclient **waiters;
+    int nwaiters;
+    struct dcontainer *next;        // hash chain
+};
+
+struct daemon {
+    int epfd;
+    struct dobj listen;
+    int lfd;
+    struct dobj signal;
+    int sfd;
+    sigset_t child_mask;            // what containers start with
+    uint32_t next_id;
+    struct dcontainer *buckets[CD_BUCKETS];
+    char buf[CD_MSG_MAX];
+};
+
+static struct dcontainer *d_find(struct daemon *d, uint32_t id)
+{
+    for (struct dcontainer *dc = d->buckets[id % CD_BUCKETS]; dc; dc = dc->next)
+        if (dc->id == id)
+            return dc;
+    return NULL;
+}
+
+static void d_unlink(struct daemon *d, struct dcontainer *dc)
+{
+    for (struct dcontainer **pp = &d->buckets[dc->id % CD_BUCKETS]; *pp; pp = &(*pp)->next)
+    {
+        if (*pp == dc)
+        {
+            *pp = dc->next;
+            return;
+        }
+    }
+}
+
+static void d_free(struct daemon *d, struct dcontainer *dc)
+{
+    d_unlink(d, dc);
+    for (int i = 0; i < 3; i++)
+        if (dc->stdio[i] >= 0)
+            close(dc->stdio[i]);
+    free(dc->waiters);
+    free(dc->argv);
+    free(dc->req);
+    free(dc);
+}
+
+// Replies never wait on a client: its socket is non-blocking, and one that
+// has stopped reading (a full buffer) or gone away is cut off. The hangup
+// then comes round as an EOF in d_request, which frees it.
+static void d_send(struct dclient *cl, uint16_t type, uint16_t flags, uint32_t id,
+                   int32_t value, const void *payload, size_t len)
+{
+    if (cd_send(cl->fd, type, flags, id, value, payload, len, NULL, 0) < 0)
+        shutdown(cl->fd, SHUT_RDWR);
+}
+
+static void d_error(struct dclient *cl, uint32_t id, int err, const char *what)
+{
+    char msg[128];
+    int n = snprintf(msg, sizeof(msg), "%s: %s", what, strerror(err));
+    d_send(cl, CD_RESP_ERR, 0, id, err, msg, n + 1);
+}
+
+static void d_create(struct daemon *d, struct dclient *cl, const char *payload, size_t len,
+                     int *fds)
+{
+    struct dcontainer *dc = calloc(1, sizeof(*dc));
+    if (!dc || !(dc->req = malloc(len)))
+    {
+        free(dc);
+        d_error(cl, 0, ENOMEM, "create");
+        for (int i = 0; i < 3; i++)
+            if (fds[i] >= 0)
+                close(fds[i]);
+        return;
+    }
+    memcpy(dc->req, payload, len);
+    memcpy(dc->stdio, fds, sizeof(dc->stdio));
+
+    dc->obj.kind = DOBJ_CONTAINER;
+    if (cd_create_decode(dc->req, len, &dc->cfg, &dc->argv) < 0)
+    {
+        d_error(cl, 0, EINVAL, "create");
+        dc->argv = NULL;
+        free(dc->req);
+        for (int i = 0; i < 3; i++)
+            if (fds[i] >= 0)
+                close(fds[i]);
+        free(dc);
+        return;
+    }
+    if (dc->stdio[0] >= 0)
+        dc->cfg.stdio = dc->stdio;
+
+    if (container_create(&dc->c, &dc->cfg, NULL, &d->child_mask) < 0)
+    {
+        d_error(cl, 0, EIO, "create");
+        for (int i = 0; i < 3; i++)
+            if (dc->stdio[i] >= 0)
+                close(dc->stdio[i]);
+        free(dc->argv);
+        free(dc->req);
+        free(dc);
+        return;
+    }
+
+    // The child has its own copies of the client's stdio now
+    for (int i = 0; i < 3; i++)
+    {
+        if (dc->stdio[i] >= 0)
+            close(dc->stdio[i]);
+        dc->stdio[i] = -1;
+    }
+    dc->cfg.stdio = NULL;
+
+    do {
+        dc->id = ++d->next_id;
+    } while (dc->id == 0 || d_find(d, dc->id));
+    dc->next = d->buckets[dc->id % CD_BUCKETS];
+    d->buckets[dc->id % CD_BUCKETS] = dc;
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = dc };
+    epoll_ctl(d->epfd, EPOLL_CTL_ADD, dc->c.pidfd, &ev);
+
+    d_send(cl, CD_RESP_OK, 0, dc->id, dc->c.pid, NULL, 0);
+}
+
+static void d_start(struct daemon *d, struct dclient *cl, uint32_t id)
+{
+    struct dcontainer *dc = d_find(d, id);
+    if (!dc)
+    {
+        d_error(cl, id, ESRCH, "start");
+        return;
+    }
+    if (dc->state != CD_CREATED)
+    {
+        d_error(cl, id, EALREADY, "start");
+        return;
+    }
+    container_start(&dc->c);
+    dc->state = CD_RUNNING;
+    d_send(cl, CD_RESP_OK, 0, id, 0, NULL, 0);
+}
+
+// The signal first; SIGKILL after the grace period if that doesn't do it
+// (as PID 1 of its namespace, the container ignores signals it has no
+// handler for)
+static void d_stop(struct daemon *d, struct dclient *cl, uint32_t id, int sig)
+{
+    struct dcontainer *dc = d_find(d, id);
+    if (!dc)
+    {
+        d_error(cl, id, ESRCH, "stop");
+        return;
+    }
+    if (dc->state != CD_EXITED)
+    {
+        // A created container is still parked in the handshake
+        if (dc->state == CD_CREATED)
+            sig = SIGKILL;
+        pidfd_send_signal_wrapper(dc->c.pidfd, sig ? sig : SIGTERM);
+        if (!dc->kill_at)
+            dc->kill_at = now_ns() + CD_STOP_GRACE_NS;
+    }
+    d_send(cl, CD_RESP_OK, 0, id, 0, NULL, 0);
+}
+
+static void d_wait(struct daemon *d, struct dclient *cl, uint32_t id)
+{
+    struct dcontainer *dc = d_find(d, id);
+    if (!dc)
+    {
+        d_error(cl, id, ESRCH, "wait");
+        return;
+    }
+
+    // Collected: the record goes with this reply
+    if (dc->state == CD_EXITED)
+    {
+        d_send(cl, CD_RESP_OK, 0, id, dc->status, NULL, 0);
+        d_free(d, dc);
+        return;
+    }
+
+    struct dclient **w = realloc(dc->waiters, (dc->nwaiters + 1) * sizeof(*w));
+    if (!w)
+    {
+        d_error(cl, id, ENOMEM, "wait");
+        return;
+    }
+    dc->waiters = w;
+    dc->waiters[dc->nwaiters++] = cl;
+}
+
+static void d_shape(struct daemon *d, struct dclient *cl, uint32_t id, const char *payload,
+                    size_t len)
+{
+    struct dcontainer *dc = d_find(d, id);
+    if (!dc)
+    {
+        d_error(cl, id, ESRCH, "shape");
+        return;
+    }
+    if (len != sizeof(struct net_shape) || dc->state == CD_EXITED)
+    {
+        d_error(cl, id, len != sizeof(struct net_shape) ? EINVAL : ESRCH, "shape");
+        return;
+    }
+    struct net_shape shape;
+    memcpy(&shape, payload, sizeof(shape));
+    if (container_shape(&dc->c, &shape) < 0)
+    {
+        d_error(cl, id, EIO, "shape");
+        return;
+    }
+    d_send(cl, CD_RESP_OK, 0, id, 0, NULL, 0);
+}
+
+static void d_list(struct daemon *d, struct dclient *cl)
+{
+    struct cd_list_entry *e = (struct cd_list_entry *)d->buf;
+    int max = sizeof(d->buf) / sizeof(*e) - 1, n = 0;
+
+    for (int b = 0; b < CD_BUCKETS; b++)
+    {
+        for (struct dcontainer *dc = d->buckets[b]; dc; dc = dc->next)
+        {
+            if (n == max)
+            {
+                d_send(cl, CD_RESP_OK, CD_MSG_MORE, 0, 0, e, n * sizeof(*e));
+                n = 0;
+            }
+            e[n++] = (struct cd_list_entry){
+                .id = dc->id, .pid = dc->c.pid, .state = dc->state, .status = dc->status,
+            };
+        }
+    }
+    d_send(cl, CD_RESP_OK, 0, 0, 0, e, n * sizeof(*e));
+}
+
+struct d_stats_walk {
+    struct dcontainer **by_slot;
+    int nslots;
+    struct cd_stats_entry *e;
+    int max, n;
+    struct dclient *cl;
+};
+
+static void d_stats_one(int slot, const struct net_stats *st, void *arg)
+{
+    struct d_stats_walk *w = arg;
+    struct dcontainer *dc = slot < w->nslots ? w->by_slot[slot] : NULL;
+    if (!dc)
+        return;
+    if (w->n == w->max)
+    {
+        d_send(w->cl, CD_RESP_OK, CD_MSG_MORE, 0, 0, w->e, w->n * sizeof(*w->e));
+        w->n = 0;
+    }
+    w->e[w->n++] = (struct cd_stats_entry){ .id = dc->id, .net = *st };
+}
+
+// All containers' counters from a single link dump, matched back to them
+// through their host ends' slots
+static void d_stats(struct daemon *d, struct dclient *cl)
+{
+    struct d_stats_walk w = {
+        .e = (struct cd_stats_entry *)d->buf,
+        .max = sizeof(d->buf) / sizeof(struct cd_stats_entry) - 1,
+        .cl = cl,
+    };
+
+    for (int b = 0; b < CD_BUCKETS; b++)
+        for (struct dcontainer *dc = d->buckets[b]; dc; dc = dc->next)
+            if (dc->state != CD_EXITED && dc->c.net.slot >= w.nslots)
+                w.nslots = dc->c.net.slot + 1;
+    if (w.nslots && !(w.by_slot = calloc(w.nslots, sizeof(*w.by_slot))))
+    {
+        d_error(cl, 0, ENOMEM, "stats");
+        return;
+    }
+    for (int b = 0; b < CD_BUCKETS; b++)
+        for (struct dcontainer *dc = d->buckets[b]; dc; dc = dc->next)
+            if (dc->state != CD_EXITED && dc->c.net.slot >= 0 && !NET_MODE_LOWER(dc->c.net.mode))
+                w.by_slot[dc->c.net.slot] = dc;
+
+    if (w.nslots && network_stats(d_stats_one, &w) < 0)
+        d_error(cl, 0, EIO, "stats");
+    else
+        d_send(cl, CD_RESP_OK, 0, 0, 0, w.e, w.n * sizeof(*w.e));
+    free(w.by_slot);
+}
+
+// The container's pidfd went readable
+static void d_exited(struct daemon *d, struct dcontainer *dc)
+{
+    epoll_ctl(d->epfd, EPOLL_CTL_DEL, dc->c.pidfd, NULL);
+    dc->status = container_finish(&dc->c, pidfd_reap(dc->c.pidfd));
+    dc->state = CD_EXITED;
+    dc->kill_at = 0;
+
+    // With someone waiting the record has been collected
+    for (int i = 0; i < dc->nwaiters; i++)
+        d_send(dc->waiters[i], CD_RESP_OK, 0, dc->id, dc->status, NULL, 0);
+    if (dc->nwaiters)
+        d_free(d, dc);
+}
+
+static void d_client_gone(struct daemon *d, struct dclient *cl)
+{
+    for (int b = 0; b < CD_BUCKETS; b++)
+        for (struct dcontainer *dc = d->buckets[b]; dc; dc = dc->next)
+            for (int i = 0; i < dc->nwaiters; i++)
+                if (dc->waiters[i] == cl)
+                    dc->waiters[i--] = dc->waiters[--dc->nwaiters];
+
+    close(cl->fd);
+    free(cl);
+}
+
+static void d_request(struct daemon *d, struct dclient *cl)
+{
+    int fds[3];
+    ssize_t n = cd_recv(cl->fd, d->buf, sizeof(d->buf), fds);
+    if (n < 0 && errno == EAGAIN)
+        return;
+    if (n <= 0)
+    {
+        for (int i = 0; i < 3; i++)
+            if (fds[i] >= 0)
+                close(fds[i]);
+        d_client_gone(d, cl);
+        return;
+    }
+
+    struct cd_msg *msg = (struct cd_msg *)d->buf;
+    const char *payload = d->buf + sizeof(*msg);
+    size_t len = n - sizeof(*msg);
+
+    if (msg->type != CD_REQ_CREATE)
+        for (int i = 0; i < 3; i++)
+            if (fds[i] >= 0)
+                close(fds[i]);
+
+    switch (msg->type)
+    {
+    case CD_REQ_CREATE: d_create(d, cl, payload, len, fds); break;
+    case CD_REQ_START:  d_start(d, cl, msg->id); break;
+    case CD_REQ_STOP:   d_stop(d, cl, msg->id, msg->value); break;
+    case CD_REQ_WAIT:   d_wait(d, cl, msg->id); break;
+    case CD_REQ_LIST:   d_list(d, cl); break;
+    case CD_REQ_SHAPE:  d_shape(d, cl, msg->id, payload, len); break;
+    case CD_REQ_STATS:  d_stats(d, cl); break;
+    default:            d_error(cl, msg->id, EOPNOTSUPP, "request"); break;
+    }
+}
+
+static void d_accept(struct daemon *d)
+{
+    for (;;)
+    {
+        int fd = accept4(d->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;     // EAGAIN: drained
+
+        struct dclient *cl = malloc(sizeof(*cl));
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = cl };
+        if (!cl || epoll_ctl(d->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            free(cl);
+            close(fd);
+            continue;
+        }
+        cl->obj.kind = DOBJ_CLIENT;
+        cl->fd = fd;
+    }
+}
+
+// Send overdue SIGKILLs; returns the epoll timeout until the next one
+static int d_timeouts(struct daemon *d)
+{
+    uint64_t now = now_ns(), next = 0;
+    for (int b = 0; b < CD_BUCKETS; b++)
+    {
+        for (struct dcontainer *dc = d->buckets[b]; dc; dc = dc->next)
+        {
+            if (!dc->kill_at)
+                continue;
+            if (dc->kill_at <= now)
+            {
+                pidfd_send_signal_wrapper(dc->c.pidfd, SIGKILL);
+                dc->kill_at = 0;
+            }
+            else if (!next || dc->kill_at < next)
+                next = dc->kill_at;
+        }
+    }
+    return next ? (int)((next - now) / 1000000) + 1 : -1;
+}
+
+static int d_listen(struct daemon *d, const char *path)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "cdockerd: socket path too long\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    d->lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (d->lfd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    // A socket file nobody answers on is left over from a dead daemon
+    if (connect(d->lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+    {
+        fprintf(stderr, "cdockerd: already running on %s\n", path);
+        return -1;
+    }
+    close(d->lfd);
+    unlink(path);
+
+    d->lfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    mode_t old = umask(077);
+    int ret = bind(d->lfd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old);
+    if (ret < 0 || listen(d->lfd, SOMAXCONN) < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+// Kill everything on the way out; nothing else would ever reap it
+static void d_shutdown(struct daemon *d)
+{
+    for (int b = 0; b < CD_BUCKETS; b++)
+    {
+        while (d->buckets[b])
+        {
+            struct dcontainer *dc = d->buckets[b];
+            if (dc->state != CD_EXITED)
+            {
+                pidfd_send_signal_wrapper(dc->c.pidfd, SIGKILL);
+                d_exited(d, dc);
+            }
+            if (d->buckets[b] == dc)
+                d_free(d, dc);
+        }
+    }
+}
+
+int run_daemon(const char *path)
+{
+    static struct daemon d;
+    d.epfd = d.lfd = d.sfd = -1;
+    d.listen.kind = DOBJ_LISTEN;
+    d.signal.kind = DOBJ_SIGNAL;
+
+    if (mkdir_p(CDOCKER_STATE_DIR, 0700) != 0)
+    {
+        perror("mkdir " CDOCKER_STATE_DIR);
+        return 1;
+    }
+    if (d_listen(&d, path) < 0)
+        return 1;
+
+    sigset_t stop;
+    sigemptyset(&stop);
+    sigaddset(&stop, SIGTERM);
+    sigaddset(&stop, SIGINT);
+    sigaddset(&stop, SIGHUP);
+    sigprocmask(SIG_BLOCK, &stop, &d.child_mask);
+
+    d.sfd = signalfd(-1, &stop, SFD_CLOEXEC);
+    d.epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &d.listen };
+    if (d.sfd < 0 || d.epfd < 0 || epoll_ctl(d.epfd, EPOLL_CTL_ADD, d.lfd, &ev) < 0)
+    {
+        perror("cdockerd epoll");
+        return 1;
+    }
+    ev.data.ptr = &d.signal;
+    epoll_ctl(d.epfd, EPOLL_CTL_ADD, d.sfd, &ev);
+
+    fprintf(stderr, "cdockerd: listening on %s\n", path);
+
+    for (int running = 1; running;)
+    {
+        struct epoll_event events[64];
+        int n = epoll_wait(d.epfd, events, 64, d_timeouts(&d));
+        if (n < 0 && errno != EINTR)
+        {
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            struct dobj *obj = events[i].data.ptr;
+            switch (obj->kind)
+            {
+            case DOBJ_LISTEN:    d_accept(&d); break;
+            case DOBJ_CLIENT:    d_request(&d, (struct dclient *)obj); break;
+            case DOBJ_CONTAINER: d_exited(&d, (struct dcontainer *)obj); break;
+            case DOBJ_SIGNAL:    running = 0; break;
+            }
+        }
+    }
+
+    fprintf(stderr, "cdockerd: shutting down\n");
+    d_shutdown(&d);
+    unlink(path);
+    return 0;
+}
+
+/*
+ * ============================================================
+ * PART 3: THE CLIENT
+ * ============================================================
+ */
+
+static int cd_connect(void)
+{
+    const char *path = cd_socket_path();
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        fprintf(stderr, "can't reach cdockerd at %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Read one reply; prints the daemon's error message for CD_RESP_ERR
+static struct cd_msg *cd_reply(int fd, char *buf, size_t len)
+{
+    ssize_t n = cd_recv(fd, buf, len, NULL);
+    if (n <= 0)
+    {
+        fprintf(stderr, "cdockerd: %s\n", n == 0 ? "connection closed" : strerror(errno));
+        return NULL;
+    }
+
+    struct cd_msg *msg = (struct cd_msg *)buf;
+    if (msg->type == CD_RESP_ERR)
+    {
+        fprintf(stderr, "cdockerd: %.*s\n", (int)(n - sizeof(*msg)), buf + sizeof(*msg));
+        return NULL;
+    }
+    return msg;
+}
+
+int client_create(const struct container_config *cfg)
+{
+    // Paths are the client's: the daemon runs somewhere else
+    struct container_config abs = *cfg;
+    char image[PATH_MAX];
+    if (!abs.rootfs.lower_stack)
+    {
+        if (!realpath(abs.rootfs.image ? abs.rootfs.image : "./rootfs", image))
+        {
+            perror("image");
+            return 1;
+        }
+        abs.rootfs.image = image;
+    }
+    char seccomp[PATH_MAX];
+    if (abs.seccomp && strcmp(abs.seccomp, "default") != 0)
+    {
+        if (!realpath(abs.seccomp, seccomp))
+        {
+            perror(abs.seccomp);
+            return 1;
+        }
+        abs.seccomp = seccomp;
+    }
+
+    static char buf[CD_MSG_MAX];
+    int len = cd_create_encode(&abs, buf, sizeof(buf) - sizeof(struct cd_msg));
+    if (len < 0)
+    {
+        fprintf(stderr, "create: command line too long\n");
+        return 1;
+    }
+
+    int fd = cd_connect();
+    if (fd < 0)
+        return 1;
+
+    static const int stdio[3] = { 0, 1, 2 };
+    struct cd_msg *reply = NULL;
+    if (cd_send(fd, CD_REQ_CREATE, 0, 0, 1, buf, len, stdio, 3) == 0)
+        reply = cd_reply(fd, buf, sizeof(buf));
+    close(fd);
+
+    if (!reply)
+        return 1;
+    printf("%u\n", reply->id);
+    return 0;
+}
+
+// shape ID EGRESS [INGRESS]: new rate limits in tc's syntax, 0 for none
+int client_shape(int argc, char **argv)
+{
+    struct net_shape shape = { 0 };
+    if (argc < 2 || argc > 3 || tc_rate_parse(argv[1], &shape.egress) < 0 ||
+        (argc == 3 && tc_rate_parse(argv[2], &shape.ingress) < 0))
+    {
+        fprintf(stderr, "usage: cdocker shape ID EGRESS [INGRESS]  (rates like 100mbit, 0: none)\n");
+        return 1;
+    }
+
+    int fd = cd_connect();
+    if (fd < 0)
+        return 1;
+
+    static char buf[CD_MSG_MAX];
+    int ret = 1;
+    if (cd_send(fd, CD_REQ_SHAPE, 0, strtoul(argv[0], NULL, 10), 0,
+                &shape, sizeof(shape), NULL, 0) < 0)
+        perror("send");
+    else if (cd_reply(fd, buf, sizeof(buf)))
+        ret = 0;
+    close(fd);
+    return ret;
+}
+
+// One round of stats replies into *all (grown as needed); returns the
+// count, or -1
+static int client_stats_get(int fd, char *buf, struct cd_stats_entry **all, int *cap)
+{
+    if (cd_send(fd, CD_REQ_STATS, 0, 0, 0, NULL, 0, NULL, 0) < 0)
+    {
+        perror("send");
+        return -1;
+    }
+
+    int n = 0;
+    struct cd_msg *reply;
+    while ((reply = cd_reply(fd, buf, CD_MSG_MAX)))
+    {
+        struct cd_stats_entry *e = (struct cd_stats_entry *)(reply + 1);
+        int got = (reply->len - sizeof(*reply)) / sizeof(*e);
+        if (n + got > *cap)
+        {
+            int cap2 = (n + got) * 2;
+            struct cd_stats_entry *grown = realloc(*all, cap2 * sizeof(*grown));
+            if (!grown)
+                return -1;
+            *all = grown;
+            *cap = cap2;
+        }
+        memcpy(*all + n, e, got * sizeof(*e));
+        n += got;
+        if (!(reply->flags & CD_MSG_MORE))
+            return n;
+    }
+    return -1;
+}
+
+// stats: every container's counters; stats INTERVAL: per-second rates
+// over each INTERVAL, until interrupted. A round is one request, and one
+// link dump in the daemon, however many containers there are.
+int client_stats(int argc, char **argv)
+{
+    double interval = argc > 0 ? atof(argv[0]) : 0;
+    if (argc > 1 || (argc == 1 && interval <= 0))
+    {
+        fprintf(stderr, "usage: cdocker stats [INTERVAL]\n");
+        return 1;
+    }
+
+    int fd = cd_connect();
+    if (fd < 0)
+        return 1;
+
+    static char buf[CD_MSG_MAX];
+    struct cd_stats_entry *cur = NULL, *prev = NULL;
+    int ncur = 0, nprev = 0, capcur = 0, capprev = 0, ret = 0;
+    for (;;)
+    {
+        uint64_t t0 = now_ns();
+        if ((ncur = client_stats_get(fd, buf, &cur, &capcur)) < 0)
+        {
+            ret = 1;
+            break;
+        }
+        if (!interval)
+        {
+            printf("%-10s %14s %12s %8s %14s %12s %8s\n", "ID",
+                   "RX-BYTES", "RX-PKTS", "RX-DROP", "TX-BYTES", "TX-PKTS", "TX-DROP");
+            for (int i = 0; i < ncur; i++)
+            {
+                const struct net_stats *st = &cur[i].net;
+                printf("%-10u %14llu %12llu %8llu %14llu %12llu %8llu\n", cur[i].id,
+                       (unsigned long long)st->rx_bytes, (unsigned long long)st->rx_packets,
+                       (unsigned long long)st->rx_dropped, (unsigned long long)st->tx_bytes,
+                       (unsigned long long)st->tx_packets, (unsigned long long)st->tx_dropped);
+            }
+            break;
+        }
+
+        // Rates against the previous round; containers keep their order
+        // between rounds unless some come or go, so look there first
+        if (prev)
+        {
+            printf("%-10s %14s %12s %14s %12s\n", "ID",
+                   "RX(bit/s)", "RX(pkt/s)", "TX(bit/s)", "TX(pkt/s)");
+            for (int i = 0; i < ncur; i++)
+            {
+                int j = i < nprev && prev[i].id == cur[i].id ? i : -1;
+                for (int k = 0; j < 0 && k < nprev; k++)
+                    if (prev[k].id == cur[i].id)
+                        j = k;
+                if (j < 0)
+                    continue;
+                const struct net_stats *a = &prev[j].net, *b = &cur[i].net;
+                printf("%-10u %14.0f %12.0f %14.0f %12.0f\n", cur[i].id,
+                       (b->rx_bytes - a->rx_bytes) * 8 / interval,
+                       (b->rx_packets - a->rx_packets) / interval,
+                       (b->tx_bytes - a->tx_bytes) * 8 / interval,
+                       (b->tx_packets - a->tx_packets) / interval);
+            }
+            printf("\n");
+            fflush(stdout);
+        }
+
+        struct cd_stats_entry *t = prev;
+        prev = cur, nprev = ncur;
+        cur = t;
+        int tc = capprev;
+        capprev = capcur, capcur = tc;
+
+        int64_t left = interval * 1e9 - (int64_t)(now_ns() - t0);
+        if (left > 0)
+            nanosleep(&(struct timespec){ .tv_sec = left / 1000000000, .tv_nsec = left % 1000000000 },
+                      NULL);
+    }
+
+    free(cur);
+    free(prev);
+    close(fd);
+    return ret;
+}
+
+// start / stop / wait / list; args are what follows the command name
+int client_command(const char *cmd, int argc, char **argv)
+{
+    static const struct { const char *name; uint16_t type; int nargs; } cmds[] = {
+        { "start", CD_REQ_START, 1 },
+        { "stop",  CD_REQ_STOP,  1 },
+        { "wait",  CD_REQ_WAIT,  1 },
+        { "list",  CD_REQ_LIST,  0 },
+    };
+
+    int c = 0, ncmds = sizeof(cmds) / sizeof(cmds[0]);
+    while (c < ncmds && strcmp(cmd, cmds[c].name) != 0)
+        c++;
+    if (c == ncmds || argc < cmds[c].nargs || argc > cmds[c].nargs + (cmds[c].type == CD_REQ_STOP))
+    {
+        fprintf(stderr, "usage: cdocker %s%s\n", cmd,
+                c < ncmds && cmds[c].nargs ? (cmds[c].type == CD_REQ_STOP ? " ID [SIGNAL]" : " ID") : "");
+        return 1;
+    }
+
+    uint32_t id = cmds[c].nargs ? strtoul(argv[0], NULL, 10) : 0;
+    int value = argc > 1 ? atoi(argv[1]) : 0;
+
+    int fd = cd_connect();
+    if (fd < 0)
+        return 1;
+
+    static char buf[CD_MSG_MAX];
+    int ret = 1;
+    if (cd_send(fd, cmds[c].type, 0, id, value, NULL, 0, NULL, 0) < 0)
+    {
+        perror("send");
+        close(fd);
+        return 1;
+    }
+
+    struct cd_msg *reply;
+    switch (cmds[c].type)
+    {
+    case CD_REQ_WAIT:
+        if ((reply = cd_reply(fd, buf, sizeof(buf))))
+        {
+            int status = reply->value;
+            ret = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        }
+        break;
+
+    case CD_REQ_LIST:
+        printf("%-10s %-8s %-8s %s\n", "ID", "PID", "STATE", "STATUS");
+        while ((reply = cd_reply(fd, buf, sizeof(buf))))
+        {
+            struct cd_list_entry *e = (struct cd_list_entry *)(reply + 1);
+            int n = (reply->len - sizeof(*reply)) / sizeof(*e);
+            for (int i = 0; i < n; i++)
+            {
+                printf("%-10u %-8d %-8s ", e[i].id, e[i].pid, cd_state_name(e[i].state));
+                if (e[i].state != CD_EXITED)
+                    printf("-\n");
+                else if (WIFEXITED(e[i].status))
+                    printf("exit %d\n", WEXITSTATUS(e[i].status));
+                else
+                    printf("signal %d\n", WTERMSIG(e[i].status));
+            }
+            if (!(reply->flags & CD_MSG_MORE))
+            {
+                ret = 0;
+                break;
+            }
+        }
+        break;
+
+    default:
+        ret = cd_reply(fd, buf, sizeof(buf)) ? 0 : 1;
+        break;
+    }
+
+    close(fd);
+    return ret;
+}
+
+#endif // CDOCKER_DAEMON_H
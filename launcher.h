@@ -0,0 +1,89 @@
+#ifndef CDOCKER_LAUNCHER_H
+#define CDOCKER_LAUNCHER_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include "container.h"
+#include "utility/timing.h"
+
+/*
+ * Launching many containers at once.
+ *
+ * A pool of forked workers pulls launch indexes off a shared counter, so
+ * one worker's clone, rootfs and network steps overlap with the others'
+ * and a slow launch doesn't hold up a fixed share of the queue. Workers
+ * are processes rather than threads: the container is cloned without
+ * CLONE_VM from whoever launches it, and a copy of a multi-threaded
+ * process can inherit locks (stdio, malloc) that some other thread held.
+ * Separate processes also keep per-process state such as the current
+ * netns private to each launch.
+ *
+ * Addresses and interface names come from the shared IPAM pool, so the
+ * workers need no coordination beyond the counter.
+ */
+
+struct launch_queue {
+    int next;       // next launch index to hand out
+};
+
+// Launch count containers, concurrency at a time. status[i] gets the wait
+// status of launch i (or -1); timing, if not NULL, is timing_alloc(count).
+// status must be shared memory too. Returns how many launches failed.
+int launch_pool(const struct container_config *cfg, int count, int concurrency,
+                struct launch_timing *timing, int *status)
+{
+    if (concurrency < 1) concurrency = 1;
+    if (concurrency > count) concurrency = count;
+
+    struct launch_queue *q = mmap(NULL, sizeof(*q), PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (q == MAP_FAILED)
+    {
+        perror("mmap launch queue");
+        return count;
+    }
+    q->next = 0;
+
+    for (int i = 0; i < count; i++)
+        status[i] = -1;
+
+    // Once here rather than racing in every worker
+    if (cfg->network)
+        network_host_init(cfg->subnet ? cfg->subnet : CONTAINER_SUBNET, cfg->net_mode);
+
+    for (int w = 0; w < concurrency; w++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            perror("fork launch worker");
+            break;
+        }
+        if (pid == 0)
+        {
+            int i;
+            while ((i = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED)) < count)
+                status[i] = launch_container(cfg, timing ? &timing[i] : NULL);
+            fflush(stdout);
+            _exit(0);
+        }
+    }
+    while (wait(NULL) > 0)
+        ;
+
+    munmap(q, sizeof(*q));
+
+    int failed = 0;
+    for (int i = 0; i < count; i++)
+        if (status[i] != 0)
+            failed++;
+    return failed;
+}
+
+#endif // CDOCKER_LAUNCHER_H
@@ -11,11 +11,14 @@
 #include <linux/limits.h>
 #include <errno.h>
 
-#include "rootfs.h"
-// #include "ns.h"
-#include "simple_ns.h"
+#include <getopt.h>
+
+#include "container.h"
+#include "bench.h"
+#include "launcher.h"
+#include "daemon.h"
+#include "utility/layer_store.h"
 
-#define STACK_SIZE (1024 * 1024)
 /*
 
 
@@ -29,103 +32,316 @@ mount /prov to new root
 
 */
 
-struct child_args {
-    int sync_pipe;  // child reads from this, blocks until parent says go
-
-};
-
-int child_func(void *arg)
+static void usage(const char *prog)
 {
-    printf("Inside new PID + Mount namespace\n");
-    printf("PID inside container: %d\n", getpid());
-
-    struct child_args *cargs = (struct child_args *)arg;
-    setup_rootfs();
-
-    char buf;
-    printf("⭐ [child] Waiting for parent to set up network...\n");
-    if (read(cargs->sync_pipe, &buf, 1) != 1)
-    {
-        perror("child read sync_pipe");
-        return 1;
-    }
-    close(cargs->sync_pipe);
-
-    // Set up DNS using resolve
-    // write to the resolve.conf ig 
-    FILE *resolv = fopen("/etc/resolv.conf", "w");
-    if (resolv) {
-        fprintf(resolv, "nameserver 8.8.8.8\n");
-        fclose(resolv);
-    }
-
-    printf("⭐ About to exec shell...\n");
-    if (sethostname("cdocker", strlen("cdocker")) != 0)
-    {
-        perror("sethostname");
-    }
-
-    char *const args[] = {"/bin/sh", NULL};
-    execv("/bin/sh", args);
-    perror("execv /bin/sh failed");
-    return 1;
+    fprintf(stderr,
+            "usage: %s [run] [-n count] [-c concurrency] [options] [cmd [args...]]\n"
+            "       %s bench [-n count] [-c concurrency] [options] [cmd [args...]]\n"
+            "       %s bench sync [-n rounds]\n"
+            "       %s bench net [-n rounds] [--subnet CIDR]\n"
+            "       %s bench veth [-n streams] [--veth OPTS]\n"
+            "       %s bench stats [-n links]\n"
+            "       %s bench publish [-n conns] [--subnet CIDR]\n"
+            "       %s bench seccomp [-n calls] [--seccomp PROFILE]\n"
+            "       %s import <oci-layout-dir> <name>\n"
+            "       %s mkimage <rootfs-dir> <image.erofs>\n"
+            "       %s daemon\n"
+            "       %s create [options] [cmd [args...]]\n"
+            "       %s start|wait ID | stop ID [SIGNAL] | list\n"
+            "       %s shape ID EGRESS [INGRESS] | stats [INTERVAL]\n"
+            "\n"
+            "  -t, --timing       print the per-phase launch breakdown\n"
+            "  -n, --count        containers to launch (default 1, bench 100)\n"
+            "  -c, --concurrency  launches in flight at once (default 1)\n"
+            "      --no-net       skip the veth/NAT setup\n"
+            "      --subnet CIDR  container address pool (default " CONTAINER_SUBNET ")\n"
+            "      --net MODE     bridge (default): veths on the " BRIDGE_NAME " bridge\n"
+            "                     routed: a /32 route per container, no bridge\n"
+            "                     macvlan, ipvlan, ipvlan-l3: eth0 sits directly on a\n"
+            "                     host interface, no veth/NAT (--subnet is its network)\n"
+            "      --net-parent IF\n"
+            "                     host interface for macvlan/ipvlan (default: the uplink)\n"
+            "      --netns-pool K keep K network namespaces configured in advance\n"
+            "      --veth OPTS    veth pair tuning for bridge/routed, comma separated:\n"
+            "                     queues=N,mtu=N,gso_max_size=N,gro_max_size=N,gro\n"
+            "      --egress RATE  limit the container's outgoing traffic, e.g. 100mbit\n"
+            "      --ingress RATE limit its incoming traffic (both: bridge/routed only)\n"
+            "  -p, --publish H:C  forward host TCP port H to the container's port C\n"
+            "                     (repeatable, bridge/routed only)\n"
+            "      --publish-mode MODE\n"
+            "                     nat (default): nftables DNAT rules\n"
+            "                     proxy: a splice() proxy, also reaches 127.0.0.1\n"
+            "      --image DIR    image directory (default ./rootfs), or an EROFS or\n"
+            "                     squashfs image file (see mkimage)\n"
+            "      --overlay      run on a private overlay over a read-only image\n"
+            "      --tmpfs        keep the overlay's writable layer on tmpfs\n"
+            "      --dev MODE     host (default): a clone of the host's /dev\n"
+            "                     minimal: a tmpfs with null, zero, full, random,\n"
+            "                     urandom, tty, ptmx/pts, shm and the fd links\n"
+            "      --userns BASE[:COUNT]\n"
+            "                     run as root of a user namespace mapping ids\n"
+            "                     0..COUNT-1 (default 65536) to host BASE..; the\n"
+            "                     image is idmapped, not chowned, and read-only\n"
+            "                     unless --overlay gives it an upper layer\n"
+            "      --seccomp PROFILE\n"
+            "                     filter the container's syscalls: default (the\n"
+            "                     built-in profile), a profile file, or unconfined\n"
+            "                     (the default: no filter)\n"
+            "      --from NAME    run an imported image (implies --overlay)\n"
+            "      --zygote       fork from a template process with the image already\n"
+            "                     set up (plain images only)\n"
+            "      --memory SIZE  memory limit, e.g. 512M (cgroup memory.max)\n"
+            "      --cpus N       CPU limit, may be fractional (cgroup cpu.max)\n"
+            "      --pids N       process limit (cgroup pids.max)\n"
+            "      --io LIMIT     block IO limit in io.max syntax, e.g. \"8:0 wbps=1048576\"\n"
+            "      --stats        print the container's resource usage on exit\n"
+            "      --sync KIND    parent/child handshake: futex (default) or pipe\n",
+            prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog);
 }
 
-int main()
+int main(int argc, char *argv[])
 {
-    // Create sync pipe
-    int pipefd[2];
-    if (pipe(pipefd) < 0)
-    {
-        perror("pipe");
-        return 1;
-    }
+    static char *default_cmd[] = {"/bin/sh", NULL};
+    static char *bench_cmd[] = {"/bin/sh", "-c", "true", NULL};
 
-    void *stack = malloc(STACK_SIZE);
-    if (!stack)
-    {
-        perror("malloc");
-        return 1;
+    const char *prog = argv[0];
+    int bench = 0, bench_sync = 0, bench_net = 0, bench_veth = 0, bench_stats = 0,
+        bench_publish = 0, bench_seccomp = 0, create = 0;
+    if (argc > 1 && strcmp(argv[1], "daemon") == 0) {
+        return run_daemon(cd_socket_path());
+    } else if (argc > 1 && (strcmp(argv[1], "start") == 0 || strcmp(argv[1], "stop") == 0 ||
+                            strcmp(argv[1], "wait") == 0 || strcmp(argv[1], "list") == 0)) {
+        return client_command(argv[1], argc - 2, argv + 2);
+    } else if (argc > 1 && strcmp(argv[1], "shape") == 0) {
+        return client_shape(argc - 2, argv + 2);
+    } else if (argc > 1 && strcmp(argv[1], "stats") == 0) {
+        return client_stats(argc - 2, argv + 2);
+    } else if (argc > 1 && strcmp(argv[1], "create") == 0) {
+        create = 1;
+        argc--, argv++;
+    } else if (argc > 1 && strcmp(argv[1], "import") == 0) {
+        if (argc != 4) {
+            usage(prog);
+            return 1;
+        }
+        return image_import(argv[2], argv[3]) < 0 ? 1 : 0;
+    } else if (argc > 1 && strcmp(argv[1], "mkimage") == 0) {
+        if (argc != 4) {
+            usage(prog);
+            return 1;
+        }
+        return erofs_build(argv[2], argv[3]) < 0 ? 1 : 0;
+    } else if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        bench = 1;
+        argc--, argv++;
+        if (argc > 1 && strcmp(argv[1], "sync") == 0) {
+            bench_sync = 1;
+            argc--, argv++;
+        } else if (argc > 1 && strcmp(argv[1], "net") == 0) {
+            bench_net = 1;
+            argc--, argv++;
+        } else if (argc > 1 && strcmp(argv[1], "veth") == 0) {
+            bench_veth = 1;
+            argc--, argv++;
+        } else if (argc > 1 && strcmp(argv[1], "stats") == 0) {
+            bench_stats = 1;
+            argc--, argv++;
+        } else if (argc > 1 && strcmp(argv[1], "publish") == 0) {
+            bench_publish = 1;
+            argc--, argv++;
+        } else if (argc > 1 && strcmp(argv[1], "seccomp") == 0) {
+            bench_seccomp = 1;
+            argc--, argv++;
+        }
+    } else if (argc > 1 && strcmp(argv[1], "run") == 0) {
+        argc--, argv++;
     }
 
-    struct child_args args = {
-        .sync_pipe = pipefd[0] // child gets read end
+    struct container_config cfg = {
+        .argv = bench ? bench_cmd : default_cmd,
+        .network = 1,
     };
+    int show_timing = 0, concurrency = 1;
+    int count = bench_sync ? 100000 : bench_net ? 10000 : bench_veth ? 0 :
+                bench_stats ? 1000 : bench_publish ? 2000 : bench_seccomp ? 1000000 : bench ? 100 : 1;
 
-    pid_t child = clone(
-        child_func,
-        stack + STACK_SIZE,
-        CLONE_NEWPID | CLONE_NEWNET | CLONE_NEWNS | CLONE_NEWUTS | SIGCHLD,
-        &args);
+    static const struct option longopts[] = {
+        {"timing",      no_argument,       NULL, 't'},
+        {"count",       required_argument, NULL, 'n'},
+        {"concurrency", required_argument, NULL, 'c'},
+        {"no-net",      no_argument,       NULL, 'N'},
+        {"subnet",      required_argument, NULL, 'U'},
+        {"net",         required_argument, NULL, 'W'},
+        {"net-parent",  required_argument, NULL, 'L'},
+        {"netns-pool",  required_argument, NULL, 'K'},
+        {"veth",        required_argument, NULL, 'V'},
+        {"egress",      required_argument, NULL, 'E'},
+        {"ingress",     required_argument, NULL, 'G'},
+        {"publish",     required_argument, NULL, 'p'},
+        {"publish-mode", required_argument, NULL, 'R'},
+        {"image",       required_argument, NULL, 'I'},
+        {"overlay",     no_argument,       NULL, 'O'},
+        {"tmpfs",       no_argument,       NULL, 'T'},
+        {"dev",         required_argument, NULL, 'D'},
+        {"userns",      required_argument, NULL, 'u'},
+        {"seccomp",     required_argument, NULL, 'X'},
+        {"from",        required_argument, NULL, 'F'},
+        {"zygote",      no_argument,       NULL, 'Z'},
+        {"memory",      required_argument, NULL, 'M'},
+        {"cpus",        required_argument, NULL, 'C'},
+        {"pids",        required_argument, NULL, 'P'},
+        {"io",          required_argument, NULL, 'B'},
+        {"stats",       no_argument,       NULL, 'S'},
+        {"sync",        required_argument, NULL, 'Y'},
+        {"help",        no_argument,       NULL, 'h'},
+        {0}
+    };
 
-    if (child < 0)
-    {
-        perror("clone");
-        return 1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "+tn:c:hp:", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 't': show_timing = 1; break;
+        case 'n': count = atoi(optarg); break;
+        case 'c': concurrency = atoi(optarg); break;
+        case 'N': cfg.network = 0; break;
+        case 'U': cfg.subnet = optarg; break;
+        case 'W':
+            if (net_mode_parse(optarg) < 0) {
+                fprintf(stderr, "unknown --net mode: %s\n", optarg);
+                return 1;
+            }
+            cfg.net_mode = net_mode_parse(optarg);
+            break;
+        case 'L': cfg.net_parent = optarg; break;
+        case 'K': cfg.netns_pool = atoi(optarg); break;
+        case 'V':
+            if (veth_opts_parse(optarg, &cfg.veth) < 0)
+                return 1;
+            break;
+        case 'E':
+        case 'G':
+            if (tc_rate_parse(optarg, opt == 'E' ? &cfg.shape.egress : &cfg.shape.ingress) < 0) {
+                fprintf(stderr, "bad rate: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'p':
+            if (cfg.nports == PUBLISH_MAX || port_map_parse(optarg, &cfg.ports[cfg.nports]) < 0) {
+                fprintf(stderr, "bad or too many --publish: %s\n", optarg);
+                return 1;
+            }
+            cfg.nports++;
+            break;
+        case 'R':
+            if (publish_mode_parse(optarg) < 0) {
+                fprintf(stderr, "unknown --publish-mode: %s\n", optarg);
+                return 1;
+            }
+            cfg.publish_mode = publish_mode_parse(optarg);
+            break;
+        case 'I': cfg.rootfs.image = optarg; break;
+        case 'O': cfg.rootfs.overlay = 1; break;
+        case 'T': cfg.rootfs.overlay = cfg.rootfs.upper_tmpfs = 1; break;
+        case 'D':
+            if (rootfs_dev_parse(optarg) < 0) {
+                fprintf(stderr, "unknown --dev mode: %s\n", optarg);
+                return 1;
+            }
+            cfg.rootfs.dev = rootfs_dev_parse(optarg);
+            break;
+        case 'u':
+            if (userns_map_parse(optarg, &cfg.userns) < 0) {
+                fprintf(stderr, "bad --userns range: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'X':
+            // Compiled now, so a bad profile fails here and not per launch
+            cfg.seccomp = strcmp(optarg, "unconfined") == 0 ? NULL : optarg;
+            if (cfg.seccomp && !seccomp_get(cfg.seccomp))
+                return 1;
+            break;
+        case 'F': {
+            static char lower_stack[4096];
+            if (image_lower_stack(optarg, lower_stack, sizeof(lower_stack)) < 0) {
+                fprintf(stderr, "image %s not found, run '%s import' first\n", optarg, prog);
+                return 1;
+            }
+            cfg.rootfs.lower_stack = lower_stack;
+            cfg.rootfs.overlay = 1;
+            break;
+        }
+        case 'Z': cfg.zygote = 1; break;
+        case 'M': cfg.limits.memory_max = optarg; break;
+        case 'C': {
+            static char cpu_max[64];
+            if (cgroup_cpus(optarg, cpu_max, sizeof(cpu_max)) < 0) {
+                fprintf(stderr, "bad --cpus value: %s\n", optarg);
+                return 1;
+            }
+            cfg.limits.cpu_max = cpu_max;
+            break;
+        }
+        case 'P': cfg.limits.pids_max = optarg; break;
+        case 'B': cfg.limits.io_max = optarg; break;
+        case 'S': cfg.print_stats = 1; break;
+        case 'Y':
+            if (strcmp(optarg, "futex") == 0) {
+                cfg.sync = CD_SYNC_FUTEX;
+            } else if (strcmp(optarg, "pipe") == 0) {
+                cfg.sync = CD_SYNC_PIPE;
+            } else {
+                fprintf(stderr, "unknown --sync kind: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            usage(prog);
+            return opt == 'h' ? 0 : 1;
+        }
     }
 
-    close(pipefd[0]); // parent doesn't need read end
+    if (optind < argc)
+        cfg.argv = &argv[optind];
 
-    printf("[parent] Child PID = %d\n", child);
+    if (create)
+        return client_create(&cfg);
+    if (bench_sync)
+        return run_sync_bench(count);
+    if (bench_net)
+        return run_net_bench(&cfg, count);
+    if (bench_veth)
+        return run_veth_bench(&cfg, count);
+    if (bench_stats)
+        return run_stats_bench(count);
+    if (bench_publish)
+        return run_publish_bench(&cfg, count);
+    if (bench_seccomp)
+        return run_seccomp_bench(&cfg, count);
+    if (bench)
+        return run_bench(&cfg, count, concurrency);
 
-    // Set up networking from parent
-    if (setup_network(child) < 0)
-    {
-        fprintf(stderr, "[parent] Network setup failed\n");
-        // Continue anyway, container just won't have networking
+    if (count > 1) {
+        int *status = mmap(NULL, sizeof(int) * count, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (status == MAP_FAILED) {
+            perror("mmap");
+            return 1;
+        }
+        int failed = launch_pool(&cfg, count, concurrency, NULL, status);
+        if (failed)
+            fprintf(stderr, "%d of %d containers failed\n", failed, count);
+        munmap(status, sizeof(int) * count);
+        return failed ? 1 : 0;
     }
 
-    // Signal child to proceed
-    printf("[parent] Signaling child\n");
-    write(pipefd[1], "x", 1);
-    close(pipefd[1]);
-
-    // Wait for child to exit
-    waitpid(child, NULL, 0);
-
-    printf("[parent] Child exited, cleaning up\n");
-    // veth pair auto-deleted when child namespace dies
+    struct launch_timing *timing = timing_alloc(1);
+    int status = launch_container(&cfg, timing);
+    if (show_timing && timing)
+        timing_print(stderr, timing);
+    timing_free(timing, 1);
 
-    free(stack);
-    return 0;
-}
\ No newline at end of file
+    if (status < 0)
+        return 1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
@@ -1,3 +1,6 @@
+#ifndef CDOCKER_ROOTFS_H
+#define CDOCKER_ROOTFS_H
+
 #define _GNU_SOURCE
 #include <sched.h>
 #include <stdio.h>
@@ -6,10 +9,18 @@
 #include <sys/wait.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <string.h>
 #include <sys/syscall.h>
 #include <linux/limits.h>
 #include <errno.h>
+#include <endian.h>
+#include <sys/file.h>
+
+#include "utility/fs.h"
+#include "utility/loop.h"
+#include "utility/erofs.h"
+#include "utility/userns.h"
 
 
 /*
@@ -29,106 +40,579 @@ static int pivot_root_wrapper(const char *new_root, const char *put_old) {
     return syscall(SYS_pivot_root, new_root, put_old);
 }
 
-int setup_rootfs(void)
+// Where per-container state (overlay upper/work dirs) lives on the host
+#define CDOCKER_STATE_DIR "/run/cdocker"
+
+// What a container's /dev is
+enum rootfs_dev {
+    ROOTFS_DEV_HOST,            // a clone of the host's, every node and submount
+    ROOTFS_DEV_MINIMAL,         // a small tmpfs with just the standard nodes
+};
+
+struct rootfs_opts {
+    const char *image;          // image directory, "./rootfs" if NULL
+    enum rootfs_dev dev;
+    int overlay;                // mount the image read-only under an overlay
+    int upper_tmpfs;            // keep the overlay's writable layer in memory
+    const char *lower_stack;    // "top:...:bottom" layer dirs, replaces image
+    struct userns_map idmap;    // owners as this maps them, count 0: as on disk
+    char state_dir[PATH_MAX];   // per-container upper/work/merged (overlay only)
+};
+
+int rootfs_dev_parse(const char *name)
 {
+    if (strcmp(name, "host") == 0)
+        return ROOTFS_DEV_HOST;
+    if (strcmp(name, "minimal") == 0)
+        return ROOTFS_DEV_MINIMAL;
+    return -1;
+}
 
-    // Make all mounts private to avoid propagation issues with pivot_root
-    if (mount("", "/", "", MS_PRIVATE | MS_REC, "") != 0)
+// Parent, before clone: pick and create the per-container state dir
+int rootfs_prepare(struct rootfs_opts *opts, const char *id)
+{
+    if (!opts->overlay)
+        return 0;
+
+    snprintf(opts->state_dir, sizeof(opts->state_dir), "%s/%s", CDOCKER_STATE_DIR, id);
+    if (mkdir_p(opts->state_dir, 0700) != 0)
     {
-        perror("mount private");
-        return 1;
+        perror("mkdir state dir");
+        return -1;
     }
+    return 0;
+}
 
-    const char *new_root = "./rootfs";
-    char old_root[PATH_MAX];
+// Parent, after the container exited. Overlay and tmpfs mounts lived in the
+// child's mount namespace and are already gone; only the directories (and a
+// disk-backed upper layer) are left to remove.
+void rootfs_cleanup(const struct rootfs_opts *opts)
+{
+    if (!opts->overlay || !opts->state_dir[0])
+        return;
+    rm_rf(opts->state_dir);
+}
+
+/*
+ * The mount tree is built from detached mounts (the fd-based mount API,
+ * 5.2+): the root and /dev are cloned or created before the container's
+ * clone, off its critical path, and the child only attaches them with
+ * move_mount(). proc and sysfs belong to the PID and network namespaces
+ * of whoever creates them, so those two are the child's to make.
+ *
+ * The root goes in with pivot_root(".", "."), which stacks the old root
+ * on the new one until it's detached: no oldroot directory in the image.
+ */
 
-    // Ensure rootfs exists
-    if (mkdir(new_root, 0755) && errno != EEXIST)
+// Detached mounts for one container, -1 where not (yet) made
+struct rootfs_mounts {
+    int root;       // the container's /, with proc, sys and dev to mount on
+    int dev;        // its /dev: a clone of the host's, or a minimal tmpfs
+    int dev_sub[2]; // minimal /dev's pts and shm, when they couldn't be
+                    // mounted on it detached (before 6.15)
+};
+
+// Where dev_sub[] go, under the root
+static const char *const dev_sub_paths[2] = { "dev/pts", "dev/shm" };
+
+void rootfs_mounts_init(struct rootfs_mounts *m)
+{
+    m->root = m->dev = m->dev_sub[0] = m->dev_sub[1] = -1;
+}
+
+void rootfs_mounts_close(struct rootfs_mounts *m)
+{
+    int fds[] = { m->root, m->dev, m->dev_sub[0], m->dev_sub[1] };
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+        if (fds[i] >= 0)
+            close(fds[i]);
+    rootfs_mounts_init(m);
+}
+
+// A new, detached instance of a filesystem, with options ("key=value" or
+// a flag) from a NULL-terminated list, or none
+static int fs_instance(const char *type, const char *const *opts)
+{
+    int fs = fsopen(type, FSOPEN_CLOEXEC);
+    if (fs < 0)
+        return -1;
+
+    int mnt = -1, ok = 1;
+    for (; ok && opts && *opts; opts++)
     {
-        perror("mkdir rootfs");
-        return 1;
+        char key[64];
+        const char *eq = strchr(*opts, '=');
+        snprintf(key, sizeof(key), "%.*s", eq ? (int)(eq - *opts) : (int)strlen(*opts), *opts);
+        ok = fsconfig(fs, eq ? FSCONFIG_SET_STRING : FSCONFIG_SET_FLAG, key,
+                      eq ? eq + 1 : NULL, 0) == 0;
     }
+    if (ok && fsconfig(fs, FSCONFIG_CMD_CREATE, NULL, NULL, 0) == 0)
+        mnt = fsmount(fs, FSMOUNT_CLOEXEC, 0);
+    int err = errno;
+    close(fs);
+    errno = err;
+    return mnt;
+}
 
-    // bind mount rootfs onto itself so it's a mountapoint
-    // A mountpoint is a mounted directyroy, we have rounted this special fs, the root fs, onto itself
-    // this is imoprtant because we need this for pivot root syscall
-    if (mount(new_root, new_root, "bind", MS_BIND | MS_REC, "") != 0)
+// A detached clone of the tree at path, with none of its mounts
+// propagating anywhere (pivot_root refuses shared ones)
+static int tree_clone(const char *path)
+{
+    int mnt = open_tree(AT_FDCWD, path, OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_RECURSIVE);
+    struct mount_attr attr = { .propagation = MS_PRIVATE };
+    if (mnt >= 0 && mount_setattr(mnt, "", AT_EMPTY_PATH | AT_RECURSIVE, &attr, sizeof(attr)) != 0)
     {
-        perror("bind_mount rootfs");
-        return 1;
+        int err = errno;
+        close(mnt);
+        errno = err;
+        return -1;
     }
+    return mnt;
+}
+
+#define OVERLAY_IDMAP_MAX 128     // idmapped lower layers per overlay
 
-    // (3) Prepare the rootfs directory structure BEFORE pivot_root
-    snprintf(old_root, sizeof(old_root), "%s/%s", new_root, "oldroot");
-    if (mkdir(old_root, 0755) && errno != EEXIST)
+// Rewrite the ':'-separated lower dirs as idmapped clones of themselves,
+// reached through their fds (in fds[], for the caller to close once the
+// overlay exists). Returns how many, or -1.
+static int overlay_idmap_lowers(const char *lower, int userns, char *buf, size_t len, int *fds)
+{
+    int n = 0;
+    size_t off = 0;
+    buf[0] = '\0';
+    for (const char *p = lower; *p; n++)
     {
-        perror("mkdir oldroot");
-        return 1;
+        size_t dir_len = strcspn(p, ":");
+        char dir[PATH_MAX];
+        snprintf(dir, sizeof(dir), "%.*s", (int)dir_len, p);
+        p += dir_len + (p[dir_len] == ':');
+
+        int mnt = n < OVERLAY_IDMAP_MAX ? tree_clone(dir) : -1;
+        if (mnt < 0 || mount_idmap(mnt, userns) != 0)
+        {
+            fprintf(stderr, "idmap %s: %s\n", dir, n < OVERLAY_IDMAP_MAX ? strerror(errno)
+                                                                          : "too many layers");
+            if (mnt >= 0)
+                close(mnt);
+            goto fail;
+        }
+        fds[n] = mnt;
+        off += snprintf(buf + off, off < len ? len - off : 0, "%s/proc/self/fd/%d",
+                        n ? ":" : "", mnt);
+        if (off >= len)
+        {
+            n++;
+            fprintf(stderr, "idmap: lower dirs too long\n");
+            goto fail;
+        }
     }
+    return n;
 
-    // Create mount point directories in rootfs before pivot
-    char path[PATH_MAX];
-    snprintf(path, sizeof(path), "%s/proc", new_root);
-    mkdir(path, 0555);
+fail:
+    while (n--)
+        close(fds[n]);
+    return -1;
+}
 
-    snprintf(path, sizeof(path), "%s/sys", new_root);
-    mkdir(path, 0755);
+// A detached overlay of <image> as the read-only lower layer, with this
+// container's upper/work dirs on top. userns >= 0 idmaps the lower layers
+// through it and hands the upper layer's root to its root.
+static int overlay_instance(const struct rootfs_opts *opts, const char *image, int userns)
+{
+    // The writable layer is either in the state dir or on a tmpfs of its
+    // own, reached through its fd as it isn't mounted anywhere
+    char base[PATH_MAX];
+    int upper_fs = -1;
+    snprintf(base, sizeof(base), "%s", opts->state_dir);
+    if (opts->upper_tmpfs)
+    {
+        static const char *const upper_opts[] = { "mode=0700", NULL };
+        upper_fs = fs_instance("tmpfs", upper_opts);
+        if (upper_fs < 0)
+        {
+            perror("tmpfs upper");
+            return -1;
+        }
+        snprintf(base, sizeof(base), "/proc/self/fd/%d", upper_fs);
+    }
 
-    snprintf(path, sizeof(path), "%s/dev", new_root);
-    mkdir(path, 0755);
+    int mnt = -1, fs = -1, nidmap = 0;
+    int idmap_fds[OVERLAY_IDMAP_MAX];
+    char upper[PATH_MAX + 8], work[PATH_MAX + 8];
+    snprintf(upper, sizeof(upper), "%s/upper", base);
+    snprintf(work, sizeof(work), "%s/work", base);
+    if ((mkdir(upper, 0755) && errno != EEXIST) || (mkdir(work, 0755) && errno != EEXIST))
+    {
+        perror("mkdir overlay dirs");
+        goto out;
+    }
 
-    // (4) pivot root (new root, old root) now we can pivot to a new pointpoint root
-    if (pivot_root_wrapper(new_root, old_root) != 0)
+    // Either a stack of store layers or the single image directory
+    char lower_buf[PATH_MAX];
+    const char *lower = opts->lower_stack;
+    if (!lower)
     {
-        perror("pivot root failed");
-        return 1;
+        if (!realpath(image, lower_buf))
+        {
+            perror("realpath image");
+            goto out;
+        }
+        lower = lower_buf;
     }
 
-    // Change the dir to our new /
-    if (chdir("/") != 0)
+    // The container's files are created with its ids as they are, so the
+    // upper layer isn't idmapped; only its root has to be the container's
+    char idmap_lower[PATH_MAX];
+    if (userns >= 0)
     {
-        perror("chdir / ");
-        return 1;
+        nidmap = overlay_idmap_lowers(lower, userns, idmap_lower, sizeof(idmap_lower), idmap_fds);
+        if (nidmap < 0)
+        {
+            nidmap = 0;
+            goto out;
+        }
+        if (chown(upper, opts->idmap.base, opts->idmap.base) != 0)
+        {
+            perror("chown overlay upper");
+            goto out;
+        }
+        lower = idmap_lower;
+    }
+
+    fs = fsopen("overlay", FSOPEN_CLOEXEC);
+    if (fs < 0 || fsconfig(fs, FSCONFIG_SET_STRING, "lowerdir", lower, 0) != 0 ||
+        fsconfig(fs, FSCONFIG_SET_STRING, "upperdir", upper, 0) != 0 ||
+        fsconfig(fs, FSCONFIG_SET_STRING, "workdir", work, 0) != 0)
+    {
+        perror("overlay options");
+        goto out;
     }
 
-    // ------ mounting stuff (BEFORE unmounting oldroot) -------
-    // Directories were already created before pivot_root
+    // The upper layer is thrown away with the container, so there's no
+    // point paying for syncs on a disk-backed one. Kernels before 5.10
+    // refuse "volatile"; they just go without.
+    if (!opts->upper_tmpfs)
+        fsconfig(fs, FSCONFIG_SET_FLAG, "volatile", NULL, 0);
+
+    if (fsconfig(fs, FSCONFIG_CMD_CREATE, NULL, NULL, 0) != 0 ||
+        (mnt = fsmount(fs, FSMOUNT_CLOEXEC, 0)) < 0)
+        perror("mount overlay");
+
+out:
+    while (nidmap--)
+        close(idmap_fds[nidmap]);
+    if (fs >= 0)
+        close(fs);
+    if (upper_fs >= 0)
+        close(upper_fs);
+    return mnt;
+}
+
+// A minimal /dev: the usual character devices, the /proc/self/fd links,
+// a devpts instance of its own with ptmx pointing into it, and a tmpfs
+// for shm. A handful of inodes however big the host's /dev is.
+static const struct {
+    const char *name;
+    unsigned int major, minor;
+} dev_nodes[] = {
+    { "null", 1, 3 }, { "zero", 1, 5 }, { "full", 1, 7 },
+    { "random", 1, 8 }, { "urandom", 1, 9 }, { "tty", 5, 0 },
+};
+
+static const struct {
+    const char *name, *target;
+} dev_links[] = {
+    { "fd", "/proc/self/fd" }, { "stdin", "/proc/self/fd/0" },
+    { "stdout", "/proc/self/fd/1" }, { "stderr", "/proc/self/fd/2" },
+    { "ptmx", "pts/ptmx" },
+};
+
+// Owned by the container's root, and its tty group, if it has a user
+// namespace
+static void dev_owner_opts(const struct userns_map *idmap, char uid[32], char gid[32],
+                           char tty_gid[32])
+{
+    snprintf(uid, 32, "uid=%u", idmap->count ? idmap->base : 0);
+    snprintf(gid, 32, "gid=%u", idmap->count ? idmap->base : 0);
+    snprintf(tty_gid, 32, "gid=%u", idmap->count ? idmap->base + (idmap->count > 5 ? 5 : 0) : 5);
+}
+
+// A new devpts (i = 0) or shm tmpfs (i = 1) for dev_sub_paths[i]
+static int dev_sub_instance(int i, const struct userns_map *idmap)
+{
+    char uid[32], gid[32], tty_gid[32];
+    dev_owner_opts(idmap, uid, gid, tty_gid);
+    const char *const pts_opts[] = {
+        "newinstance", "ptmxmode=0666", "mode=0620", tty_gid, NULL
+    };
+    const char *const shm_opts[] = { "mode=1777", "size=64m", uid, gid, NULL };
+    return i == 0 ? fs_instance("devpts", pts_opts) : fs_instance("tmpfs", shm_opts);
+}
+
+static int dev_minimal(const struct userns_map *idmap, struct rootfs_mounts *m)
+{
+    char uid[32], gid[32], tty_gid[32];
+    dev_owner_opts(idmap, uid, gid, tty_gid);
+    const char *const dev_opts[] = { "mode=0755", "size=64k", uid, gid, NULL };
+
+    int dev = fs_instance("tmpfs", dev_opts);
+    if (dev < 0)
+        return -1;
 
-    // Mount /dev from the old root (host) while we still have access to it
-    if (mount("/oldroot/dev", "/dev", "", MS_BIND | MS_REC, "") != 0)
+    // Modes exactly as given
+    mode_t umask_was = umask(0);
+    int ok = 1;
+    for (size_t i = 0; ok && i < sizeof(dev_nodes) / sizeof(dev_nodes[0]); i++)
+        ok = mknodat(dev, dev_nodes[i].name, S_IFCHR | 0666,
+                     makedev(dev_nodes[i].major, dev_nodes[i].minor)) == 0;
+    for (size_t i = 0; ok && i < sizeof(dev_links) / sizeof(dev_links[0]); i++)
+        ok = symlinkat(dev_links[i].target, dev, dev_links[i].name) == 0;
+    ok = ok && mkdirat(dev, "pts", 0755) == 0 && mkdirat(dev, "shm", 01777) == 0;
+    umask(umask_was);
+    if (!ok)
     {
-        perror("mount /dev failed");
-        // Continue - not critical for basic functionality
+        close(dev);
+        return -1;
     }
 
-    // (5) mount /proc to new root
-    if (mount("proc", "/proc", "proc", 0, "") != 0)
+    // Onto the detached tmpfs if the kernel lets us, else the child
+    // mounts them once /dev is in place
+    int sub[2] = { dev_sub_instance(0, idmap), dev_sub_instance(1, idmap) };
+    for (int i = 0; i < 2; i++)
     {
-        perror("mount /proc failed");
-        return 1;
+        if (sub[i] < 0)
+            perror(dev_sub_paths[i]);   // Continue - /dev works without
+        else if (move_mount(sub[i], "", dev, dev_sub_paths[i] + 4, MOVE_MOUNT_F_EMPTY_PATH) == 0)
+            close(sub[i]);
+        else
+            m->dev_sub[i] = sub[i];
     }
+    return dev;
+}
 
-    // Mount /sys filesystem
-    if (mount("sysfs", "/sys", "sysfs", 0, "") != 0)
+// For a process already inside a minimal /dev that isn't its own (a
+// zygote's child): its own ptys and shared memory, in place of the copies
+// of the zygote's
+int rootfs_dev_renew(void)
+{
+    static const struct userns_map none;
+    for (int i = 0; i < 2; i++)
     {
-        perror("mount /sys failed");
-        return 1;
+        char path[16];
+        snprintf(path, sizeof(path), "/%s", dev_sub_paths[i]);
+        int fd = dev_sub_instance(i, &none);
+        if (fd < 0)
+            return -1;
+        umount2(path, MNT_DETACH);      // not there if dev_minimal couldn't
+        int ret = move_mount(fd, "", AT_FDCWD, path, MOVE_MOUNT_F_EMPTY_PATH);
+        close(fd);
+        if (ret != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Image files: an EROFS ("cdocker mkimage") or squashfs image instead of
+ * a directory. Each is mounted read-only once, through a loop device, at
+ * ROOTFS_IMAGE_DIR/<dev>-<inode>-<mtime> of the file; every container
+ * running it is a clone of that mount or an overlay over it, so they all
+ * share one superblock and one page cache. The mount stays for the next
+ * launch, and a rebuilt image gets a new one.
+ */
+
+#define ROOTFS_IMAGE_DIR CDOCKER_STATE_DIR "/images"
+
+static const char *image_fstype(int fd)
+{
+    uint32_t magic;
+    if (pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) && memcmp(&magic, "hsqs", 4) == 0)
+        return "squashfs";
+    if (pread(fd, &magic, sizeof(magic), EROFS_SUPER_OFFSET) == sizeof(magic) &&
+        le32toh(magic) == EROFS_MAGIC)
+        return "erofs";
+    return NULL;
+}
+
+// dir has something mounted on it
+static int image_mounted(const char *dir)
+{
+    struct stat st, parent;
+    return stat(dir, &st) == 0 && stat(ROOTFS_IMAGE_DIR, &parent) == 0 &&
+           st.st_dev != parent.st_dev;
+}
+
+// Where the image file is mounted, mounting it first if need be
+int rootfs_image_mount(const char *file, char *dir, size_t len)
+{
+    struct stat st;
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror(file);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    snprintf(dir, len, ROOTFS_IMAGE_DIR "/%lx-%lx-%lx", (unsigned long)st.st_dev,
+             (unsigned long)st.st_ino, (unsigned long)st.st_mtime);
+
+    // One mount per image however many launch at once: the lock goes
+    // with the fd
+    int ret = 0;
+    if (!image_mounted(dir) && flock(fd, LOCK_EX) == 0 && !image_mounted(dir))
+    {
+        ret = -1;
+        const char *type = image_fstype(fd);
+        char dev[32], source[40];
+        int loop = -1, mnt = -1;
+        if (!type)
+            fprintf(stderr, "%s: not an EROFS or squashfs image\n", file);
+        else if (mkdir_p(dir, 0755) != 0)
+            perror("mkdir image dir");
+        else if ((loop = loop_attach(fd, dev, sizeof(dev))) >= 0)
+        {
+            snprintf(source, sizeof(source), "source=%s", dev);
+            const char *const opts[] = { source, "ro", NULL };
+            mnt = fs_instance(type, opts);
+            if (mnt < 0 || move_mount(mnt, "", AT_FDCWD, dir, MOVE_MOUNT_F_EMPTY_PATH) != 0)
+                fprintf(stderr, "mount %s (%s): %s\n", file, type, strerror(errno));
+            else
+                ret = 0;
+        }
+        if (mnt >= 0)
+            close(mnt);
+        if (loop >= 0)
+            close(loop);
+    }
+    close(fd);
+    return ret;
+}
+
+// Make the root and /dev for a container, detached. Runs before the clone;
+// the overlay's state dir must exist (rootfs_prepare()).
+int rootfs_mounts_prepare(const struct rootfs_opts *opts, struct rootfs_mounts *m)
+{
+    const char *image = opts->image ? opts->image : "./rootfs";
+    char image_dir[PATH_MAX];
+    struct stat st;
+
+    rootfs_mounts_init(m);
+    if (stat(image, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        if (rootfs_image_mount(image, image_dir, sizeof(image_dir)) < 0)
+            return -1;
+        image = image_dir;
     }
+    int userns = opts->idmap.count ? userns_get(&opts->idmap) : -1;
+    if (opts->idmap.count && userns < 0)
+        return -1;
 
-    // unmount oldroot and remove it now (after we've grabbed what we need from it)
-    if (umount2("/oldroot", MNT_DETACH) != 0)
+    m->root = opts->overlay ? overlay_instance(opts, image, userns) : tree_clone(image);
+    if (m->root < 0)
     {
-        perror("umount2 /oldroot");
-        // Continue anyway - may already be unmounted
+        if (!opts->overlay)
+            perror("clone rootfs");
+        return -1;
     }
 
-    if (rmdir("/oldroot") != 0)
+    // Mount points, in the image the first time (or the upper layer)
+    if ((mkdirat(m->root, "proc", 0555) && errno != EEXIST) ||
+        (mkdirat(m->root, "sys", 0755) && errno != EEXIST) ||
+        (mkdirat(m->root, "dev", 0755) && errno != EEXIST))
     {
-        perror("rmdir /oldroot");
-        // Continue anyway - directory removal is not critical
+        perror("mkdir mount points");
+        rootfs_mounts_close(m);
+        return -1;
     }
 
-    printf("✅ Mounted RootFs\n");
+    // After those: through the idmap, our ids have no owner to create as.
+    // Read-only without an overlay; the image is the host's files.
+    if (!opts->overlay && userns >= 0 && mount_idmap(m->root, userns) != 0)
+    {
+        perror("idmap rootfs");
+        rootfs_mounts_close(m);
+        return -1;
+    }
 
+    // Without it the container just has an empty /dev
+    m->dev = opts->dev == ROOTFS_DEV_MINIMAL ? dev_minimal(&opts->idmap, m)
+                                              : tree_clone("/dev");
+    if (m->dev < 0)
+        perror(opts->dev == ROOTFS_DEV_MINIMAL ? "minimal /dev" : "clone /dev");
     return 0;
-}
\ No newline at end of file
+}
+
+// Child: attach the container's mounts and make its root the root. Uses
+// (and closes) the mounts prepared ahead, or makes them now if there are
+// none.
+int setup_rootfs(const struct rootfs_opts *opts, struct rootfs_mounts *m)
+{
+    if (m->root < 0 && rootfs_mounts_prepare(opts, m) != 0)
+        return 1;
+
+    int ret = 1;
+
+    // Private, so pivot_root() agrees and nothing below shows up on the host
+    if (mount("", "/", "", MS_PRIVATE | MS_REC, "") != 0)
+    {
+        perror("mount private");
+        goto out;
+    }
+
+    // The root tree has to be attached somewhere to become the root; on
+    // top of the old one is as good a place as any
+    if (move_mount(m->root, "", AT_FDCWD, "/", MOVE_MOUNT_F_EMPTY_PATH) != 0)
+    {
+        perror("attach rootfs");
+        goto out;
+    }
+
+    if (m->dev >= 0 && move_mount(m->dev, "", m->root, "dev", MOVE_MOUNT_F_EMPTY_PATH) != 0)
+        perror("mount /dev failed");    // Continue - not critical
+    for (int i = 0; i < 2; i++)
+        if (m->dev_sub[i] >= 0 &&
+            move_mount(m->dev_sub[i], "", m->root, dev_sub_paths[i], MOVE_MOUNT_F_EMPTY_PATH) != 0)
+            perror(dev_sub_paths[i]);
+
+    int proc = fs_instance("proc", NULL);
+    if (proc < 0 || move_mount(proc, "", m->root, "proc", MOVE_MOUNT_F_EMPTY_PATH) != 0)
+    {
+        perror("mount /proc failed");
+        if (proc >= 0)
+            close(proc);
+        goto out;
+    }
+    close(proc);
+
+    int sys = fs_instance("sysfs", NULL);
+    if (sys < 0 || move_mount(sys, "", m->root, "sys", MOVE_MOUNT_F_EMPTY_PATH) != 0)
+    {
+        perror("mount /sys failed");
+        if (sys >= 0)
+            close(sys);
+        goto out;
+    }
+    close(sys);
+
+    // The old root ends up stacked under "." and is detached from there
+    if (fchdir(m->root) != 0 || pivot_root_wrapper(".", ".") != 0)
+    {
+        perror("pivot root failed");
+        goto out;
+    }
+    if (umount2(".", MNT_DETACH) != 0)
+        perror("umount2 old root");     // Continue anyway
+    if (chdir("/") != 0)
+    {
+        perror("chdir / ");
+        goto out;
+    }
+    ret = 0;
+
+out:
+    rootfs_mounts_close(m);
+    return ret;
+}
+
+#endif // CDOCKER_ROOTFS_H
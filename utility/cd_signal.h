@@ -1,17 +1,37 @@
+#ifndef CDOCKER_CD_SIGNAL_H
+#define CDOCKER_CD_SIGNAL_H
+
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
 
+/*
+ * ============================================================
+ * PART 1: CD_SIGNAL, A ONE-SHOT PIPE
+ * ============================================================
+ */
 
 struct cd_signal {
-    int read_fd; 
-    int write_fd; 
+    int read_fd;
+    int write_fd;
 };
 
 int cd_signal_init(struct cd_signal *sig)
 {
     int pipefd[2];
 
-    if (pipe(pipefd) < 0) {
+    if (pipe2(pipefd, O_CLOEXEC) < 0) {
         perror("pipe");
         return -1;
     }
@@ -22,42 +42,336 @@ int cd_signal_init(struct cd_signal *sig)
     return 0;
 }
 
+// Block until the other side writes. Returns 0, or -1 on error or if every
+// write end was closed without a write (the writer died).
 int cd_signal_wait(struct cd_signal *sig)
 {
-    // read one character to unblock 
-    char buf; 
-    int n = read(sig->read_fd, &buf, 1);
+    // read one character to unblock
+    char buf;
+    ssize_t n;
+    do {
+        n = read(sig->read_fd, &buf, 1);
+    } while (n < 0 && errno == EINTR);
+
     if (n < 0) {
         perror("read");
         return -1;
     }
-    return 0;
+    return n == 1 ? 0 : -1;
 }
 
 int cd_signal_write(struct cd_signal *sig)
 {
-    // read one character to unblock 
+    // write one character to unblock the reader
     char buf = '\0';
-    int n = write(sig->read_fd, &buf, 1);
-    if (n < 0) {
+    if (write(sig->write_fd, &buf, 1) != 1) {
         perror("write");
         return -1;
     }
     return 0;
 }
 
+static void cd_signal_close_fd(int *fd)
+{
+    if (*fd >= 0)
+        close(*fd);
+    *fd = -1;
+}
 
 int cd_signal_close(struct cd_signal *sig)
 {
-    close(sig->read_fd);
-    close(sig->write_fd);
+    int ret = 0;
+    if (sig->read_fd >= 0 && close(sig->read_fd) < 0)
+        ret = -1;
+    if (sig->write_fd >= 0 && close(sig->write_fd) < 0)
+        ret = -1;
+    sig->read_fd = sig->write_fd = -1;
+    return ret;
 }
 
+/*
+ * ============================================================
+ * PART 2: CD_SYNC, THE PARENT/CHILD HANDSHAKE
+ *
+ * A shared page, created before clone(), that both sides keep mapped.
+ * Each side publishes how far it has got as a phase counter; the other
+ * side spins briefly on that counter, then sleeps on it with a futex, so
+ * a handoff is at most one FUTEX_WAKE, and no syscall at all if the
+ * waiter is still spinning. The same page carries timestamps per phase, and, if the
+ * child fails before exec, what failed and its errno.
+ *
+ * CD_SYNC_PIPE keeps the same page but wakes through a pipe per
+ * direction instead, to have the old handshake to compare against.
+ *
+ * Not a FUTEX_PRIVATE_FLAG futex: after clone() without CLONE_VM the two
+ * sides are separate address spaces sharing the page. When the child
+ * isn't cloned by us (the zygote's), the page is a memfd instead, which
+ * the child maps with cd_sync_attach().
+ * ============================================================
+ */
+
+enum cd_sync_kind {
+    CD_SYNC_FUTEX,
+    CD_SYNC_PIPE,
+};
+
+enum cd_sync_side {
+    CD_SYNC_PARENT,
+    CD_SYNC_CHILD,
+};
 
-// cd_sync_init()
-// cd_sync_child_wait()
-// cd_sync_parent_notify()
-// cd_sync_close()
+#define CD_SYNC_PHASES  8
+#define CD_SYNC_FAILED  UINT32_MAX  // phase posted by cd_sync_fail()
 
+struct cd_sync_page {
+    uint32_t phase[2];                      // per side, only ever grows
+    uint32_t waiters[2];                    // asleep on phase[side]
+    uint64_t ts[2][CD_SYNC_PHASES];         // CLOCK_MONOTONIC ns at each post
+    int error;                              // errno reported by cd_sync_fail
+    char what[64];                          // and what failed
+};
 
+struct cd_sync {
+    enum cd_sync_kind kind;
+    struct cd_sync_page *page;
+    struct cd_signal pipe[2];               // CD_SYNC_PIPE: wakes for each side
+    enum cd_sync_side side;                 // which end this copy is
+    int peer_pidfd;                         // parent: notices a dead child
+    int page_fd;                            // cd_sync_init_memfd: the page's memfd
+};
+
+// Spins before sleeping: enough to catch a peer running on another CPU
+// that's about to post, far less than a launch phase costs anyway. On a
+// single CPU the peer can't run while we spin, so don't.
+#define CD_SYNC_SPIN 1000
+
+static int cd_sync_spin_limit(void)
+{
+    static int limit = -1;
+    if (limit < 0)
+        limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? CD_SYNC_SPIN : 0;
+    return limit;
+}
+
+static inline void cd_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield" ::: "memory");
+#else
+    __asm__ volatile("" ::: "memory");
+#endif
+}
+
+static long cd_futex(uint32_t *addr, int op, uint32_t val, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+static uint64_t cd_sync_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int cd_sync_init(struct cd_sync *s, enum cd_sync_kind kind)
+{
+    memset(s, 0, sizeof(*s));
+    s->kind = kind;
+    s->peer_pidfd = -1;
+    s->page_fd = -1;
+    s->pipe[0].read_fd = s->pipe[0].write_fd = -1;
+    s->pipe[1].read_fd = s->pipe[1].write_fd = -1;
+
+    s->page = mmap(NULL, sizeof(*s->page), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (s->page == MAP_FAILED) {
+        perror("mmap sync page");
+        s->page = NULL;
+        return -1;
+    }
+
+    if (kind == CD_SYNC_PIPE &&
+        (cd_signal_init(&s->pipe[0]) < 0 || cd_signal_init(&s->pipe[1]) < 0)) {
+        cd_signal_close(&s->pipe[0]);
+        munmap(s->page, sizeof(*s->page));
+        s->page = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Futex kind on a memfd-backed page, for a child started by some other
+// process: pass s->page_fd along and cd_sync_attach() to it there
+int cd_sync_init_memfd(struct cd_sync *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->kind = CD_SYNC_FUTEX;
+    s->peer_pidfd = -1;
+    s->pipe[0].read_fd = s->pipe[0].write_fd = -1;
+    s->pipe[1].read_fd = s->pipe[1].write_fd = -1;
+
+    s->page_fd = memfd_create("cd_sync", MFD_CLOEXEC);
+    if (s->page_fd < 0 || ftruncate(s->page_fd, sizeof(*s->page)) != 0) {
+        perror("memfd sync page");
+        if (s->page_fd >= 0)
+            close(s->page_fd);
+        s->page_fd = -1;
+        return -1;
+    }
+
+    s->page = mmap(NULL, sizeof(*s->page), PROT_READ | PROT_WRITE, MAP_SHARED, s->page_fd, 0);
+    if (s->page == MAP_FAILED) {
+        perror("mmap sync page");
+        close(s->page_fd);
+        s->page_fd = -1;
+        s->page = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Map the page behind a cd_sync_init_memfd() memfd; fd stays the caller's
+int cd_sync_attach(struct cd_sync *s, int fd)
+{
+    memset(s, 0, sizeof(*s));
+    s->kind = CD_SYNC_FUTEX;
+    s->peer_pidfd = -1;
+    s->page_fd = -1;
+    s->pipe[0].read_fd = s->pipe[0].write_fd = -1;
+    s->pipe[1].read_fd = s->pipe[1].write_fd = -1;
+
+    s->page = mmap(NULL, sizeof(*s->page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (s->page == MAP_FAILED) {
+        s->page = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// After clone: each side says which end it is and drops the pipe ends it
+// doesn't use, so a side that dies shows up as EOF. The parent also hands
+// over the child's pidfd for the same purpose in futex mode.
+void cd_sync_parent(struct cd_sync *s, int child_pidfd)
+{
+    s->side = CD_SYNC_PARENT;
+    s->peer_pidfd = child_pidfd;
+    cd_signal_close_fd(&s->pipe[CD_SYNC_PARENT].read_fd);
+    cd_signal_close_fd(&s->pipe[CD_SYNC_CHILD].write_fd);
+}
+
+void cd_sync_child(struct cd_sync *s)
+{
+    s->side = CD_SYNC_CHILD;
+    s->peer_pidfd = -1;
+    cd_signal_close_fd(&s->pipe[CD_SYNC_CHILD].read_fd);
+    cd_signal_close_fd(&s->pipe[CD_SYNC_PARENT].write_fd);
+}
+
+static void cd_sync_publish(struct cd_sync *s, uint32_t phase)
+{
+    if (phase < CD_SYNC_PHASES)
+        s->page->ts[s->side][phase] = cd_sync_now();
+    __atomic_store_n(&s->page->phase[s->side], phase, __ATOMIC_SEQ_CST);
+
+    if (s->kind == CD_SYNC_PIPE)
+        cd_signal_write(&s->pipe[s->side]);
+    else if (__atomic_load_n(&s->page->waiters[s->side], __ATOMIC_SEQ_CST))
+        cd_futex(&s->page->phase[s->side], FUTEX_WAKE, INT_MAX, NULL);
+}
+
+// Tell the other side we've reached phase (1 .. CD_SYNC_PHASES-1)
+void cd_sync_post(struct cd_sync *s, uint32_t phase)
+{
+    cd_sync_publish(s, phase);
+}
+
+// Child: report a failure before exec and wake the parent if it waits.
+// err is an errno value; what names the step, e.g. "execv".
+void cd_sync_fail(struct cd_sync *s, const char *what, int err)
+{
+    s->page->error = err;
+    snprintf(s->page->what, sizeof(s->page->what), "%s", what);
+    cd_sync_publish(s, CD_SYNC_FAILED);
+}
+
+// Has the other side failed? Never blocks.
+int cd_sync_failed(const struct cd_sync *s)
+{
+    enum cd_sync_side peer = s->side == CD_SYNC_PARENT ? CD_SYNC_CHILD : CD_SYNC_PARENT;
+    return __atomic_load_n(&s->page->phase[peer], __ATOMIC_ACQUIRE) == CD_SYNC_FAILED;
+}
+
+static int cd_sync_peer_dead(const struct cd_sync *s)
+{
+    struct pollfd pfd = { .fd = s->peer_pidfd, .events = POLLIN };
+    return s->peer_pidfd >= 0 && poll(&pfd, 1, 0) == 1;
+}
+
+// Wait for the other side to reach phase. Returns 0, or -1 if it failed
+// or died first (errno is then the reported error, or ESRCH).
+int cd_sync_wait(struct cd_sync *s, uint32_t phase)
+{
+    enum cd_sync_side peer = s->side == CD_SYNC_PARENT ? CD_SYNC_CHILD : CD_SYNC_PARENT;
+    uint32_t *word = &s->page->phase[peer];
+
+    for (;;) {
+        uint32_t cur = __atomic_load_n(word, __ATOMIC_ACQUIRE);
+        if (cur == CD_SYNC_FAILED) {
+            errno = s->page->error;
+            return -1;
+        }
+        if (cur >= phase)
+            return 0;
+
+        if (s->kind == CD_SYNC_PIPE) {
+            if (cd_signal_wait(&s->pipe[peer]) < 0) {
+                errno = ESRCH;
+                return -1;
+            }
+            continue;
+        }
+
+        int spin = 0, limit = cd_sync_spin_limit();
+        while (spin < limit && __atomic_load_n(word, __ATOMIC_ACQUIRE) == cur) {
+            cd_cpu_relax();
+            spin++;
+        }
+        if (spin < limit)
+            continue;
+
+        // The child can't post after a crash, so the parent looks at its
+        // pidfd every so often; the child side is covered by PDEATHSIG
+        struct timespec timeout = { .tv_nsec = 50 * 1000000 };
+        __atomic_fetch_add(&s->page->waiters[peer], 1, __ATOMIC_SEQ_CST);
+        long r = 0;
+        if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == cur)
+            r = cd_futex(word, FUTEX_WAIT, cur, s->peer_pidfd >= 0 ? &timeout : NULL);
+        __atomic_fetch_sub(&s->page->waiters[peer], 1, __ATOMIC_SEQ_CST);
+        if (r < 0 && errno == ETIMEDOUT && cd_sync_peer_dead(s) &&
+            __atomic_load_n(word, __ATOMIC_ACQUIRE) < phase) {
+            errno = ESRCH;
+            return -1;
+        }
+    }
+}
+
+// Timestamp of a side's post of phase, 0 if it never got there
+uint64_t cd_sync_ts(const struct cd_sync *s, enum cd_sync_side side, uint32_t phase)
+{
+    return phase < CD_SYNC_PHASES ? s->page->ts[side][phase] : 0;
+}
+
+void cd_sync_close(struct cd_sync *s)
+{
+    cd_signal_close(&s->pipe[0]);
+    cd_signal_close(&s->pipe[1]);
+    cd_signal_close_fd(&s->page_fd);
+    if (s->page)
+        munmap(s->page, sizeof(*s->page));
+    s->page = NULL;
+}
 
+#endif // CDOCKER_CD_SIGNAL_H
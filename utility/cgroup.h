@@ -0,0 +1,363 @@
+#ifndef CDOCKER_CGROUP_H
+#define CDOCKER_CGROUP_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <linux/limits.h>
+#include <linux/magic.h>
+
+#include "fs.h"
+
+/*
+ * ============================================================
+ * PART 1: PER-CONTAINER CGROUPS (v2)
+ *
+ * Every container gets <cgroup2 root>/cdocker/<id>. The directory fd is
+ * handed to clone3(CLONE_INTO_CGROUP), so the child is born inside its
+ * limits instead of being moved there after it has started running.
+ * ============================================================
+ */
+
+#define CDOCKER_CGROUP "cdocker"
+
+// Limits in the kernel's own syntax; NULL leaves the default ("max")
+struct cgroup_limits {
+    const char *memory_max;     // memory.max, e.g. "512M"
+    const char *cpu_max;        // cpu.max, "$QUOTA $PERIOD" (see cgroup_cpus)
+    const char *io_max;         // io.max, e.g. "8:0 rbps=1048576 wbps=1048576"
+    const char *pids_max;       // pids.max
+};
+
+struct cgroup {
+    int dirfd;                  // O_DIRECTORY fd, for CLONE_INTO_CGROUP
+    char path[PATH_MAX + 64];
+    // Stats files stay open so sampling is one pread() each, no path walk
+    int memory_current_fd;
+    int cpu_stat_fd;
+    int io_stat_fd;
+};
+
+struct cgroup_stats {
+    uint64_t memory_current;    // bytes
+    uint64_t cpu_usage_usec;
+    uint64_t cpu_user_usec;
+    uint64_t cpu_system_usec;
+    uint64_t io_rbytes;         // summed over all devices
+    uint64_t io_wbytes;
+    uint64_t io_rios;
+    uint64_t io_wios;
+};
+
+static int cgroup_limits_set(const struct cgroup_limits *l)
+{
+    return l && (l->memory_max || l->cpu_max || l->io_max || l->pids_max);
+}
+
+// Convert a CPU count ("1.5") into cpu.max syntax ("150000 100000")
+int cgroup_cpus(const char *cpus, char *out, size_t len)
+{
+    char *end;
+    double n = strtod(cpus, &end);
+    if (end == cpus || *end || n <= 0)
+        return -1;
+
+    const long period = 100000;
+    snprintf(out, len, "%ld %ld", (long)(n * period + 0.5), period);
+    return 0;
+}
+
+// /sys/fs/cgroup on unified hosts, /sys/fs/cgroup/unified on hybrid ones
+static const char *cgroup2_root(void)
+{
+    static const char *roots[] = { "/sys/fs/cgroup", "/sys/fs/cgroup/unified" };
+    struct statfs sfs;
+
+    for (size_t i = 0; i < sizeof(roots) / sizeof(roots[0]); i++)
+        if (statfs(roots[i], &sfs) == 0 && sfs.f_type == CGROUP2_SUPER_MAGIC)
+            return roots[i];
+    return NULL;
+}
+
+static int cgroup_write(int dirfd, const char *file, const char *value)
+{
+    int fd = openat(dirfd, file, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    ssize_t n = write(fd, value, strlen(value));
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return n < 0 ? -1 : 0;
+}
+
+// Make the controllers available to our children, each the first time a
+// container needs it (cdockerd sees all sorts of limits over its life).
+// A controller only counts as enabled once both levels took it, so a
+// failure is retried by the next container that wants it.
+static int cgroup_enable_controllers(const char *root, const struct cgroup_limits *l)
+{
+    static unsigned int enabled;    // bits of want[] done already
+    const char *want[] = {
+        l && l->memory_max ? "+memory" : NULL,
+        l && l->cpu_max ? "+cpu" : NULL,
+        l && l->io_max ? "+io" : NULL,
+        l && l->pids_max ? "+pids" : NULL,
+    };
+    unsigned int needed = 0;
+    for (size_t j = 0; j < sizeof(want) / sizeof(want[0]); j++)
+        if (want[j] && !(enabled & 1u << j))
+            needed |= 1u << j;
+    if (!needed)
+        return 0;
+
+    char parent[PATH_MAX];
+    snprintf(parent, sizeof(parent), "%s/%s", root, CDOCKER_CGROUP);
+    const char *levels[] = { root, parent };
+    int fds[2];
+
+    for (int i = 0; i < 2; i++)
+    {
+        fds[i] = open(levels[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fds[i] < 0)
+        {
+            perror(levels[i]);
+            if (i)
+                close(fds[0]);
+            return -1;
+        }
+    }
+
+    int ret = 0;
+    for (size_t j = 0; j < sizeof(want) / sizeof(want[0]) && !ret; j++)
+    {
+        if (!(needed & 1u << j))
+            continue;
+        for (int i = 0; i < 2 && !ret; i++)
+            if (cgroup_write(fds[i], "cgroup.subtree_control", want[j]))
+            {
+                fprintf(stderr, "cgroup: enabling %s in %s: %s\n",
+                        want[j] + 1, levels[i], strerror(errno));
+                ret = -1;
+            }
+        if (!ret)
+            enabled |= 1u << j;
+    }
+    close(fds[0]);
+    close(fds[1]);
+    return ret;
+}
+
+void cgroup_destroy(struct cgroup *cg);
+
+// <root>/cdocker, created and opened once per process; new cgroups are
+// made relative to it without walking the path again
+static int cgroup_parent_fd(const char *root)
+{
+    static int fd = -1;
+    if (fd >= 0)
+        return fd;
+
+    char parent[PATH_MAX];
+    snprintf(parent, sizeof(parent), "%s/%s", root, CDOCKER_CGROUP);
+    if (mkdir(parent, 0755) && errno != EEXIST)
+        return -1;
+    fd = open(parent, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    return fd;
+}
+
+// Create the cgroup for container id and apply limits. Without limits
+// a missing cgroup2 mount isn't an error: cg->dirfd is just left at -1.
+int cgroup_create(struct cgroup *cg, const char *id, const struct cgroup_limits *limits)
+{
+    cg->dirfd = cg->memory_current_fd = cg->cpu_stat_fd = cg->io_stat_fd = -1;
+    cg->path[0] = '\0';
+
+    int required = cgroup_limits_set(limits);
+    const char *root = cgroup2_root();
+    if (!root)
+    {
+        if (required)
+            fprintf(stderr, "cgroup: no cgroup2 mount, can't apply limits\n");
+        return required ? -1 : 0;
+    }
+
+    int parent_fd = cgroup_parent_fd(root);
+    if (parent_fd < 0)
+    {
+        if (required)
+            perror("mkdir cgroup");
+        return required ? -1 : 0;
+    }
+    if (required && cgroup_enable_controllers(root, limits))
+        return -1;
+
+    snprintf(cg->path, sizeof(cg->path), "%s/%s/%s", root, CDOCKER_CGROUP, id);
+    if (mkdirat(parent_fd, id, 0755) && errno != EEXIST)
+    {
+        if (required)
+            perror("mkdir cgroup");
+        cg->path[0] = '\0';
+        return required ? -1 : 0;
+    }
+
+    cg->dirfd = openat(parent_fd, id, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cg->dirfd < 0)
+    {
+        perror("open cgroup");
+        cgroup_destroy(cg);
+        return required ? -1 : 0;
+    }
+
+    if (required)
+    {
+        struct { const char *file, *value; } set[] = {
+            { "memory.max", limits->memory_max },
+            { "cpu.max",    limits->cpu_max },
+            { "io.max",     limits->io_max },
+            { "pids.max",   limits->pids_max },
+        };
+        for (size_t i = 0; i < sizeof(set) / sizeof(set[0]); i++)
+        {
+            if (!set[i].value || cgroup_write(cg->dirfd, set[i].file, set[i].value) == 0)
+                continue;
+            fprintf(stderr, "cgroup: %s = %s: %s\n", set[i].file, set[i].value,
+                    errno == ENOENT ? "controller not available" : strerror(errno));
+            cgroup_destroy(cg);
+            return -1;
+        }
+    }
+
+    // Controllers that aren't enabled just leave their fd at -1
+    cg->memory_current_fd = openat(cg->dirfd, "memory.current", O_RDONLY | O_CLOEXEC);
+    cg->cpu_stat_fd = openat(cg->dirfd, "cpu.stat", O_RDONLY | O_CLOEXEC);
+    cg->io_stat_fd = openat(cg->dirfd, "io.stat", O_RDONLY | O_CLOEXEC);
+    return 0;
+}
+
+// Close the fds and remove the cgroup. Anything still inside is killed
+// first; the rmdir can also race the last exiting task, so retry briefly.
+void cgroup_destroy(struct cgroup *cg)
+{
+    int *fds[] = { &cg->memory_current_fd, &cg->cpu_stat_fd, &cg->io_stat_fd };
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++)
+    {
+        if (*fds[i] >= 0)
+            close(*fds[i]);
+        *fds[i] = -1;
+    }
+
+    if (cg->path[0])
+    {
+        for (int tries = 0; rmdir(cg->path) != 0 && errno == EBUSY && tries < 100; tries++)
+        {
+            if (tries == 0 && cg->dirfd >= 0)
+                cgroup_write(cg->dirfd, "cgroup.kill", "1");
+            nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+        }
+        if (access(cg->path, F_OK) == 0)
+            perror("rmdir cgroup");
+        cg->path[0] = '\0';
+    }
+
+    if (cg->dirfd >= 0)
+        close(cg->dirfd);
+    cg->dirfd = -1;
+}
+
+/*
+ * ============================================================
+ * PART 2: STATS
+ *
+ * cgroup files are generated on read, from offset 0, so pread() on a
+ * long-lived fd gets a fresh snapshot without open/close per sample.
+ * ============================================================
+ */
+
+// Read a whole stats file into buf (NUL-terminated); -1 if unavailable
+static ssize_t cgroup_pread(int fd, char *buf, size_t len)
+{
+    if (fd < 0)
+        return -1;
+    ssize_t n = pread(fd, buf, len - 1, 0);
+    if (n < 0)
+        return -1;
+    buf[n] = '\0';
+    return n;
+}
+
+// Value of "key N" in a flat-keyed file like cpu.stat
+static uint64_t cgroup_key(const char *buf, const char *key)
+{
+    size_t klen = strlen(key);
+    for (const char *p = buf; p && *p; p = strchr(p, '\n'), p = p ? p + 1 : NULL)
+        if (strncmp(p, key, klen) == 0 && p[klen] == ' ')
+            return strtoull(p + klen + 1, NULL, 10);
+    return 0;
+}
+
+// Sum one field ("rbytes=") over all device lines of io.stat
+static uint64_t cgroup_io_sum(const char *buf, const char *field)
+{
+    uint64_t sum = 0;
+    size_t flen = strlen(field);
+    for (const char *p = buf; (p = strstr(p, field)); p += flen)
+        if (p == buf || p[-1] == ' ')
+            sum += strtoull(p + flen, NULL, 10);
+    return sum;
+}
+
+// Snapshot the container's usage. Fields whose controller isn't enabled
+// read as zero. Returns 0, or -1 if nothing could be read.
+int cgroup_read_stats(const struct cgroup *cg, struct cgroup_stats *st)
+{
+    char buf[4096];
+    int got = 0;
+    memset(st, 0, sizeof(*st));
+
+    if (cgroup_pread(cg->memory_current_fd, buf, sizeof(buf)) > 0)
+    {
+        st->memory_current = strtoull(buf, NULL, 10);
+        got++;
+    }
+
+    if (cgroup_pread(cg->cpu_stat_fd, buf, sizeof(buf)) > 0)
+    {
+        st->cpu_usage_usec = cgroup_key(buf, "usage_usec");
+        st->cpu_user_usec = cgroup_key(buf, "user_usec");
+        st->cpu_system_usec = cgroup_key(buf, "system_usec");
+        got++;
+    }
+
+    if (cgroup_pread(cg->io_stat_fd, buf, sizeof(buf)) >= 0)
+    {
+        st->io_rbytes = cgroup_io_sum(buf, "rbytes=");
+        st->io_wbytes = cgroup_io_sum(buf, "wbytes=");
+        st->io_rios = cgroup_io_sum(buf, "rios=");
+        st->io_wios = cgroup_io_sum(buf, "wios=");
+        got++;
+    }
+
+    return got ? 0 : -1;
+}
+
+void cgroup_print_stats(FILE *out, const struct cgroup_stats *st)
+{
+    fprintf(out, "cgroup: cpu %.3fs (user %.3fs sys %.3fs), memory %llu KiB, "
+                 "io read %llu B/%llu ops, write %llu B/%llu ops\n",
+            st->cpu_usage_usec / 1e6, st->cpu_user_usec / 1e6, st->cpu_system_usec / 1e6,
+            (unsigned long long)st->memory_current / 1024,
+            (unsigned long long)st->io_rbytes, (unsigned long long)st->io_rios,
+            (unsigned long long)st->io_wbytes, (unsigned long long)st->io_wios);
+}
+
+#endif // CDOCKER_CGROUP_H
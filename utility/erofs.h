@@ -0,0 +1,516 @@
+#ifndef CDOCKER_EROFS_H
+#define CDOCKER_EROFS_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <endian.h>
+#include <search.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/limits.h>
+
+/*
+ * ============================================================
+ * EROFS IMAGE BUILDER
+ *
+ * Packs a root filesystem directory into one read-only EROFS image
+ * ("cdocker mkimage"), which rootfs.h mounts once per host through a loop
+ * device and shares between every container that runs it.
+ *
+ * The layout is the plain one, uncompressed: all inodes first (extended,
+ * 64 bytes, in breadth-first order so a directory's entries sit
+ * together), each followed by the tail of its data when that fits in the
+ * same block, then every file's full blocks back to back in the same
+ * order. Ownership, modes, mtimes, device numbers and hard links are
+ * kept; xattrs are not.
+ * ============================================================
+ */
+
+#define EROFS_MAGIC             0xE0F5E1E2
+#define EROFS_SUPER_OFFSET      1024
+#define EROFS_BLKBITS           12
+#define EROFS_BLKSIZ            (1u << EROFS_BLKBITS)
+#define EROFS_ISLOT             32          // nid = byte offset / 32
+#define EROFS_INODE_SIZE        64          // extended inodes only
+#define EROFS_DIRENT_SIZE       12
+#define EROFS_NULL_ADDR         0xffffffffu
+
+// i_format: bit 0 the inode version, bits 1-3 the data layout
+#define EROFS_INODE_EXTENDED    1
+#define EROFS_FLAT_PLAIN        0
+#define EROFS_FLAT_INLINE       2
+
+enum {
+    EROFS_FT_UNKNOWN, EROFS_FT_REG_FILE, EROFS_FT_DIR, EROFS_FT_CHRDEV,
+    EROFS_FT_BLKDEV, EROFS_FT_FIFO, EROFS_FT_SOCK, EROFS_FT_SYMLINK,
+};
+
+struct erofs_super_block {
+    uint32_t magic;
+    uint32_t checksum;
+    uint32_t feature_compat;
+    uint8_t blkszbits;
+    uint8_t sb_extslots;
+    uint16_t root_nid;
+    uint64_t inos;
+    uint64_t build_time;
+    uint32_t build_time_nsec;
+    uint32_t blocks;
+    uint32_t meta_blkaddr;
+    uint32_t xattr_blkaddr;
+    uint8_t uuid[16];
+    uint8_t volume_name[16];
+    uint32_t feature_incompat;
+    uint16_t available_compr_algs;
+    uint16_t extra_devices;
+    uint16_t devt_slotoff;
+    uint8_t dirblkbits;
+    uint8_t xattr_prefix_count;
+    uint32_t xattr_prefix_start;
+    uint64_t packed_nid;
+    uint8_t reserved[24];
+} __attribute__((packed));
+
+struct erofs_inode_extended {
+    uint16_t i_format;
+    uint16_t i_xattr_icount;
+    uint16_t i_mode;
+    uint16_t i_reserved;
+    uint64_t i_size;
+    uint32_t i_u;           // raw_blkaddr, or rdev
+    uint32_t i_ino;
+    uint32_t i_uid;
+    uint32_t i_gid;
+    uint64_t i_mtime;
+    uint32_t i_mtime_nsec;
+    uint32_t i_nlink;
+    uint8_t i_reserved2[16];
+} __attribute__((packed));
+
+struct erofs_dirent {
+    uint64_t nid;
+    uint16_t nameoff;
+    uint8_t file_type;
+    uint8_t reserved;
+} __attribute__((packed));
+
+struct erofs_entry {
+    char *name;
+    struct erofs_node *to;          // hard links repeat a node
+};
+
+struct erofs_node {
+    char *path;                     // on the host
+    struct stat st;
+    struct erofs_node *parent;      // a directory's (dirs aren't hard linked)
+    struct erofs_entry *entries;    // a directory's, "." and ".." too, sorted
+    int nentries;
+    uint32_t nlink;                 // as seen in the tree
+    uint32_t ino;
+    uint64_t size;                  // i_size: file, link target or directory bytes
+    uint64_t nid;
+    uint32_t blkaddr;               // first full block, or EROFS_NULL_ADDR
+    int inline_tail;                // the last partial block follows the inode
+};
+
+struct erofs_build {
+    struct erofs_node **nodes;      // breadth-first, each inode once
+    int count, cap;
+    void *links;                    // tsearch() tree of nodes by st_dev/st_ino
+    char *buf;                      // EROFS_BLKSIZ of scratch
+};
+
+static int erofs_node_cmp(const void *a, const void *b)
+{
+    const struct erofs_node *x = a, *y = b;
+    if (x->st.st_dev != y->st.st_dev)
+        return x->st.st_dev < y->st.st_dev ? -1 : 1;
+    return x->st.st_ino < y->st.st_ino ? -1 : x->st.st_ino > y->st.st_ino;
+}
+
+static int erofs_entry_cmp(const void *a, const void *b)
+{
+    const struct erofs_entry *x = a, *y = b;
+    return strcmp(x->name, y->name);
+}
+
+static uint8_t erofs_file_type(mode_t mode)
+{
+    switch (mode & S_IFMT)
+    {
+    case S_IFREG:  return EROFS_FT_REG_FILE;
+    case S_IFDIR:  return EROFS_FT_DIR;
+    case S_IFCHR:  return EROFS_FT_CHRDEV;
+    case S_IFBLK:  return EROFS_FT_BLKDEV;
+    case S_IFIFO:  return EROFS_FT_FIFO;
+    case S_IFSOCK: return EROFS_FT_SOCK;
+    case S_IFLNK:  return EROFS_FT_SYMLINK;
+    }
+    return EROFS_FT_UNKNOWN;
+}
+
+static struct erofs_node *erofs_node_new(struct erofs_build *b, const char *path,
+                                         struct erofs_node *parent)
+{
+    struct erofs_node *n = calloc(1, sizeof(*n));
+    if (!n || !(n->path = strdup(path)))
+    {
+        free(n);
+        return NULL;
+    }
+    n->parent = parent ? parent : n;
+    n->blkaddr = EROFS_NULL_ADDR;
+    if (lstat(path, &n->st) != 0)
+    {
+        perror(path);
+        free(n->path);
+        free(n);
+        return NULL;
+    }
+
+    // A hard link to a file we already have is just another entry for it
+    if (!S_ISDIR(n->st.st_mode) && n->st.st_nlink > 1)
+    {
+        struct erofs_node **seen = tsearch(n, &b->links, erofs_node_cmp);
+        if (seen && *seen != n)
+        {
+            (*seen)->nlink++;
+            free(n->path);
+            free(n);
+            return *seen;
+        }
+    }
+
+    if (b->count == b->cap)
+    {
+        int cap = b->cap ? b->cap * 2 : 256;
+        struct erofs_node **nodes = realloc(b->nodes, cap * sizeof(*nodes));
+        if (!nodes)
+            return NULL;
+        b->nodes = nodes;
+        b->cap = cap;
+    }
+    b->nodes[b->count++] = n;
+    n->ino = b->count;
+    n->nlink = S_ISDIR(n->st.st_mode) ? 2 : 1;
+    if (S_ISREG(n->st.st_mode) || S_ISLNK(n->st.st_mode))
+        n->size = n->st.st_size;
+    return n;
+}
+
+static int erofs_add_entry(struct erofs_node *dir, int *cap, const char *name,
+                           struct erofs_node *to)
+{
+    if (dir->nentries == *cap)
+    {
+        *cap = *cap ? *cap * 2 : 16;
+        struct erofs_entry *e = realloc(dir->entries, *cap * sizeof(*e));
+        if (!e)
+            return -1;
+        dir->entries = e;
+    }
+    struct erofs_entry *e = &dir->entries[dir->nentries];
+    if (!(e->name = strdup(name)))
+        return -1;
+    e->to = to;
+    dir->nentries++;
+    return 0;
+}
+
+// A directory's entries, sorted; subdirectories are queued behind it
+static int erofs_read_dir(struct erofs_build *b, struct erofs_node *dir)
+{
+    DIR *d = opendir(dir->path);
+    if (!d)
+    {
+        perror(dir->path);
+        return -1;
+    }
+
+    int cap = 0, ret = 0;
+    if (erofs_add_entry(dir, &cap, ".", dir) < 0 || erofs_add_entry(dir, &cap, "..", dir->parent) < 0)
+        ret = -1;
+
+    struct dirent *e;
+    while (ret == 0 && (e = readdir(d)))
+    {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            continue;
+
+        char path[PATH_MAX];
+        if (snprintf(path, sizeof(path), "%s/%s", dir->path, e->d_name) >= (int)sizeof(path))
+        {
+            fprintf(stderr, "%s/%s: path too long\n", dir->path, e->d_name);
+            ret = -1;
+            break;
+        }
+        struct erofs_node *n = erofs_node_new(b, path, dir);
+        if (!n || erofs_add_entry(dir, &cap, e->d_name, n) < 0)
+            ret = -1;
+        else if (S_ISDIR(n->st.st_mode))
+            dir->nlink++;
+    }
+    closedir(d);
+
+    qsort(dir->entries, dir->nentries, sizeof(*dir->entries), erofs_entry_cmp);
+    return ret;
+}
+
+// Lay out a directory's entries block by block, as many as fit in each.
+// With out, fill in the blocks too (size bytes); returns the size.
+static uint64_t erofs_dir_blocks(const struct erofs_node *dir, char *out)
+{
+    int total = dir->nentries;
+    uint64_t size = 0;
+    for (int first = 0; first < total;)
+    {
+        // How many go in this block
+        int n = 0;
+        size_t names = 0;
+        while (first + n < total)
+        {
+            size_t len = strlen(dir->entries[first + n].name);
+            if ((n + 1) * EROFS_DIRENT_SIZE + names + len > EROFS_BLKSIZ)
+                break;
+            names += len;
+            n++;
+        }
+        if (n == 0)
+            return 0;   // a name too long for a block; can't happen under NAME_MAX
+
+        size_t used = n * EROFS_DIRENT_SIZE + names;
+        if (out)
+        {
+            char *blk = out + size;
+            size_t nameoff = n * EROFS_DIRENT_SIZE;
+            for (int i = 0; i < n; i++)
+            {
+                const char *name = dir->entries[first + i].name;
+                const struct erofs_node *to = dir->entries[first + i].to;
+                struct erofs_dirent de = {
+                    .nid = htole64(to->nid),
+                    .nameoff = htole16(nameoff),
+                    .file_type = erofs_file_type(to->st.st_mode),
+                };
+                memcpy(blk + i * EROFS_DIRENT_SIZE, &de, sizeof(de));
+                memcpy(blk + nameoff, name, strlen(name));
+                nameoff += strlen(name);
+            }
+        }
+
+        first += n;
+        size += first < total ? EROFS_BLKSIZ : used;
+    }
+    return size;
+}
+
+// Where every inode and block goes; returns the image size in blocks
+static uint32_t erofs_layout(struct erofs_build *b)
+{
+    uint64_t pos = EROFS_SUPER_OFFSET + sizeof(struct erofs_super_block);
+    for (int i = 0; i < b->count; i++)
+    {
+        struct erofs_node *n = b->nodes[i];
+        if (S_ISDIR(n->st.st_mode))
+            n->size = erofs_dir_blocks(n, NULL);
+
+        // The tail goes after the inode if both fit in one block
+        unsigned int tail = n->size % EROFS_BLKSIZ;
+        n->inline_tail = tail && tail <= EROFS_BLKSIZ - EROFS_INODE_SIZE;
+        size_t need = EROFS_INODE_SIZE + (n->inline_tail ? tail : 0);
+        if (pos % EROFS_BLKSIZ + need > EROFS_BLKSIZ)
+            pos = (pos + EROFS_BLKSIZ - 1) & ~(uint64_t)(EROFS_BLKSIZ - 1);
+        n->nid = pos / EROFS_ISLOT;
+        pos += (need + EROFS_ISLOT - 1) & ~(size_t)(EROFS_ISLOT - 1);
+    }
+
+    uint64_t blk = (pos + EROFS_BLKSIZ - 1) / EROFS_BLKSIZ;
+    for (int i = 0; i < b->count; i++)
+    {
+        struct erofs_node *n = b->nodes[i];
+        uint64_t blocks = n->inline_tail ? n->size / EROFS_BLKSIZ
+                                         : (n->size + EROFS_BLKSIZ - 1) / EROFS_BLKSIZ;
+        if (blocks)
+            n->blkaddr = blk;
+        blk += blocks;
+    }
+    return blk;
+}
+
+// A node's data: a file's contents, a symlink's target or a directory's
+// blocks. Full blocks go to blkaddr, an inline tail after the inode.
+static int erofs_write_data(struct erofs_build *b, int img, const struct erofs_node *n)
+{
+    if (!n->size)
+        return 0;
+
+    uint64_t full = n->inline_tail ? n->size / EROFS_BLKSIZ * EROFS_BLKSIZ : n->size;
+    unsigned int tail = n->size - full;
+    off_t tail_at = n->nid * EROFS_ISLOT + EROFS_INODE_SIZE;
+
+    if (S_ISREG(n->st.st_mode))
+    {
+        int fd = open(n->path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            perror(n->path);
+            return -1;
+        }
+        loff_t in = 0, out = (loff_t)n->blkaddr * EROFS_BLKSIZ;
+        while (in < (loff_t)full)
+        {
+            ssize_t c = copy_file_range(fd, &in, img, &out, full - in, 0);
+            if (c <= 0)
+            {
+                perror(c < 0 ? n->path : "short copy");
+                close(fd);
+                return -1;
+            }
+        }
+        int ok = !tail || (pread(fd, b->buf, tail, full) == tail &&
+                           pwrite(img, b->buf, tail, tail_at) == tail);
+        close(fd);
+        return ok ? 0 : -1;
+    }
+
+    char *data = b->buf;
+    if (S_ISLNK(n->st.st_mode))
+    {
+        if (n->size >= EROFS_BLKSIZ || readlink(n->path, data, n->size) != (ssize_t)n->size)
+        {
+            fprintf(stderr, "%s: link changed or too long\n", n->path);
+            return -1;
+        }
+    }
+    else
+    {
+        data = calloc(1, (n->size + EROFS_BLKSIZ - 1) / EROFS_BLKSIZ * EROFS_BLKSIZ);
+        if (!data)
+            return -1;
+        erofs_dir_blocks(n, data);
+    }
+
+    int ok = (!full || pwrite(img, data, full, (off_t)n->blkaddr * EROFS_BLKSIZ) == (ssize_t)full) &&
+             (!tail || pwrite(img, data + full, tail, tail_at) == tail);
+    if (data != b->buf)
+        free(data);
+    return ok ? 0 : -1;
+}
+
+static int erofs_write_inode(int img, const struct erofs_node *n)
+{
+    unsigned int layout = n->inline_tail ? EROFS_FLAT_INLINE : EROFS_FLAT_PLAIN;
+    uint32_t u = n->blkaddr;
+    if (S_ISCHR(n->st.st_mode) || S_ISBLK(n->st.st_mode))
+    {
+        // new_encode_dev()
+        unsigned int maj = major(n->st.st_rdev), min = minor(n->st.st_rdev);
+        u = (min & 0xff) | (maj << 8) | ((min & ~0xffu) << 12);
+    }
+
+    struct erofs_inode_extended di = {
+        .i_format = htole16(EROFS_INODE_EXTENDED | layout << 1),
+        .i_mode = htole16(n->st.st_mode),
+        .i_size = htole64(n->size),
+        .i_u = htole32(u),
+        .i_ino = htole32(n->ino),
+        .i_uid = htole32(n->st.st_uid),
+        .i_gid = htole32(n->st.st_gid),
+        .i_mtime = htole64(n->st.st_mtim.tv_sec),
+        .i_mtime_nsec = htole32(n->st.st_mtim.tv_nsec),
+        .i_nlink = htole32(n->nlink),
+    };
+    return pwrite(img, &di, sizeof(di), n->nid * EROFS_ISLOT) == sizeof(di) ? 0 : -1;
+}
+
+static void erofs_build_free(struct erofs_build *b)
+{
+    while (b->links)
+        tdelete(*(void **)b->links, &b->links, erofs_node_cmp);
+    for (int i = 0; i < b->count; i++)
+    {
+        for (int j = 0; j < b->nodes[i]->nentries; j++)
+            free(b->nodes[i]->entries[j].name);
+        free(b->nodes[i]->entries);
+        free(b->nodes[i]->path);
+        free(b->nodes[i]);
+    }
+    free(b->nodes);
+    free(b->buf);
+}
+
+// Pack the directory src into an EROFS image at dst
+int erofs_build(const char *src, const char *dst)
+{
+    struct erofs_build b = { 0 };
+    int img = -1, ret = -1;
+    b.buf = malloc(EROFS_BLKSIZ);
+    struct erofs_node *root = b.buf ? erofs_node_new(&b, src, NULL) : NULL;
+    if (!root)
+        goto out;
+    if (!S_ISDIR(root->st.st_mode))
+    {
+        fprintf(stderr, "%s: not a directory\n", src);
+        goto out;
+    }
+
+    // Breadth-first: the queue is the node list itself
+    for (int i = 0; i < b.count; i++)
+        if (S_ISDIR(b.nodes[i]->st.st_mode) && erofs_read_dir(&b, b.nodes[i]) < 0)
+            goto out;
+
+    uint32_t blocks = erofs_layout(&b);
+    if (root->nid > UINT16_MAX)
+        goto out;   // first inode: can't happen
+
+    img = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (img < 0 || ftruncate(img, (off_t)blocks * EROFS_BLKSIZ) != 0)
+    {
+        perror(dst);
+        goto out;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct erofs_super_block sb = {
+        .magic = htole32(EROFS_MAGIC),
+        .blkszbits = EROFS_BLKBITS,
+        .root_nid = htole16(root->nid),
+        .inos = htole64(b.count),
+        .build_time = htole64(now.tv_sec),
+        .build_time_nsec = htole32(now.tv_nsec),
+        .blocks = htole32(blocks),
+    };
+    if (pwrite(img, &sb, sizeof(sb), EROFS_SUPER_OFFSET) != sizeof(sb))
+        goto out;
+
+    for (int i = 0; i < b.count; i++)
+        if (erofs_write_inode(img, b.nodes[i]) < 0 || erofs_write_data(&b, img, b.nodes[i]) < 0)
+        {
+            fprintf(stderr, "%s: writing %s failed\n", dst, b.nodes[i]->path);
+            goto out;
+        }
+    if (fsync(img) != 0)
+        goto out;
+
+    printf("%s: %d inodes, %u blocks of %u\n", dst, b.count, blocks, EROFS_BLKSIZ);
+    ret = 0;
+
+out:
+    if (img >= 0)
+        close(img);
+    if (ret < 0 && img >= 0)
+        unlink(dst);
+    erofs_build_free(&b);
+    return ret;
+}
+
+#endif // CDOCKER_EROFS_H
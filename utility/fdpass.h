@@ -0,0 +1,102 @@
+#ifndef CDOCKER_FDPASS_H
+#define CDOCKER_FDPASS_H
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/*
+ * Messages with file descriptors attached (SCM_RIGHTS), over Unix
+ * sockets. Used for cdockerd's client connections and the zygote's
+ * control socket; both are SOCK_SEQPACKET, so one call is one message.
+ */
+
+#define FDPASS_MAX 8    // fds per message
+
+// Send iov as one message with nfds fds attached. MSG_NOSIGNAL: a peer
+// that went away is an EPIPE, not a SIGPIPE.
+static int fd_sendmsg(int sock, struct iovec *iov, int iovcnt, const int *fds, int nfds)
+{
+    struct msghdr mh = { .msg_iov = iov, .msg_iovlen = iovcnt };
+
+    char cbuf[CMSG_SPACE(FDPASS_MAX * sizeof(int))];
+    if (nfds > FDPASS_MAX)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (nfds > 0)
+    {
+        memset(cbuf, 0, sizeof(cbuf));
+        mh.msg_control = cbuf;
+        mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+    }
+
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &mh, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n < 0 ? -1 : 0;
+}
+
+// Receive one message into buf. Passed fds (O_CLOEXEC) fill fds[0..max-1],
+// the rest of fds is set to -1 and any extra fds are closed. Returns the
+// length, 0 on EOF, or -1 (EMSGSIZE if the message didn't fit).
+static ssize_t fd_recvmsg(int sock, void *buf, size_t len, int *fds, int max)
+{
+    struct iovec iov = { .iov_base = buf, .iov_len = len };
+    char cbuf[CMSG_SPACE(FDPASS_MAX * sizeof(int))];
+    struct msghdr mh = {
+        .msg_iov = &iov, .msg_iovlen = 1,
+        .msg_control = cbuf, .msg_controllen = sizeof(cbuf),
+    };
+
+    for (int i = 0; i < max; i++)
+        fds[i] = -1;
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0)
+        return -1;
+
+    int got = 0;
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm))
+    {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+            continue;
+        int count = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int passed[FDPASS_MAX];
+        memcpy(passed, CMSG_DATA(cm), count * sizeof(int));
+        for (int i = 0; i < count; i++)
+        {
+            if (got < max)
+                fds[got++] = passed[i];
+            else
+                close(passed[i]);
+        }
+    }
+
+    if (mh.msg_flags & MSG_TRUNC)
+    {
+        for (int i = 0; i < got; i++)
+        {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+        errno = EMSGSIZE;
+        return -1;
+    }
+    return n;
+}
+
+#endif // CDOCKER_FDPASS_H
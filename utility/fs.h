@@ -0,0 +1,47 @@
+#ifndef CDOCKER_FS_H
+#define CDOCKER_FS_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+// mkdir -p; intermediate directories get 0755, the last one gets mode
+int mkdir_p(const char *path, mode_t mode)
+{
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+
+    for (char *p = tmp + 1; *p; p++)
+    {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        if (mkdir(tmp, 0755) && errno != EEXIST)
+            return -1;
+        *p = '/';
+    }
+
+    if (mkdir(tmp, mode) && errno != EEXIST)
+        return -1;
+    return 0;
+}
+
+static int rm_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st; (void)flag; (void)ftw;
+    if (remove(path) != 0 && errno != ENOENT)
+        perror(path);
+    return 0;
+}
+
+// rm -rf, staying on this filesystem and never following symlinks
+void rm_rf(const char *path)
+{
+    nftw(path, rm_entry, 16, FTW_DEPTH | FTW_PHYS | FTW_MOUNT);
+}
+
+#endif // CDOCKER_FS_H
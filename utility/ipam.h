@@ -0,0 +1,204 @@
+#ifndef CDOCKER_IPAM_H
+#define CDOCKER_IPAM_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <linux/limits.h>
+
+#include "fs.h"
+#include "network.h"
+
+/*
+ * Container address allocation.
+ *
+ * One bit per address in the subnet, in a file under /run/cdocker mapped
+ * MAP_SHARED, so every cdocker process (and every bench worker) allocates
+ * from the same pool without a daemon. Bits are claimed with an atomic
+ * fetch-or, so there is no lock at all; concurrent allocators start from
+ * a rotating hint so they don't all fight over the first free word.
+ *
+ * Each slot also records the pid that holds it. If the pool fills up,
+ * slots whose owner has died without releasing them are reclaimed.
+ *
+ * Slot 0 is the network address, 1 the gateway (the host side), and the
+ * last one the broadcast address; those are never handed out.
+ */
+
+#define IPAM_DIR        "/run/cdocker/ipam"
+#define IPAM_MIN_PREFIX 16      // at most 65536 addresses per pool
+#define IPAM_MAX_PREFIX 29
+
+struct ipam_pool {
+    uint32_t size;              // addresses in the subnet
+    uint32_t hint;              // next word to try, shared
+    // followed by uint64_t bits[size / 64], then pid_t owner[size]
+};
+
+struct ipam {
+    struct ipam_pool *pool;
+    uint64_t *bits;
+    pid_t *owner;
+    size_t map_len;
+    struct in_addr net;         // network order
+    int prefix;
+};
+
+static size_t ipam_words(uint32_t size)
+{
+    return (size + 63) / 64;
+}
+
+// Open (creating if needed) the pool for subnet, e.g. "10.0.0.0/24"
+int ipam_open(struct ipam *ip, const char *subnet)
+{
+    memset(ip, 0, sizeof(*ip));
+    if (parse_cidr(subnet, &ip->net, &ip->prefix) < 0 ||
+        ip->prefix < IPAM_MIN_PREFIX || ip->prefix > IPAM_MAX_PREFIX)
+    {
+        fprintf(stderr, "ipam: subnet must be /%d to /%d: %s\n",
+                IPAM_MIN_PREFIX, IPAM_MAX_PREFIX, subnet);
+        return -1;
+    }
+    ip->net.s_addr &= htonl(~0u << (32 - ip->prefix));
+
+    uint32_t size = 1u << (32 - ip->prefix);
+    ip->map_len = sizeof(struct ipam_pool) + ipam_words(size) * sizeof(uint64_t) +
+                  size * sizeof(pid_t);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s_%d", IPAM_DIR, inet_ntoa(ip->net), ip->prefix);
+    if (mkdir_p(IPAM_DIR, 0700) != 0)
+    {
+        perror("mkdir " IPAM_DIR);
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    // Racing creators all truncate to the same size, which is harmless;
+    // a fresh file reads as zeroes, i.e. all free
+    if (ftruncate(fd, ip->map_len) != 0)
+    {
+        perror("ftruncate ipam");
+        close(fd);
+        return -1;
+    }
+
+    ip->pool = mmap(NULL, ip->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ip->pool == MAP_FAILED)
+    {
+        perror("mmap ipam");
+        ip->pool = NULL;
+        return -1;
+    }
+
+    ip->bits = (uint64_t *)(ip->pool + 1);
+    ip->owner = (pid_t *)(ip->bits + ipam_words(size));
+    __atomic_store_n(&ip->pool->size, size, __ATOMIC_RELAXED);
+
+    // Reserve network, gateway and broadcast
+    __atomic_fetch_or(&ip->bits[0], 3, __ATOMIC_RELAXED);
+    __atomic_fetch_or(&ip->bits[(size - 1) / 64], 1ull << ((size - 1) % 64), __ATOMIC_RELAXED);
+    return 0;
+}
+
+void ipam_close(struct ipam *ip)
+{
+    if (ip->pool)
+        munmap(ip->pool, ip->map_len);
+    ip->pool = NULL;
+}
+
+// Give slots back whose owner no longer exists. Returns how many.
+static int ipam_reclaim(struct ipam *ip)
+{
+    int freed = 0;
+    for (uint32_t slot = 2; slot < ip->pool->size - 1; slot++)
+    {
+        pid_t pid = __atomic_load_n(&ip->owner[slot], __ATOMIC_ACQUIRE);
+        if (pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH)
+            continue;
+
+        // Only one reclaimer wins the slot
+        if (!__atomic_compare_exchange_n(&ip->owner[slot], &pid, 0, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            continue;
+        __atomic_fetch_and(&ip->bits[slot / 64], ~(1ull << (slot % 64)), __ATOMIC_RELEASE);
+        freed++;
+    }
+    return freed;
+}
+
+// Claim a free slot for the calling process. Returns it, or -1 when the
+// subnet is exhausted.
+int ipam_alloc(struct ipam *ip)
+{
+    uint32_t words = ipam_words(ip->pool->size);
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        uint32_t start = __atomic_fetch_add(&ip->pool->hint, 1, __ATOMIC_RELAXED) % words;
+
+        for (uint32_t n = 0; n < words; n++)
+        {
+            uint32_t w = (start + n) % words;
+            uint64_t cur = __atomic_load_n(&ip->bits[w], __ATOMIC_RELAXED);
+
+            while (~cur)
+            {
+                uint64_t bit = 1ull << __builtin_ctzll(~cur);
+                cur = __atomic_fetch_or(&ip->bits[w], bit, __ATOMIC_ACQ_REL);
+                if (cur & bit)
+                    continue;   // lost the race for it; cur is fresh, retry
+
+                int slot = w * 64 + __builtin_ctzll(bit);
+                __atomic_store_n(&ip->owner[slot], getpid(), __ATOMIC_RELEASE);
+                return slot;
+            }
+        }
+
+        if (pass == 0 && ipam_reclaim(ip) == 0)
+            break;
+    }
+
+    fprintf(stderr, "ipam: no free addresses in %s/%d\n", inet_ntoa(ip->net), ip->prefix);
+    return -1;
+}
+
+void ipam_free(struct ipam *ip, int slot)
+{
+    if (slot < 2 || (uint32_t)slot >= ip->pool->size - 1)
+        return;
+    __atomic_store_n(&ip->owner[slot], 0, __ATOMIC_RELEASE);
+    __atomic_fetch_and(&ip->bits[slot / 64], ~(1ull << (slot % 64)), __ATOMIC_RELEASE);
+}
+
+// "a.b.c.d" of a slot; with_prefix appends "/prefix"
+void ipam_addr(const struct ipam *ip, int slot, int with_prefix, char *out, size_t len)
+{
+    struct in_addr a = { .s_addr = htonl(ntohl(ip->net.s_addr) + slot) };
+    char buf[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &a, buf, sizeof(buf));
+
+    if (with_prefix)
+        snprintf(out, len, "%s/%d", buf, ip->prefix);
+    else
+        snprintf(out, len, "%s", buf);
+}
+
+#endif // CDOCKER_IPAM_H
@@ -0,0 +1,465 @@
+#ifndef CDOCKER_LAYER_STORE_H
+#define CDOCKER_LAYER_STORE_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+
+#include "fs.h"
+#include "sha256.h"
+#include "tar.h"
+
+/*
+ * Content-addressed layer store
+ *
+ *   /var/lib/cdocker/layers/<hex>    extracted layer, keyed by blob digest
+ *   /var/lib/cdocker/images/<name>   "sha256:<hex>" per line, bottom layer first
+ *
+ * Layers shared between images are extracted once. A layer is extracted
+ * into "<hex>.tmp-<n>" and renamed into place only after its digest has
+ * been verified, so a directory under its final name is always complete.
+ *
+ * Layers are independent (whiteouts are stored as overlayfs whiteouts and
+ * only take effect when stacked), so all of an image's layers are
+ * extracted at once on a pool of threads, one layer per thread.
+ */
+
+#define CDOCKER_STORE_DIR "/var/lib/cdocker"
+
+struct layer_job {
+    char hex[65];            // digest of the blob
+    char blob[PATH_MAX];     // blob path in the OCI layout
+    int error;
+    int cached;              // already in the store
+};
+
+struct layer_pool {
+    struct layer_job *jobs;
+    int count;
+    int next;                // next job to hand out (atomic)
+};
+
+/*
+ * ============================================================
+ * PART 1: JUST ENOUGH JSON
+ *
+ * OCI index.json and manifests are read with a small scanner that knows
+ * how to find a top-level key in an object and walk an array; that is
+ * all the layout needs.
+ * ============================================================
+ */
+
+static const char *json_ws(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+        p++;
+    return p;
+}
+
+// p points at a string, object or array; returns just past its end
+static const char *json_skip(const char *p)
+{
+    int depth = 0, in_str = 0;
+
+    for (; *p; p++)
+    {
+        if (in_str)
+        {
+            if (*p == '\\' && p[1])
+                p++;
+            else if (*p == '"')
+            {
+                in_str = 0;
+                if (depth == 0)
+                    return p + 1;
+            }
+            continue;
+        }
+
+        if (depth == 0 && (*p == ',' || *p == '}' || *p == ']'))
+            return p;    // end of a bare number/literal
+        if (*p == '"')
+            in_str = 1;
+        else if (*p == '{' || *p == '[')
+            depth++;
+        else if ((*p == '}' || *p == ']') && --depth == 0)
+            return p + 1;
+    }
+    return p;
+}
+
+// Copy the string at p (which must start with '"') into out
+static int json_string(const char *p, char *out, size_t len)
+{
+    if (*p != '"')
+        return -1;
+
+    size_t n = 0;
+    for (p++; *p && *p != '"'; p++)
+    {
+        if (*p == '\\' && p[1])
+            p++;
+        if (n + 1 < len)
+            out[n++] = *p;
+    }
+    out[n] = '\0';
+    return *p == '"' ? 0 : -1;
+}
+
+// Value of a top-level key in the object at obj, or NULL
+static const char *json_get(const char *obj, const char *key)
+{
+    obj = json_ws(obj);
+    if (*obj != '{')
+        return NULL;
+
+    const char *p = json_ws(obj + 1);
+    while (*p == '"')
+    {
+        char name[64];
+        json_string(p, name, sizeof(name));
+        p = json_ws(json_skip(p));
+        if (*p != ':')
+            return NULL;
+        p = json_ws(p + 1);
+
+        if (strcmp(name, key) == 0)
+            return p;
+
+        p = json_ws(json_skip(p));
+        if (*p == ',')
+            p = json_ws(p + 1);
+    }
+    return NULL;
+}
+
+// Iterate an array: pass the '[' first, then the previous element
+static const char *json_next(const char *p, int first)
+{
+    p = json_ws(p);
+    if (first)
+        p = (*p == '[') ? json_ws(p + 1) : NULL;
+    else
+    {
+        p = json_ws(json_skip(p));
+        if (*p == ',')
+            p = json_ws(p + 1);
+    }
+    return (p && *p && *p != ']') ? p : NULL;
+}
+
+static char *read_file(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    struct stat st;
+    char *buf = NULL;
+    if (fstat(fd, &st) == 0 && (buf = malloc(st.st_size + 1)))
+    {
+        ssize_t n = read(fd, buf, st.st_size);
+        buf[n > 0 ? n : 0] = '\0';
+    }
+    close(fd);
+    return buf;
+}
+
+// "sha256:<64 hex>" -> hex, rejecting anything that isn't exactly that
+static int parse_digest(const char *digest, char hex[65])
+{
+    if (strncmp(digest, "sha256:", 7) != 0 || strlen(digest + 7) != 64)
+        return -1;
+    for (const char *p = digest + 7; *p; p++)
+        if (!((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f')))
+            return -1;
+    memcpy(hex, digest + 7, 65);
+    return 0;
+}
+
+/*
+ * ============================================================
+ * PART 2: PARALLEL LAYER EXTRACTION
+ * ============================================================
+ */
+
+static void extract_layer(struct layer_job *job)
+{
+    char final[PATH_MAX], tmp[PATH_MAX + 32];
+    snprintf(final, sizeof(final), CDOCKER_STORE_DIR "/layers/%s", job->hex);
+
+    if (access(final, F_OK) == 0)
+    {
+        job->cached = 1;
+        return;
+    }
+
+    static int tmp_seq;
+    snprintf(tmp, sizeof(tmp), "%s.tmp-%d-%d", final, getpid(),
+             __atomic_fetch_add(&tmp_seq, 1, __ATOMIC_RELAXED));
+    if (mkdir(tmp, 0755) != 0)
+    {
+        perror(tmp);
+        job->error = -errno;
+        return;
+    }
+
+    int rootfd = open(tmp, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct sha256 sha;
+    struct layer_reader r;
+    sha256_init(&sha);
+
+    if (rootfd < 0 || layer_reader_open(&r, job->blob, &sha) < 0)
+    {
+        job->error = -EIO;
+        goto fail;
+    }
+
+    int ret = tar_extract(&r, rootfd);
+    int close_ret = layer_reader_close(&r);
+    if (ret < 0 || close_ret < 0)
+    {
+        fprintf(stderr, "layer %.12s: extraction failed\n", job->hex);
+        job->error = ret < 0 ? ret : close_ret;
+        goto fail;
+    }
+
+    char hex[65];
+    if (r.kind == LAYER_ZSTD)
+    {
+        int fd = open(job->blob, O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || sha256_file(fd, hex) < 0)
+            hex[0] = '\0';
+        if (fd >= 0)
+            close(fd);
+    }
+    else
+    {
+        sha256_final_hex(&sha, hex);
+    }
+
+    if (strcmp(hex, job->hex) != 0)
+    {
+        fprintf(stderr, "layer %.12s: digest mismatch (got %.12s)\n", job->hex, hex);
+        job->error = -EBADMSG;
+        goto fail;
+    }
+
+    close(rootfd);
+    if (rename(tmp, final) != 0)
+    {
+        // Someone else finished the same layer first
+        if (errno == EEXIST || errno == ENOTEMPTY)
+            job->cached = 1;
+        else
+            job->error = -errno;
+        rm_rf(tmp);
+    }
+    return;
+
+fail:
+    if (rootfd >= 0)
+        close(rootfd);
+    rm_rf(tmp);
+}
+
+static void *layer_worker(void *arg)
+{
+    struct layer_pool *pool = arg;
+    for (;;)
+    {
+        int i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (i >= pool->count)
+            return NULL;
+        extract_layer(&pool->jobs[i]);
+    }
+}
+
+// Extract every job, up to one thread per CPU
+int extract_layers(struct layer_job *jobs, int count)
+{
+    struct layer_pool pool = { .jobs = jobs, .count = count };
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = count < ncpu ? count : (int)ncpu;
+    if (nthreads < 1) nthreads = 1;
+
+    pthread_t *threads = calloc(nthreads, sizeof(*threads));
+    int started = 0;
+    for (int i = 0; threads && i < nthreads; i++)
+        if (pthread_create(&threads[i], NULL, layer_worker, &pool) == 0)
+            started++;
+
+    // No threads at all: do it here
+    if (started == 0)
+        layer_worker(&pool);
+
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+
+    for (int i = 0; i < count; i++)
+        if (jobs[i].error)
+            return jobs[i].error;
+    return 0;
+}
+
+/*
+ * ============================================================
+ * PART 3: OCI IMPORT
+ * ============================================================
+ */
+
+// Import the first manifest of an OCI image layout directory as <name>
+int image_import(const char *oci_dir, const char *name)
+{
+    if (!*name || strchr(name, '/') || name[0] == '.')
+    {
+        fprintf(stderr, "invalid image name: %s\n", name);
+        return -EINVAL;
+    }
+
+    char path[PATH_MAX + 128], hex[65], digest[128];
+    int ret = -EINVAL;
+    char *index = NULL, *manifest = NULL;
+    struct layer_job *jobs = NULL;
+
+    snprintf(path, sizeof(path), "%s/index.json", oci_dir);
+    if (!(index = read_file(path)))
+        return -ENOENT;
+
+    const char *manifests = json_get(index, "manifests");
+    const char *m = manifests ? json_next(manifests, 1) : NULL;
+    const char *d = m ? json_get(m, "digest") : NULL;
+    if (!d || json_string(d, digest, sizeof(digest)) < 0 || parse_digest(digest, hex) < 0)
+    {
+        fprintf(stderr, "%s: no usable manifest\n", path);
+        goto out;
+    }
+
+    snprintf(path, sizeof(path), "%s/blobs/sha256/%s", oci_dir, hex);
+    if (!(manifest = read_file(path)))
+        goto out;
+
+    const char *layers = json_get(manifest, "layers");
+    int count = 0;
+    for (const char *l = layers ? json_next(layers, 1) : NULL; l; l = json_next(l, 0))
+        count++;
+
+    jobs = calloc(count ? count : 1, sizeof(*jobs));
+    if (!jobs)
+    {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    int i = 0;
+    for (const char *l = layers ? json_next(layers, 1) : NULL; l; l = json_next(l, 0), i++)
+    {
+        d = json_get(l, "digest");
+        if (!d || json_string(d, digest, sizeof(digest)) < 0 ||
+            parse_digest(digest, jobs[i].hex) < 0)
+        {
+            fprintf(stderr, "layer %d: bad digest\n", i);
+            goto out;
+        }
+        snprintf(jobs[i].blob, sizeof(jobs[i].blob), "%s/blobs/sha256/%s", oci_dir, jobs[i].hex);
+    }
+
+    if (mkdir_p(CDOCKER_STORE_DIR "/layers", 0700) != 0 ||
+        mkdir_p(CDOCKER_STORE_DIR "/images", 0700) != 0)
+    {
+        perror("mkdir " CDOCKER_STORE_DIR);
+        ret = -errno;
+        goto out;
+    }
+
+    ret = extract_layers(jobs, count);
+    if (ret < 0)
+        goto out;
+
+    int cached = 0;
+    for (i = 0; i < count; i++)
+        cached += jobs[i].cached;
+
+    // Write the layer list next to it, then rename, so readers never see
+    // a partial image
+    char tmp[sizeof(path) + 8];
+    snprintf(path, sizeof(path), CDOCKER_STORE_DIR "/images/%s", name);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f)
+    {
+        perror(tmp);
+        ret = -errno;
+        goto out;
+    }
+    for (i = 0; i < count; i++)
+        fprintf(f, "sha256:%s\n", jobs[i].hex);
+    if (fclose(f) != 0 || rename(tmp, path) != 0)
+    {
+        perror(path);
+        ret = -errno;
+        goto out;
+    }
+
+    printf("imported %s: %d layers (%d already in store)\n", name, count, cached);
+    ret = 0;
+
+out:
+    free(jobs);
+    free(manifest);
+    free(index);
+    return ret;
+}
+
+// Build an overlay lowerdir string ("top:...:bottom") for an imported image
+int image_lower_stack(const char *name, char *out, size_t len)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), CDOCKER_STORE_DIR "/images/%s", name);
+
+    char *list = read_file(path);
+    if (!list)
+        return -ENOENT;
+
+    out[0] = '\0';
+    size_t used = 0;
+    int ret = 0;
+
+    // The file is bottom-first, overlay wants top-first: prepend each layer
+    for (char *line = strtok(list, "\n"); line; line = strtok(NULL, "\n"))
+    {
+        char hex[65], dir[PATH_MAX];
+        if (parse_digest(line, hex) < 0)
+            continue;
+
+        int n = snprintf(dir, sizeof(dir), CDOCKER_STORE_DIR "/layers/%s%s",
+                         hex, used ? ":" : "");
+        if (used + n + 1 > len)
+        {
+            ret = -E2BIG;
+            break;
+        }
+        memmove(out + n, out, used + 1);
+        memcpy(out, dir, n);
+        used += n;
+    }
+
+    free(list);
+    if (ret == 0 && used == 0)
+        ret = -ENOENT;
+    return ret;
+}
+
+#endif // CDOCKER_LAYER_STORE_H
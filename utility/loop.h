@@ -0,0 +1,90 @@
+#ifndef CDOCKER_LOOP_H
+#define CDOCKER_LOOP_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/loop.h>
+
+/*
+ * Read-only loop devices for image files. LOOP_CONFIGURE (5.8+) binds the
+ * file and sets every flag in one ioctl, with direct I/O so the file's
+ * pages aren't cached a second time under the device's; older kernels
+ * get LOOP_SET_FD then LOOP_SET_STATUS64. Devices are autoclear: they go
+ * away with the last mount on them.
+ */
+
+#define LOOP_ATTACH_TRIES 16    // free devices taken by someone else first
+
+static int loop_configure(int loop, int fd)
+{
+    struct loop_config cfg = {
+        .fd = fd,
+        .info.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR | LO_FLAGS_DIRECT_IO,
+    };
+    if (ioctl(loop, LOOP_CONFIGURE, &cfg) == 0)
+        return 0;
+
+    // The file's filesystem can't do direct I/O at the device's block size
+    if (errno == EINVAL)
+    {
+        cfg.info.lo_flags &= ~LO_FLAGS_DIRECT_IO;
+        if (ioctl(loop, LOOP_CONFIGURE, &cfg) == 0)
+            return 0;
+    }
+    if (errno != ENOTTY && errno != EINVAL)
+        return -1;
+
+    // Before LOOP_CONFIGURE
+    if (ioctl(loop, LOOP_SET_FD, fd) != 0)
+        return -1;
+    if (ioctl(loop, LOOP_SET_STATUS64, &cfg.info) != 0)
+    {
+        int err = errno;
+        ioctl(loop, LOOP_CLR_FD, 0);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+// Bind fd (open read-only) to a free loop device. Returns the device,
+// open, with its path in dev.
+int loop_attach(int fd, char *dev, size_t len)
+{
+    int ctl = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    if (ctl < 0)
+    {
+        perror("/dev/loop-control");
+        return -1;
+    }
+
+    int loop = -1;
+    for (int tries = 0; loop < 0 && tries < LOOP_ATTACH_TRIES; tries++)
+    {
+        int n = ioctl(ctl, LOOP_CTL_GET_FREE);
+        if (n < 0)
+            break;
+        snprintf(dev, len, "/dev/loop%d", n);
+        loop = open(dev, O_RDONLY | O_CLOEXEC);
+        if (loop >= 0 && loop_configure(loop, fd) != 0)
+        {
+            int err = errno;
+            close(loop);
+            loop = -1;
+            errno = err;
+            if (err != EBUSY)
+                break;
+        }
+    }
+    if (loop < 0)
+        perror("attach loop device");
+    close(ctl);
+    return loop;
+}
+
+#endif // CDOCKER_LOOP_H
@@ -0,0 +1,794 @@
+#ifndef CDOCKER_NETNS_POOL_H
+#define CDOCKER_NETNS_POOL_H
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <linux/pkt_sched.h>
+#include <linux/fib_rules.h>
+
+#include "ns.h"
+#include "nft.h"
+#include "spawn.h"
+#include "fdpass.h"
+
+/*
+ * Pre-warmed network namespaces.
+ *
+ * The network is the slowest part of a launch: a veth pair, moving one
+ * end, addresses, routes, all between clone and go. With a pool, a
+ * helper process does that ahead of time. It keeps up to K namespaces
+ * fully configured (lo up, eth0 with the container's address and default
+ * route, the host end on the bridge) and queues them to us as netns fds
+ * on a socketpair; the socket's queue is the pool. A container then
+ * joins one with setns() instead of cloning with CLONE_NEWNET, and the
+ * parent has nothing left to do for it.
+ *
+ * Taking one tells the helper to make the next, in the background. After
+ * the container exits its namespace goes back to the helper, which
+ * resets it (links, IPv4 and IPv6 addresses, routes in every table and
+ * policy rules the container added are removed, ours restored, qdiscs,
+ * neighbours and nftables flushed, the net sysctls put back to a fresh
+ * namespace's) and queues it again. One it can't put right, e.g. with
+ * eth0 renamed, a default rule deleted, legacy iptables tables or a
+ * sysctl that won't go back, is thrown away. If none is ready, the
+ * launch sets its network up inline as before.
+ *
+ * Like the netlink session, the pool is per process (forked launch
+ * workers start their own) and its helper dies with it.
+ */
+
+#define NETNS_POOL_MAX  64
+#define NETNS_DUMP_MAX  64  // links a reset will clean up
+#define NETNS_DUMP_BUF  (64 * 1024) // addresses/routes/rules, as dumped
+#define NETNS_SYSCTL_VALUE_MAX 4096
+
+enum netns_op {
+    NETNS_READY,    // helper -> us, with the netns fd
+    NETNS_TAKEN,    // us -> helper: one fewer ready, make another
+    NETNS_RETURN,   // us -> helper, with the netns fd: reset and reuse
+};
+
+struct netns_msg {
+    int op;
+    struct container_net net;   // subnet only means something to the sender
+};
+
+struct netns_pool {
+    pid_t owner;                // process the pool belongs to; 0: none
+    pid_t pid;                  // the helper
+    int pidfd;
+    int sock;                   // our end, non-blocking
+    int size;
+    enum net_mode mode;
+    char subnet[INET_ADDRSTRLEN + 4];
+    char parent[IF_NAMESIZE];
+    struct veth_opts veth;
+};
+
+static struct netns_pool netns_pool;
+
+/*
+ * ============================================================
+ * PART 1: THE HELPER
+ * ============================================================
+ */
+
+// A new, empty network namespace as an fd, plus a netlink socket in it
+// (*nl) to configure it with; we stay in host_ns
+static int netns_new(int host_ns, int *nl)
+{
+    if (unshare(CLONE_NEWNET) != 0)
+    {
+        perror("unshare netns");
+        return -1;
+    }
+    int fd = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+    *nl = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (setns(host_ns, CLONE_NEWNET) != 0)
+    {
+        // Everything after this would happen in the wrong namespace
+        perror("setns to host");
+        _exit(1);
+    }
+    if (fd < 0 || *nl < 0)
+    {
+        perror("netns_new");
+        if (fd >= 0)
+            close(fd);
+        if (*nl >= 0)
+            close(*nl);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * The namespace's own sysctls, everything writable under /proc/sys/net,
+ * as the first namespace the helper made had them. A reset writes back
+ * whichever differ. /proc/sys/net shows the netns of whoever opens it.
+ */
+struct netns_sysctl {
+    char *path;                 // relative to /proc/sys/net
+    char *value;                // NULL: couldn't be read (stable_secret unset)
+    size_t len;
+};
+
+static struct {
+    struct netns_sysctl *v;
+    int n, cap;
+    int taken;                  // 1: done, -1: failed, resets can't be trusted
+} netns_sysctls;
+
+// The file's contents, in buf; -1 if it can't be read
+static ssize_t netns_sysctl_read(int dirfd, const char *path, char *buf)
+{
+    int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t len = read(fd, buf, NETNS_SYSCTL_VALUE_MAX);
+    close(fd);
+    return len;
+}
+
+static int netns_sysctl_add(const char *path, const char *value, ssize_t len)
+{
+    if (netns_sysctls.n == netns_sysctls.cap)
+    {
+        int cap = netns_sysctls.cap ? 2 * netns_sysctls.cap : 512;
+        struct netns_sysctl *v = realloc(netns_sysctls.v, cap * sizeof(*v));
+        if (!v)
+            return -1;
+        netns_sysctls.v = v;
+        netns_sysctls.cap = cap;
+    }
+    struct netns_sysctl *e = &netns_sysctls.v[netns_sysctls.n];
+    e->path = strdup(path);
+    e->value = len >= 0 ? malloc(len ? len : 1) : NULL;
+    e->len = len >= 0 ? len : 0;
+    if (!e->path || (len >= 0 && !e->value))
+    {
+        free(e->path);
+        free(e->value);
+        return -1;
+    }
+    if (len > 0)
+        memcpy(e->value, value, len);
+    netns_sysctls.n++;
+    return 0;
+}
+
+// Record every writable file below path (in root, a /proc/sys/net fd)
+static int netns_sysctl_walk(int root, char *path, size_t plen)
+{
+    int fd = openat(root, plen ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir)
+    {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    int ret = 0;
+    static char value[NETNS_SYSCTL_VALUE_MAX];
+    struct dirent *de;
+    while (ret == 0 && (de = readdir(dir)))
+    {
+        if (de->d_name[0] == '.')
+            continue;
+        size_t len = plen + (plen != 0) + strlen(de->d_name);
+        if (len >= PATH_MAX)
+            continue;
+        sprintf(path + plen, "%s%s", plen ? "/" : "", de->d_name);
+
+        struct stat st;
+        if (fstatat(root, path, &st, 0) != 0)
+            ret = -1;
+        else if (S_ISDIR(st.st_mode))
+            ret = netns_sysctl_walk(root, path, len);
+        else if (st.st_mode & S_IWUSR)
+            ret = netns_sysctl_add(path, value, netns_sysctl_read(root, path, value));
+        path[plen] = '\0';
+    }
+    closedir(dir);
+    return ret;
+}
+
+// In the namespace to take them from
+static int netns_sysctl_snapshot(void)
+{
+    char path[PATH_MAX] = "";
+    int root = open("/proc/sys/net", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root < 0 || netns_sysctl_walk(root, path, 0) < 0)
+    {
+        perror("netns sysctl snapshot");
+        if (root >= 0)
+            close(root);
+        return -1;
+    }
+    close(root);
+    return 0;
+}
+
+// In the namespace to reset: one pass, writing back whatever differs.
+// Gives the number written, -1 for one that can't be put back.
+static int netns_sysctl_restore_pass(int root)
+{
+    static char value[NETNS_SYSCTL_VALUE_MAX];
+    int written = 0;
+    for (int i = 0; i < netns_sysctls.n; i++)
+    {
+        const struct netns_sysctl *e = &netns_sysctls.v[i];
+        ssize_t len = netns_sysctl_read(root, e->path, value);
+        if (!e->value)
+        {
+            // Set since, and there's no unsetting it
+            if (len >= 0)
+                return -1;
+            continue;
+        }
+        if (len < 0)
+        {
+            // Gone with a device, or never there
+            if (errno == ENOENT)
+                continue;
+            return -1;
+        }
+        if ((size_t)len == e->len && memcmp(value, e->value, len) == 0)
+            continue;
+
+        int fd = openat(root, e->path, O_WRONLY | O_CLOEXEC);
+        int ok = fd >= 0 && write(fd, e->value, e->len) == (ssize_t)e->len;
+        if (fd >= 0)
+            close(fd);
+        if (!ok)
+            return -1;
+        written++;
+    }
+    return written;
+}
+
+// Writing conf/all/ also writes every device's, so a pass can undo an
+// earlier one's work; it's settled once a pass has nothing to write
+static int netns_sysctl_restore(void)
+{
+    if (netns_sysctls.taken != 1)
+        return -1;
+    int root = open("/proc/sys/net", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root < 0)
+        return -1;
+    int n = -1;
+    for (int pass = 0; pass < 3; pass++)
+        if ((n = netns_sysctl_restore_pass(root)) <= 0)
+            break;
+    close(root);
+    return n == 0 ? 0 : -1;
+}
+
+// Allocate an address and build a configured namespace around it
+static int netns_make(const char *subnet, enum net_mode mode, const char *parent,
+                      const struct veth_opts *veth, struct container_net *net)
+{
+    struct net_host *host = net_host_get();
+    if (!host || network_alloc(net, subnet, mode, parent, veth) < 0)
+        return -1;
+
+    int nl;
+    int ns = netns_new(host->netns, &nl);
+    if (ns < 0 || network_configure(net, ns, nl) < 0)
+    {
+        teardown_network(net);
+        if (ns >= 0)
+            close(ns);
+        return -1;
+    }
+
+    // The first one is what every reset puts back
+    if (!netns_sysctls.taken)
+    {
+        if (setns(ns, CLONE_NEWNET) != 0)
+            netns_sysctls.taken = -1;
+        else
+            netns_sysctls.taken = netns_sysctl_snapshot() == 0 ? 1 : -1;
+        if (setns(host->netns, CLONE_NEWNET) != 0)
+        {
+            perror("setns to host");
+            _exit(1);
+        }
+    }
+    return ns;
+}
+
+struct netns_dump {
+    unsigned int lo, eth0;
+    unsigned int links[NETNS_DUMP_MAX];
+    int nlinks;
+    char msgs[NETNS_DUMP_BUF];  // RTM_NEW* replies to send back as RTM_DEL*
+    size_t len;
+    unsigned int rules;         // NETNS_RULE_* bits: default rules found intact
+    int full;                   // more than fits: the reset gives up
+};
+
+// A fresh namespace's policy rules: local, main and default for IPv4, no
+// default for IPv6
+enum {
+    NETNS_RULE_LOCAL4 = 1 << 0, NETNS_RULE_MAIN4 = 1 << 1, NETNS_RULE_DEFAULT4 = 1 << 2,
+    NETNS_RULE_LOCAL6 = 1 << 3, NETNS_RULE_MAIN6 = 1 << 4,
+    NETNS_RULES_DEFAULT = (1 << 5) - 1,
+};
+
+// Keep a dumped object to be deleted, as the kernel described it; the
+// same message with RTM_DEL* names exactly that one
+static void netns_dump_keep(struct netns_dump *d, struct nlmsghdr *nlh)
+{
+    if (nlh->nlmsg_len > NL_MSG_MAX || d->len + NLMSG_ALIGN(nlh->nlmsg_len) > sizeof(d->msgs))
+    {
+        d->full = 1;
+        return;
+    }
+    memcpy(d->msgs + d->len, nlh, nlh->nlmsg_len);
+    d->len += NLMSG_ALIGN(nlh->nlmsg_len);
+}
+
+// Everything but lo and our veth (eth0, with its peer in another netns)
+static int netns_link_cb(struct nlmsghdr *nlh, void *arg)
+{
+    struct netns_dump *d = arg;
+    if (nlh->nlmsg_type != RTM_NEWLINK)
+        return 0;
+
+    struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    struct rtattr *tb[IFLA_MAX + 1];
+    nl_attr_parse(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+    const char *name = tb[IFLA_IFNAME] ? RTA_DATA(tb[IFLA_IFNAME]) : "";
+
+    if (strcmp(name, "lo") == 0)
+        d->lo = ifi->ifi_index;
+    else if (strcmp(name, "eth0") == 0 && tb[IFLA_LINK_NETNSID])
+        d->eth0 = ifi->ifi_index;
+    else if (d->nlinks < NETNS_DUMP_MAX)
+        d->links[d->nlinks++] = ifi->ifi_index;
+    else
+        d->full = 1;
+    return 0;
+}
+
+// Every address except lo's 127.0.0.1 (its IPv6 ones went with it down)
+static int netns_addr_cb(struct nlmsghdr *nlh, void *arg)
+{
+    struct netns_dump *d = arg;
+    if (nlh->nlmsg_type != RTM_NEWADDR)
+        return 0;
+
+    struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+    struct rtattr *tb[IFA_MAX + 1];
+    nl_attr_parse(tb, IFA_MAX, IFA_RTA(ifa), IFA_PAYLOAD(nlh));
+    if (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)
+        return 0;
+    if (ifa->ifa_family == AF_INET && ifa->ifa_index == d->lo && tb[IFA_LOCAL] &&
+        *(uint32_t *)RTA_DATA(tb[IFA_LOCAL]) == htonl(INADDR_LOOPBACK) && ifa->ifa_prefixlen == 8)
+        return 0;
+
+    netns_dump_keep(d, nlh);
+    return 0;
+}
+
+// Every IPv4 and IPv6 route, in any table: lo's come back as it goes up,
+// eth0's with its address
+static int netns_route_cb(struct nlmsghdr *nlh, void *arg)
+{
+    struct netns_dump *d = arg;
+    if (nlh->nlmsg_type != RTM_NEWROUTE)
+        return 0;
+
+    struct rtmsg *rtm = NLMSG_DATA(nlh);
+    if (rtm->rtm_family == AF_INET || rtm->rtm_family == AF_INET6)
+        netns_dump_keep(d, nlh);
+    return 0;
+}
+
+// Every rule but the first copy of each default one: the kernel's own,
+// with nothing besides its table and priority
+static int netns_rule_cb(struct nlmsghdr *nlh, void *arg)
+{
+    struct netns_dump *d = arg;
+    if (nlh->nlmsg_type != RTM_NEWRULE)
+        return 0;
+
+    struct fib_rule_hdr *frh = NLMSG_DATA(nlh);
+    if (frh->family != AF_INET && frh->family != AF_INET6)
+        return 0;
+
+    struct rtattr *rta = (struct rtattr *)((char *)frh + NLMSG_ALIGN(sizeof(*frh)));
+    int len = NLMSG_PAYLOAD(nlh, sizeof(*frh));
+    int plain = frh->action == FR_ACT_TO_TBL && !frh->dst_len && !frh->src_len &&
+                !frh->tos && !frh->flags;
+    uint32_t table = frh->table, prio = 0, proto = RTPROT_UNSPEC;
+    for (; plain && RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    {
+        if (rta->rta_type == FRA_TABLE)
+            table = *(uint32_t *)RTA_DATA(rta);
+        else if (rta->rta_type == FRA_PRIORITY)
+            prio = *(uint32_t *)RTA_DATA(rta);
+        else if (rta->rta_type == FRA_PROTOCOL)
+            proto = *(uint8_t *)RTA_DATA(rta);
+        else if (rta->rta_type != FRA_SUPPRESS_PREFIXLEN || *(int32_t *)RTA_DATA(rta) != -1)
+            plain = 0;      // -1: unset, some kernels send it anyway
+    }
+
+    unsigned int bit = 0;
+    if (plain && proto == RTPROT_KERNEL)
+    {
+        int v6 = frh->family == AF_INET6;
+        if (prio == 0 && table == RT_TABLE_LOCAL)
+            bit = v6 ? NETNS_RULE_LOCAL6 : NETNS_RULE_LOCAL4;
+        else if (prio == 32766 && table == RT_TABLE_MAIN)
+            bit = v6 ? NETNS_RULE_MAIN6 : NETNS_RULE_MAIN4;
+        else if (prio == 32767 && table == RT_TABLE_DEFAULT && !v6)
+            bit = NETNS_RULE_DEFAULT4;
+    }
+    if (bit && !(d->rules & bit))
+        d->rules |= bit;
+    else
+        netns_dump_keep(d, nlh);
+    return 0;
+}
+
+// All families; the callback picks what it wants to delete
+static int netns_dump(struct nl_session *nl, uint16_t type, size_t hdrlen,
+                      nl_reply_cb cb, struct netns_dump *d)
+{
+    d->len = 0;
+    if (!nl_session_msg(nl, type, NLM_F_DUMP, hdrlen))
+        return -1;
+
+    struct nl_request *req = nl_session_last(nl);
+    req->what = "netns reset dump";
+    req->cb = cb;
+    req->arg = d;
+    return nl_session_flush(nl) < 0 || d->full ? -1 : 0;
+}
+
+// Send what the last dump kept back as type, to delete it
+static int netns_dump_delete(struct nl_session *nl, struct netns_dump *d, uint16_t type,
+                             int ignore_error)
+{
+    for (size_t off = 0; off < d->len;)
+    {
+        struct nlmsghdr *nlh = (struct nlmsghdr *)(d->msgs + off);
+        size_t len = NLMSG_PAYLOAD(nlh, 0);
+        struct nl_msg *msg = nl_session_msg(nl, type, NLM_F_ACK, len);
+        if (!msg)
+            return -1;
+        memcpy(NLMSG_DATA(msg->nlh), NLMSG_DATA(nlh), len);
+        nl_session_last(nl)->what = "netns reset";
+        nl_session_last(nl)->ignore_error = ignore_error;
+        off += NLMSG_ALIGN(nlh->nlmsg_len);
+    }
+    return nl_session_flush(nl);
+}
+
+// Legacy xtables tables can't be flushed short of replacing each one
+// whole; a namespace that has any is thrown away instead
+static int netns_xtables_used(void)
+{
+    static const char *const names[] = {
+        "/proc/net/ip_tables_names", "/proc/net/ip6_tables_names", "/proc/net/arp_tables_names",
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    {
+        char c;
+        int fd = open(names[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue;   // not built in: none of those
+        ssize_t n = read(fd, &c, 1);
+        close(fd);
+        if (n != 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Drop ifindex's qdisc at parent, its root or ingress (clsact too), and
+// the filters on it; ENOENT if it only has the default
+static void netns_qdisc_del(struct nl_session *nl, unsigned int ifindex, uint32_t parent)
+{
+    struct nl_msg *msg = nl_session_msg(nl, RTM_DELQDISC, NLM_F_ACK, sizeof(struct tcmsg));
+    if (!msg)
+        return;
+    struct tcmsg *tcm = NLMSG_DATA(msg->nlh);
+    tcm->tcm_family = AF_UNSPEC;
+    tcm->tcm_ifindex = ifindex;
+    tcm->tcm_parent = parent;
+    nl_session_last(nl)->what = "netns reset qdisc";
+    nl_session_last(nl)->ignore_error = ENOENT;
+}
+
+// Put a returned namespace back the way netns_make() left it. Only one
+// dump can run at a time on a socket, hence the separate flushes.
+static int netns_reset(const struct container_net *net, int ns)
+{
+    struct net_host *host = net_host_get();
+    if (!host || setns(ns, CLONE_NEWNET) != 0)
+        return -1;
+
+    int ret = -1;
+    struct nl_session nl;
+    struct netns_dump d;
+    memset(&d, 0, sizeof(d));
+    if (nl_session_open(&nl, NETLINK_ROUTE) < 0)
+        goto out;
+
+    if (netns_dump(&nl, RTM_GETLINK, sizeof(struct ifinfomsg), netns_link_cb, &d) < 0 ||
+        !d.lo || !d.eth0)
+        goto close;
+    for (int i = 0; i < d.nlinks; i++)
+    {
+        nl_link_del_index(&nl, d.links[i]);
+        nl_session_last(&nl)->ignore_error = ENODEV;
+    }
+
+    // Qdiscs take their filters with them. Taking eth0 down flushes its
+    // neighbours, permanent ones too, and lo and eth0 down take their
+    // IPv6 addresses and routes; both come back up as fresh.
+    netns_qdisc_del(&nl, d.lo, TC_H_ROOT);
+    netns_qdisc_del(&nl, d.lo, TC_H_INGRESS);
+    netns_qdisc_del(&nl, d.eth0, TC_H_ROOT);
+    netns_qdisc_del(&nl, d.eth0, TC_H_INGRESS);
+    nl_if_set_flags(&nl, "eth0", 0, IFF_UP);
+    nl_if_set_flags(&nl, "lo", 0, IFF_UP);
+    if (nl_session_flush(&nl) < 0)
+        goto close;
+
+    // Addresses take their prefix routes with them; what's left after
+    // that was added by hand, in whatever table
+    if (netns_dump(&nl, RTM_GETADDR, sizeof(struct ifaddrmsg), netns_addr_cb, &d) < 0 ||
+        netns_dump_delete(&nl, &d, RTM_DELADDR, EADDRNOTAVAIL) < 0 ||
+        netns_dump(&nl, RTM_GETROUTE, sizeof(struct rtmsg), netns_route_cb, &d) < 0 ||
+        netns_dump_delete(&nl, &d, RTM_DELROUTE, ESRCH) < 0 ||
+        netns_dump(&nl, RTM_GETRULE, sizeof(struct fib_rule_hdr), netns_rule_cb, &d) < 0 ||
+        netns_dump_delete(&nl, &d, RTM_DELRULE, ENOENT) < 0)
+        goto close;
+    if (d.rules != NETNS_RULES_DEFAULT || netns_xtables_used())
+        goto close;
+
+    // Nothing of ours lives in there; ENOENT if nf_tables was never used
+    nft_flush_ruleset();
+
+    // Sysctls first: lo and eth0 come up as configured (disable_ipv6, say)
+    if (netns_sysctl_restore() < 0)
+        goto close;
+    nl_if_up(&nl, "lo");
+    network_queue_eth0(&nl, net, d.eth0);
+    ret = nl_session_flush(&nl);
+
+close:
+    nl_session_close(&nl);
+out:
+    if (setns(host->netns, CLONE_NEWNET) != 0)
+    {
+        perror("setns to host");
+        _exit(1);
+    }
+    return ret;
+}
+
+// Queue a ready namespace to the owner and remember it until it's taken
+static void netns_offer(int sock, const struct container_net *net, int ns,
+                        struct container_net *ready, int *nready)
+{
+    struct netns_msg m = { .op = NETNS_READY, .net = *net };
+    struct iovec iov = { .iov_base = &m, .iov_len = sizeof(m) };
+
+    if (fd_sendmsg(sock, &iov, 1, &ns, 1) == 0)
+        ready[(*nready)++] = *net;
+    else
+        teardown_network(&m.net);
+    close(ns);
+}
+
+struct netns_helper_args {
+    int sock;                   // the helper's end
+    int peer;                   // the owner's end, closed in the helper
+    const char *subnet;
+    enum net_mode mode;
+    const char *parent;
+    const struct veth_opts *veth;
+    int size;
+};
+
+static int netns_helper(void *arg)
+{
+    struct netns_helper_args *a = arg;
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    close(a->peer);
+
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    // Open the host netns and session before the first unshare
+    if (!net_host_get())
+        return 1;
+
+    static struct container_net ready[2 * NETNS_POOL_MAX];
+    int nready = 0;
+
+    for (;;)
+    {
+        // Top the pool up while nobody's asking for anything
+        struct pollfd pfd = { .fd = a->sock, .events = POLLIN };
+        int n = poll(&pfd, 1, nready < a->size ? 0 : -1);
+        if (n == 0)
+        {
+            struct container_net net;
+            int ns = netns_make(a->subnet, a->mode, a->parent, a->veth, &net);
+            if (ns >= 0)
+                netns_offer(a->sock, &net, ns, ready, &nready);
+            else
+                nanosleep(&(struct timespec){ .tv_nsec = 100 * 1000000 }, NULL);
+            continue;
+        }
+        if (n < 0)
+            continue;
+
+        struct netns_msg m;
+        int ns;
+        ssize_t len = fd_recvmsg(a->sock, &m, sizeof(m), &ns, 1);
+        if (len <= 0)
+            break;      // owner gone: the queued namespaces go with its socket
+        if (len != sizeof(m))
+        {
+            if (ns >= 0)
+                close(ns);
+            continue;
+        }
+
+        if (m.op == NETNS_TAKEN)
+        {
+            for (int i = 0; i < nready; i++)
+                if (ready[i].slot == m.net.slot)
+                {
+                    ready[i] = ready[--nready];
+                    break;
+                }
+        }
+        else if (m.op == NETNS_RETURN && ns >= 0)
+        {
+            // Resetting is cheaper than making one, so a returned namespace
+            // is kept even with the pool already topped up; up to twice
+            // its size, or a sequential launcher would never reuse any
+            m.net.subnet = a->subnet;
+            if (nready < 2 * a->size && netns_reset(&m.net, ns) == 0)
+                netns_offer(a->sock, &m.net, ns, ready, &nready);
+            else
+            {
+                teardown_network(&m.net);
+                close(ns);
+            }
+        }
+        else if (ns >= 0)
+            close(ns);
+    }
+
+    // Their veths would only go once the namespaces are freed, async;
+    // delete them now so the slots can be reused straight away
+    for (int i = 0; i < nready; i++)
+        teardown_network(&ready[i]);
+    return 0;
+}
+
+/*
+ * ============================================================
+ * PART 2: THE OWNER'S SIDE
+ * ============================================================
+ */
+
+static struct netns_pool *netns_pool_get(const char *subnet, enum net_mode mode,
+                                         const char *parent, const struct veth_opts *veth,
+                                         int size)
+{
+    struct netns_pool *p = &netns_pool;
+
+    // Inherited over fork: the helper isn't ours to talk to
+    if (p->owner && p->owner != getpid())
+    {
+        close(p->sock);
+        close(p->pidfd);
+        memset(p, 0, sizeof(*p));
+    }
+    if (p->owner)
+        return p->mode == mode && strcmp(p->subnet, subnet) == 0 &&
+               strcmp(p->parent, parent ? parent : "") == 0 &&
+               memcmp(&p->veth, veth, sizeof(*veth)) == 0 ? p : NULL;
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0)
+    {
+        perror("socketpair netns pool");
+        return NULL;
+    }
+
+    struct netns_helper_args args = {
+        .sock = sv[1], .peer = sv[0], .subnet = subnet, .mode = mode, .parent = parent,
+        .veth = veth,
+        .size = size < 1 ? 1 : size > NETNS_POOL_MAX ? NETNS_POOL_MAX : size,
+    };
+    p->pid = spawn_child(netns_helper, &args, 0, -1, &p->pidfd);
+    close(sv[1]);
+    if (p->pid < 0)
+    {
+        perror("spawn netns pool");
+        close(sv[0]);
+        return NULL;
+    }
+
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    p->owner = getpid();
+    p->sock = sv[0];
+    p->size = args.size;
+    p->mode = mode;
+    snprintf(p->parent, sizeof(p->parent), "%s", parent ? parent : "");
+    p->veth = *veth;
+    snprintf(p->subnet, sizeof(p->subnet), "%s", subnet);
+    return p;
+}
+
+// A ready namespace from this process's pool (started on first use), as
+// a netns fd with net filled in; -1 if none is ready (yet)
+int netns_pool_take(const char *subnet, enum net_mode mode, const char *parent,
+                    const struct veth_opts *veth, int size, struct container_net *net)
+{
+    struct netns_pool *p = netns_pool_get(subnet, mode, parent, veth, size);
+    if (!p)
+        return -1;
+
+    struct netns_msg m;
+    int ns;
+    if (fd_recvmsg(p->sock, &m, sizeof(m), &ns, 1) != sizeof(m) || m.op != NETNS_READY || ns < 0)
+    {
+        if (ns >= 0)
+            close(ns);
+        return -1;
+    }
+
+    *net = m.net;
+    net->subnet = p->subnet;
+
+    struct netns_msg taken = { .op = NETNS_TAKEN, .net = m.net };
+    struct iovec iov = { .iov_base = &taken, .iov_len = sizeof(taken) };
+    fd_sendmsg(p->sock, &iov, 1, NULL, 0);
+    return ns;
+}
+
+// Hand a namespace from netns_pool_take() back once its container is gone
+void netns_pool_return(struct container_net *net, int ns)
+{
+    struct netns_pool *p = &netns_pool;
+    struct netns_msg m = { .op = NETNS_RETURN, .net = *net };
+    struct iovec iov = { .iov_base = &m, .iov_len = sizeof(m) };
+
+    // Without a helper to take it, tear it down here
+    if (p->owner != getpid() || fd_sendmsg(p->sock, &iov, 1, &ns, 1) < 0)
+    {
+        if (net_pool_open(net->subnet) == 0)
+            teardown_network(net);
+    }
+    close(ns);
+    net->slot = -1;
+}
+
+#endif // CDOCKER_NETNS_POOL_H
@@ -1,7 +1,13 @@
+#ifndef CDOCKER_NETWORK_H
+#define CDOCKER_NETWORK_H
+
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <errno.h>
 #include <net/if.h>
@@ -12,6 +18,14 @@
 #include <linux/veth.h>
 #include <linux/if_addr.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+#include <linux/pkt_sched.h>
+#include <linux/pkt_cls.h>
+#include <linux/tc_act/tc_mirred.h>
+#include <linux/if_ether.h>
 
 
 
@@ -151,170 +165,659 @@ void nl_attr_nest_end(struct nl_msg *msg, struct rtattr *nest)
     nest->rta_len = (char *)nl_tail(msg) - (char *)nest;
 }
 
+// Index a run of attributes by type (for parsing replies); tb has max+1 slots
+void nl_attr_parse(struct rtattr *tb[], int max, struct rtattr *rta, int len)
+{
+    memset(tb, 0, sizeof(*tb) * (max + 1));
+    for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    {
+        int type = rta->rta_type & ~NLA_F_NESTED;
+        if (type <= max)
+            tb[type] = rta;
+    }
+}
+
 /*
  * ============================================================
- * PART 3: VETH PAIR CREATION
+ * PART 3: NETLINK SESSION (BATCHED REQUESTS)
+ *
+ * A session keeps one netlink socket open and queues requests back
+ * to back in a single buffer, each with its own sequence number.
+ * nl_session_flush() hands the whole batch to the kernel with one
+ * sendmsg(), then reads replies until every request has been ACKed
+ * (or its dump has finished), matching them back by sequence number.
+ * Replies are received into a buffer that grows to fit, so multipart
+ * dumps bigger than a page work too.
  * ============================================================
  */
 
-int veth_create(const char *name1, const char *name2)
+#define NL_MSG_MAX   4096   // room reserved for each queued request
+#define NL_BATCH_MAX 64     // requests per sendmsg before auto-flush
+
+// Called for every reply that isn't an ACK/DONE (dump entries, GET replies)
+// Return < 0 to fail the request with that error
+typedef int (*nl_reply_cb)(struct nlmsghdr *nlh, void *arg);
+
+struct nl_request {
+    uint32_t seq;
+    int waiting;          // still expecting an ACK / NLMSG_DONE
+    int error;            // 0 or -errno once finished
+    int ignore_error;     // errno that counts as success (e.g. EEXIST)
+    const char *what;     // name used in error messages
+    nl_reply_cb cb;
+    void *arg;
+};
+
+struct nl_session {
+    int fd;
+    uint32_t seq;                 // last sequence number handed out
+
+    char *buf;                    // outgoing batch
+    size_t size;
+    size_t len;                   // bytes of finished messages in buf
+    struct nl_msg cur;            // message currently being built
+
+    char *rbuf;                   // incoming replies, grown on demand
+    size_t rsize;
+
+    struct nl_request reqs[NL_BATCH_MAX];
+    int count;
+    int deferred_error;           // first error from an automatic flush
+};
+
+int nl_session_flush(struct nl_session *s);
+
+// Build a session around an existing netlink socket, which it then owns.
+// The socket talks to the netns it was created in, so one opened by a
+// container and passed over lets us configure that netns from outside.
+int nl_session_open_fd(struct nl_session *s, int fd)
 {
-    int fd = nl_open();
-    if (fd < 0) return -1;
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+
+    // ACKs only carry the header of the request, not a copy of all of it
+    int one = 1;
+    setsockopt(s->fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+
+    s->size = NL_MSG_MAX * 4;
+    s->buf = malloc(s->size);
+    s->rsize = 32768;
+    s->rbuf = malloc(s->rsize);
+    if (!s->buf || !s->rbuf)
+    {
+        perror("malloc");
+        free(s->buf);
+        free(s->rbuf);
+        close(s->fd);
+        return -1;
+    }
 
-    // Allocate message buffer
-    char buf[4096];
-    memset(buf, 0, sizeof(buf));
+    return 0;
+}
+
+int nl_session_open(struct nl_session *s, int protocol)
+{
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+    if (fd < 0)
+    {
+        perror("socket(netlink)");
+        return -1;
+    }
+
+    struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+    {
+        perror("bind(netlink)");
+        close(fd);
+        return -1;
+    }
+
+    return nl_session_open_fd(s, fd);
+}
+
+void nl_session_close(struct nl_session *s)
+{
+    if (s->fd >= 0)
+        close(s->fd);
+    free(s->buf);
+    free(s->rbuf);
+    s->fd = -1;
+    s->buf = s->rbuf = NULL;
+}
+
+// Account for the message being built so the next one goes after it
+static void nl_session_finish_cur(struct nl_session *s)
+{
+    if (s->cur.nlh)
+    {
+        s->len += NLMSG_ALIGN(s->cur.nlh->nlmsg_len);
+        s->cur.nlh = NULL;
+    }
+}
+
+// Start a new request at the end of the batch.
+// hdrlen is the size of the family header (ifinfomsg, ifaddrmsg, ...),
+// which is zeroed and can be reached with NLMSG_DATA(msg->nlh).
+// Requests that carry NLM_F_ACK or NLM_F_DUMP are waited for on flush.
+struct nl_msg *nl_session_msg(struct nl_session *s, uint16_t type,
+                              uint16_t flags, size_t hdrlen)
+{
+    nl_session_finish_cur(s);
+
+    if (s->count == NL_BATCH_MAX)
+    {
+        int ret = nl_session_flush(s);
+        if (ret < 0 && !s->deferred_error)
+            s->deferred_error = ret;
+    }
+
+    if (s->len + NL_MSG_MAX > s->size)
+    {
+        size_t size = s->size * 2;
+        char *buf = realloc(s->buf, size);
+        if (!buf)
+        {
+            perror("realloc");
+            return NULL;
+        }
+        s->buf = buf;
+        s->size = size;
+    }
+
+    memset(s->buf + s->len, 0, NL_MSG_MAX);
 
-    struct nl_msg msg = {
-        .buf = buf,
-        .size = sizeof(buf),
-        .nlh = (struct nlmsghdr *)buf
+    s->cur.buf = s->buf + s->len;
+    s->cur.size = NL_MSG_MAX;
+    s->cur.nlh = (struct nlmsghdr *)s->cur.buf;
+    s->cur.nlh->nlmsg_len = NLMSG_LENGTH(hdrlen);
+    s->cur.nlh->nlmsg_type = type;
+    s->cur.nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+    s->cur.nlh->nlmsg_seq = ++s->seq;
+
+    struct nl_request *req = &s->reqs[s->count++];
+    memset(req, 0, sizeof(*req));
+    req->seq = s->seq;
+    req->waiting = (flags & (NLM_F_ACK | NLM_F_DUMP)) != 0;
+
+    return &s->cur;
+}
+
+// The request most recently queued, to attach a callback or label to it
+struct nl_request *nl_session_last(struct nl_session *s)
+{
+    return s->count ? &s->reqs[s->count - 1] : NULL;
+}
+
+static struct nl_request *nl_session_find(struct nl_session *s, uint32_t seq)
+{
+    if (s->count == 0)
+        return NULL;
+
+    uint32_t first = s->reqs[0].seq;
+    if (seq - first >= (uint32_t)s->count)
+        return NULL;    // stale reply from an earlier batch
+
+    return &s->reqs[seq - first];
+}
+
+static void nl_request_done(struct nl_request *req, int error, int *waiting)
+{
+    if (!req->waiting)
+        return;
+
+    if (error < 0 && -error == req->ignore_error)
+        error = 0;
+
+    req->error = error;
+    req->waiting = 0;
+    (*waiting)--;
+}
+
+// Receive one datagram, growing the buffer first if it wouldn't fit
+static ssize_t nl_session_recv(struct nl_session *s)
+{
+    for (;;)
+    {
+        ssize_t len = recv(s->fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("recv(netlink)");
+            return -errno;
+        }
+
+        if ((size_t)len > s->rsize)
+        {
+            char *rbuf = realloc(s->rbuf, len);
+            if (!rbuf)
+            {
+                perror("realloc");
+                return -ENOMEM;
+            }
+            s->rbuf = rbuf;
+            s->rsize = len;
+        }
+
+        len = recv(s->fd, s->rbuf, s->rsize, 0);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0)
+        {
+            perror("recv(netlink)");
+            return -errno;
+        }
+        return len;
+    }
+}
+
+// Send everything queued in one sendmsg() and collect the replies.
+// Returns 0 if every request succeeded, otherwise the first error.
+int nl_session_flush(struct nl_session *s)
+{
+    nl_session_finish_cur(s);
+
+    int ret = s->deferred_error;
+    s->deferred_error = 0;
+
+    if (s->count == 0)
+        return ret;
+
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    struct iovec iov = { .iov_base = s->buf, .iov_len = s->len };
+    struct msghdr mh = {
+        .msg_name = &kernel,
+        .msg_namelen = sizeof(kernel),
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
     };
 
-    // Initialize netlink header
-    msg.nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
-    msg.nlh->nlmsg_type = RTM_NEWLINK;
-    msg.nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK;
-    msg.nlh->nlmsg_seq = 1;
+    int waiting = 0;
+    for (int i = 0; i < s->count; i++)
+        waiting += s->reqs[i].waiting;
+
+    if (sendmsg(s->fd, &mh, 0) < 0)
+    {
+        perror("sendmsg(netlink)");
+        ret = -errno;
+        waiting = 0;
+    }
+
+    while (waiting > 0)
+    {
+        ssize_t len = nl_session_recv(s);
+        if (len < 0)
+        {
+            ret = len;
+            break;
+        }
+
+        struct nlmsghdr *nlh = (struct nlmsghdr *)s->rbuf;
+        for (; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len))
+        {
+            struct nl_request *req = nl_session_find(s, nlh->nlmsg_seq);
+            if (!req)
+                continue;
+
+            if (nlh->nlmsg_type == NLMSG_ERROR)
+            {
+                struct nlmsgerr *err = NLMSG_DATA(nlh);
+                nl_request_done(req, err->error, &waiting);
+            }
+            else if (nlh->nlmsg_type == NLMSG_DONE)
+            {
+                nl_request_done(req, 0, &waiting);
+            }
+            else if (req->cb && req->error == 0)
+            {
+                int rc = req->cb(nlh, req->arg);
+                if (rc < 0)
+                    req->error = rc;
+            }
+        }
+    }
+
+    for (int i = 0; i < s->count; i++)
+    {
+        struct nl_request *req = &s->reqs[i];
+        if (req->error == 0)
+            continue;
+
+        if (req->what)
+            fprintf(stderr, "%s failed: %s\n", req->what, strerror(-req->error));
+        if (ret == 0)
+            ret = req->error;
+    }
+
+    s->len = 0;
+    s->count = 0;
+    return ret;
+}
+
+// Open a throwaway session, run one queued request and close it again.
+// Used by the single-shot helpers below.
+#define NL_ONESHOT(queue_call)                          \
+    do {                                                \
+        struct nl_session s_;                           \
+        if (nl_session_open(&s_, NETLINK_ROUTE) < 0)    \
+            return -1;                                  \
+        struct nl_session *s = &s_;                     \
+        int ret_ = (queue_call);                        \
+        if (ret_ == 0)                                  \
+            ret_ = nl_session_flush(s);                 \
+        nl_session_close(s);                            \
+        return ret_;                                    \
+    } while (0)
+
+/*
+ * ============================================================
+ * PART 4: VETH PAIR CREATION
+ * ============================================================
+ */
+
+// Creation-time tuning, applied to both ends of a veth pair alike.
+// 0 leaves the kernel's default.
+struct veth_opts {
+    unsigned int queues;        // TX and RX queues each (default 1)
+    unsigned int mtu;
+    unsigned int gso_max_size;  // largest GSO packet handed to the driver
+    unsigned int gro_max_size;  // largest packet GRO builds
+    int gro;                    // GRO on (if_set_gro()), see below
+};
+
+// "queues=4,mtu=9000,gso_max_size=65536,gro_max_size=65536,gro"
+int veth_opts_parse(const char *spec, struct veth_opts *opts)
+{
+    static const struct { const char *key; size_t off; } keys[] = {
+        { "queues",       offsetof(struct veth_opts, queues) },
+        { "mtu",          offsetof(struct veth_opts, mtu) },
+        { "gso_max_size", offsetof(struct veth_opts, gso_max_size) },
+        { "gro_max_size", offsetof(struct veth_opts, gro_max_size) },
+    };
+
+    memset(opts, 0, sizeof(*opts));
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (char *save, *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+    {
+        if (strcmp(tok, "gro") == 0)
+        {
+            opts->gro = 1;
+            continue;
+        }
+
+        char *eq = strchr(tok, '=');
+        size_t i, n = sizeof(keys) / sizeof(keys[0]);
+        for (i = 0; eq && i < n; i++)
+            if (strncmp(tok, keys[i].key, eq - tok) == 0 && keys[i].key[eq - tok] == '\0')
+                break;
+
+        char *end;
+        unsigned long val = eq ? strtoul(eq + 1, &end, 0) : 0;
+        if (!eq || i == n || *end || val == 0 || val > UINT32_MAX)
+        {
+            fprintf(stderr, "bad veth option: %s\n", tok);
+            return -1;
+        }
+        *(unsigned int *)((char *)opts + keys[i].off) = val;
+    }
+    return 0;
+}
+
+// One end's share of veth_opts: attributes of its own ifinfomsg
+static void nl_veth_put_opts(struct nl_msg *msg, const struct veth_opts *opts)
+{
+    if (!opts)
+        return;
+    if (opts->queues)
+    {
+        nl_attr_put_u32(msg, IFLA_NUM_TX_QUEUES, opts->queues);
+        nl_attr_put_u32(msg, IFLA_NUM_RX_QUEUES, opts->queues);
+    }
+    if (opts->mtu)
+        nl_attr_put_u32(msg, IFLA_MTU, opts->mtu);
+    if (opts->gso_max_size)
+        nl_attr_put_u32(msg, IFLA_GSO_MAX_SIZE, opts->gso_max_size);
+    if (opts->gro_max_size)
+        nl_attr_put_u32(msg, IFLA_GRO_MAX_SIZE, opts->gro_max_size);
+}
+
+// A veth pair whose second end (name2) is created straight in another
+// netns: the one behind ns_fd if >= 0, else pid's if > 0, else ours.
+// name2 only has to be free in that namespace. opts may be NULL.
+int nl_veth_create_in(struct nl_session *s, const char *name1, const char *name2,
+                      int ns_fd, pid_t pid, const struct veth_opts *opts)
+{
+    struct nl_msg *msg = nl_session_msg(s, RTM_NEWLINK,
+                                        NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK,
+                                        sizeof(struct ifinfomsg));
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "veth_create";
 
     // Initialize interface info (for first interface)
-    struct ifinfomsg *ifi = NLMSG_DATA(msg.nlh);
+    struct ifinfomsg *ifi = NLMSG_DATA(msg->nlh);
     ifi->ifi_family = AF_UNSPEC;
 
     // Name the first interface
-    nl_attr_put_str(&msg, IFLA_IFNAME, name1);
+    nl_attr_put_str(msg, IFLA_IFNAME, name1);
+    nl_veth_put_opts(msg, opts);
 
     // Start IFLA_LINKINFO nest
-    struct rtattr *linkinfo = nl_attr_nest_start(&msg, IFLA_LINKINFO);
+    struct rtattr *linkinfo = nl_attr_nest_start(msg, IFLA_LINKINFO);
 
     // Specify link type as "veth"
-    nl_attr_put_str(&msg, IFLA_INFO_KIND, "veth");
+    nl_attr_put_str(msg, IFLA_INFO_KIND, "veth");
 
     // Start IFLA_INFO_DATA nest (veth-specific configuration)
-    struct rtattr *info_data = nl_attr_nest_start(&msg, IFLA_INFO_DATA);
+    struct rtattr *info_data = nl_attr_nest_start(msg, IFLA_INFO_DATA);
 
     // Start VETH_INFO_PEER nest (peer interface configuration)
-    struct rtattr *peer = nl_attr_nest_start(&msg, VETH_INFO_PEER);
+    struct rtattr *peer = nl_attr_nest_start(msg, VETH_INFO_PEER);
 
     // Peer needs its own ifinfomsg header (this is a quirk of veth)
-    struct ifinfomsg *peer_ifi = nl_tail(&msg);
+    struct ifinfomsg *peer_ifi = nl_tail(msg);
     memset(peer_ifi, 0, sizeof(*peer_ifi));
     peer_ifi->ifi_family = AF_UNSPEC;
-    msg.nlh->nlmsg_len += sizeof(struct ifinfomsg);
+    msg->nlh->nlmsg_len += sizeof(struct ifinfomsg);
 
     // Name the peer interface
-    nl_attr_put_str(&msg, IFLA_IFNAME, name2);
+    nl_attr_put_str(msg, IFLA_IFNAME, name2);
+    nl_veth_put_opts(msg, opts);
+
+    // Where the peer is created, with the same attributes that move a link
+    if (ns_fd >= 0)
+        nl_attr_put_u32(msg, IFLA_NET_NS_FD, ns_fd);
+    else if (pid > 0)
+        nl_attr_put_u32(msg, IFLA_NET_NS_PID, pid);
 
     // Close all nests (inside-out order!)
-    nl_attr_nest_end(&msg, peer);
-    nl_attr_nest_end(&msg, info_data);
-    nl_attr_nest_end(&msg, linkinfo);
+    nl_attr_nest_end(msg, peer);
+    nl_attr_nest_end(msg, info_data);
+    nl_attr_nest_end(msg, linkinfo);
 
-    // Send and check result
-    int ret = nl_send_and_wait(fd, msg.nlh);
-    if (ret < 0)
-    {
-        fprintf(stderr, "veth_create failed: %s\n", strerror(-ret));
-    }
+    return 0;
+}
 
-    close(fd);
-    return ret;
+int nl_veth_create(struct nl_session *s, const char *name1, const char *name2)
+{
+    return nl_veth_create_in(s, name1, name2, -1, 0, NULL);
 }
 
-/*
- * ============================================================
- * PART 4: MOVE INTERFACE TO NAMESPACE
- * ============================================================
- */
+int veth_create(const char *name1, const char *name2)
+{
+    NL_ONESHOT(nl_veth_create(s, name1, name2));
+}
 
-int if_move_to_pid_ns(const char *ifname, pid_t pid)
+// A Linux bridge; ports are attached with nl_if_set_master()
+int nl_bridge_create(struct nl_session *s, const char *name)
 {
-    int fd = nl_open();
-    if (fd < 0) return -1;
+    struct nl_msg *msg = nl_session_msg(s, RTM_NEWLINK,
+                                        NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK,
+                                        sizeof(struct ifinfomsg));
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "bridge_create";
 
-    unsigned int ifindex = if_nametoindex(ifname);
-    if (ifindex == 0)
-    {
-        fprintf(stderr, "Interface %s not found\n", ifname);
-        close(fd);
-        return -ENODEV;
-    }
+    struct ifinfomsg *ifi = NLMSG_DATA(msg->nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    nl_attr_put_str(msg, IFLA_IFNAME, name);
 
-    char buf[4096];
-    memset(buf, 0, sizeof(buf));
+    struct rtattr *linkinfo = nl_attr_nest_start(msg, IFLA_LINKINFO);
+    nl_attr_put_str(msg, IFLA_INFO_KIND, "bridge");
+    nl_attr_nest_end(msg, linkinfo);
 
-    struct nl_msg msg = {
-        .buf = buf,
-        .size = sizeof(buf),
-        .nlh = (struct nlmsghdr *)buf
-    };
+    return 0;
+}
 
-    msg.nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
-    msg.nlh->nlmsg_type = RTM_NEWLINK;  // modify existing link
-    msg.nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
-    msg.nlh->nlmsg_seq = 1;
+// An IFB: traffic redirected to it leaves through its qdisc, then goes
+// on where it was headed
+int nl_ifb_create(struct nl_session *s, const char *name)
+{
+    struct nl_msg *msg = nl_session_msg(s, RTM_NEWLINK,
+                                        NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK,
+                                        sizeof(struct ifinfomsg));
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "ifb_create";
 
-    struct ifinfomsg *ifi = NLMSG_DATA(msg.nlh);
+    struct ifinfomsg *ifi = NLMSG_DATA(msg->nlh);
     ifi->ifi_family = AF_UNSPEC;
-    ifi->ifi_index = ifindex;  // which interface to modify
+    nl_attr_put_str(msg, IFLA_IFNAME, name);
 
-    // IFLA_NET_NS_PID tells kernel: move this interface to the
-    // network namespace of process with this PID
-    nl_attr_put(&msg, IFLA_NET_NS_PID, &pid, sizeof(pid));
+    struct rtattr *linkinfo = nl_attr_nest_start(msg, IFLA_LINKINFO);
+    nl_attr_put_str(msg, IFLA_INFO_KIND, "ifb");
+    nl_attr_nest_end(msg, linkinfo);
 
-    int ret = nl_send_and_wait(fd, msg.nlh);
-    if (ret < 0)
-    {
-        fprintf(stderr, "if_move_to_pid_ns failed: %s\n", strerror(-ret));
-    }
+    return 0;
+}
 
-    close(fd);
-    return ret;
+// A macvlan or ipvlan link on top of parent_index, created straight in
+// another netns like nl_veth_create_in()'s peer. Its data nest holds the
+// mode: IFLA_MACVLAN_MODE or IFLA_IPVLAN_MODE (a u16), per kind.
+static int nl_lower_create_in(struct nl_session *s, const char *kind, int mode_attr,
+                              const void *mode, size_t mode_len, unsigned int parent_index,
+                              const char *name, int ns_fd, pid_t pid)
+{
+    struct nl_msg *msg = nl_session_msg(s, RTM_NEWLINK,
+                                        NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK,
+                                        sizeof(struct ifinfomsg));
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = kind;
+
+    struct ifinfomsg *ifi = NLMSG_DATA(msg->nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    nl_attr_put_str(msg, IFLA_IFNAME, name);
+    nl_attr_put_u32(msg, IFLA_LINK, parent_index);  // resolved in our netns
+    if (ns_fd >= 0)
+        nl_attr_put_u32(msg, IFLA_NET_NS_FD, ns_fd);
+    else if (pid > 0)
+        nl_attr_put_u32(msg, IFLA_NET_NS_PID, pid);
+
+    struct rtattr *linkinfo = nl_attr_nest_start(msg, IFLA_LINKINFO);
+    nl_attr_put_str(msg, IFLA_INFO_KIND, kind);
+    struct rtattr *info_data = nl_attr_nest_start(msg, IFLA_INFO_DATA);
+    nl_attr_put(msg, mode_attr, mode, mode_len);
+    nl_attr_nest_end(msg, info_data);
+    nl_attr_nest_end(msg, linkinfo);
+
+    return 0;
+}
+
+// Bridge mode: macvlans on one parent reach each other directly
+int nl_macvlan_create_in(struct nl_session *s, unsigned int parent_index,
+                         const char *name, int ns_fd, pid_t pid)
+{
+    uint32_t mode = MACVLAN_MODE_BRIDGE;
+    return nl_lower_create_in(s, "macvlan", IFLA_MACVLAN_MODE, &mode, sizeof(mode),
+                              parent_index, name, ns_fd, pid);
+}
+
+// mode is IPVLAN_MODE_L2 or IPVLAN_MODE_L3; all slaves share the
+// parent's MAC address
+int nl_ipvlan_create_in(struct nl_session *s, unsigned int parent_index, uint16_t mode,
+                        const char *name, int ns_fd, pid_t pid)
+{
+    return nl_lower_create_in(s, "ipvlan", IFLA_IPVLAN_MODE, &mode, sizeof(mode),
+                              parent_index, name, ns_fd, pid);
 }
 
 /*
  * ============================================================
- * PART 5: SET INTERFACE UP/DOWN
+ * PART 5: MOVE INTERFACE TO NAMESPACE
+ *
+ * Links are addressed by name (ifi_index = 0 + IFLA_IFNAME), so these
+ * can be queued in the same batch that creates the link.
  * ============================================================
  */
 
-int if_set_flags(const char *ifname, unsigned int flags_set, unsigned int flags_clear)
+int nl_if_move_to_pid_ns(struct nl_session *s, const char *ifname, pid_t pid)
 {
-    int fd = nl_open();
-    if (fd < 0) return -1;
+    struct nl_msg *msg = nl_session_msg(s, RTM_NEWLINK,  // modify existing link
+                                        NLM_F_ACK, sizeof(struct ifinfomsg));
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "if_move_to_pid_ns";
 
-    unsigned int ifindex = if_nametoindex(ifname);
-    if (ifindex == 0)
-    {
-        fprintf(stderr, "Interface %s not found\n", ifname);
-        close(fd);
-        return -ENODEV;
-    }
+    struct ifinfomsg *ifi = NLMSG_DATA(msg->nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    nl_attr_put_str(msg, IFLA_IFNAME, ifname);  // which interface to modify
 
-    char buf[4096];
-    memset(buf, 0, sizeof(buf));
+    // IFLA_NET_NS_PID tells kernel: move this interface to the
+    // network namespace of process with this PID
+    nl_attr_put(msg, IFLA_NET_NS_PID, &pid, sizeof(pid));
 
-    struct nl_msg msg = {
-        .buf = buf,
-        .size = sizeof(buf),
-        .nlh = (struct nlmsghdr *)buf
-    };
+    return 0;
+}
+
+int if_move_to_pid_ns(const char *ifname, pid_t pid)
+{
+    NL_ONESHOT(nl_if_move_to_pid_ns(s, ifname, pid));
+}
 
-    msg.nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
-    msg.nlh->nlmsg_type = RTM_NEWLINK;
-    msg.nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
-    msg.nlh->nlmsg_seq = 1;
+// Same, into the namespace behind an open netns fd (not a pidfd), for a
+// namespace no process lives in yet
+int nl_if_move_to_ns_fd(struct nl_session *s, const char *ifname, int ns_fd)
+{
+    struct nl_msg *msg = nl_session_msg(s, RTM_NEWLINK, NLM_F_ACK, sizeof(struct ifinfomsg));
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "if_move_to_ns_fd";
 
-    struct ifinfomsg *ifi = NLMSG_DATA(msg.nlh);
+    struct ifinfomsg *ifi = NLMSG_DATA(msg->nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    nl_attr_put_str(msg, IFLA_IFNAME, ifname);
+    nl_attr_put_u32(msg, IFLA_NET_NS_FD, ns_fd);
+
+    return 0;
+}
+
+/*
+ * ============================================================
+ * PART 6: SET INTERFACE UP/DOWN
+ * ============================================================
+ */
+
+int nl_if_set_flags(struct nl_session *s, const char *ifname,
+                    unsigned int flags_set, unsigned int flags_clear)
+{
+    struct nl_msg *msg = nl_session_msg(s, RTM_NEWLINK, NLM_F_ACK,
+                                        sizeof(struct ifinfomsg));
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "if_set_flags";
+
+    struct ifinfomsg *ifi = NLMSG_DATA(msg->nlh);
     ifi->ifi_family = AF_UNSPEC;
-    ifi->ifi_index = ifindex;
     ifi->ifi_flags = flags_set;           // flags to set
     ifi->ifi_change = flags_set | flags_clear;  // mask of flags we're changing
+    nl_attr_put_str(msg, IFLA_IFNAME, ifname);
 
-    int ret = nl_send_and_wait(fd, msg.nlh);
-    close(fd);
-    return ret;
+    return 0;
+}
+
+int if_set_flags(const char *ifname, unsigned int flags_set, unsigned int flags_clear)
+{
+    NL_ONESHOT(nl_if_set_flags(s, ifname, flags_set, flags_clear));
+}
+
+int nl_if_up(struct nl_session *s, const char *ifname)
+{
+    return nl_if_set_flags(s, ifname, IFF_UP, 0);
 }
 
 int if_up(const char *ifname)
@@ -327,16 +830,247 @@ int if_down(const char *ifname)
     return if_set_flags(ifname, 0, IFF_UP);
 }
 
+// Turn GRO on or off (legacy ETHTOOL_SGRO). sock may be any socket, a
+// netlink one included: device ioctls act on the netns it was made in.
+// On a veth, GRO on the receiving end also moves it from backlog
+// processing to per-queue NAPI, the path its XDP programs run in, so
+// multi-queue veths spread receive work across CPUs.
+int if_set_gro(int sock, const char *ifname, int on)
+{
+    struct ethtool_value ev = { .cmd = ETHTOOL_SGRO, .data = on };
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+    ifr.ifr_data = (char *)&ev;
+    if (ioctl(sock, SIOCETHTOOL, &ifr) < 0)
+    {
+        int err = errno;
+        fprintf(stderr, "gro %s on %s: %s\n", on ? "on" : "off", ifname, strerror(err));
+        return -err;
+    }
+    return 0;
+}
+
+int nl_link_del(struct nl_session *s, const char *ifname)
+{
+    struct nl_msg *msg = nl_session_msg(s, RTM_DELLINK, NLM_F_ACK,
+                                        sizeof(struct ifinfomsg));
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "link_del";
+
+    struct ifinfomsg *ifi = NLMSG_DATA(msg->nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    nl_attr_put_str(msg, IFLA_IFNAME, ifname);
+
+    return 0;
+}
+
+int link_del(const char *ifname)
+{
+    NL_ONESHOT(nl_link_del(s, ifname));
+}
+
+int nl_link_del_index(struct nl_session *s, unsigned int ifindex)
+{
+    struct nl_msg *msg = nl_session_msg(s, RTM_DELLINK, NLM_F_ACK,
+                                        sizeof(struct ifinfomsg));
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "link_del";
+
+    struct ifinfomsg *ifi = NLMSG_DATA(msg->nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = ifindex;
+
+    return 0;
+}
+
+static int nl_link_index_cb(struct nlmsghdr *nlh, void *arg)
+{
+    if (nlh->nlmsg_type == RTM_NEWLINK)
+        *(unsigned int *)arg = ((struct ifinfomsg *)NLMSG_DATA(nlh))->ifi_index;
+    return 0;
+}
+
+// Look ifname up in the session's netns (if_nametoindex() only sees
+// ours); *ifindex is filled in when the batch is flushed
+int nl_link_get_index(struct nl_session *s, const char *ifname, unsigned int *ifindex)
+{
+    struct nl_msg *msg = nl_session_msg(s, RTM_GETLINK, NLM_F_ACK,
+                                        sizeof(struct ifinfomsg));
+    if (!msg) return -ENOMEM;
+
+    struct nl_request *req = nl_session_last(s);
+    req->what = "link_get_index";
+    req->cb = nl_link_index_cb;
+    req->arg = ifindex;
+
+    struct ifinfomsg *ifi = NLMSG_DATA(msg->nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    nl_attr_put_str(msg, IFLA_IFNAME, ifname);
+    nl_attr_put_u32(msg, IFLA_EXT_MASK, RTEXT_FILTER_SKIP_STATS);
+
+    return 0;
+}
+
+// One link's counters out of a dump
+struct nl_link_stats {
+    unsigned int ifindex;
+    const char *ifname;         // NULL from nl_stats_dump()
+    struct rtnl_link_stats64 stats;
+};
+
+typedef int (*nl_link_stats_cb)(const struct nl_link_stats *st, void *arg);
+
+struct nl_link_stats_dump {
+    nl_link_stats_cb cb;
+    void *arg;
+};
+
+static int nl_link_stats_parse(struct nlmsghdr *nlh, void *arg)
+{
+    struct nl_link_stats_dump *d = arg;
+    if (nlh->nlmsg_type != RTM_NEWLINK)
+        return 0;
+
+    struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    struct rtattr *tb[IFLA_MAX + 1];
+    nl_attr_parse(tb, IFLA_MAX, IFLA_RTA(ifi), IFLA_PAYLOAD(nlh));
+    if (!tb[IFLA_IFNAME] || !tb[IFLA_STATS64])
+        return 0;
+
+    // Only 4-byte aligned in the message: copy it out
+    struct nl_link_stats st = { .ifindex = ifi->ifi_index, .ifname = RTA_DATA(tb[IFLA_IFNAME]) };
+    size_t len = RTA_PAYLOAD(tb[IFLA_STATS64]);
+    memcpy(&st.stats, RTA_DATA(tb[IFLA_STATS64]),
+           len < sizeof(st.stats) ? len : sizeof(st.stats));
+    return d->cb(&st, d->arg);
+}
+
+// Every link's counters (IFLA_STATS64) in one RTM_GETLINK dump, or only
+// links of one kind ("veth") if kind isn't NULL: the kernel filters those
+// itself, so the reply carries nothing else. cb runs per link as the
+// replies come in when the batch is flushed; d must live until then.
+int nl_link_stats(struct nl_session *s, const char *kind, struct nl_link_stats_dump *d)
+{
+    struct nl_msg *msg = nl_session_msg(s, RTM_GETLINK, NLM_F_DUMP, sizeof(struct ifinfomsg));
+    if (!msg) return -ENOMEM;
+
+    struct nl_request *req = nl_session_last(s);
+    req->what = "link stats dump";
+    req->cb = nl_link_stats_parse;
+    req->arg = d;
+
+    struct ifinfomsg *ifi = NLMSG_DATA(msg->nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    if (kind)
+    {
+        struct rtattr *linkinfo = nl_attr_nest_start(msg, IFLA_LINKINFO);
+        nl_attr_put_str(msg, IFLA_INFO_KIND, kind);
+        nl_attr_nest_end(msg, linkinfo);
+    }
+
+    return 0;
+}
+
+static int nl_stats_parse(struct nlmsghdr *nlh, void *arg)
+{
+    struct nl_link_stats_dump *d = arg;
+    if (nlh->nlmsg_type != RTM_NEWSTATS)
+        return 0;
+
+    struct if_stats_msg *ifsm = NLMSG_DATA(nlh);
+    struct rtattr *tb[IFLA_STATS_MAX + 1];
+    int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifsm));
+    nl_attr_parse(tb, IFLA_STATS_MAX,
+                  (struct rtattr *)((char *)ifsm + NLMSG_ALIGN(sizeof(*ifsm))), len);
+    if (!tb[IFLA_STATS_LINK_64])
+        return 0;
+
+    struct nl_link_stats st = { .ifindex = ifsm->ifindex };
+    size_t slen = RTA_PAYLOAD(tb[IFLA_STATS_LINK_64]);
+    memcpy(&st.stats, RTA_DATA(tb[IFLA_STATS_LINK_64]),
+           slen < sizeof(st.stats) ? slen : sizeof(st.stats));
+    return d->cb(&st, d->arg);
+}
+
+// The same counters for every link from an RTM_GETSTATS dump that asks
+// for IFLA_STATS_LINK_64 alone: a link costs ~200 bytes of reply instead
+// of a whole RTM_NEWLINK (~1.5 KB, IPv6 settings and all), which makes
+// it an order of magnitude cheaper. There are no names, only indexes.
+int nl_stats_dump(struct nl_session *s, struct nl_link_stats_dump *d)
+{
+    struct nl_msg *msg = nl_session_msg(s, RTM_GETSTATS, NLM_F_DUMP, sizeof(struct if_stats_msg));
+    if (!msg) return -ENOMEM;
+
+    struct nl_request *req = nl_session_last(s);
+    req->what = "stats dump";
+    req->cb = nl_stats_parse;
+    req->arg = d;
+
+    struct if_stats_msg *ifsm = NLMSG_DATA(msg->nlh);
+    ifsm->filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64);
+
+    return 0;
+}
+
+// Enslave a link to a bridge (or bond); ifname may have been created
+// earlier in the same batch, the master must already exist
+int nl_if_set_master(struct nl_session *s, const char *ifname, const char *master)
+{
+    unsigned int master_index = if_nametoindex(master);
+    if (master_index == 0)
+    {
+        fprintf(stderr, "Interface %s not found\n", master);
+        return -ENODEV;
+    }
+
+    struct nl_msg *msg = nl_session_msg(s, RTM_NEWLINK, NLM_F_ACK,
+                                        sizeof(struct ifinfomsg));
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "if_set_master";
+
+    struct ifinfomsg *ifi = NLMSG_DATA(msg->nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    nl_attr_put_str(msg, IFLA_IFNAME, ifname);
+    nl_attr_put_u32(msg, IFLA_MASTER, master_index);
+
+    return 0;
+}
+
+// Rename a link. The link must be down; later requests in the same batch
+// can already refer to it by the new name.
+int nl_if_rename(struct nl_session *s, const char *ifname, const char *newname)
+{
+    unsigned int ifindex = if_nametoindex(ifname);
+    if (ifindex == 0)
+    {
+        fprintf(stderr, "Interface %s not found\n", ifname);
+        return -ENODEV;
+    }
+
+    struct nl_msg *msg = nl_session_msg(s, RTM_NEWLINK, NLM_F_ACK,
+                                        sizeof(struct ifinfomsg));
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "if_rename";
+
+    struct ifinfomsg *ifi = NLMSG_DATA(msg->nlh);
+    ifi->ifi_family = AF_UNSPEC;
+    ifi->ifi_index = ifindex;   // by index, IFLA_IFNAME is the new name
+    nl_attr_put_str(msg, IFLA_IFNAME, newname);
+
+    return 0;
+}
+
 /*
  * ============================================================
- * PART 6: ASSIGN IP ADDRESS
+ * PART 7: ASSIGN IP ADDRESS
  * ============================================================
  */
 
-int if_add_addr(const char *ifname, const char *ip_cidr)
+// Parse "192.168.1.1/24" format
+int parse_cidr(const char *ip_cidr, struct in_addr *addr, int *prefix_len)
 {
-    // Parse "192.168.1.1/24" format
-    char ip_copy[64];
+    char ip_copy[64] = {0};
     strncpy(ip_copy, ip_cidr, sizeof(ip_copy) - 1);
 
     char *slash = strchr(ip_copy, '/');
@@ -346,56 +1080,175 @@ int if_add_addr(const char *ifname, const char *ip_cidr)
         return -EINVAL;
     }
     *slash = '\0';
-    int prefix_len = atoi(slash + 1);
+    *prefix_len = atoi(slash + 1);
 
-    struct in_addr addr;
-    if (inet_pton(AF_INET, ip_copy, &addr) != 1)
+    if (inet_pton(AF_INET, ip_copy, addr) != 1 || *prefix_len < 0 || *prefix_len > 32)
     {
-        fprintf(stderr, "Invalid IP address: %s\n", ip_copy);
+        fprintf(stderr, "Invalid IP address: %s\n", ip_cidr);
         return -EINVAL;
     }
 
-    int fd = nl_open();
-    if (fd < 0) return -1;
+    return 0;
+}
+
+// Queue an address for the interface with this index. Taking the index
+// rather than a name lets it share a batch with a rename of that link.
+int nl_if_add_addr_index(struct nl_session *s, unsigned int ifindex, const char *ip_cidr)
+{
+    struct in_addr addr;
+    int prefix_len;
+    int ret = parse_cidr(ip_cidr, &addr, &prefix_len);
+    if (ret < 0) return ret;
 
+    // For addresses, we use RTM_NEWADDR and ifaddrmsg instead of ifinfomsg
+    struct nl_msg *msg = nl_session_msg(s, RTM_NEWADDR,
+                                        NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK,
+                                        sizeof(struct ifaddrmsg));
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "if_add_addr";
+
+    struct ifaddrmsg *ifa = NLMSG_DATA(msg->nlh);
+    ifa->ifa_family = AF_INET;
+    ifa->ifa_prefixlen = prefix_len;
+    ifa->ifa_scope = RT_SCOPE_UNIVERSE;
+    ifa->ifa_index = ifindex;
+
+    // IFA_LOCAL = the address on this interface
+    nl_attr_put(msg, IFA_LOCAL, &addr, sizeof(addr));
+    // IFA_ADDRESS = for point-to-point, the peer; for broadcast, same as LOCAL
+    nl_attr_put(msg, IFA_ADDRESS, &addr, sizeof(addr));
+
+    return 0;
+}
+
+// The interface has to exist (in the current netns) when this is queued,
+// because addresses are attached by index rather than by name.
+int nl_if_add_addr(struct nl_session *s, const char *ifname, const char *ip_cidr)
+{
     unsigned int ifindex = if_nametoindex(ifname);
     if (ifindex == 0)
     {
         fprintf(stderr, "Interface %s not found\n", ifname);
-        close(fd);
         return -ENODEV;
     }
 
-    char buf[4096];
-    memset(buf, 0, sizeof(buf));
+    return nl_if_add_addr_index(s, ifindex, ip_cidr);
+}
 
-    struct nl_msg msg = {
-        .buf = buf,
-        .size = sizeof(buf),
-        .nlh = (struct nlmsghdr *)buf
-    };
+int if_add_addr(const char *ifname, const char *ip_cidr)
+{
+    NL_ONESHOT(nl_if_add_addr(s, ifname, ip_cidr));
+}
 
-    // For addresses, we use RTM_NEWADDR and ifaddrmsg instead of ifinfomsg
-    msg.nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
-    msg.nlh->nlmsg_type = RTM_NEWADDR;
-    msg.nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK;
-    msg.nlh->nlmsg_seq = 1;
+/*
+ * ============================================================
+ * PART 8: ROUTES AND FORWARDING
+ * ============================================================
+ */
 
-    struct ifaddrmsg *ifa = NLMSG_DATA(msg.nlh);
-    ifa->ifa_family = AF_INET;
-    ifa->ifa_prefixlen = prefix_len;
-    ifa->ifa_scope = RT_SCOPE_UNIVERSE;
-    ifa->ifa_index = ifindex;
+// Add "<dst> [via <gateway>] dev <oif>" to the main table. dst NULL is the
+// default route; gateway NULL makes it a directly connected (scope link)
+// route. oif may be 0 to let the kernel pick the device from the gateway.
+int nl_route_add(struct nl_session *s, const char *dst, const char *gateway, unsigned int oif)
+{
+    struct in_addr dst_addr = { 0 }, gw;
+    int dst_len = 0;
 
-    // IFA_LOCAL = the address on this interface
-    nl_attr_put(&msg, IFA_LOCAL, &addr, sizeof(addr));
-    // IFA_ADDRESS = for point-to-point, the peer; for broadcast, same as LOCAL
-    nl_attr_put(&msg, IFA_ADDRESS, &addr, sizeof(addr));
+    if (dst && parse_cidr(dst, &dst_addr, &dst_len) < 0)
+        return -EINVAL;
+    if (gateway && inet_pton(AF_INET, gateway, &gw) != 1)
+    {
+        fprintf(stderr, "Invalid gateway: %s\n", gateway);
+        return -EINVAL;
+    }
+
+    struct nl_msg *msg = nl_session_msg(s, RTM_NEWROUTE,
+                                        NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK,
+                                        sizeof(struct rtmsg));
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = dst ? "route_add" : "route_add_default";
+
+    struct rtmsg *rtm = NLMSG_DATA(msg->nlh);
+    rtm->rtm_family = AF_INET;
+    rtm->rtm_dst_len = dst_len;
+    rtm->rtm_table = RT_TABLE_MAIN;
+    rtm->rtm_protocol = RTPROT_BOOT;
+    rtm->rtm_scope = gateway ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+    rtm->rtm_type = RTN_UNICAST;
+
+    if (dst)
+        nl_attr_put(msg, RTA_DST, &dst_addr, sizeof(dst_addr));
+    if (gateway)
+        nl_attr_put(msg, RTA_GATEWAY, &gw, sizeof(gw));
+    if (oif)
+        nl_attr_put_u32(msg, RTA_OIF, oif);
+
+    return 0;
+}
+
+// Add "default via <gateway> dev <oif>" to the main table.
+int nl_route_add_default(struct nl_session *s, const char *gateway, unsigned int oif)
+{
+    return nl_route_add(s, NULL, gateway, oif);
+}
+
+static int nl_default_route_cb(struct nlmsghdr *nlh, void *arg)
+{
+    if (nlh->nlmsg_type != RTM_NEWROUTE)
+        return 0;
+
+    struct rtmsg *rtm = NLMSG_DATA(nlh);
+    if (rtm->rtm_family != AF_INET || rtm->rtm_dst_len != 0 ||
+        rtm->rtm_table != RT_TABLE_MAIN)
+        return 0;
+
+    struct rtattr *tb[RTA_MAX + 1];
+    nl_attr_parse(tb, RTA_MAX, RTM_RTA(rtm), RTM_PAYLOAD(nlh));
+
+    unsigned int *oif = arg;
+    if (tb[RTA_OIF] && *oif == 0)
+        *oif = *(uint32_t *)RTA_DATA(tb[RTA_OIF]);
+
+    return 0;
+}
+
+// Find the interface the IPv4 default route leaves through (the uplink).
+// Returns its index, or 0 if there is no default route.
+unsigned int nl_default_route_ifindex(struct nl_session *s)
+{
+    struct nl_msg *msg = nl_session_msg(s, RTM_GETROUTE, NLM_F_DUMP,
+                                        sizeof(struct rtmsg));
+    if (!msg) return 0;
+
+    struct rtmsg *rtm = NLMSG_DATA(msg->nlh);
+    rtm->rtm_family = AF_INET;
+
+    unsigned int oif = 0;
+    struct nl_request *req = nl_session_last(s);
+    req->what = "route dump";
+    req->cb = nl_default_route_cb;
+    req->arg = &oif;
+
+    if (nl_session_flush(s) < 0)
+        return 0;
+    return oif;
+}
+
+// Equivalent of "sysctl -w net.ipv4.ip_forward=1"
+int ip_forward_enable(void)
+{
+    int fd = open("/proc/sys/net/ipv4/ip_forward", O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror("open ip_forward");
+        return -errno;
+    }
 
-    int ret = nl_send_and_wait(fd, msg.nlh);
-    if (ret < 0)
+    int ret = 0;
+    if (write(fd, "1\n", 2) != 2)
     {
-        fprintf(stderr, "if_add_addr failed: %s\n", strerror(-ret));
+        perror("write ip_forward");
+        ret = -errno;
     }
 
     close(fd);
@@ -404,42 +1257,243 @@ int if_add_addr(const char *ifname, const char *ip_cidr)
 
 /*
  * ============================================================
- * PART 7: PUTTING IT ALL TOGETHER
+ * PART 9: TRAFFIC CONTROL
+ * ============================================================
+ *
+ * A rate limit on one interface's egress, the way
+ *
+ *   tc qdisc add dev X root handle 1: htb default 1
+ *   tc class replace dev X parent 1: classid 1:1 htb rate R ceil R burst B
+ *   tc qdisc add dev X parent 1:1 handle 10: fq_codel
+ *
+ * sets it up: everything goes through the one HTB class, and fq_codel
+ * keeps the queue behind it short and fair between flows. Applying it
+ * again only changes the class, so a limit can be changed while traffic
+ * flows; HTB itself can't be changed in place.
+ *
+ * Traffic an interface receives has no queue to shape; it's redirected
+ * to an IFB and shaped on that one's egress instead:
+ *
+ *   tc qdisc add dev X ingress
+ *   tc filter add dev X parent ffff: prio 1 handle 800::1 u32 match u32 0 0 \
+ *       action mirred egress redirect dev IFB
+ */
+
+#define TC_HTB_HANDLE   0x10000     // 1:
+#define TC_HTB_CLASS    0x10001     // 1:1
+#define TC_LEAF_HANDLE  0x100000    // 10:
+#define TC_HTB_QUANTUM  65536       // bytes per round: one GSO packet
+#define TC_INGRESS_HANDLE 0xffff0000 // ffff:
+#define TC_REDIRECT_FILTER 0x80000001  // 800::1, in u32's root hash table
+
+// tc's rate syntax: a number with an optional k/m/g/t and "bit" (bits per
+// second, also the default) or "bps" (bytes). Gives bytes per second.
+int tc_rate_parse(const char *str, uint64_t *rate)
+{
+    static const struct { const char *unit; double mult; } units[] = {
+        { "",     1 / 8.0 }, { "bit",  1 / 8.0 }, { "bps",  1 },
+        { "kbit", 1e3 / 8 }, { "mbit", 1e6 / 8 }, { "gbit", 1e9 / 8 }, { "tbit", 1e12 / 8 },
+        { "kbps", 1e3 },     { "mbps", 1e6 },     { "gbps", 1e9 },     { "tbps", 1e12 },
+    };
+
+    char *end;
+    double val = strtod(str, &end);
+    if (end == str || val < 0)
+        return -1;
+    for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++)
+    {
+        if (strcasecmp(end, units[i].unit) == 0)
+        {
+            *rate = val * units[i].mult;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static struct nl_msg *nl_tc_msg(struct nl_session *s, uint16_t type, uint16_t flags,
+                                unsigned int ifindex, uint32_t parent, uint32_t handle)
+{
+    struct nl_msg *msg = nl_session_msg(s, type, flags | NLM_F_ACK, sizeof(struct tcmsg));
+    if (!msg) return NULL;
+
+    struct tcmsg *tcm = NLMSG_DATA(msg->nlh);
+    tcm->tcm_family = AF_UNSPEC;
+    tcm->tcm_ifindex = ifindex;
+    tcm->tcm_parent = parent;
+    tcm->tcm_handle = handle;
+    return msg;
+}
+
+// Limit ifindex's egress to rate bytes per second, bursting up to 10ms
+// of it (at least one GSO packet). Safe to repeat with another rate.
+int nl_tc_rate_limit(struct nl_session *s, unsigned int ifindex, uint64_t rate)
+{
+    // The root HTB, only if it isn't there yet
+    struct nl_msg *msg = nl_tc_msg(s, RTM_NEWQDISC, NLM_F_CREATE | NLM_F_EXCL,
+                                   ifindex, TC_H_ROOT, TC_HTB_HANDLE);
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "tc qdisc htb";
+    nl_session_last(s)->ignore_error = EEXIST;
+
+    struct tc_htb_glob glob = { .version = 3, .rate2quantum = 10, .defcls = 1 };
+    nl_attr_put_str(msg, TCA_KIND, "htb");
+    struct rtattr *opts = nl_attr_nest_start(msg, TCA_OPTIONS);
+    nl_attr_put(msg, TCA_HTB_INIT, &glob, sizeof(glob));
+    nl_attr_nest_end(msg, opts);
+
+    // The class: created, or changed if it exists. Burst is in scheduler
+    // ticks of 64ns; rates past 32 bits go in the 64-bit attributes.
+    uint64_t burst_ns = 10000000, gso_ns = 65536ULL * 1000000000 / (rate ? rate : 1);
+    if (gso_ns > burst_ns)
+        burst_ns = gso_ns;
+    uint64_t ticks = burst_ns >> 6;
+
+    struct tc_htb_opt hopt = {
+        .rate = { .rate = rate > UINT32_MAX ? UINT32_MAX : rate,
+                  .linklayer = TC_LINKLAYER_ETHERNET },
+        .buffer = ticks > UINT32_MAX ? UINT32_MAX : ticks,
+        .quantum = TC_HTB_QUANTUM,
+    };
+    hopt.ceil = hopt.rate;
+    hopt.cbuffer = hopt.buffer;
+
+    msg = nl_tc_msg(s, RTM_NEWTCLASS, NLM_F_CREATE, ifindex, TC_HTB_HANDLE, TC_HTB_CLASS);
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "tc class htb";
+    nl_attr_put_str(msg, TCA_KIND, "htb");
+    opts = nl_attr_nest_start(msg, TCA_OPTIONS);
+    nl_attr_put(msg, TCA_HTB_PARMS, &hopt, sizeof(hopt));
+    if (rate > UINT32_MAX)
+    {
+        nl_attr_put(msg, TCA_HTB_RATE64, &rate, sizeof(rate));
+        nl_attr_put(msg, TCA_HTB_CEIL64, &rate, sizeof(rate));
+    }
+    nl_attr_nest_end(msg, opts);
+
+    // fq_codel under it, with its defaults. A kernel without it keeps
+    // HTB's own pfifo there.
+    msg = nl_tc_msg(s, RTM_NEWQDISC, NLM_F_CREATE | NLM_F_REPLACE,
+                    ifindex, TC_HTB_CLASS, TC_LEAF_HANDLE);
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "tc qdisc fq_codel";
+    nl_session_last(s)->ignore_error = ENOENT;
+    nl_attr_put_str(msg, TCA_KIND, "fq_codel");
+
+    return 0;
+}
+
+// Back to the device's default qdisc, no limit
+int nl_tc_rate_clear(struct nl_session *s, unsigned int ifindex)
+{
+    struct nl_msg *msg = nl_tc_msg(s, RTM_DELQDISC, 0, ifindex, TC_H_ROOT, 0);
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "tc qdisc del";
+    nl_session_last(s)->ignore_error = ENOENT;
+    return 0;
+}
+
+// Send everything ifindex receives out through target (an IFB) first.
+// Safe to repeat: both the qdisc and the filter are only added once.
+int nl_tc_redirect_ingress(struct nl_session *s, unsigned int ifindex, unsigned int target)
+{
+    struct nl_msg *msg = nl_tc_msg(s, RTM_NEWQDISC, NLM_F_CREATE | NLM_F_EXCL,
+                                   ifindex, TC_H_INGRESS, TC_INGRESS_HANDLE);
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "tc qdisc ingress";
+    nl_session_last(s)->ignore_error = EEXIST;
+    nl_attr_put_str(msg, TCA_KIND, "ingress");
+
+    msg = nl_tc_msg(s, RTM_NEWTFILTER, NLM_F_CREATE | NLM_F_EXCL,
+                    ifindex, TC_INGRESS_HANDLE, TC_REDIRECT_FILTER);
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "tc filter u32 mirred";
+    nl_session_last(s)->ignore_error = EEXIST;
+    struct tcmsg *tcm = NLMSG_DATA(msg->nlh);
+    tcm->tcm_info = TC_H_MAKE(1 << 16, htons(ETH_P_ALL));
+    nl_attr_put_str(msg, TCA_KIND, "u32");
+
+    // One key that matches anything
+    struct {
+        struct tc_u32_sel sel;
+        struct tc_u32_key key;
+    } sel = { .sel = { .flags = TC_U32_TERMINAL, .nkeys = 1 } };
+    struct tc_mirred mirred = {
+        .action = TC_ACT_STOLEN,
+        .eaction = TCA_EGRESS_REDIR,
+        .ifindex = target,
+    };
+
+    struct rtattr *opts = nl_attr_nest_start(msg, TCA_OPTIONS);
+    nl_attr_put(msg, TCA_U32_SEL, &sel, sizeof(sel));
+    struct rtattr *acts = nl_attr_nest_start(msg, TCA_U32_ACT);
+    struct rtattr *act = nl_attr_nest_start(msg, 1);
+    nl_attr_put_str(msg, TCA_ACT_KIND, "mirred");
+    struct rtattr *aopts = nl_attr_nest_start(msg, TCA_ACT_OPTIONS);
+    nl_attr_put(msg, TCA_MIRRED_PARMS, &mirred, sizeof(mirred));
+    nl_attr_nest_end(msg, aopts);
+    nl_attr_nest_end(msg, act);
+    nl_attr_nest_end(msg, acts);
+    nl_attr_nest_end(msg, opts);
+
+    return 0;
+}
+
+// Drop ifindex's ingress or clsact qdisc, and the filters on it
+int nl_tc_ingress_clear(struct nl_session *s, unsigned int ifindex)
+{
+    struct nl_msg *msg = nl_tc_msg(s, RTM_DELQDISC, 0, ifindex, TC_H_INGRESS, 0);
+    if (!msg) return -ENOMEM;
+    nl_session_last(s)->what = "tc qdisc del ingress";
+    nl_session_last(s)->ignore_error = ENOENT;
+    return 0;
+}
+
+/*
+ * ============================================================
+ * PART 10: PUTTING IT ALL TOGETHER
  * ============================================================
  */
 
 // Example: Full container network setup
+// Two round-trips: the veth has to exist before its address can be
+// attached by index, everything else rides along in the same batches.
 int setup_container_network(pid_t container_pid,
                             const char *host_if, const char *host_ip,
                             const char *cont_if, const char *cont_ip)
 {
+    struct nl_session s;
     int ret;
 
+    if (nl_session_open(&s, NETLINK_ROUTE) < 0)
+        return -1;
+
     // Step 1: Create the veth pair (both ends start in our namespace)
+    // and move one end into the container's network namespace
     printf("Creating veth pair: %s <-> %s\n", host_if, cont_if);
-    ret = veth_create(host_if, cont_if);
-    if (ret < 0) return ret;
-
-    // Step 2: Move one end into the container's network namespace
     printf("Moving %s to container (pid %d)\n", cont_if, container_pid);
-    ret = if_move_to_pid_ns(cont_if, container_pid);
-    if (ret < 0) return ret;
+    nl_veth_create(&s, host_if, cont_if);
+    nl_if_move_to_pid_ns(&s, cont_if, container_pid);
+    ret = nl_session_flush(&s);
+    if (ret < 0) goto out;
 
-    // Step 3: Configure the host end
+    // Step 2: Configure the host end
     printf("Configuring %s with %s\n", host_if, host_ip);
-    ret = if_add_addr(host_if, host_ip);
-    if (ret < 0) return ret;
-
-    ret = if_up(host_if);
-    if (ret < 0) return ret;
+    ret = nl_if_add_addr(&s, host_if, host_ip);
+    if (ret < 0) goto out;
+    nl_if_up(&s, host_if);
+    ret = nl_session_flush(&s);
+    if (ret < 0) goto out;
 
-    // Step 4: Container end must be configured FROM INSIDE the container
+    // Step 3: Container end must be configured FROM INSIDE the container
     // (or via nsenter/setns). That's a separate concern.
 
     printf("Host side ready. Container must configure %s with %s\n",
            cont_if, cont_ip);
 
-    return 0;
+out:
+    nl_session_close(&s);
+    return ret;
 }
 
 /*
@@ -477,4 +1531,6 @@ int setup_container_network(pid_t container_pid,
 //         "veth_host", "10.0.0.1/24",
 //         "veth_cont", "10.0.0.2/24"
 //     );
-// }
\ No newline at end of file
+// }
+
+#endif // CDOCKER_NETWORK_H
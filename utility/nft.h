@@ -0,0 +1,804 @@
+#ifndef CDOCKER_NFT_H
+#define CDOCKER_NFT_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/file.h>
+#include <sys/time.h>
+#include <endian.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+#include <linux/netfilter/nf_conntrack_common.h>
+#include <linux/netfilter/x_tables.h>
+#include <linux/netfilter_ipv4/ip_tables.h>
+
+#include "network.h"
+
+/*
+ * nftables over netlink
+ *
+ * Everything cdocker needs lives in its own "cdocker" ip table, so we never
+ * touch rules owned by iptables/firewalld. Writes go through an nfnetlink
+ * batch (BATCH_BEGIN ... BATCH_END) which the kernel applies atomically.
+ *
+ * Each rule carries a key in NFTA_RULE_USERDATA. Before adding rules we
+ * dump the table once and skip any key that's already there, which is the
+ * netlink equivalent of the old "iptables -C ... || iptables -A ...".
+ * The dump and the batch are two transactions, so cdocker processes take
+ * NFT_LOCK_FILE around the pair (nft_lock()).
+ */
+
+#define NFT_TABLE "cdocker"
+#define NFT_KEY_MAX 128
+#define NFT_LOCK_FILE "/run/cdocker/nft.lock"
+
+// Held until the fd is closed; -1 (unlocked) if the file can't be opened
+static int nft_lock(void)
+{
+    int fd = open(NFT_LOCK_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd >= 0)
+        flock(fd, LOCK_EX);
+    return fd;
+}
+
+/*
+ * ============================================================
+ * PART 1: MESSAGE + EXPRESSION BUILDERS
+ * ============================================================
+ */
+
+static struct nl_msg *nft_msg(struct nl_session *s, uint16_t type, uint16_t flags, int family)
+{
+    struct nl_msg *msg = nl_session_msg(s, (NFNL_SUBSYS_NFTABLES << 8) | type,
+                                        flags, sizeof(struct nfgenmsg));
+    if (!msg) return NULL;
+
+    struct nfgenmsg *nfg = NLMSG_DATA(msg->nlh);
+    nfg->nfgen_family = family;
+    nfg->version = NFNETLINK_V0;
+    return msg;
+}
+
+// Batch delimiters are addressed to nfnetlink itself and never ACKed
+static void nft_batch(struct nl_session *s, uint16_t type)
+{
+    struct nl_msg *msg = nl_session_msg(s, type, 0, sizeof(struct nfgenmsg));
+    if (!msg) return;
+
+    struct nfgenmsg *nfg = NLMSG_DATA(msg->nlh);
+    nfg->nfgen_family = AF_UNSPEC;
+    nfg->version = NFNETLINK_V0;
+    nfg->res_id = htons(NFNL_SUBSYS_NFTABLES);
+}
+
+static void nft_put_be32(struct nl_msg *msg, int type, uint32_t val)
+{
+    nl_attr_put_u32(msg, type, htonl(val));
+}
+
+static struct rtattr *nft_nest(struct nl_msg *msg, int type)
+{
+    return nl_attr_nest_start(msg, type | NLA_F_NESTED);
+}
+
+// Open one NFTA_LIST_ELEM { NFTA_EXPR_NAME, NFTA_EXPR_DATA { ... } }.
+// Returns the inner data nest; close both with nft_expr_end().
+static struct rtattr *nft_expr_start(struct nl_msg *msg, const char *name, struct rtattr **elem)
+{
+    *elem = nft_nest(msg, NFTA_LIST_ELEM);
+    nl_attr_put_str(msg, NFTA_EXPR_NAME, name);
+    return nft_nest(msg, NFTA_EXPR_DATA);
+}
+
+static void nft_expr_end(struct nl_msg *msg, struct rtattr *data, struct rtattr *elem)
+{
+    nl_attr_nest_end(msg, data);
+    nl_attr_nest_end(msg, elem);
+}
+
+static void nft_put_data(struct nl_msg *msg, int type, const void *data, size_t len)
+{
+    struct rtattr *nest = nft_nest(msg, type);
+    nl_attr_put(msg, NFTA_DATA_VALUE, data, len);
+    nl_attr_nest_end(msg, nest);
+}
+
+// payload load: reg1 = header[offset .. offset+len], base is
+// NFT_PAYLOAD_NETWORK_HEADER or NFT_PAYLOAD_TRANSPORT_HEADER
+static void nft_expr_payload_base(struct nl_msg *msg, uint32_t base, uint32_t offset, uint32_t len)
+{
+    struct rtattr *elem;
+    struct rtattr *data = nft_expr_start(msg, "payload", &elem);
+    nft_put_be32(msg, NFTA_PAYLOAD_DREG, NFT_REG_1);
+    nft_put_be32(msg, NFTA_PAYLOAD_BASE, base);
+    nft_put_be32(msg, NFTA_PAYLOAD_OFFSET, offset);
+    nft_put_be32(msg, NFTA_PAYLOAD_LEN, len);
+    nft_expr_end(msg, data, elem);
+}
+
+// payload load: reg1 = network header[offset .. offset+len]
+void nft_expr_payload(struct nl_msg *msg, uint32_t offset, uint32_t len)
+{
+    nft_expr_payload_base(msg, NFT_PAYLOAD_NETWORK_HEADER, offset, len);
+}
+
+// meta load: reg1 = meta key (e.g. NFT_META_OIFNAME)
+void nft_expr_meta(struct nl_msg *msg, uint32_t key)
+{
+    struct rtattr *elem;
+    struct rtattr *data = nft_expr_start(msg, "meta", &elem);
+    nft_put_be32(msg, NFTA_META_DREG, NFT_REG_1);
+    nft_put_be32(msg, NFTA_META_KEY, key);
+    nft_expr_end(msg, data, elem);
+}
+
+// ct load: reg1 = conntrack key (e.g. NFT_CT_STATE)
+void nft_expr_ct(struct nl_msg *msg, uint32_t key)
+{
+    struct rtattr *elem;
+    struct rtattr *data = nft_expr_start(msg, "ct", &elem);
+    nft_put_be32(msg, NFTA_CT_DREG, NFT_REG_1);
+    nft_put_be32(msg, NFTA_CT_KEY, key);
+    nft_expr_end(msg, data, elem);
+}
+
+// reg1 = (reg1 & mask) ^ 0
+void nft_expr_mask(struct nl_msg *msg, const void *mask, uint32_t len)
+{
+    char zero[16] = {0};
+
+    struct rtattr *elem;
+    struct rtattr *data = nft_expr_start(msg, "bitwise", &elem);
+    nft_put_be32(msg, NFTA_BITWISE_SREG, NFT_REG_1);
+    nft_put_be32(msg, NFTA_BITWISE_DREG, NFT_REG_1);
+    nft_put_be32(msg, NFTA_BITWISE_LEN, len);
+    nft_put_data(msg, NFTA_BITWISE_MASK, mask, len);
+    nft_put_data(msg, NFTA_BITWISE_XOR, zero, len);
+    nft_expr_end(msg, data, elem);
+}
+
+// compare reg1 against data, stop evaluating the rule if it doesn't hold
+void nft_expr_cmp(struct nl_msg *msg, uint32_t op, const void *value, uint32_t len)
+{
+    struct rtattr *elem;
+    struct rtattr *data = nft_expr_start(msg, "cmp", &elem);
+    nft_put_be32(msg, NFTA_CMP_SREG, NFT_REG_1);
+    nft_put_be32(msg, NFTA_CMP_OP, op);
+    nft_put_data(msg, NFTA_CMP_DATA, value, len);
+    nft_expr_end(msg, data, elem);
+}
+
+// Interface names are compared as the full IFNAMSIZ buffer
+// A trailing '*' matches any name with that prefix, like nft's "veth*":
+// only the prefix bytes are compared, without the terminating NUL
+void nft_expr_ifname(struct nl_msg *msg, uint32_t meta_key, const char *ifname)
+{
+    char name[IFNAMSIZ] = {0};
+    strncpy(name, ifname, IFNAMSIZ - 1);
+
+    size_t len = strlen(name);
+    uint32_t cmp_len = IFNAMSIZ;
+    if (len > 0 && name[len - 1] == '*')
+        cmp_len = len - 1;
+
+    nft_expr_meta(msg, meta_key);
+    nft_expr_cmp(msg, NFT_CMP_EQ, name, cmp_len);
+}
+
+// ip saddr/daddr in subnet (offset 12 = saddr, 16 = daddr)
+void nft_expr_ip_subnet(struct nl_msg *msg, uint32_t offset, struct in_addr net, int prefix_len)
+{
+    uint32_t mask = prefix_len ? htonl(~0u << (32 - prefix_len)) : 0;
+    uint32_t value = net.s_addr & mask;
+
+    nft_expr_payload(msg, offset, 4);
+    nft_expr_mask(msg, &mask, 4);
+    nft_expr_cmp(msg, NFT_CMP_EQ, &value, 4);
+}
+
+void nft_expr_verdict(struct nl_msg *msg, int verdict)
+{
+    struct rtattr *elem;
+    struct rtattr *data = nft_expr_start(msg, "immediate", &elem);
+    nft_put_be32(msg, NFTA_IMMEDIATE_DREG, NFT_REG_VERDICT);
+    struct rtattr *imm = nft_nest(msg, NFTA_IMMEDIATE_DATA);
+    struct rtattr *verd = nft_nest(msg, NFTA_DATA_VERDICT);
+    nft_put_be32(msg, NFTA_VERDICT_CODE, verdict);
+    nl_attr_nest_end(msg, verd);
+    nl_attr_nest_end(msg, imm);
+    nft_expr_end(msg, data, elem);
+}
+
+// "meta l4proto tcp th dport <port>"
+void nft_expr_tcp_dport(struct nl_msg *msg, uint16_t port)
+{
+    uint8_t proto = IPPROTO_TCP;
+    uint16_t be_port = htons(port);
+
+    nft_expr_meta(msg, NFT_META_L4PROTO);
+    nft_expr_cmp(msg, NFT_CMP_EQ, &proto, sizeof(proto));
+    nft_expr_payload_base(msg, NFT_PAYLOAD_TRANSPORT_HEADER, 2, 2);
+    nft_expr_cmp(msg, NFT_CMP_EQ, &be_port, sizeof(be_port));
+}
+
+// "fib daddr type local": the packet is for one of this host's addresses
+void nft_expr_daddr_local(struct nl_msg *msg)
+{
+    uint32_t local = RTN_LOCAL;
+
+    struct rtattr *elem;
+    struct rtattr *data = nft_expr_start(msg, "fib", &elem);
+    nft_put_be32(msg, NFTA_FIB_DREG, NFT_REG_1);
+    nft_put_be32(msg, NFTA_FIB_RESULT, NFT_FIB_RESULT_ADDRTYPE);
+    nft_put_be32(msg, NFTA_FIB_FLAGS, NFTA_FIB_F_DADDR);
+    nft_expr_end(msg, data, elem);
+    nft_expr_cmp(msg, NFT_CMP_EQ, &local, sizeof(local));
+}
+
+// "dnat to addr:port": both go through registers (1 and 2) first
+void nft_expr_dnat(struct nl_msg *msg, struct in_addr addr, uint16_t port)
+{
+    uint16_t be_port = htons(port);
+    struct rtattr *elem, *data, *imm;
+
+    data = nft_expr_start(msg, "immediate", &elem);
+    nft_put_be32(msg, NFTA_IMMEDIATE_DREG, NFT_REG_1);
+    imm = nft_nest(msg, NFTA_IMMEDIATE_DATA);
+    nl_attr_put(msg, NFTA_DATA_VALUE, &addr, sizeof(addr));
+    nl_attr_nest_end(msg, imm);
+    nft_expr_end(msg, data, elem);
+
+    data = nft_expr_start(msg, "immediate", &elem);
+    nft_put_be32(msg, NFTA_IMMEDIATE_DREG, NFT_REG_2);
+    imm = nft_nest(msg, NFTA_IMMEDIATE_DATA);
+    nl_attr_put(msg, NFTA_DATA_VALUE, &be_port, sizeof(be_port));
+    nl_attr_nest_end(msg, imm);
+    nft_expr_end(msg, data, elem);
+
+    data = nft_expr_start(msg, "nat", &elem);
+    nft_put_be32(msg, NFTA_NAT_TYPE, NFT_NAT_DNAT);
+    nft_put_be32(msg, NFTA_NAT_FAMILY, NFPROTO_IPV4);
+    nft_put_be32(msg, NFTA_NAT_REG_ADDR_MIN, NFT_REG_1);
+    nft_put_be32(msg, NFTA_NAT_REG_PROTO_MIN, NFT_REG_2);
+    nft_expr_end(msg, data, elem);
+}
+
+void nft_expr_masq(struct nl_msg *msg)
+{
+    struct rtattr *elem = nft_nest(msg, NFTA_LIST_ELEM);
+    nl_attr_put_str(msg, NFTA_EXPR_NAME, "masq");
+    nl_attr_nest_end(msg, elem);
+}
+
+/*
+ * ============================================================
+ * PART 2: TABLES, CHAINS AND RULES
+ * ============================================================
+ */
+
+void nft_add_table(struct nl_session *s)
+{
+    struct nl_msg *msg = nft_msg(s, NFT_MSG_NEWTABLE, NLM_F_CREATE | NLM_F_ACK, NFPROTO_IPV4);
+    if (!msg) return;
+    nl_session_last(s)->what = "nft add table";
+    nl_attr_put_str(msg, NFTA_TABLE_NAME, NFT_TABLE);
+}
+
+// Base chain: type is "nat" or "filter", hook is NF_INET_*
+void nft_add_chain(struct nl_session *s, const char *name, const char *type,
+                   uint32_t hook, int32_t priority)
+{
+    struct nl_msg *msg = nft_msg(s, NFT_MSG_NEWCHAIN, NLM_F_CREATE | NLM_F_ACK, NFPROTO_IPV4);
+    if (!msg) return;
+    nl_session_last(s)->what = "nft add chain";
+
+    nl_attr_put_str(msg, NFTA_CHAIN_TABLE, NFT_TABLE);
+    nl_attr_put_str(msg, NFTA_CHAIN_NAME, name);
+
+    struct rtattr *h = nft_nest(msg, NFTA_CHAIN_HOOK);
+    nft_put_be32(msg, NFTA_HOOK_HOOKNUM, hook);
+    nft_put_be32(msg, NFTA_HOOK_PRIORITY, (uint32_t)priority);
+    nl_attr_nest_end(msg, h);
+
+    nl_attr_put_str(msg, NFTA_CHAIN_TYPE, type);
+}
+
+// Start appending a rule; add nft_expr_* calls, then nft_rule_end()
+struct nl_msg *nft_rule_start(struct nl_session *s, const char *chain, struct rtattr **exprs)
+{
+    struct nl_msg *msg = nft_msg(s, NFT_MSG_NEWRULE,
+                                 NLM_F_CREATE | NLM_F_APPEND | NLM_F_ACK, NFPROTO_IPV4);
+    if (!msg) return NULL;
+    nl_session_last(s)->what = "nft add rule";
+
+    nl_attr_put_str(msg, NFTA_RULE_TABLE, NFT_TABLE);
+    nl_attr_put_str(msg, NFTA_RULE_CHAIN, chain);
+    *exprs = nft_nest(msg, NFTA_RULE_EXPRESSIONS);
+    return msg;
+}
+
+void nft_rule_end(struct nl_msg *msg, struct rtattr *exprs, const char *key)
+{
+    nl_attr_nest_end(msg, exprs);
+    nl_attr_put(msg, NFTA_RULE_USERDATA, key, strlen(key));
+}
+
+/*
+ * ============================================================
+ * PART 3: EXISTING RULE LOOKUP
+ * ============================================================
+ */
+
+struct nft_keys {
+    char (*keys)[NFT_KEY_MAX];
+    int count;
+    int cap;
+};
+
+static int nft_keys_cb(struct nlmsghdr *nlh, void *arg)
+{
+    struct nft_keys *k = arg;
+
+    struct rtattr *tb[NFTA_RULE_MAX + 1];
+    nl_attr_parse(tb, NFTA_RULE_MAX,
+                  (struct rtattr *)((char *)NLMSG_DATA(nlh) + NLMSG_ALIGN(sizeof(struct nfgenmsg))),
+                  nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct nfgenmsg)));
+    if (!tb[NFTA_RULE_USERDATA])
+        return 0;
+
+    if (k->count == k->cap)
+    {
+        int cap = k->cap ? k->cap * 2 : 16;
+        void *keys = realloc(k->keys, cap * sizeof(*k->keys));
+        if (!keys) return -ENOMEM;
+        k->keys = keys;
+        k->cap = cap;
+    }
+
+    size_t len = RTA_PAYLOAD(tb[NFTA_RULE_USERDATA]);
+    if (len >= NFT_KEY_MAX) len = NFT_KEY_MAX - 1;
+    memcpy(k->keys[k->count], RTA_DATA(tb[NFTA_RULE_USERDATA]), len);
+    k->keys[k->count][len] = '\0';
+    k->count++;
+    return 0;
+}
+
+// Dump every rule key in our table (an absent table just means no keys)
+int nft_load_keys(struct nl_session *s, struct nft_keys *k)
+{
+    memset(k, 0, sizeof(*k));
+
+    struct nl_msg *msg = nft_msg(s, NFT_MSG_GETRULE, NLM_F_DUMP, NFPROTO_IPV4);
+    if (!msg) return -ENOMEM;
+    nl_attr_put_str(msg, NFTA_RULE_TABLE, NFT_TABLE);
+
+    struct nl_request *req = nl_session_last(s);
+    req->what = "nft list rules";
+    req->ignore_error = ENOENT;
+    req->cb = nft_keys_cb;
+    req->arg = k;
+
+    return nl_session_flush(s);
+}
+
+int nft_has_key(const struct nft_keys *k, const char *key)
+{
+    for (int i = 0; i < k->count; i++)
+        if (strcmp(k->keys[i], key) == 0)
+            return 1;
+    return 0;
+}
+
+void nft_keys_free(struct nft_keys *k)
+{
+    free(k->keys);
+    k->keys = NULL;
+    k->count = k->cap = 0;
+}
+
+// Rules with a key (or one that starts with it), for deleting them by
+// handle
+struct nft_rule_ref {
+    char chain[NFT_KEY_MAX];
+    uint64_t handle;            // host order
+};
+
+struct nft_rule_find {
+    const char *key;
+    int prefix;                 // key is only the start
+    struct nft_rule_ref *refs;
+    int count;
+    int cap;
+};
+
+static int nft_rule_find_cb(struct nlmsghdr *nlh, void *arg)
+{
+    struct nft_rule_find *f = arg;
+
+    struct rtattr *tb[NFTA_RULE_MAX + 1];
+    nl_attr_parse(tb, NFTA_RULE_MAX,
+                  (struct rtattr *)((char *)NLMSG_DATA(nlh) + NLMSG_ALIGN(sizeof(struct nfgenmsg))),
+                  nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct nfgenmsg)));
+    if (!tb[NFTA_RULE_USERDATA] || !tb[NFTA_RULE_HANDLE] || !tb[NFTA_RULE_CHAIN])
+        return 0;
+
+    size_t klen = strlen(f->key), len = RTA_PAYLOAD(tb[NFTA_RULE_USERDATA]);
+    if (len < klen || (!f->prefix && len != klen) ||
+        memcmp(RTA_DATA(tb[NFTA_RULE_USERDATA]), f->key, klen) != 0)
+        return 0;
+
+    if (f->count == f->cap)
+    {
+        int cap = f->cap ? f->cap * 2 : 8;
+        void *refs = realloc(f->refs, cap * sizeof(*f->refs));
+        if (!refs) return -ENOMEM;
+        f->refs = refs;
+        f->cap = cap;
+    }
+
+    struct nft_rule_ref *r = &f->refs[f->count++];
+    uint64_t handle;
+    memcpy(&handle, RTA_DATA(tb[NFTA_RULE_HANDLE]), sizeof(handle));
+    r->handle = be64toh(handle);
+    snprintf(r->chain, sizeof(r->chain), "%s", (char *)RTA_DATA(tb[NFTA_RULE_CHAIN]));
+    return 0;
+}
+
+// Every rule in our table with that key, or one starting with it
+int nft_find_rules(struct nl_session *s, const char *key, int prefix, struct nft_rule_find *f)
+{
+    memset(f, 0, sizeof(*f));
+    f->key = key;
+    f->prefix = prefix;
+
+    struct nl_msg *msg = nft_msg(s, NFT_MSG_GETRULE, NLM_F_DUMP, NFPROTO_IPV4);
+    if (!msg) return -ENOMEM;
+    nl_attr_put_str(msg, NFTA_RULE_TABLE, NFT_TABLE);
+
+    struct nl_request *req = nl_session_last(s);
+    req->what = "nft list rules";
+    req->ignore_error = ENOENT;
+    req->cb = nft_rule_find_cb;
+    req->arg = f;
+
+    return nl_session_flush(s);
+}
+
+// Queue the deletion of one found rule (inside a batch)
+void nft_del_rule(struct nl_session *s, const struct nft_rule_ref *r)
+{
+    struct nl_msg *msg = nft_msg(s, NFT_MSG_DELRULE, NLM_F_ACK, NFPROTO_IPV4);
+    if (!msg) return;
+    struct nl_request *req = nl_session_last(s);
+    req->what = "nft delete rule";
+    req->ignore_error = ENOENT;
+
+    uint64_t handle = htobe64(r->handle);
+    nl_attr_put_str(msg, NFTA_RULE_TABLE, NFT_TABLE);
+    nl_attr_put_str(msg, NFTA_RULE_CHAIN, r->chain);
+    nl_attr_put(msg, NFTA_RULE_HANDLE, &handle, sizeof(handle));
+}
+
+int nft_open(struct nl_session *s)
+{
+    if (nl_session_open(s, NETLINK_NETFILTER) < 0)
+        return -1;
+
+    // Don't hang forever if a batch gets aborted without a reply
+    struct timeval tv = { .tv_sec = 5 };
+    setsockopt(s->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return 0;
+}
+
+// "nft flush ruleset": a DELTABLE without a name drops every table of
+// every family. For resetting a namespace cdocker owns outright.
+int nft_flush_ruleset(void)
+{
+    struct nl_session s;
+    if (nft_open(&s) < 0)
+        return -1;
+
+    nft_batch(&s, NFNL_MSG_BATCH_BEGIN);
+    if (nft_msg(&s, NFT_MSG_DELTABLE, NLM_F_ACK, NFPROTO_UNSPEC))
+        nl_session_last(&s)->what = "nft flush ruleset";
+    nft_batch(&s, NFNL_MSG_BATCH_END);
+
+    int ret = nl_session_flush(&s);
+    nl_session_close(&s);
+    return ret;
+}
+
+/*
+ * ============================================================
+ * PART 4: CONTAINER NAT
+ *
+ * Netlink equivalent of:
+ *   iptables -t nat -A POSTROUTING -s <subnet> -o <uplink> -j MASQUERADE
+ *   iptables -A FORWARD -i <veth> -o <uplink> -j ACCEPT
+ *   iptables -A FORWARD -i <uplink> -o <veth> -m state --state RELATED,ESTABLISHED -j ACCEPT
+ * uplink may be NULL to match any output interface; veth may end in '*'
+ * to cover every container interface with that prefix.
+ *
+ * Unlike those, our accepts only have the last word in our own table.
+ * Every table's forward hook sees the packet, and a drop in any of them
+ * wins: a host whose iptables filter FORWARD chain drops by default (one
+ * Docker has set up, say) drops container traffic whatever we accept.
+ * We don't add rules to other tools' tables, so that's only detected,
+ * for the caller to report.
+ * ============================================================
+ */
+
+int nft_setup_nat(const char *subnet_cidr, const char *veth, const char *uplink)
+{
+    struct in_addr net;
+    int prefix_len;
+    if (parse_cidr(subnet_cidr, &net, &prefix_len) < 0)
+        return -EINVAL;
+
+    struct nl_session s;
+    if (nft_open(&s) < 0)
+        return -1;
+
+    struct nft_keys keys;
+    int ret = nft_load_keys(&s, &keys);
+    if (ret < 0)
+        goto out;
+
+    char masq_key[NFT_KEY_MAX], out_key[NFT_KEY_MAX], in_key[NFT_KEY_MAX];
+    snprintf(masq_key, sizeof(masq_key), "masq %s %s", subnet_cidr, uplink ? uplink : "*");
+    snprintf(out_key, sizeof(out_key), "fwd %s>%s", veth, uplink ? uplink : "*");
+    snprintf(in_key, sizeof(in_key), "fwd %s>%s est", uplink ? uplink : "*", veth);
+
+    nft_batch(&s, NFNL_MSG_BATCH_BEGIN);
+
+    nft_add_table(&s);
+    nft_add_chain(&s, "postrouting", "nat", NF_INET_POST_ROUTING, 100);
+    nft_add_chain(&s, "forward", "filter", NF_INET_FORWARD, 0);
+
+    struct nl_msg *msg;
+    struct rtattr *exprs;
+
+    if (!nft_has_key(&keys, masq_key) &&
+        (msg = nft_rule_start(&s, "postrouting", &exprs)))
+    {
+        nft_expr_ip_subnet(msg, 12, net, prefix_len);   // ip saddr
+        if (uplink)
+            nft_expr_ifname(msg, NFT_META_OIFNAME, uplink);
+        nft_expr_masq(msg);
+        nft_rule_end(msg, exprs, masq_key);
+    }
+
+    if (!nft_has_key(&keys, out_key) &&
+        (msg = nft_rule_start(&s, "forward", &exprs)))
+    {
+        nft_expr_ifname(msg, NFT_META_IIFNAME, veth);
+        if (uplink)
+            nft_expr_ifname(msg, NFT_META_OIFNAME, uplink);
+        nft_expr_verdict(msg, NF_ACCEPT);
+        nft_rule_end(msg, exprs, out_key);
+    }
+
+    if (!nft_has_key(&keys, in_key) &&
+        (msg = nft_rule_start(&s, "forward", &exprs)))
+    {
+        uint32_t state = NF_CT_STATE_BIT(IP_CT_ESTABLISHED) | NF_CT_STATE_BIT(IP_CT_RELATED);
+        uint32_t zero = 0;
+
+        if (uplink)
+            nft_expr_ifname(msg, NFT_META_IIFNAME, uplink);
+        nft_expr_ifname(msg, NFT_META_OIFNAME, veth);
+        nft_expr_ct(msg, NFT_CT_STATE);
+        nft_expr_mask(msg, &state, sizeof(state));
+        nft_expr_cmp(msg, NFT_CMP_NEQ, &zero, sizeof(zero));
+        nft_expr_verdict(msg, NF_ACCEPT);
+        nft_rule_end(msg, exprs, in_key);
+    }
+
+    nft_batch(&s, NFNL_MSG_BATCH_END);
+    ret = nl_session_flush(&s);
+
+out:
+    nft_keys_free(&keys);
+    nl_session_close(&s);
+    return ret;
+}
+
+static int nft_forward_policy_cb(struct nlmsghdr *nlh, void *arg)
+{
+    int *drops = arg;
+
+    struct rtattr *tb[NFTA_CHAIN_MAX + 1];
+    nl_attr_parse(tb, NFTA_CHAIN_MAX,
+                  (struct rtattr *)((char *)NLMSG_DATA(nlh) + NLMSG_ALIGN(sizeof(struct nfgenmsg))),
+                  nlh->nlmsg_len - NLMSG_LENGTH(sizeof(struct nfgenmsg)));
+    if (tb[NFTA_CHAIN_TABLE] && tb[NFTA_CHAIN_NAME] && tb[NFTA_CHAIN_POLICY] &&
+        strcmp(RTA_DATA(tb[NFTA_CHAIN_TABLE]), "filter") == 0 &&
+        strcmp(RTA_DATA(tb[NFTA_CHAIN_NAME]), "FORWARD") == 0 &&
+        ntohl(*(uint32_t *)RTA_DATA(tb[NFTA_CHAIN_POLICY])) == NF_DROP)
+        *drops = 1;
+    return 0;
+}
+
+// iptables-legacy's filter FORWARD policy, from its table blob. Only if
+// the table's there: asking for it would create it.
+static int ipt_forward_drops(void)
+{
+    FILE *names = fopen("/proc/net/ip_tables_names", "re");
+    char line[XT_TABLE_MAXNAMELEN + 2];
+    int found = 0;
+    while (names && !found && fgets(line, sizeof(line), names))
+        found = strcmp(line, "filter\n") == 0;
+    if (names)
+        fclose(names);
+    if (!found)
+        return 0;
+
+    int fd = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, IPPROTO_RAW);
+    struct ipt_getinfo info = { .name = "filter" };
+    socklen_t len = sizeof(info);
+    if (fd < 0 || getsockopt(fd, IPPROTO_IP, IPT_SO_GET_INFO, &info, &len) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return 0;
+    }
+
+    int drops = 0;
+    len = sizeof(struct ipt_get_entries) + info.size;
+    struct ipt_get_entries *e = calloc(1, len);
+    if (e)
+    {
+        strcpy(e->name, "filter");
+        e->size = info.size;
+        if (getsockopt(fd, IPPROTO_IP, IPT_SO_GET_ENTRIES, e, &len) == 0)
+        {
+            // The chain's policy is the standard target of its last entry
+            struct ipt_entry *policy =
+                (struct ipt_entry *)((char *)e->entrytable + info.underflow[NF_INET_FORWARD]);
+            struct xt_standard_target *t =
+                (struct xt_standard_target *)((char *)policy + policy->target_offset);
+            drops = t->verdict == -NF_DROP - 1;
+        }
+        free(e);
+    }
+    close(fd);
+    return drops;
+}
+
+// 1 if the host's filter FORWARD chain, iptables-nft's or legacy's,
+// drops what nothing in it accepts
+int nft_host_forward_drops(void)
+{
+    int drops = 0;
+    struct nl_session s;
+    if (nft_open(&s) == 0)
+    {
+        struct nl_msg *msg = nft_msg(&s, NFT_MSG_GETCHAIN, NLM_F_DUMP, NFPROTO_IPV4);
+        if (msg)
+        {
+            struct nl_request *req = nl_session_last(&s);
+            req->what = "nft list chains";
+            req->cb = nft_forward_policy_cb;
+            req->arg = &drops;
+            nl_session_flush(&s);
+        }
+        nl_session_close(&s);
+    }
+    return drops || ipt_forward_drops();
+}
+
+/*
+ * ============================================================
+ * PART 5: PUBLISHED PORTS
+ *
+ * Netlink equivalent of, per published port:
+ *   nft add rule ip cdocker prerouting fib daddr type local tcp dport <host> \
+ *       dnat to <addr>:<port>
+ *   nft add rule ip cdocker output fib daddr type local tcp dport <host> \
+ *       dnat to <addr>:<port>
+ * prerouting catches connections from elsewhere, output those from the
+ * host itself (to any of its addresses but 127.0.0.1, which can't be
+ * routed to a container). Both rules carry the key "dnat <host> ...", by
+ * which they're found again to be removed, and by which a host port is
+ * seen to be taken already.
+ * ============================================================
+ */
+
+static void nft_dnat_key(char *key, size_t len, uint16_t host_port,
+                         struct in_addr addr, uint16_t port)
+{
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+    snprintf(key, len, "dnat %u %s:%u", host_port, ip, port);
+}
+
+// Publish host_port as addr:port. -EADDRINUSE if the host port is
+// published already, for any address.
+int nft_add_dnat(uint16_t host_port, struct in_addr addr, uint16_t port)
+{
+    struct nl_session s;
+    if (nft_open(&s) < 0)
+        return -1;
+
+    char key[NFT_KEY_MAX], prefix[32];
+    nft_dnat_key(key, sizeof(key), host_port, addr, port);
+    snprintf(prefix, sizeof(prefix), "dnat %u ", host_port);
+
+    // Or two launches could both find the port free
+    int lock = nft_lock();
+    struct nft_rule_find found;
+    int ret = nft_find_rules(&s, prefix, 1, &found);
+    if (ret == 0 && found.count)
+        ret = -EADDRINUSE;
+    free(found.refs);
+    if (ret < 0)
+    {
+        if (lock >= 0)
+            close(lock);
+        nl_session_close(&s);
+        return ret;
+    }
+
+    nft_batch(&s, NFNL_MSG_BATCH_BEGIN);
+    nft_add_table(&s);
+    nft_add_chain(&s, "prerouting", "nat", NF_INET_PRE_ROUTING, -100);
+    nft_add_chain(&s, "output", "nat", NF_INET_LOCAL_OUT, -100);
+
+    static const char *chains[] = { "prerouting", "output" };
+    for (int i = 0; i < 2; i++)
+    {
+        struct rtattr *exprs;
+        struct nl_msg *msg = nft_rule_start(&s, chains[i], &exprs);
+        if (!msg)
+            break;
+        nft_expr_daddr_local(msg);
+        nft_expr_tcp_dport(msg, host_port);
+        nft_expr_dnat(msg, addr, port);
+        nft_rule_end(msg, exprs, key);
+    }
+
+    nft_batch(&s, NFNL_MSG_BATCH_END);
+    ret = nl_session_flush(&s);
+    if (lock >= 0)
+        close(lock);
+    nl_session_close(&s);
+    return ret;
+}
+
+// Take what nft_add_dnat() published back down
+int nft_del_dnat(uint16_t host_port, struct in_addr addr, uint16_t port)
+{
+    struct nl_session s;
+    if (nft_open(&s) < 0)
+        return -1;
+
+    char key[NFT_KEY_MAX];
+    nft_dnat_key(key, sizeof(key), host_port, addr, port);
+
+    struct nft_rule_find found;
+    int ret = nft_find_rules(&s, key, 0, &found);
+    if (ret == 0 && found.count)
+    {
+        nft_batch(&s, NFNL_MSG_BATCH_BEGIN);
+        for (int i = 0; i < found.count; i++)
+            nft_del_rule(&s, &found.refs[i]);
+        nft_batch(&s, NFNL_MSG_BATCH_END);
+        ret = nl_session_flush(&s);
+    }
+
+    free(found.refs);
+    nl_session_close(&s);
+    return ret;
+}
+
+#endif // CDOCKER_NFT_H
@@ -1,3 +1,6 @@
+#ifndef CDOCKER_NS_H
+#define CDOCKER_NS_H
+
 #define _GNU_SOURCE
 #include <sched.h>
 #include <stdio.h>
@@ -14,75 +17,641 @@
 
 #include "network.h"
 
-#define STACK_SIZE (1024 * 1024)
+#include "nft.h"
+
+
+#include "ipam.h"
+#include "fdpass.h"
+
+#define CONTAINER_SUBNET  "10.0.0.0/24"
+#define VETH_PREFIX       "cdk"     // host ends are cdk<slot>, e.g. cdk1f
+#define IFB_PREFIX        "cdi"     // the container's egress limit runs on cdi<slot>
+#define BRIDGE_NAME       "cdocker0"
+
+/*
+ * Every container gets a slot from the subnet's IPAM pool, and everything
+ * else derives from it: its address, and its veth names. That keeps
+ * concurrent launches, also from separate cdocker processes, apart.
+ *
+ * How the host end is wired up depends on the mode:
+ *
+ *   bridge  The host ends are ports of one bridge, cdocker0, which holds
+ *           the gateway address for the whole subnet. Starting a container
+ *           is create veth + set master; the host's routes and NAT rules
+ *           don't change, and containers reach each other at layer 2.
+ *   routed  Each host end carries the gateway as a /32, plus a /32 route
+ *           to its container. No bridge, but one route per container, and
+ *           container to container traffic isn't possible.
+ *
+ * The lower-device modes have no host end at all. The container's eth0 is
+ * a macvlan or ipvlan link on a host interface (its parent, by default
+ * the one with the default route), created straight in its netns. Packets
+ * leave through the parent without crossing a veth, the bridge, or the
+ * host's forwarding and NAT, so the subnet has to be one the parent's
+ * network routes, with the gateway at its first address. As usual for
+ * these, the host itself can't reach its containers through the parent.
+ *
+ *   macvlan    A MAC address per container, bridge mode between them
+ *   ipvlan     Shares the parent's MAC, switched at layer 2
+ *   ipvlan-l3  Shares the parent's MAC, routed at layer 3, no ARP/broadcast
+ */
+enum net_mode {
+    NET_BRIDGE,
+    NET_ROUTED,
+    NET_MACVLAN,
+    NET_IPVLAN,
+    NET_IPVLAN_L3,
+    NET_MODES
+};
+
+#define NET_MODE_LOWER(mode) ((mode) >= NET_MACVLAN)
+
+static const char *const net_mode_names[NET_MODES] = {
+    "bridge", "routed", "macvlan", "ipvlan", "ipvlan-l3",
+};
 
-// Passed to child via clone arg
-struct child_args {
-    int sync_pipe;  // child reads from this, blocks until parent says go
+// --net's argument; -1 if it isn't a mode
+static int net_mode_parse(const char *name)
+{
+    for (int i = 0; i < NET_MODES; i++)
+        if (strcmp(name, net_mode_names[i]) == 0)
+            return i;
+    return -1;
+}
 
+struct container_net {
+    enum net_mode mode;
+    const char *subnet;
+    int slot;                           // -1: not allocated
+    char host_if[IF_NAMESIZE];          // cdk<slot>; eth0 inside
+    char parent[IF_NAMESIZE];           // lower-device modes; "": the uplink
+    struct veth_opts veth;              // veth modes: queues, MTU, offloads
+    char addr[INET_ADDRSTRLEN + 4];     // container address, with prefix
+    char gateway[INET_ADDRSTRLEN];
 };
 
-int setup_network(pid_t child_pid) {
+// Rate limits, in bytes per second; 0: none
+struct net_shape {
+    uint64_t egress;    // leaving the container: what the host end receives, via an IFB
+    uint64_t ingress;   // reaching it: on the veth's host end
+};
+
+static struct ipam net_pool;
+static const char *net_pool_subnet;
+
+// Open the pool for subnet, once per process (forked workers inherit it)
+static int net_pool_open(const char *subnet)
+{
+    if (net_pool.pool)
+    {
+        if (strcmp(subnet, net_pool_subnet) == 0)
+            return 0;
+        ipam_close(&net_pool);
+    }
+    if (ipam_open(&net_pool, subnet) < 0)
+        return -1;
+    net_pool_subnet = subnet;
+    return 0;
+}
+
+// Create cdocker0 with the gateway address, unless it's already there
+static int bridge_init(const char *subnet)
+{
+    if (net_pool_open(subnet) < 0)
+        return -1;
+
+    char gateway[INET_ADDRSTRLEN + 4];
+    ipam_addr(&net_pool, 1, 1, gateway, sizeof(gateway));
+
+    struct nl_session nl;
+    if (nl_session_open(&nl, NETLINK_ROUTE) < 0)
+        return -1;
+
+    nl_bridge_create(&nl, BRIDGE_NAME);
+    nl_session_last(&nl)->ignore_error = EEXIST;
+    int ret = nl_session_flush(&nl);
+
+    if (ret == 0)
+    {
+        nl_if_add_addr(&nl, BRIDGE_NAME, gateway);
+        nl_session_last(&nl)->ignore_error = EEXIST;
+        nl_if_up(&nl, BRIDGE_NAME);
+        ret = nl_session_flush(&nl);
+    }
+
+    nl_session_close(&nl);
+    return ret;
+}
+
+// Host-wide setup that every container on subnet shares: forwarding, the
+// bridge, and one set of NAT rules covering all containers. Idempotent,
+// and serialised between processes so the check-then-add steps can't race.
+int network_host_init(const char *subnet, enum net_mode mode)
+{
+    static int done[NET_MODES];
+    if (done[mode] || NET_MODE_LOWER(mode))
+        return 0;
+
+    ip_forward_enable();
+
+    char uplink[IF_NAMESIZE];
+    struct nl_session nl;
+    unsigned int uplink_index = 0;
+    if (nl_session_open(&nl, NETLINK_ROUTE) == 0) {
+        uplink_index = nl_default_route_ifindex(&nl);
+        nl_session_close(&nl);
+    }
+    if (!uplink_index || !if_indextoname(uplink_index, uplink)) {
+        fprintf(stderr, "[parent] no default route, masquerading on any interface\n");
+        uplink[0] = '\0';
+    }
+
+    // /run/cdocker exists by now: the IPAM pool lives under it
+    int lock = nft_lock();
+
+    // Routed traffic comes in on the veths themselves, bridged traffic on
+    // the bridge; either way a single rule covers every container
     int ret = 0;
+    if (mode == NET_BRIDGE)
+        ret = bridge_init(subnet);
+    if (ret == 0)
+        ret = nft_setup_nat(subnet, mode == NET_BRIDGE ? BRIDGE_NAME : VETH_PREFIX "*",
+                            uplink[0] ? uplink : NULL);
 
-    // Save host namespace
-    int host_ns = open("/proc/self/ns/net", O_RDONLY);
-    if (host_ns < 0) {
+    if (lock >= 0)
+        close(lock);
+    if (ret == 0)
+        done[mode] = 1;
+
+    // Ours can't override it; say what would
+    if (ret == 0 && nft_host_forward_drops()) {
+        const char *in = mode == NET_BRIDGE ? BRIDGE_NAME : VETH_PREFIX "+";
+        fprintf(stderr,
+                "[parent] warning: the host's filter FORWARD chain drops by default, so\n"
+                "[parent] containers can't reach past the host until it accepts them:\n"
+                "[parent]   iptables -I FORWARD -i %s -j ACCEPT\n"
+                "[parent]   iptables -I FORWARD -o %s -m conntrack --ctstate RELATED,ESTABLISHED -j ACCEPT\n",
+                in, in);
+    }
+    return ret;
+}
+
+// The host netns fd and a host rtnetlink session stay open for the life
+// of the process, so a long-running launcher (cdockerd) doesn't pay for
+// them per container. Forked launch workers must not share one netlink
+// socket, so a process that inherited them opens its own.
+struct net_host {
+    pid_t owner;
+    int netns;
+    struct nl_session nl;
+};
+
+static struct net_host net_host;
+
+static struct net_host *net_host_get(void)
+{
+    if (net_host.owner == getpid())
+        return &net_host;
+
+    if (net_host.owner) {
+        // The parent's; closing our copies leaves its own alone
+        close(net_host.netns);
+        nl_session_close(&net_host.nl);
+        net_host.owner = 0;
+    }
+
+    net_host.netns = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+    if (net_host.netns < 0) {
         perror("open host netns");
+        return NULL;
+    }
+    if (nl_session_open(&net_host.nl, NETLINK_ROUTE) < 0) {
+        close(net_host.netns);
+        return NULL;
+    }
+    net_host.owner = getpid();
+    return &net_host;
+}
+
+// Claim an address on subnet and name the interfaces after it. parent is
+// the lower-device modes' host interface, NULL for the default route's;
+// veth, if not NULL, tunes the veth modes' pair.
+int network_alloc(struct container_net *net, const char *subnet, enum net_mode mode,
+                  const char *parent, const struct veth_opts *veth)
+{
+    net->mode = mode;
+    net->subnet = subnet;
+    net->slot = -1;
+    snprintf(net->parent, sizeof(net->parent), "%s", parent ? parent : "");
+    if (veth)
+        net->veth = *veth;
+    else
+        memset(&net->veth, 0, sizeof(net->veth));
+    if (net_pool_open(subnet) < 0)
+        return -1;
+
+    net->slot = ipam_alloc(&net_pool);
+    if (net->slot < 0)
+        return -1;
+
+    snprintf(net->host_if, sizeof(net->host_if), VETH_PREFIX "%x", net->slot);
+    ipam_addr(&net_pool, net->slot, 1, net->addr, sizeof(net->addr));
+    ipam_addr(&net_pool, 1, 0, net->gateway, sizeof(net->gateway));
+    return 0;
+}
+
+// Inside the container's netns: eth0 (ifindex) gets its address, goes up
+// and carries the default route
+static void network_queue_eth0(struct nl_session *nl, const struct container_net *net,
+                               unsigned int ifindex) {
+    nl_if_add_addr_index(nl, ifindex, net->addr);
+    nl_if_up(nl, "eth0");
+
+    // Add default route for internet access
+    nl_route_add_default(nl, net->gateway, ifindex);
+}
+
+// macvlan/ipvlan: just the one link on the parent, as eth0 in the
+// container's netns; nothing on the host changes
+static int network_configure_lower(const struct container_net *net, int child_ns,
+                                   pid_t child_pid) {
+    struct net_host *host = net_host_get();
+    if (!host)
+        return -1;
+
+    static unsigned int uplink;
+    if (!net->parent[0] && !uplink)
+        uplink = nl_default_route_ifindex(&host->nl);
+    unsigned int parent = net->parent[0] ? if_nametoindex(net->parent) : uplink;
+    if (!parent) {
+        fprintf(stderr, "[parent] no parent interface %s\n",
+                net->parent[0] ? net->parent : "(no default route)");
         return -1;
     }
 
-    // Open child's namespace
-    char ns_path[64];
-    snprintf(ns_path, sizeof(ns_path), "/proc/%d/ns/net", child_pid);
-    int child_ns = open(ns_path, O_RDONLY);
-    if (child_ns < 0) {
-        perror("open child netns");
-        close(host_ns);
+    printf("[parent] Creating %s eth0 on ifindex %u\n", net_mode_names[net->mode], parent);
+    if (net->mode == NET_MACVLAN)
+        nl_macvlan_create_in(&host->nl, parent, "eth0", child_ns, child_pid);
+    else
+        nl_ipvlan_create_in(&host->nl, parent,
+                            net->mode == NET_IPVLAN ? IPVLAN_MODE_L2 : IPVLAN_MODE_L3,
+                            "eth0", child_ns, child_pid);
+    return nl_session_flush(&host->nl) < 0 ? -1 : 0;
+}
+
+// The host half of wiring net up: the veth pair, its other end created
+// as eth0 directly in the container's netns (child_ns, a netns fd, or
+// child_pid's), and the host end on the bridge or routed.
+int network_configure_host(const struct container_net *net, int child_ns, pid_t child_pid) {
+    if (NET_MODE_LOWER(net->mode))
+        return network_configure_lower(net, child_ns, child_pid);
+
+    if (network_host_init(net->subnet, net->mode) < 0)
+        fprintf(stderr, "[parent] NAT setup failed, container will be isolated\n");
+
+    struct net_host *host = net_host_get();
+    if (!host)
+        return -1;
+    struct nl_session *host_nl = &host->nl;
+
+    // 1) Create veth pair with the container end already in place
+    printf("[parent] Creating veth pair %s/eth0\n", net->host_if);
+    nl_veth_create_in(host_nl, net->host_if, "eth0", child_ns, child_pid, &net->veth);
+    if (nl_session_flush(host_nl) < 0)
         return -1;
+    if (net->veth.gro)
+        if_set_gro(host_nl->fd, net->host_if, 1);
+
+    // 2) Configure host end: a bridge port, or gateway /32 plus a route to
+    //    the container
+    printf("[parent] Configuring host side\n");
+    if (net->mode == NET_BRIDGE) {
+        nl_if_set_master(host_nl, net->host_if, BRIDGE_NAME);
+        nl_if_up(host_nl, net->host_if);
+    } else {
+        char gw32[INET_ADDRSTRLEN + 4], cont32[INET_ADDRSTRLEN + 4];
+        snprintf(gw32, sizeof(gw32), "%s/32", net->gateway);
+        snprintf(cont32, sizeof(cont32), "%.*s/32", (int)strcspn(net->addr, "/"), net->addr);
+
+        unsigned int host_index = if_nametoindex(net->host_if);
+        nl_if_add_addr_index(host_nl, host_index, gw32);
+        nl_if_up(host_nl, net->host_if);
+        nl_route_add(host_nl, cont32, NULL, host_index);
     }
+    return nl_session_flush(host_nl) < 0 ? -1 : 0;
+}
+
+// The container half: lo, and eth0's address and default route, through
+// child_nl, a netlink socket opened in the container's netns. Nobody
+// enters the netns, so any number of these can run side by side.
+int network_configure_child(const struct container_net *net, int child_nl) {
+    struct nl_session nl;
+    int fd = fcntl(child_nl, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0 || nl_session_open_fd(&nl, fd) < 0)
+        return -1;
 
-    // Create veth pair in host namespace
-    printf("[parent] Creating veth pair\n");
-    if (veth_create("veth_host", "veth_cont") < 0) {
+    printf("[parent] Configuring container side\n");
+    unsigned int cont_index = 0;
+    nl_if_up(&nl, "lo");
+    nl_link_get_index(&nl, "eth0", &cont_index);
+    int ret = nl_session_flush(&nl);
+    if (ret == 0 && cont_index) {
+        if (!NET_MODE_LOWER(net->mode) && net->veth.gro)
+            if_set_gro(nl.fd, "eth0", 1);
+        network_queue_eth0(&nl, net, cont_index);
+        ret = nl_session_flush(&nl);
+    } else if (ret == 0) {
+        fprintf(stderr, "[parent] eth0 missing in child netns\n");
         ret = -1;
-        goto cleanup;
     }
 
-    // Move container end to child
-    printf("[parent] Moving veth_cont to child netns\n");
-    if (if_move_to_pid_ns("veth_cont", child_pid) < 0) {
-        ret = -1;
-        goto cleanup;
+    nl_session_close(&nl);
+    return ret < 0 ? -1 : 0;
+}
+
+// Both halves, for a netns we hold an fd and a netlink socket for
+// (which is closed)
+int network_configure(const struct container_net *net, int child_ns, int child_nl) {
+    int ret = network_configure_host(net, child_ns, 0);
+    if (ret == 0)
+        ret = network_configure_child(net, child_nl);
+    close(child_nl);
+    return ret;
+}
+
+// The container's side of the handshake below: right after clone, open a
+// netlink socket in the new netns and pass it to the parent over sock.
+// Closes sock; if anything fails the parent just sees it closed.
+void network_child_send(int sock) {
+    int nl = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nl >= 0) {
+        char byte = 0;
+        struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+        fd_sendmsg(sock, &iov, 1, &nl, 1);
+        close(nl);
     }
+    close(sock);
+}
 
-    // Configure host end
-    printf("[parent] Configuring host side\n");
-    if_add_addr("veth_host", "10.0.0.1/24");
-    if_up("veth_host");
+// Everything happens over netlink and /proc/sys; nothing is fork()ed and
+// we never leave our own netns. The host half runs while the child is
+// still starting up; child_sock is where its netlink socket arrives
+// (network_child_send()). It's kept in *child_nl for
+// network_release_child(), or -1.
+int setup_network(const struct container_net *net, pid_t child_pid, int child_sock,
+                  int *child_nl) {
+    *child_nl = -1;
+    if (network_configure_host(net, -1, child_pid) < 0)
+        return -1;
 
-    // Enter child namespace and configure its end
-    printf("[parent] Entering child netns to configure\n");
-    if (setns(child_ns, CLONE_NEWNET) < 0) {
-        perror("setns to child");
-        ret = -1;
-        goto cleanup;
+    char byte;
+    if (fd_recvmsg(child_sock, &byte, 1, child_nl, 1) <= 0 || *child_nl < 0) {
+        fprintf(stderr, "[parent] no netlink socket from the child\n");
+        return -1;
     }
+    return network_configure_child(net, *child_nl);
+}
 
-    if_add_addr("veth_cont", "10.0.0.2/24");
-    if_up("veth_cont");
-    if_up("lo");
+// Before the container's netns goes away: a dead netns is dismantled
+// asynchronously, and until then a macvlan/ipvlan eth0 in it still holds
+// its address (ipvlan refuses duplicates on a parent). Delete that one now
+// through the child's netlink socket; a veth's host end goes in
+// teardown_network() anyway. Closes child_nl.
+void network_release_child(const struct container_net *net, int child_nl) {
+    if (!NET_MODE_LOWER(net->mode)) {
+        close(child_nl);
+        return;
+    }
 
-    // Return to host namespace
-    if (setns(host_ns, CLONE_NEWNET) < 0) {
-        perror("setns to host");
-        ret = -1;
+    struct nl_session nl;
+    if (nl_session_open_fd(&nl, child_nl) < 0)
+        return;
+    nl_link_del(&nl, "eth0");
+    nl_session_last(&nl)->ignore_error = ENODEV;
+    nl_session_flush(&nl);
+    nl_session_close(&nl);
+}
+
+// A container's traffic as it sees it
+struct net_stats {
+    uint64_t rx_bytes, rx_packets, rx_dropped;
+    uint64_t tx_bytes, tx_packets, tx_dropped;
+};
+
+typedef void (*network_stats_cb)(int slot, const struct net_stats *st, void *arg);
+
+// Which container each host link belongs to: ifindex -> slot, -1 for
+// links that aren't a container's. Indexes aren't reused while a netns
+// lives (they only count up), so entries never go stale, they only stop
+// showing up; the map is rebuilt whenever a link it doesn't know appears.
+struct net_index_map {
+    int *index;                 // 0: empty
+    int *slot;
+    size_t size;                // power of two
+    size_t used;
+};
+
+static struct net_index_map net_index_map;
+
+static int *net_index_find(struct net_index_map *m, int ifindex) {
+    if (!m->size)
+        return NULL;
+    for (size_t i = (size_t)ifindex * 2654435761u & (m->size - 1);; i = (i + 1) & (m->size - 1)) {
+        if (m->index[i] == ifindex)
+            return &m->slot[i];
+        if (!m->index[i])
+            return NULL;
     }
+}
 
-cleanup:
-    close(host_ns);
-    close(child_ns);
-    return ret;
+static int net_index_add(struct net_index_map *m, int ifindex, int slot) {
+    if ((m->used + 1) * 2 > m->size) {
+        struct net_index_map grown = { .size = m->size ? m->size * 2 : 256 };
+        grown.index = calloc(grown.size, sizeof(int));
+        grown.slot = calloc(grown.size, sizeof(int));
+        if (!grown.index || !grown.slot) {
+            free(grown.index);
+            free(grown.slot);
+            return -1;
+        }
+        for (size_t i = 0; i < m->size; i++)
+            if (m->index[i])
+                net_index_add(&grown, m->index[i], m->slot[i]);
+        free(m->index);
+        free(m->slot);
+        *m = grown;
+    }
+    size_t i = (size_t)ifindex * 2654435761u & (m->size - 1);
+    while (m->index[i] && m->index[i] != ifindex)
+        i = (i + 1) & (m->size - 1);
+    m->used += !m->index[i];
+    m->index[i] = ifindex;
+    m->slot[i] = slot;
+    return 0;
+}
+
+// Counters of the current sample, until they're matched to slots
+struct net_stats_sample {
+    struct nl_link_stats *links;
+    size_t n, cap;
+    int unknown;                // links the index map doesn't know
+};
+
+static int net_stats_collect(const struct nl_link_stats *st, void *arg) {
+    struct net_stats_sample *smp = arg;
+    if (smp->n == smp->cap) {
+        size_t cap = smp->cap ? smp->cap * 2 : 256;
+        struct nl_link_stats *links = realloc(smp->links, cap * sizeof(*links));
+        if (!links)
+            return -ENOMEM;
+        smp->links = links;
+        smp->cap = cap;
+    }
+    smp->links[smp->n] = *st;
+    smp->links[smp->n++].ifname = NULL;
+    smp->unknown += !net_index_find(&net_index_map, st->ifindex);
+    return 0;
+}
+
+// Rebuild pass: every veth named like a host end gets its slot
+static int net_index_learn(const struct nl_link_stats *st, void *arg) {
+    (void)arg;
+    size_t plen = strlen(VETH_PREFIX);
+    char *end;
+    if (strncmp(st->ifname, VETH_PREFIX, plen) != 0)
+        return 0;
+    long slot = strtol(st->ifname + plen, &end, 16);
+    if (end == st->ifname + plen || *end)
+        return 0;
+    return net_index_add(&net_index_map, st->ifindex, slot) < 0 ? -ENOMEM : 0;
+}
+
+// Every veth container's counters at once, whatever their number: one
+// RTM_GETSTATS dump of the host's links per call. Only when that turns up
+// a link we haven't seen does a second, RTM_GETLINK dump (of veths, by
+// name) map host ends back to slots. cb gets each host end's slot;
+// macvlan/ipvlan containers have no host end and don't show.
+int network_stats(network_stats_cb cb, void *arg) {
+    struct net_host *host = net_host_get();
+    if (!host)
+        return -1;
+
+    struct net_stats_sample smp = { 0 };
+    struct nl_link_stats_dump d = { .cb = net_stats_collect, .arg = &smp };
+    nl_stats_dump(&host->nl, &d);
+    int ret = nl_session_flush(&host->nl);
+
+    if (ret == 0 && smp.unknown) {
+        free(net_index_map.index);
+        free(net_index_map.slot);
+        memset(&net_index_map, 0, sizeof(net_index_map));
+        struct nl_link_stats_dump learn = { .cb = net_index_learn };
+        nl_link_stats(&host->nl, "veth", &learn);
+        ret = nl_session_flush(&host->nl);
+
+        // The rest are the host's own links, or gone already
+        for (size_t i = 0; ret == 0 && i < smp.n; i++)
+            if (!net_index_find(&net_index_map, smp.links[i].ifindex))
+                ret = net_index_add(&net_index_map, smp.links[i].ifindex, -1);
+    }
+
+    for (size_t i = 0; ret == 0 && i < smp.n; i++) {
+        const struct rtnl_link_stats64 *h = &smp.links[i].stats;
+        int *slot = net_index_find(&net_index_map, smp.links[i].ifindex);
+        if (!slot || *slot < 0)
+            continue;
+
+        // The host end's receive side is the container's transmit side
+        struct net_stats st = {
+            .rx_bytes = h->tx_bytes, .rx_packets = h->tx_packets, .rx_dropped = h->tx_dropped,
+            .tx_bytes = h->rx_bytes, .tx_packets = h->rx_packets, .tx_dropped = h->rx_dropped,
+        };
+        cb(*slot, &st, arg);
+    }
+
+    free(smp.links);
+    return ret < 0 ? -1 : 0;
+}
+
+static int network_shape_if(struct nl_session *s, const char *ifname, uint64_t rate) {
+    unsigned int index = 0;
+    nl_link_get_index(s, ifname, &index);
+    if (nl_session_flush(s) < 0 || !index)
+        return -1;
+    if (rate)
+        nl_tc_rate_limit(s, index, rate);
+    else
+        nl_tc_rate_clear(s, index);
+    return nl_session_flush(s);
+}
+
+// Egress is shaped where the container can't reach it: what its eth0
+// sends arrives on the host end, which redirects it to an IFB of its own
+// with the HTB on it. Limit 0 removes both.
+static int network_shape_egress(struct nl_session *s, const struct container_net *net,
+                                uint64_t rate) {
+    char ifb[IF_NAMESIZE];
+    snprintf(ifb, sizeof(ifb), IFB_PREFIX "%x", net->slot);
+    unsigned int index = if_nametoindex(net->host_if);
+    if (!index)
+        return -1;
+
+    if (!rate) {
+        nl_tc_ingress_clear(s, index);
+        nl_link_del(s, ifb);
+        nl_session_last(s)->ignore_error = ENODEV;
+        return nl_session_flush(s);
+    }
+
+    nl_ifb_create(s, ifb);
+    nl_session_last(s)->ignore_error = EEXIST;
+    nl_if_up(s, ifb);
+    if (network_shape_if(s, ifb, rate) < 0)
+        return -1;
+    nl_tc_redirect_ingress(s, index, if_nametoindex(ifb));
+    return nl_session_flush(s);
+}
+
+// Set, change or clear (0) the container's rate limits, both on the host
+// end of its veth through the host's session; either can be redone while
+// the container runs. A macvlan/ipvlan eth0 has no end on our side to
+// queue on.
+int network_shape(const struct container_net *net, const struct net_shape *shape) {
+    if (NET_MODE_LOWER(net->mode) && (shape->egress || shape->ingress)) {
+        fprintf(stderr, "rate limits need a veth (bridge or routed mode)\n");
+        return -1;
+    }
+    if (NET_MODE_LOWER(net->mode))
+        return 0;
+
+    struct net_host *host = net_host_get();
+    if (!host || network_shape_egress(&host->nl, net, shape->egress) < 0 ||
+        network_shape_if(&host->nl, net->host_if, shape->ingress) < 0)
+        return -1;
+    return 0;
+}
+
+
+// The kernel tears a dead netns down asynchronously, so the host end of the
+// veth can outlive the container for a while. Delete it now, then give the
+// slot back: the next launch to get it reuses the name straight away.
+void teardown_network(struct container_net *net) {
+    if (net->slot < 0)
+        return;
+
+    struct net_host *host = NET_MODE_LOWER(net->mode) ? NULL : net_host_get();
+    if (host) {
+        char ifb[IF_NAMESIZE];
+        snprintf(ifb, sizeof(ifb), IFB_PREFIX "%x", net->slot);
+        nl_link_del(&host->nl, net->host_if);
+        nl_session_last(&host->nl)->ignore_error = ENODEV;
+        nl_link_del(&host->nl, ifb);
+        nl_session_last(&host->nl)->ignore_error = ENODEV;
+        nl_session_flush(&host->nl);
+    }
+
+    ipam_free(&net_pool, net->slot);
+    net->slot = -1;
 }
 
 
@@ -94,18 +663,21 @@ The flow:
 ```
 PARENT                              CHILD
 ──────                              ─────
-clone() ──────────────────────────► starts, blocks on pipe read
-    │
-setup_network()
-  - create veth pair
-  - move veth_cont to child
-  - configure host end
-  - setns into child, configure its end
-  - setns back to host
-    │
-write to pipe ────────────────────► unblocks
-    │                               setup_rootfs()
+clone() ──────────────────────────► starts
+    │                               opens a netlink socket in its
+setup_network()                  ┌── netns, sends it to the parent
+  - bridge + NAT rules over      │  setup_rootfs()
+    nfnetlink (once)             │  blocks on the handshake
+  - create veth pair cdk<slot> + │      │
+    eth0 inside the child's netns│      │
+  - attach host end to cdocker0  │      │
+  - receive the child's socket ◄─┘      │
+  - configure lo/eth0 through it        │
+    │                                   │
+signal go ────────────────────────► unblocks
     │                               exec /bin/sh
 waitpid()
 
-*/
\ No newline at end of file
+*/
+
+#endif // CDOCKER_NS_H
@@ -0,0 +1,392 @@
+#ifndef CDOCKER_PUBLISH_H
+#define CDOCKER_PUBLISH_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "nft.h"
+#include "spawn.h"
+
+/*
+ * Published ports: host:container TCP port pairs, "-p 8080:80".
+ *
+ * Two ways to get a connection to the host port through to the
+ * container, picked with --publish-mode:
+ *
+ *   nat    nftables DNAT rules (nft_add_dnat()): the kernel rewrites the
+ *          destination and forwards; nothing of ours sits in the path.
+ *          From the host itself only its non-loopback addresses work.
+ *
+ *   proxy  a proxy process that accepts on the host port and connects
+ *          to the container for each connection. The bytes move socket
+ *          to pipe to socket with splice(), so they never reach user
+ *          space; one epoll loop drives every connection. Works for
+ *          127.0.0.1 too, but the container sees the proxy's address as
+ *          the peer.
+ *
+ * The proxy is spawned per container, holds only its listening sockets
+ * and dies with whoever started it.
+ */
+
+#define PUBLISH_MAX     16      // published ports per container
+#define PROXY_EVENTS    64
+#define PROXY_SPLICE    (1 << 20)   // most bytes per splice() call
+
+enum publish_mode {
+    PUBLISH_NAT,
+    PUBLISH_PROXY,
+};
+
+struct port_map {
+    uint16_t host;
+    uint16_t container;
+};
+
+struct publish {
+    enum publish_mode mode;
+    struct in_addr addr;        // the container's
+    struct port_map ports[PUBLISH_MAX];
+    int n;                      // ports up (the DNAT rules in place)
+    pid_t proxy;                // the proxy process, or 0
+    int proxy_pidfd;
+};
+
+// "HOST:CONTAINER", or "PORT" for the same on both sides
+int port_map_parse(const char *spec, struct port_map *pm)
+{
+    char *end;
+    unsigned long host = strtoul(spec, &end, 10), cont = host;
+    if (*end == ':')
+        cont = strtoul(end + 1, &end, 10);
+    if (end == spec || *end || !host || !cont || host > 65535 || cont > 65535)
+        return -1;
+    pm->host = host;
+    pm->container = cont;
+    return 0;
+}
+
+int publish_mode_parse(const char *name)
+{
+    if (strcmp(name, "nat") == 0)
+        return PUBLISH_NAT;
+    if (strcmp(name, "proxy") == 0)
+        return PUBLISH_PROXY;
+    return -1;
+}
+
+/*
+ * ============================================================
+ * PART 1: THE SPLICE PROXY
+ * ============================================================
+ */
+
+// epoll data.ptr points at one of these, tagged by kind
+enum { PROXY_LISTENER, PROXY_CONN };
+
+struct proxy_listener {
+    int kind;
+    int fd;
+    struct sockaddr_in to;      // the container's side
+};
+
+// One proxied connection: end 0 is the client, end 1 the container.
+// Direction d moves fd[d] -> pipe[d] -> fd[!d].
+struct proxy_conn {
+    int kind;
+    int fd[2];
+    int pipe[2][2];
+    size_t queued[2];           // bytes sitting in pipe[d]
+    int eof[2];                 // fd[d] has nothing more to send
+    int closed;
+    struct proxy_conn *next;    // closed ones, freed after the batch
+};
+
+struct proxy_args {
+    struct proxy_listener listeners[PUBLISH_MAX];
+    int n;
+};
+
+// Move whatever direction d has until it would block. Sockets are
+// registered edge-triggered, so "would block" on both sides is the only
+// place to stop. Returns -1 if the connection is broken.
+static int proxy_pump(struct proxy_conn *c, int d)
+{
+    for (;;)
+    {
+        int moved = 0;
+        if (!c->eof[d])
+        {
+            ssize_t n = splice(c->fd[d], NULL, c->pipe[d][1], NULL, PROXY_SPLICE,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0)
+                c->queued[d] += n;
+            else if (n == 0)
+                c->eof[d] = 1;
+            else if (errno != EAGAIN)
+                return -1;
+            moved |= n >= 0;
+        }
+        if (c->queued[d])
+        {
+            ssize_t n = splice(c->pipe[d][0], NULL, c->fd[!d], NULL, c->queued[d],
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0)
+                c->queued[d] -= n, moved = 1;
+            else if (n < 0 && errno != EAGAIN)
+                return -1;
+        }
+        if (c->eof[d] && !c->queued[d])
+        {
+            // Pass the half-close on once everything before it is through
+            shutdown(c->fd[!d], SHUT_WR);
+            return 0;
+        }
+        if (!moved)
+            return 0;
+    }
+}
+
+static void proxy_close(int epfd, struct proxy_conn *c, struct proxy_conn **closed)
+{
+    if (c->closed)
+        return;
+    for (int i = 0; i < 2; i++)
+    {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd[i], NULL);
+        close(c->fd[i]);
+        close(c->pipe[i][0]);
+        close(c->pipe[i][1]);
+    }
+    c->closed = 1;
+    c->next = *closed;
+    *closed = c;
+}
+
+static void proxy_accept(int epfd, struct proxy_listener *l)
+{
+    int one = 1;
+    for (;;)
+    {
+        int fd = accept4(l->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+
+        struct proxy_conn *c = calloc(1, sizeof(*c));
+        if (!c)
+        {
+            close(fd);
+            continue;
+        }
+        c->kind = PROXY_CONN;
+        c->fd[0] = fd;
+        c->fd[1] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        c->pipe[0][0] = c->pipe[0][1] = c->pipe[1][0] = c->pipe[1][1] = -1;
+        if (c->fd[1] < 0 || pipe2(c->pipe[0], O_NONBLOCK | O_CLOEXEC) != 0 ||
+            pipe2(c->pipe[1], O_NONBLOCK | O_CLOEXEC) != 0 ||
+            (connect(c->fd[1], (struct sockaddr *)&l->to, sizeof(l->to)) != 0 &&
+             errno != EINPROGRESS))
+        {
+            for (int i = 0; i < 2; i++)
+            {
+                if (c->fd[i] >= 0) close(c->fd[i]);
+                if (c->pipe[i][0] >= 0) close(c->pipe[i][0]);
+                if (c->pipe[i][1] >= 0) close(c->pipe[i][1]);
+            }
+            free(c);
+            continue;
+        }
+
+        // Nagle would hold back what the client already sent in pieces
+        struct epoll_event ev = {
+            .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = c,
+        };
+        for (int i = 0; i < 2; i++)
+        {
+            setsockopt(c->fd[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd[i], &ev);
+        }
+    }
+}
+
+static int proxy_main(void *arg)
+{
+    struct proxy_args *a = arg;
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+    // Keep only the listeners (and stdio): a client connection inherited
+    // from the daemon would otherwise never see its EOF
+    for (unsigned lo = 3;;)
+    {
+        unsigned next = ~0U;
+        for (int i = 0; i < a->n; i++)
+            if ((unsigned)a->listeners[i].fd >= lo && (unsigned)a->listeners[i].fd < next)
+                next = a->listeners[i].fd;
+        if (next > lo)
+            close_range(lo, next - 1, 0);
+        if (next == ~0U)
+            break;
+        lo = next + 1;
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+        return 1;
+    for (int i = 0; i < a->n; i++)
+    {
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &a->listeners[i] };
+        epoll_ctl(epfd, EPOLL_CTL_ADD, a->listeners[i].fd, &ev);
+    }
+
+    struct epoll_event events[PROXY_EVENTS];
+    for (;;)
+    {
+        int n = epoll_wait(epfd, events, PROXY_EVENTS, -1);
+        struct proxy_conn *closed = NULL;
+        for (int i = 0; i < n; i++)
+        {
+            int *kind = events[i].data.ptr;
+            if (*kind == PROXY_LISTENER)
+            {
+                proxy_accept(epfd, events[i].data.ptr);
+                continue;
+            }
+
+            // Either end waking up can unblock either direction
+            struct proxy_conn *c = events[i].data.ptr;
+            if (c->closed)
+                continue;
+            if (proxy_pump(c, 0) < 0 || proxy_pump(c, 1) < 0 ||
+                (c->eof[0] && c->eof[1] && !c->queued[0] && !c->queued[1]))
+                proxy_close(epfd, c, &closed);
+        }
+        while (closed)
+        {
+            struct proxy_conn *next = closed->next;
+            free(closed);
+            closed = next;
+        }
+    }
+}
+
+/*
+ * ============================================================
+ * PART 2: PUBLISHING A CONTAINER'S PORTS
+ * ============================================================
+ */
+
+static int publish_proxy_start(struct publish *p, const struct port_map *ports, int n)
+{
+    struct proxy_args args = { .n = 0 };
+    int one = 1, ret = 0;
+
+    // Bound here, so a taken port is our error rather than the proxy's
+    for (int i = 0; i < n && ret == 0; i++)
+    {
+        struct proxy_listener *l = &args.listeners[args.n];
+        struct sockaddr_in sa = {
+            .sin_family = AF_INET,
+            .sin_port = htons(ports[i].host),
+            .sin_addr.s_addr = htonl(INADDR_ANY),
+        };
+        l->kind = PROXY_LISTENER;
+        l->to = (struct sockaddr_in){
+            .sin_family = AF_INET, .sin_port = htons(ports[i].container), .sin_addr = p->addr,
+        };
+        l->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (l->fd >= 0)
+            args.n++;
+        if (l->fd < 0 || setsockopt(l->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+            bind(l->fd, (struct sockaddr *)&sa, sizeof(sa)) != 0 || listen(l->fd, SOMAXCONN) != 0)
+        {
+            fprintf(stderr, "publish %u: %s\n", ports[i].host, strerror(errno));
+            ret = -1;
+        }
+    }
+
+    if (ret == 0)
+    {
+        p->proxy = spawn_child(proxy_main, &args, 0, -1, &p->proxy_pidfd);
+        if (p->proxy < 0)
+        {
+            perror("clone proxy");
+            p->proxy = 0;
+            ret = -1;
+        }
+    }
+    for (int i = 0; i < args.n; i++)
+        close(args.listeners[i].fd);
+    return ret;
+}
+
+// Publish ports of the container at addr ("a.b.c.d/len" or bare) one of
+// the two ways. On failure nothing stays published.
+int publish_start(struct publish *p, enum publish_mode mode, const struct port_map *ports,
+                  int n, const char *addr)
+{
+    char ip[INET_ADDRSTRLEN];
+    snprintf(ip, sizeof(ip), "%.*s", (int)strcspn(addr, "/"), addr);
+
+    memset(p, 0, sizeof(*p));
+    p->mode = mode;
+    p->proxy_pidfd = -1;
+    if (n > PUBLISH_MAX || inet_pton(AF_INET, ip, &p->addr) != 1)
+        return -1;
+
+    if (mode == PUBLISH_PROXY)
+    {
+        if (publish_proxy_start(p, ports, n) < 0)
+            return -1;
+        memcpy(p->ports, ports, n * sizeof(*ports));
+        p->n = n;
+        return 0;
+    }
+
+    for (; p->n < n; p->n++)
+    {
+        int ret = nft_add_dnat(ports[p->n].host, p->addr, ports[p->n].container);
+        if (ret < 0)
+        {
+            fprintf(stderr, "publish %u: %s\n", ports[p->n].host, strerror(-ret));
+            for (int i = 0; i < p->n; i++)
+                nft_del_dnat(p->ports[i].host, p->addr, p->ports[i].container);
+            p->n = 0;
+            return -1;
+        }
+        p->ports[p->n] = ports[p->n];
+    }
+    return 0;
+}
+
+// Take it all down again: the proxy, or the DNAT rules
+void publish_stop(struct publish *p)
+{
+    if (p->proxy > 0)
+    {
+        pidfd_send_signal_wrapper(p->proxy_pidfd, SIGKILL);
+        pidfd_reap(p->proxy_pidfd);
+        close(p->proxy_pidfd);
+    }
+    else
+    {
+        for (int i = 0; i < p->n; i++)
+            nft_del_dnat(p->ports[i].host, p->addr, p->ports[i].container);
+    }
+    p->proxy = 0;
+    p->proxy_pidfd = -1;
+    p->n = 0;
+}
+
+#endif // CDOCKER_PUBLISH_H
@@ -0,0 +1,553 @@
+#ifndef CDOCKER_SECCOMP_H
+#define CDOCKER_SECCOMP_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/seccomp.h>
+#include <linux/filter.h>
+#include <linux/audit.h>
+#include <linux/limits.h>
+
+#include "syscall_names.h"
+
+/*
+ * Seccomp profiles, compiled to classic BPF.
+ *
+ * A profile says, per architecture, what happens to each syscall: allow,
+ * deny (the process is killed) or fail with an errno, and what happens to
+ * the ones it doesn't name. As text:
+ *
+ *   # comment
+ *   default allow|deny|errno N      whatever isn't listed
+ *   arch x86_64|x86|aarch64         the rules below are for this arch
+ *   allow NAME|NUMBER ...
+ *   deny NAME|NUMBER ...
+ *   errno N NAME|NUMBER ...
+ *
+ * Rules before any "arch" are the native arch's. A "default" in an arch
+ * section is that arch's; before the first, it's for every arch without
+ * one of its own (allow if there's none at all).
+ * Syscalls of an arch the profile doesn't mention kill the process: a
+ * filter for x86_64 alone must not be sidestepped through int 0x80.
+ *
+ * The filter is a binary search, not a list of compares. Each arch's
+ * syscall numbers are cut into runs with the same action, [lo, next lo),
+ * and the program is a balanced tree of "nr >= lo" jumps over the run
+ * boundaries with a "ret" at every leaf: about log2(runs) compares for
+ * any syscall, where a list costs one per rule ahead of its match, and
+ * every rule for the ones that aren't listed.
+ */
+
+#define SECCOMP_ARCH_MAX 4      // arch sections per profile
+#define SECCOMP_RULES_MAX 1024  // syscall rules per arch
+#define SECCOMP_NR_MAX 1024     // highest syscall number a rule can name, + 1
+#define SECCOMP_CACHE_SLOTS 4
+#define SECCOMP_PROFILE_MAX 65536
+#define SECCOMP_X32_BIT 0x40000000  // x32 syscalls, on AUDIT_ARCH_X86_64
+
+#if defined(__x86_64__)
+#define SECCOMP_ARCH_NATIVE AUDIT_ARCH_X86_64
+#elif defined(__i386__)
+#define SECCOMP_ARCH_NATIVE AUDIT_ARCH_I386
+#elif defined(__aarch64__)
+#define SECCOMP_ARCH_NATIVE AUDIT_ARCH_AARCH64
+#else
+#error "seccomp: unknown native architecture"
+#endif
+
+static const struct {
+    const char *name;
+    uint32_t arch;
+    const char *names;      // syscall_names.h table, NULL: numbers only
+    size_t names_len;
+} seccomp_arches[] = {
+    { "x86_64",  AUDIT_ARCH_X86_64,  syscall_names_x86_64, sizeof(syscall_names_x86_64) },
+    { "x86",     AUDIT_ARCH_I386,    syscall_names_i386,   sizeof(syscall_names_i386) },
+    { "aarch64", AUDIT_ARCH_AARCH64, syscall_names_aarch64, sizeof(syscall_names_aarch64) },
+};
+
+struct seccomp_rule {
+    uint32_t nr;
+    uint32_t action;        // SECCOMP_RET_*
+};
+
+struct seccomp_arch_rules {
+    uint32_t arch;          // AUDIT_ARCH_*
+    int has_default;
+    uint32_t dflt;          // for numbers without a rule
+    int nrules;
+    struct seccomp_rule rules[SECCOMP_RULES_MAX];
+};
+
+struct seccomp_profile {
+    uint32_t dflt;          // for arches without a default of their own
+    int narches;
+    struct seccomp_arch_rules arches[SECCOMP_ARCH_MAX];
+};
+
+// What namespaces don't contain: the clock, the keyring, kernel modules
+// and kexec, perf and bpf, swap, file handles that reach past the root,
+// and (re)building the mount tree
+#define SECCOMP_DEFAULT_DENIED \
+    "acct add_key bpf clock_adjtime clock_settime delete_module finit_module " \
+    "fsconfig fsmount fsopen fspick init_module kexec_load keyctl lookup_dcookie " \
+    "mount mount_setattr move_mount name_to_handle_at nfsservctl open_by_handle_at " \
+    "open_tree perf_event_open pivot_root quotactl reboot request_key setns " \
+    "settimeofday swapoff swapon syslog umount2 unshare userfaultfd"
+
+// x86's older calls on top: raw I/O ports and what the generic table left out
+#define SECCOMP_DEFAULT_DENIED_X86 \
+    "create_module get_kernel_syms ioperm iopl query_module sysfs _sysctl uselib ustat"
+
+// The arches the kernel we run on can take syscalls from
+static const char seccomp_default_profile[] =
+    "default allow\n"
+#if defined(__aarch64__)
+    "arch aarch64\n"
+    "errno 1 " SECCOMP_DEFAULT_DENIED " kexec_file_load\n";
+#else
+    "arch x86_64\n"
+    "errno 1 " SECCOMP_DEFAULT_DENIED " " SECCOMP_DEFAULT_DENIED_X86 " kexec_file_load\n"
+    "arch x86\n"
+    "errno 1 " SECCOMP_DEFAULT_DENIED " " SECCOMP_DEFAULT_DENIED_X86
+    " stime umount vm86 vm86old\n";
+#endif
+
+/*
+ * ============================================================
+ * PART 1: PARSING A PROFILE
+ * ============================================================
+ */
+
+static int seccomp_arch_index(const char *name)
+{
+    for (size_t i = 0; i < sizeof(seccomp_arches) / sizeof(seccomp_arches[0]); i++)
+        if (strcmp(name, seccomp_arches[i].name) == 0)
+            return i;
+    return -1;
+}
+
+// A syscall by name or number in arch's table; -1 if there's none
+static int seccomp_syscall_nr(uint32_t arch, const char *name)
+{
+    char *end;
+    long nr = strtol(name, &end, 10);
+    if (end != name && !*end)
+        return nr >= 0 && nr < SECCOMP_NR_MAX ? nr : -1;
+
+    for (size_t i = 0; i < sizeof(seccomp_arches) / sizeof(seccomp_arches[0]); i++)
+    {
+        if (seccomp_arches[i].arch != arch || !seccomp_arches[i].names)
+            continue;
+        const char *names = seccomp_arches[i].names;
+        nr = 0;
+        for (const char *p = names; p < names + seccomp_arches[i].names_len - 1;
+             p += strlen(p) + 1, nr++)
+            if (*p && strcmp(p, name) == 0)
+                return nr;
+    }
+    return -1;
+}
+
+static struct seccomp_arch_rules *seccomp_arch_rules(struct seccomp_profile *p, uint32_t arch)
+{
+    for (int i = 0; i < p->narches; i++)
+        if (p->arches[i].arch == arch)
+            return &p->arches[i];
+    if (p->narches == SECCOMP_ARCH_MAX)
+        return NULL;
+    struct seccomp_arch_rules *a = &p->arches[p->narches++];
+    a->arch = arch;
+    a->has_default = 0;
+    a->nrules = 0;
+    return a;
+}
+
+// The action tok[] starts with; *used: how many words it took
+static int seccomp_action_parse(char **tok, int ntok, int *used, uint32_t *action)
+{
+    if (ntok >= 1 && strcmp(tok[0], "allow") == 0)
+    {
+        *action = SECCOMP_RET_ALLOW;
+        *used = 1;
+        return 0;
+    }
+    if (ntok >= 1 && strcmp(tok[0], "deny") == 0)
+    {
+        *action = SECCOMP_RET_KILL_PROCESS;
+        *used = 1;
+        return 0;
+    }
+    if (ntok >= 2 && strcmp(tok[0], "errno") == 0)
+    {
+        char *end;
+        long err = strtol(tok[1], &end, 10);
+        if (end == tok[1] || *end || err < 0 || err > SECCOMP_RET_DATA)
+            return -1;
+        *action = SECCOMP_RET_ERRNO | err;
+        *used = 2;
+        return 0;
+    }
+    return -1;
+}
+
+// Parse profile text into p; where names it in error messages
+int seccomp_profile_parse(const char *text, const char *where, struct seccomp_profile *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->dflt = SECCOMP_RET_ALLOW;
+
+    char *copy = strdup(text);
+    if (!copy)
+        return -1;
+
+    struct seccomp_arch_rules *cur = NULL;
+    int lineno = 0, ret = 0;
+    for (char *line = copy, *next; line && ret == 0; line = next)
+    {
+        lineno++;
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        char *hash = strchr(line, '#');
+        if (hash)
+            *hash = '\0';
+
+        char *tok[SECCOMP_RULES_MAX + 2], *save_tok;
+        int ntok = 0;
+        for (char *t = strtok_r(line, " \t\r", &save_tok); t && ntok < SECCOMP_RULES_MAX + 2;
+             t = strtok_r(NULL, " \t\r", &save_tok))
+            tok[ntok++] = t;
+        if (ntok == 0)
+            continue;
+
+        uint32_t action;
+        int used;
+        const char *err = NULL;
+        if (strcmp(tok[0], "arch") == 0)
+        {
+            int i = ntok == 2 ? seccomp_arch_index(tok[1]) : -1;
+            if (i < 0)
+                err = "unknown arch";
+            else if (!(cur = seccomp_arch_rules(p, seccomp_arches[i].arch)))
+                err = "too many arches";
+        }
+        else if (strcmp(tok[0], "default") == 0)
+        {
+            if (seccomp_action_parse(tok + 1, ntok - 1, &used, &action) < 0 || used != ntok - 1)
+                err = "bad default action";
+            else if (cur)
+            {
+                cur->dflt = action;
+                cur->has_default = 1;
+            }
+            else
+                p->dflt = action;
+        }
+        else if (seccomp_action_parse(tok, ntok, &used, &action) == 0)
+        {
+            struct seccomp_arch_rules *a = cur ? cur : seccomp_arch_rules(p, SECCOMP_ARCH_NATIVE);
+            if (!a)
+                err = "too many arches";
+            for (int i = used; !err && i < ntok; i++)
+            {
+                int nr = seccomp_syscall_nr(a->arch, tok[i]);
+                if (nr < 0)
+                {
+                    fprintf(stderr, "%s:%d: unknown syscall: %s\n", where, lineno, tok[i]);
+                    ret = -1;
+                    break;
+                }
+
+                // The last rule for a syscall wins
+                int r = 0;
+                while (r < a->nrules && a->rules[r].nr != (uint32_t)nr)
+                    r++;
+                if (r == SECCOMP_RULES_MAX)
+                    err = "too many rules";
+                else
+                {
+                    a->rules[r] = (struct seccomp_rule){ .nr = nr, .action = action };
+                    a->nrules += r == a->nrules;
+                }
+            }
+        }
+        else
+            err = "unknown rule";
+
+        if (err)
+        {
+            fprintf(stderr, "%s:%d: %s\n", where, lineno, err);
+            ret = -1;
+        }
+    }
+    free(copy);
+
+    for (int i = 0; i < p->narches; i++)
+        if (!p->arches[i].has_default)
+            p->arches[i].dflt = p->dflt;
+    if (ret == 0 && p->narches == 0)
+        seccomp_arch_rules(p, SECCOMP_ARCH_NATIVE)->dflt = p->dflt;
+    return ret;
+}
+
+/*
+ * ============================================================
+ * PART 2: COMPILING
+ * ============================================================
+ */
+
+// Syscall numbers from lo up to the next run's lo get action
+struct seccomp_run {
+    uint32_t lo;
+    uint32_t action;
+};
+
+static int seccomp_rule_cmp(const void *a, const void *b)
+{
+    const struct seccomp_rule *x = a, *y = b;
+    return x->nr < y->nr ? -1 : x->nr > y->nr;
+}
+
+// Cut an arch's numbers into runs, gaps going to its default; run[] has
+// room for 2 * nrules + 1. Returns how many.
+static int seccomp_runs(const struct seccomp_arch_rules *a, struct seccomp_run *run)
+{
+    struct seccomp_rule sorted[SECCOMP_RULES_MAX];
+    memcpy(sorted, a->rules, a->nrules * sizeof(sorted[0]));
+    qsort(sorted, a->nrules, sizeof(sorted[0]), seccomp_rule_cmp);
+
+    int n = 0;
+    uint32_t next = 0;      // first number not yet covered
+    for (int i = 0; i <= a->nrules; i++)
+    {
+        uint32_t nr = i < a->nrules ? sorted[i].nr : UINT32_MAX;
+        if (nr > next && (n == 0 || run[n - 1].action != a->dflt))
+            run[n++] = (struct seccomp_run){ .lo = next, .action = a->dflt };
+        if (i == a->nrules)
+            break;
+        if (n == 0 || run[n - 1].action != sorted[i].action)
+            run[n++] = (struct seccomp_run){ .lo = nr, .action = sorted[i].action };
+        next = nr + 1;
+    }
+    return n;
+}
+
+struct seccomp_emit {
+    struct sock_filter *insns;
+    int len;
+    int max;
+};
+
+static void seccomp_put(struct seccomp_emit *e, uint16_t code, uint8_t jt, uint8_t jf, uint32_t k)
+{
+    if (e->len < e->max)
+        e->insns[e->len] = (struct sock_filter)BPF_JUMP(code, k, jt, jf);
+    e->len++;
+}
+
+// Instructions the tree over run[lo, hi) takes. A compare's "true" side
+// is the right half, after all of the left; past a jump's 8-bit offset it
+// goes through a "ja" instead.
+static int seccomp_tree_size(const struct seccomp_run *run, int lo, int hi)
+{
+    if (hi - lo == 1)
+        return 1;
+    int mid = lo + (hi - lo) / 2;
+    int left = seccomp_tree_size(run, lo, mid);
+    return 1 + (left > 255) + left + seccomp_tree_size(run, mid, hi);
+}
+
+static void seccomp_tree(struct seccomp_emit *e, const struct seccomp_run *run, int lo, int hi)
+{
+    if (hi - lo == 1)
+    {
+        seccomp_put(e, BPF_RET | BPF_K, 0, 0, run[lo].action);
+        return;
+    }
+    int mid = lo + (hi - lo) / 2;
+    int left = seccomp_tree_size(run, lo, mid);
+    if (left > 255)
+    {
+        seccomp_put(e, BPF_JMP | BPF_JGE | BPF_K, 0, 1, run[mid].lo);
+        seccomp_put(e, BPF_JMP | BPF_JA, 0, 0, left);
+    }
+    else
+        seccomp_put(e, BPF_JMP | BPF_JGE | BPF_K, left, 0, run[mid].lo);
+    seccomp_tree(e, run, lo, mid);
+    seccomp_tree(e, run, mid, hi);
+}
+
+// The same rules as a list of compares, one per syscall, in number order
+static void seccomp_list(struct seccomp_emit *e, const struct seccomp_arch_rules *a)
+{
+    struct seccomp_rule sorted[SECCOMP_RULES_MAX];
+    memcpy(sorted, a->rules, a->nrules * sizeof(sorted[0]));
+    qsort(sorted, a->nrules, sizeof(sorted[0]), seccomp_rule_cmp);
+    for (int i = 0; i < a->nrules; i++)
+    {
+        seccomp_put(e, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, sorted[i].nr);
+        seccomp_put(e, BPF_RET | BPF_K, 0, 0, sorted[i].action);
+    }
+    seccomp_put(e, BPF_RET | BPF_K, 0, 0, a->dflt);
+}
+
+static int seccomp_arch_size(const struct seccomp_arch_rules *a, int linear)
+{
+    static struct seccomp_run run[2 * SECCOMP_RULES_MAX + 1];
+    int n = 1 + (a->arch == AUDIT_ARCH_X86_64) * 3;     // load nr, x32 check
+    return n + (linear ? 2 * a->nrules + 1 : seccomp_tree_size(run, 0, seccomp_runs(a, run)));
+}
+
+/*
+ * Compile p into out->filter (malloc'd, the caller frees it): the arch
+ * dispatch, then each arch's tree, or with linear its list of compares
+ * (for comparison). Returns 0, or -1 if it's over the kernel's limit.
+ *
+ *   ld arch; jeq ARCH0 ? next : +2; ja arch0; ...; ret KILL
+ *   arch0: ld nr; [x86_64: jge X32 && jne -1 ? kill]; tree
+ */
+int seccomp_compile(const struct seccomp_profile *p, int linear, struct sock_fprog *out)
+{
+    static struct seccomp_run run[2 * SECCOMP_RULES_MAX + 1];
+    int size = 1 + 2 * p->narches + 1;
+    for (int i = 0; i < p->narches; i++)
+        size += seccomp_arch_size(&p->arches[i], linear);
+    if (size > BPF_MAXINSNS)
+    {
+        fprintf(stderr, "seccomp: profile compiles to %d instructions, over %d\n",
+                size, BPF_MAXINSNS);
+        return -1;
+    }
+
+    struct seccomp_emit e = { .insns = calloc(size, sizeof(struct sock_filter)), .max = size };
+    if (!e.insns)
+        return -1;
+
+    seccomp_put(&e, BPF_LD | BPF_W | BPF_ABS, 0, 0, offsetof(struct seccomp_data, arch));
+    int block = 2 * p->narches + 1;     // arch 0's block, from after its "ja"
+    for (int i = 0; i < p->narches; i++)
+    {
+        seccomp_put(&e, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, p->arches[i].arch);
+        seccomp_put(&e, BPF_JMP | BPF_JA, 0, 0, block - 2 * (i + 1));
+        block += seccomp_arch_size(&p->arches[i], linear);
+    }
+    seccomp_put(&e, BPF_RET | BPF_K, 0, 0, SECCOMP_RET_KILL_PROCESS);
+
+    for (int i = 0; i < p->narches; i++)
+    {
+        const struct seccomp_arch_rules *a = &p->arches[i];
+        seccomp_put(&e, BPF_LD | BPF_W | BPF_ABS, 0, 0, offsetof(struct seccomp_data, nr));
+        // syscall(-1) isn't x32: it goes to the tree, like any number
+        // without a rule, and gets ENOSYS where that's allowed
+        if (a->arch == AUDIT_ARCH_X86_64)
+        {
+            seccomp_put(&e, BPF_JMP | BPF_JGE | BPF_K, 0, 2, SECCOMP_X32_BIT);
+            seccomp_put(&e, BPF_JMP | BPF_JEQ | BPF_K, 1, 0, UINT32_MAX);
+            seccomp_put(&e, BPF_RET | BPF_K, 0, 0, SECCOMP_RET_KILL_PROCESS);
+        }
+        if (linear)
+            seccomp_list(&e, a);
+        else
+            seccomp_tree(&e, run, 0, seccomp_runs(a, run));
+    }
+
+    out->filter = e.insns;
+    out->len = e.len;
+    return 0;
+}
+
+/*
+ * ============================================================
+ * PART 3: LOADING AND INSTALLING
+ * ============================================================
+ */
+
+// A profile by name: "default" for the built-in one, or a file
+int seccomp_profile_load(const char *name, struct seccomp_profile *p)
+{
+    if (strcmp(name, "default") == 0)
+        return seccomp_profile_parse(seccomp_default_profile, "default", p);
+
+    FILE *f = fopen(name, "r");
+    if (!f)
+    {
+        perror(name);
+        return -1;
+    }
+    char *text = malloc(SECCOMP_PROFILE_MAX + 1);
+    size_t n = text ? fread(text, 1, SECCOMP_PROFILE_MAX + 1, f) : 0;
+    fclose(f);
+    if (!text || n > SECCOMP_PROFILE_MAX)
+    {
+        fprintf(stderr, "%s: profile too big\n", name);
+        free(text);
+        return -1;
+    }
+    text[n] = '\0';
+    int ret = seccomp_profile_parse(text, name, p);
+    free(text);
+    return ret;
+}
+
+// Compiled profiles by name, recompiled when the file changes; replaced
+// round robin
+static struct {
+    char name[PATH_MAX];
+    struct timespec mtime;
+    struct sock_fprog prog;
+} seccomp_cache[SECCOMP_CACHE_SLOTS];
+static unsigned int seccomp_cache_next;
+
+// The filter for a profile (seccomp_profile_load()), compiled once. Not
+// the caller's to free; good until the next call.
+const struct sock_fprog *seccomp_get(const char *name)
+{
+    struct stat st = { 0 };
+    if (strcmp(name, "default") != 0 && stat(name, &st) != 0)
+    {
+        perror(name);
+        return NULL;
+    }
+
+    for (int i = 0; i < SECCOMP_CACHE_SLOTS; i++)
+        if (seccomp_cache[i].prog.filter && strcmp(seccomp_cache[i].name, name) == 0 &&
+            seccomp_cache[i].mtime.tv_sec == st.st_mtim.tv_sec &&
+            seccomp_cache[i].mtime.tv_nsec == st.st_mtim.tv_nsec)
+            return &seccomp_cache[i].prog;
+
+    static struct seccomp_profile profile;
+    struct sock_fprog prog;
+    if (strlen(name) >= PATH_MAX || seccomp_profile_load(name, &profile) < 0 ||
+        seccomp_compile(&profile, 0, &prog) < 0)
+        return NULL;
+
+    unsigned int slot = seccomp_cache_next++ % SECCOMP_CACHE_SLOTS;
+    free(seccomp_cache[slot].prog.filter);
+    strcpy(seccomp_cache[slot].name, name);
+    seccomp_cache[slot].mtime = st.st_mtim;
+    seccomp_cache[slot].prog = prog;
+    return &seccomp_cache[slot].prog;
+}
+
+// Filter our syscalls from here on, through exec. Root doesn't need
+// no_new_privs for it, so setuid binaries keep working; anyone else does.
+int seccomp_install(const struct sock_fprog *prog)
+{
+    if (syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, 0, prog) == 0)
+        return 0;
+    if (errno != EACCES || prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0)
+        return -1;
+    return syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, 0, prog);
+}
+
+#endif // CDOCKER_SECCOMP_H
@@ -0,0 +1,337 @@
+#ifndef CDOCKER_SPAWN_H
+#define CDOCKER_SPAWN_H
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+
+/*
+ * ============================================================
+ * PART 1: SPAWNING WITH A PIDFD
+ *
+ * clone3() without CLONE_VM behaves like fork(): the child returns from
+ * the syscall on a copy of our stack, so no separate child stack is
+ * needed. CLONE_PIDFD hands back a pidfd, which is what everything else
+ * here works on: it can't be confused with a recycled PID, it polls
+ * readable when the process exits, and it works for pidfd_send_signal()
+ * and setns().
+ *
+ * Kernels without clone3 (< 5.3) fall back to clone(CLONE_PIDFD), which
+ * needs a stack for the child to start on.
+ * ============================================================
+ */
+
+/*
+ * Stacks for the clone() fallback.
+ *
+ * Without CLONE_VM the child runs on its own copy-on-write copy of the
+ * stack, so the parent can take its stack back as soon as clone()
+ * returns; there is no need to wait for exec (CLONE_VFORK) or exit. One
+ * stack per thread doing clone() at the same time is all a pool needs.
+ *
+ * Each stack is mmap'd with a PROT_NONE guard page below it, which the
+ * child inherits, so an overflow faults instead of running into the
+ * heap. The parent never writes to them, so they stay unpopulated and
+ * cost it address space, not memory.
+ */
+
+// child_func's deepest path (setup_rootfs' path buffers, stdio) is a few
+// tens of KB
+#define STACK_SIZE (256 * 1024)
+#define STACK_POOL_SLOTS 8
+
+static void *stack_pool[STACK_POOL_SLOTS];
+
+static size_t stack_guard_size(void)
+{
+    return sysconf(_SC_PAGESIZE);
+}
+
+// Returns the lowest usable address; the stack grows down from +STACK_SIZE
+static void *stack_get(void)
+{
+    for (int i = 0; i < STACK_POOL_SLOTS; i++)
+    {
+        void *stack = __atomic_exchange_n(&stack_pool[i], NULL, __ATOMIC_ACQUIRE);
+        if (stack)
+            return stack;
+    }
+
+    size_t guard = stack_guard_size();
+    char *base = mmap(NULL, guard + STACK_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+    if (mprotect(base, guard, PROT_NONE) != 0)
+    {
+        munmap(base, guard + STACK_SIZE);
+        return NULL;
+    }
+    return base + guard;
+}
+
+static void stack_put(void *stack)
+{
+    for (int i = 0; i < STACK_POOL_SLOTS; i++)
+    {
+        void *empty = NULL;
+        if (__atomic_compare_exchange_n(&stack_pool[i], &empty, stack, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return;
+    }
+
+    size_t guard = stack_guard_size();
+    munmap((char *)stack - guard, guard + STACK_SIZE);
+}
+
+static int pidfd_send_signal_wrapper(int pidfd, int sig)
+{
+    return syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0);
+}
+
+static pid_t clone3_wrapper(struct clone_args *args)
+{
+    return syscall(SYS_clone3, args, sizeof(*args));
+}
+
+static pid_t spawn_clone_fallback(int (*fn)(void *), void *arg, uint64_t flags, int *pidfd)
+{
+    void *stack = stack_get();
+    if (!stack)
+    {
+        perror("mmap stack");
+        return -1;
+    }
+
+    pid_t pid = clone(fn, (char *)stack + STACK_SIZE,
+                      flags | CLONE_PIDFD | SIGCHLD, arg, pidfd);
+
+    // The child has its own copy from here on
+    stack_put(stack);
+    return pid;
+}
+
+// Run fn(arg) in a new process created with the given CLONE_NEW* flags.
+// cgroup_fd >= 0 starts the child directly in that cgroup (CLONE_INTO_CGROUP),
+// so it never runs outside its limits; older kernels get it written into
+// cgroup.procs right after the clone instead. Returns the pid, fills *pidfd.
+pid_t spawn_child(int (*fn)(void *), void *arg, uint64_t flags, int cgroup_fd, int *pidfd)
+{
+    struct clone_args args = {
+        .flags = flags | CLONE_PIDFD,
+        .pidfd = (uint64_t)(uintptr_t)pidfd,
+        // CLONE_PARENT children inherit ours, and clone3 wants it left 0
+        .exit_signal = flags & CLONE_PARENT ? 0 : SIGCHLD,
+    };
+
+    if (cgroup_fd >= 0)
+    {
+        args.flags |= CLONE_INTO_CGROUP;
+        args.cgroup = cgroup_fd;
+    }
+
+    // The child gets a copy of any unflushed stdio buffers otherwise
+    fflush(NULL);
+
+    pid_t pid = clone3_wrapper(&args);
+    if (pid == 0)
+        _exit(fn(arg));
+    if (pid >= 0)
+        return pid;
+
+    // Pre-5.7 kernels reject CLONE_INTO_CGROUP (E2BIG: struct too big)
+    int retry = errno == ENOSYS || (cgroup_fd >= 0 && (errno == E2BIG || errno == EINVAL));
+    if (!retry)
+        return -1;
+
+    if (errno == ENOSYS)
+        pid = spawn_clone_fallback(fn, arg, flags, pidfd);
+    else
+    {
+        args.flags &= ~(uint64_t)CLONE_INTO_CGROUP;
+        pid = clone3_wrapper(&args);
+        if (pid == 0)
+            _exit(fn(arg));
+    }
+
+    // Move it in by hand; the caller keeps it from exec'ing until we're done
+    if (pid > 0 && cgroup_fd >= 0)
+    {
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "%d", pid);
+        int fd = openat(cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+        int ok = fd >= 0 && write(fd, buf, len) == len;
+        if (!ok)
+        {
+            // Better no container than one running outside its limits
+            perror("cgroup.procs");
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            close(*pidfd);
+            pid = -1;
+        }
+        if (fd >= 0)
+            close(fd);
+    }
+    return pid;
+}
+
+/*
+ * ============================================================
+ * PART 2: REAPING AND SUPERVISION
+ * ============================================================
+ */
+
+// Reap the process behind pidfd (which must have exited, or this blocks)
+// and return a waitpid()-style status.
+int pidfd_reap(int pidfd)
+{
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+
+    if (waitid(P_PIDFD, pidfd, &info, WEXITED) < 0)
+    {
+        perror("waitid");
+        return -1;
+    }
+
+    if (info.si_code == CLD_EXITED)
+        return (info.si_status & 0xff) << 8;
+    // killed/dumped: the signal number, plus WCOREDUMP's bit for a core
+    return (info.si_status & 0x7f) | (info.si_code == CLD_DUMPED ? 0x80 : 0);
+}
+
+// One epoll set can watch any number of pidfds; an exited process makes
+// its pidfd readable, so there's no polling and no SIGCHLD handling.
+struct supervisor {
+    int epfd;
+};
+
+struct sv_exit {
+    void *cookie;     // as passed to supervisor_watch
+    int pidfd;
+    int status;       // waitpid()-style
+};
+
+int supervisor_init(struct supervisor *sv)
+{
+    sv->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (sv->epfd < 0)
+    {
+        perror("epoll_create1");
+        return -1;
+    }
+    return 0;
+}
+
+void supervisor_close(struct supervisor *sv)
+{
+    if (sv->epfd >= 0)
+        close(sv->epfd);
+    sv->epfd = -1;
+}
+
+struct sv_watch {
+    int pidfd;
+    void *cookie;
+};
+
+int supervisor_watch(struct supervisor *sv, int pidfd, void *cookie)
+{
+    struct sv_watch *w = malloc(sizeof(*w));
+    if (!w)
+        return -1;
+    w->pidfd = pidfd;
+    w->cookie = cookie;
+
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT, .data.ptr = w };
+    if (epoll_ctl(sv->epfd, EPOLL_CTL_ADD, pidfd, &ev) < 0)
+    {
+        perror("epoll_ctl pidfd");
+        free(w);
+        return -1;
+    }
+    return 0;
+}
+
+// Wait up to timeout_ms (-1 = forever) for watched processes to exit.
+// Reaps them, fills out[] and returns how many; the pidfds stay open and
+// belong to the caller.
+int supervisor_wait(struct supervisor *sv, struct sv_exit *out, int max, int timeout_ms)
+{
+    struct epoll_event ev[64];
+    if (max > 64)
+        max = 64;
+
+    int n = epoll_wait(sv->epfd, ev, max, timeout_ms);
+    if (n < 0)
+        return errno == EINTR ? 0 : -1;
+
+    for (int i = 0; i < n; i++)
+    {
+        struct sv_watch *w = ev[i].data.ptr;
+        epoll_ctl(sv->epfd, EPOLL_CTL_DEL, w->pidfd, NULL);
+        out[i].cookie = w->cookie;
+        out[i].pidfd = w->pidfd;
+        out[i].status = pidfd_reap(w->pidfd);
+        free(w);
+    }
+    return n;
+}
+
+// Wait for a single container while forwarding the signals in fwd (which
+// the caller has blocked) to it. Returns its waitpid()-style status.
+int supervise_child(int pidfd, const sigset_t *fwd)
+{
+    int sfd = signalfd(-1, fwd, SFD_CLOEXEC);
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (sfd < 0 || epfd < 0)
+    {
+        perror("signalfd/epoll");
+        if (sfd >= 0) close(sfd);
+        if (epfd >= 0) close(epfd);
+        return pidfd_reap(pidfd);
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = pidfd };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, pidfd, &ev);
+    ev.data.fd = sfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev);
+
+    for (;;)
+    {
+        if (epoll_wait(epfd, &ev, 1, -1) < 1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        if (ev.data.fd == pidfd)
+            break;
+
+        struct signalfd_siginfo si;
+        if (read(sfd, &si, sizeof(si)) == sizeof(si))
+            pidfd_send_signal_wrapper(pidfd, si.ssi_signo);
+    }
+
+    close(epfd);
+    close(sfd);
+    return pidfd_reap(pidfd);
+}
+
+#endif // CDOCKER_SPAWN_H
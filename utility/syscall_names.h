@@ -0,0 +1,190 @@
+#ifndef CDOCKER_SYSCALL_NAMES_H
+#define CDOCKER_SYSCALL_NAMES_H
+
+/*
+ * Syscall names for seccomp profiles, as one string per table: NUL
+ * separated, in number order, so a name's position is its number. Taken
+ * from the kernel headers; numbers past the end are still fine in a
+ * profile, just not by name.
+ */
+
+// By number, "" for the unused ones (asm/unistd_64.h)
+static const char syscall_names_x86_64[] =
+    "read\0write\0open\0close\0stat\0fstat\0lstat\0poll\0lseek\0mmap\0mprotect\0"
+    "munmap\0brk\0rt_sigaction\0rt_sigprocmask\0rt_sigreturn\0ioctl\0pread64\0"
+    "pwrite64\0readv\0writev\0access\0pipe\0select\0sched_yield\0mremap\0msync\0"
+    "mincore\0madvise\0shmget\0shmat\0shmctl\0dup\0dup2\0pause\0nanosleep\0getitimer\0"
+    "alarm\0setitimer\0getpid\0sendfile\0socket\0connect\0accept\0sendto\0recvfrom\0"
+    "sendmsg\0recvmsg\0shutdown\0bind\0listen\0getsockname\0getpeername\0socketpair\0"
+    "setsockopt\0getsockopt\0clone\0fork\0vfork\0execve\0exit\0wait4\0kill\0uname\0"
+    "semget\0semop\0semctl\0shmdt\0msgget\0msgsnd\0msgrcv\0msgctl\0fcntl\0flock\0"
+    "fsync\0fdatasync\0truncate\0ftruncate\0getdents\0getcwd\0chdir\0fchdir\0rename\0"
+    "mkdir\0rmdir\0creat\0link\0unlink\0symlink\0readlink\0chmod\0fchmod\0chown\0"
+    "fchown\0lchown\0umask\0gettimeofday\0getrlimit\0getrusage\0sysinfo\0times\0"
+    "ptrace\0getuid\0syslog\0getgid\0setuid\0setgid\0geteuid\0getegid\0setpgid\0"
+    "getppid\0getpgrp\0setsid\0setreuid\0setregid\0getgroups\0setgroups\0setresuid\0"
+    "getresuid\0setresgid\0getresgid\0getpgid\0setfsuid\0setfsgid\0getsid\0capget\0"
+    "capset\0rt_sigpending\0rt_sigtimedwait\0rt_sigqueueinfo\0rt_sigsuspend\0"
+    "sigaltstack\0utime\0mknod\0uselib\0personality\0ustat\0statfs\0fstatfs\0sysfs\0"
+    "getpriority\0setpriority\0sched_setparam\0sched_getparam\0sched_setscheduler\0"
+    "sched_getscheduler\0sched_get_priority_max\0sched_get_priority_min\0"
+    "sched_rr_get_interval\0mlock\0munlock\0mlockall\0munlockall\0vhangup\0modify_ldt\0"
+    "pivot_root\0_sysctl\0prctl\0arch_prctl\0adjtimex\0setrlimit\0chroot\0sync\0acct\0"
+    "settimeofday\0mount\0umount2\0swapon\0swapoff\0reboot\0sethostname\0"
+    "setdomainname\0iopl\0ioperm\0create_module\0init_module\0delete_module\0"
+    "get_kernel_syms\0query_module\0quotactl\0nfsservctl\0getpmsg\0putpmsg\0"
+    "afs_syscall\0tuxcall\0security\0gettid\0readahead\0setxattr\0lsetxattr\0"
+    "fsetxattr\0getxattr\0lgetxattr\0fgetxattr\0listxattr\0llistxattr\0flistxattr\0"
+    "removexattr\0lremovexattr\0fremovexattr\0tkill\0time\0futex\0sched_setaffinity\0"
+    "sched_getaffinity\0set_thread_area\0io_setup\0io_destroy\0io_getevents\0"
+    "io_submit\0io_cancel\0get_thread_area\0lookup_dcookie\0epoll_create\0"
+    "epoll_ctl_old\0epoll_wait_old\0remap_file_pages\0getdents64\0set_tid_address\0"
+    "restart_syscall\0semtimedop\0fadvise64\0timer_create\0timer_settime\0"
+    "timer_gettime\0timer_getoverrun\0timer_delete\0clock_settime\0clock_gettime\0"
+    "clock_getres\0clock_nanosleep\0exit_group\0epoll_wait\0epoll_ctl\0tgkill\0utimes\0"
+    "vserver\0mbind\0set_mempolicy\0get_mempolicy\0mq_open\0mq_unlink\0mq_timedsend\0"
+    "mq_timedreceive\0mq_notify\0mq_getsetattr\0kexec_load\0waitid\0add_key\0"
+    "request_key\0keyctl\0ioprio_set\0ioprio_get\0inotify_init\0inotify_add_watch\0"
+    "inotify_rm_watch\0migrate_pages\0openat\0mkdirat\0mknodat\0fchownat\0futimesat\0"
+    "newfstatat\0unlinkat\0renameat\0linkat\0symlinkat\0readlinkat\0fchmodat\0"
+    "faccessat\0pselect6\0ppoll\0unshare\0set_robust_list\0get_robust_list\0splice\0"
+    "tee\0sync_file_range\0vmsplice\0move_pages\0utimensat\0epoll_pwait\0signalfd\0"
+    "timerfd_create\0eventfd\0fallocate\0timerfd_settime\0timerfd_gettime\0accept4\0"
+    "signalfd4\0eventfd2\0epoll_create1\0dup3\0pipe2\0inotify_init1\0preadv\0pwritev\0"
+    "rt_tgsigqueueinfo\0perf_event_open\0recvmmsg\0fanotify_init\0fanotify_mark\0"
+    "prlimit64\0name_to_handle_at\0open_by_handle_at\0clock_adjtime\0syncfs\0sendmmsg\0"
+    "setns\0getcpu\0process_vm_readv\0process_vm_writev\0kcmp\0finit_module\0"
+    "sched_setattr\0sched_getattr\0renameat2\0seccomp\0getrandom\0memfd_create\0"
+    "kexec_file_load\0bpf\0execveat\0userfaultfd\0membarrier\0mlock2\0copy_file_range\0"
+    "preadv2\0pwritev2\0pkey_mprotect\0pkey_alloc\0pkey_free\0statx\0io_pgetevents\0"
+    "rseq\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
+    "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
+    "\0\0\0\0\0\0\0\0\0\0pidfd_send_signal\0io_uring_setup\0io_uring_enter\0"
+    "io_uring_register\0open_tree\0move_mount\0fsopen\0fsconfig\0fsmount\0fspick\0"
+    "pidfd_open\0clone3\0close_range\0openat2\0pidfd_getfd\0faccessat2\0"
+    "process_madvise\0epoll_pwait2\0mount_setattr\0quotactl_fd\0"
+    "landlock_create_ruleset\0landlock_add_rule\0landlock_restrict_self\0memfd_secret\0"
+    "process_mrelease\0futex_waitv\0set_mempolicy_home_node\0";
+
+// The 32-bit (int 0x80) table, by number (asm/unistd_32.h)
+static const char syscall_names_i386[] =
+    "restart_syscall\0exit\0fork\0read\0write\0open\0close\0waitpid\0creat\0link\0"
+    "unlink\0execve\0chdir\0time\0mknod\0chmod\0lchown\0break\0oldstat\0lseek\0getpid\0"
+    "mount\0umount\0setuid\0getuid\0stime\0ptrace\0alarm\0oldfstat\0pause\0utime\0"
+    "stty\0gtty\0access\0nice\0ftime\0sync\0kill\0rename\0mkdir\0rmdir\0dup\0pipe\0"
+    "times\0prof\0brk\0setgid\0getgid\0signal\0geteuid\0getegid\0acct\0umount2\0lock\0"
+    "ioctl\0fcntl\0mpx\0setpgid\0ulimit\0oldolduname\0umask\0chroot\0ustat\0dup2\0"
+    "getppid\0getpgrp\0setsid\0sigaction\0sgetmask\0ssetmask\0setreuid\0setregid\0"
+    "sigsuspend\0sigpending\0sethostname\0setrlimit\0getrlimit\0getrusage\0"
+    "gettimeofday\0settimeofday\0getgroups\0setgroups\0select\0symlink\0oldlstat\0"
+    "readlink\0uselib\0swapon\0reboot\0readdir\0mmap\0munmap\0truncate\0ftruncate\0"
+    "fchmod\0fchown\0getpriority\0setpriority\0profil\0statfs\0fstatfs\0ioperm\0"
+    "socketcall\0syslog\0setitimer\0getitimer\0stat\0lstat\0fstat\0olduname\0iopl\0"
+    "vhangup\0idle\0vm86old\0wait4\0swapoff\0sysinfo\0ipc\0fsync\0sigreturn\0clone\0"
+    "setdomainname\0uname\0modify_ldt\0adjtimex\0mprotect\0sigprocmask\0create_module\0"
+    "init_module\0delete_module\0get_kernel_syms\0quotactl\0getpgid\0fchdir\0bdflush\0"
+    "sysfs\0personality\0afs_syscall\0setfsuid\0setfsgid\0_llseek\0getdents\0"
+    "_newselect\0flock\0msync\0readv\0writev\0getsid\0fdatasync\0_sysctl\0mlock\0"
+    "munlock\0mlockall\0munlockall\0sched_setparam\0sched_getparam\0"
+    "sched_setscheduler\0sched_getscheduler\0sched_yield\0sched_get_priority_max\0"
+    "sched_get_priority_min\0sched_rr_get_interval\0nanosleep\0mremap\0setresuid\0"
+    "getresuid\0vm86\0query_module\0poll\0nfsservctl\0setresgid\0getresgid\0prctl\0"
+    "rt_sigreturn\0rt_sigaction\0rt_sigprocmask\0rt_sigpending\0rt_sigtimedwait\0"
+    "rt_sigqueueinfo\0rt_sigsuspend\0pread64\0pwrite64\0chown\0getcwd\0capget\0capset\0"
+    "sigaltstack\0sendfile\0getpmsg\0putpmsg\0vfork\0ugetrlimit\0mmap2\0truncate64\0"
+    "ftruncate64\0stat64\0lstat64\0fstat64\0lchown32\0getuid32\0getgid32\0geteuid32\0"
+    "getegid32\0setreuid32\0setregid32\0getgroups32\0setgroups32\0fchown32\0"
+    "setresuid32\0getresuid32\0setresgid32\0getresgid32\0chown32\0setuid32\0setgid32\0"
+    "setfsuid32\0setfsgid32\0pivot_root\0mincore\0madvise\0getdents64\0fcntl64\0\0\0"
+    "gettid\0readahead\0setxattr\0lsetxattr\0fsetxattr\0getxattr\0lgetxattr\0"
+    "fgetxattr\0listxattr\0llistxattr\0flistxattr\0removexattr\0lremovexattr\0"
+    "fremovexattr\0tkill\0sendfile64\0futex\0sched_setaffinity\0sched_getaffinity\0"
+    "set_thread_area\0get_thread_area\0io_setup\0io_destroy\0io_getevents\0io_submit\0"
+    "io_cancel\0fadvise64\0\0exit_group\0lookup_dcookie\0epoll_create\0epoll_ctl\0"
+    "epoll_wait\0remap_file_pages\0set_tid_address\0timer_create\0timer_settime\0"
+    "timer_gettime\0timer_getoverrun\0timer_delete\0clock_settime\0clock_gettime\0"
+    "clock_getres\0clock_nanosleep\0statfs64\0fstatfs64\0tgkill\0utimes\0fadvise64_64\0"
+    "vserver\0mbind\0get_mempolicy\0set_mempolicy\0mq_open\0mq_unlink\0mq_timedsend\0"
+    "mq_timedreceive\0mq_notify\0mq_getsetattr\0kexec_load\0waitid\0\0add_key\0"
+    "request_key\0keyctl\0ioprio_set\0ioprio_get\0inotify_init\0inotify_add_watch\0"
+    "inotify_rm_watch\0migrate_pages\0openat\0mkdirat\0mknodat\0fchownat\0futimesat\0"
+    "fstatat64\0unlinkat\0renameat\0linkat\0symlinkat\0readlinkat\0fchmodat\0"
+    "faccessat\0pselect6\0ppoll\0unshare\0set_robust_list\0get_robust_list\0splice\0"
+    "sync_file_range\0tee\0vmsplice\0move_pages\0getcpu\0epoll_pwait\0utimensat\0"
+    "signalfd\0timerfd_create\0eventfd\0fallocate\0timerfd_settime\0timerfd_gettime\0"
+    "signalfd4\0eventfd2\0epoll_create1\0dup3\0pipe2\0inotify_init1\0preadv\0pwritev\0"
+    "rt_tgsigqueueinfo\0perf_event_open\0recvmmsg\0fanotify_init\0fanotify_mark\0"
+    "prlimit64\0name_to_handle_at\0open_by_handle_at\0clock_adjtime\0syncfs\0sendmmsg\0"
+    "setns\0process_vm_readv\0process_vm_writev\0kcmp\0finit_module\0sched_setattr\0"
+    "sched_getattr\0renameat2\0seccomp\0getrandom\0memfd_create\0bpf\0execveat\0"
+    "socket\0socketpair\0bind\0connect\0listen\0accept4\0getsockopt\0setsockopt\0"
+    "getsockname\0getpeername\0sendto\0sendmsg\0recvfrom\0recvmsg\0shutdown\0"
+    "userfaultfd\0membarrier\0mlock2\0copy_file_range\0preadv2\0pwritev2\0"
+    "pkey_mprotect\0pkey_alloc\0pkey_free\0statx\0arch_prctl\0io_pgetevents\0rseq\0\0\0"
+    "\0\0\0\0semget\0semctl\0shmget\0shmctl\0shmat\0shmdt\0msgget\0msgsnd\0msgrcv\0"
+    "msgctl\0clock_gettime64\0clock_settime64\0clock_adjtime64\0clock_getres_time64\0"
+    "clock_nanosleep_time64\0timer_gettime64\0timer_settime64\0timerfd_gettime64\0"
+    "timerfd_settime64\0utimensat_time64\0pselect6_time64\0ppoll_time64\0\0"
+    "io_pgetevents_time64\0recvmmsg_time64\0mq_timedsend_time64\0"
+    "mq_timedreceive_time64\0semtimedop_time64\0rt_sigtimedwait_time64\0futex_time64\0"
+    "sched_rr_get_interval_time64\0pidfd_send_signal\0io_uring_setup\0io_uring_enter\0"
+    "io_uring_register\0open_tree\0move_mount\0fsopen\0fsconfig\0fsmount\0fspick\0"
+    "pidfd_open\0clone3\0close_range\0openat2\0pidfd_getfd\0faccessat2\0"
+    "process_madvise\0epoll_pwait2\0mount_setattr\0quotactl_fd\0"
+    "landlock_create_ruleset\0landlock_add_rule\0landlock_restrict_self\0memfd_secret\0"
+    "process_mrelease\0futex_waitv\0set_mempolicy_home_node\0";
+
+// The generic table arm64 uses, by number (asm-generic/unistd.h)
+static const char syscall_names_aarch64[] =
+    "io_setup\0io_destroy\0io_submit\0io_cancel\0io_getevents\0setxattr\0lsetxattr\0"
+    "fsetxattr\0getxattr\0lgetxattr\0fgetxattr\0listxattr\0llistxattr\0flistxattr\0"
+    "removexattr\0lremovexattr\0fremovexattr\0getcwd\0lookup_dcookie\0eventfd2\0"
+    "epoll_create1\0epoll_ctl\0epoll_pwait\0dup\0dup3\0fcntl\0inotify_init1\0"
+    "inotify_add_watch\0inotify_rm_watch\0ioctl\0ioprio_set\0ioprio_get\0flock\0"
+    "mknodat\0mkdirat\0unlinkat\0symlinkat\0linkat\0renameat\0umount2\0mount\0"
+    "pivot_root\0nfsservctl\0statfs\0fstatfs\0truncate\0ftruncate\0fallocate\0"
+    "faccessat\0chdir\0fchdir\0chroot\0fchmod\0fchmodat\0fchownat\0fchown\0openat\0"
+    "close\0vhangup\0pipe2\0quotactl\0getdents64\0lseek\0read\0write\0readv\0writev\0"
+    "pread64\0pwrite64\0preadv\0pwritev\0sendfile\0pselect6\0ppoll\0signalfd4\0"
+    "vmsplice\0splice\0tee\0readlinkat\0newfstatat\0fstat\0sync\0fsync\0fdatasync\0"
+    "sync_file_range\0timerfd_create\0timerfd_settime\0timerfd_gettime\0utimensat\0"
+    "acct\0capget\0capset\0personality\0exit\0exit_group\0waitid\0set_tid_address\0"
+    "unshare\0futex\0set_robust_list\0get_robust_list\0nanosleep\0getitimer\0"
+    "setitimer\0kexec_load\0init_module\0delete_module\0timer_create\0timer_gettime\0"
+    "timer_getoverrun\0timer_settime\0timer_delete\0clock_settime\0clock_gettime\0"
+    "clock_getres\0clock_nanosleep\0syslog\0ptrace\0sched_setparam\0"
+    "sched_setscheduler\0sched_getscheduler\0sched_getparam\0sched_setaffinity\0"
+    "sched_getaffinity\0sched_yield\0sched_get_priority_max\0sched_get_priority_min\0"
+    "sched_rr_get_interval\0restart_syscall\0kill\0tkill\0tgkill\0sigaltstack\0"
+    "rt_sigsuspend\0rt_sigaction\0rt_sigprocmask\0rt_sigpending\0rt_sigtimedwait\0"
+    "rt_sigqueueinfo\0rt_sigreturn\0setpriority\0getpriority\0reboot\0setregid\0"
+    "setgid\0setreuid\0setuid\0setresuid\0getresuid\0setresgid\0getresgid\0setfsuid\0"
+    "setfsgid\0times\0setpgid\0getpgid\0getsid\0setsid\0getgroups\0setgroups\0uname\0"
+    "sethostname\0setdomainname\0getrlimit\0setrlimit\0getrusage\0umask\0prctl\0"
+    "getcpu\0gettimeofday\0settimeofday\0adjtimex\0getpid\0getppid\0getuid\0geteuid\0"
+    "getgid\0getegid\0gettid\0sysinfo\0mq_open\0mq_unlink\0mq_timedsend\0"
+    "mq_timedreceive\0mq_notify\0mq_getsetattr\0msgget\0msgctl\0msgrcv\0msgsnd\0"
+    "semget\0semctl\0semtimedop\0semop\0shmget\0shmctl\0shmat\0shmdt\0socket\0"
+    "socketpair\0bind\0listen\0accept\0connect\0getsockname\0getpeername\0sendto\0"
+    "recvfrom\0setsockopt\0getsockopt\0shutdown\0sendmsg\0recvmsg\0readahead\0brk\0"
+    "munmap\0mremap\0add_key\0request_key\0keyctl\0clone\0execve\0mmap\0fadvise64\0"
+    "swapon\0swapoff\0mprotect\0msync\0mlock\0munlock\0mlockall\0munlockall\0mincore\0"
+    "madvise\0remap_file_pages\0mbind\0get_mempolicy\0set_mempolicy\0migrate_pages\0"
+    "move_pages\0rt_tgsigqueueinfo\0perf_event_open\0accept4\0recvmmsg\0\0\0\0\0\0\0\0"
+    "\0\0\0\0\0\0\0\0\0wait4\0prlimit64\0fanotify_init\0fanotify_mark\0"
+    "name_to_handle_at\0open_by_handle_at\0clock_adjtime\0syncfs\0setns\0sendmmsg\0"
+    "process_vm_readv\0process_vm_writev\0kcmp\0finit_module\0sched_setattr\0"
+    "sched_getattr\0renameat2\0seccomp\0getrandom\0memfd_create\0bpf\0execveat\0"
+    "userfaultfd\0membarrier\0mlock2\0copy_file_range\0preadv2\0pwritev2\0"
+    "pkey_mprotect\0pkey_alloc\0pkey_free\0statx\0io_pgetevents\0rseq\0"
+    "kexec_file_load\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
+    "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
+    "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
+    "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0pidfd_send_signal\0io_uring_setup\0io_uring_enter\0"
+    "io_uring_register\0open_tree\0move_mount\0fsopen\0fsconfig\0fsmount\0fspick\0"
+    "pidfd_open\0clone3\0close_range\0openat2\0pidfd_getfd\0faccessat2\0"
+    "process_madvise\0epoll_pwait2\0mount_setattr\0quotactl_fd\0"
+    "landlock_create_ruleset\0landlock_add_rule\0landlock_restrict_self\0memfd_secret\0"
+    "process_mrelease\0futex_waitv\0set_mempolicy_home_node\0";
+
+#endif // CDOCKER_SYSCALL_NAMES_H
@@ -0,0 +1,766 @@
+#ifndef CDOCKER_TAR_H
+#define CDOCKER_TAR_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <zlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/xattr.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/limits.h>
+#include <linux/openat2.h>
+
+#include "sha256.h"
+
+/*
+ * ============================================================
+ * PART 1: LAYER READER
+ *
+ * Gives back the uncompressed tar stream of a layer blob. Plain tar and
+ * gzip are read in-process (zlib), hashing the blob bytes on the way
+ * through. zstd is piped through a "zstd -dc" helper process, which
+ * reads the blob itself, so those blobs are hashed in a separate pass.
+ * ============================================================
+ */
+
+enum layer_compression { LAYER_PLAIN, LAYER_GZIP, LAYER_ZSTD };
+
+#define LAYER_IO_SIZE (128 * 1024)
+
+struct layer_reader {
+    int blob_fd;                  // the blob on disk
+    int fd;                       // tar stream: blob_fd, or the helper's stdout
+    enum layer_compression kind;
+    struct sha256 *sha;           // hashes blob bytes as they're read, may be NULL
+
+    z_stream z;
+    unsigned char *in;            // compressed input buffer (gzip)
+    int raw_eof;
+    int eof;
+
+    pid_t helper;                 // zstd -dc
+};
+
+static enum layer_compression layer_detect(int fd)
+{
+    unsigned char magic[4] = {0};
+    if (pread(fd, magic, sizeof(magic), 0) < 2)
+        return LAYER_PLAIN;
+    if (magic[0] == 0x1f && magic[1] == 0x8b)
+        return LAYER_GZIP;
+    if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+        return LAYER_ZSTD;
+    return LAYER_PLAIN;
+}
+
+// Hash a whole file (used for blobs whose bytes we never see ourselves)
+int sha256_file(int fd, char hex[65])
+{
+    struct sha256 c;
+    sha256_init(&c);
+
+    char *buf = malloc(LAYER_IO_SIZE);
+    if (!buf) return -ENOMEM;
+
+    off_t off = 0;
+    ssize_t n;
+    while ((n = pread(fd, buf, LAYER_IO_SIZE, off)) > 0)
+    {
+        sha256_update(&c, buf, n);
+        off += n;
+    }
+    free(buf);
+
+    if (n < 0)
+        return -errno;
+    sha256_final_hex(&c, hex);
+    return 0;
+}
+
+static pid_t spawn_zstd(int blob_fd, int *out_fd)
+{
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) < 0)
+    {
+        perror("pipe");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork zstd");
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        dup2(blob_fd, STDIN_FILENO);
+        dup2(pipefd[1], STDOUT_FILENO);
+        lseek(STDIN_FILENO, 0, SEEK_SET);
+        char *const argv[] = {"zstd", "-dcq", NULL};
+        execvp("zstd", argv);
+        perror("exec zstd");
+        _exit(127);
+    }
+
+    close(pipefd[1]);
+    *out_fd = pipefd[0];
+    return pid;
+}
+
+int layer_reader_open(struct layer_reader *r, const char *blob, struct sha256 *sha)
+{
+    memset(r, 0, sizeof(*r));
+    r->helper = -1;
+
+    r->blob_fd = open(blob, O_RDONLY | O_CLOEXEC);
+    if (r->blob_fd < 0)
+    {
+        perror(blob);
+        return -1;
+    }
+
+    r->fd = r->blob_fd;
+    r->kind = layer_detect(r->blob_fd);
+
+    if (r->kind == LAYER_ZSTD)
+    {
+        r->helper = spawn_zstd(r->blob_fd, &r->fd);
+        if (r->helper < 0)
+        {
+            close(r->blob_fd);
+            return -1;
+        }
+        return 0;
+    }
+
+    r->sha = sha;
+
+    if (r->kind == LAYER_GZIP)
+    {
+        r->in = malloc(LAYER_IO_SIZE);
+        // 15 + 32: gzip or zlib header, detected automatically
+        if (!r->in || inflateInit2(&r->z, 15 + 32) != Z_OK)
+        {
+            fprintf(stderr, "layer: zlib init failed\n");
+            free(r->in);
+            close(r->blob_fd);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static ssize_t layer_raw_read(struct layer_reader *r, void *buf, size_t len)
+{
+    ssize_t n;
+    do {
+        n = read(r->fd, buf, len);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0 && r->sha && r->fd == r->blob_fd)
+        sha256_update(r->sha, buf, n);
+    return n;
+}
+
+// Read up to len bytes of tar stream; 0 at end of stream
+ssize_t layer_read(struct layer_reader *r, void *buf, size_t len)
+{
+    if (r->kind != LAYER_GZIP)
+        return layer_raw_read(r, buf, len);
+
+    if (r->eof)
+        return 0;
+
+    r->z.next_out = buf;
+    r->z.avail_out = len;
+
+    while (r->z.avail_out == len)
+    {
+        if (r->z.avail_in == 0 && !r->raw_eof)
+        {
+            ssize_t n = layer_raw_read(r, r->in, LAYER_IO_SIZE);
+            if (n < 0) return -errno;
+            if (n == 0) r->raw_eof = 1;
+            r->z.next_in = r->in;
+            r->z.avail_in = n;
+        }
+
+        int rc = inflate(&r->z, Z_NO_FLUSH);
+        if (rc == Z_STREAM_END)
+        {
+            // Concatenated gzip members are one stream, so only stop if
+            // there is no more input at all
+            if (r->z.avail_in == 0 && !r->raw_eof)
+            {
+                ssize_t n = layer_raw_read(r, r->in, LAYER_IO_SIZE);
+                if (n < 0) return -errno;
+                if (n == 0) r->raw_eof = 1;
+                r->z.next_in = r->in;
+                r->z.avail_in = n;
+            }
+            if (r->z.avail_in == 0 && r->raw_eof)
+            {
+                r->eof = 1;
+                break;
+            }
+            inflateReset(&r->z);
+        }
+        else if (rc == Z_BUF_ERROR && r->raw_eof)
+        {
+            fprintf(stderr, "layer: truncated gzip stream\n");
+            return -EIO;
+        }
+        else if (rc != Z_OK && rc != Z_BUF_ERROR)
+        {
+            fprintf(stderr, "layer: inflate: %s\n", r->z.msg ? r->z.msg : "error");
+            return -EIO;
+        }
+    }
+
+    return len - r->z.avail_out;
+}
+
+int layer_read_full(struct layer_reader *r, void *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = layer_read(r, (char *)buf + done, len - done);
+        if (n <= 0)
+            return n < 0 ? n : -EIO;
+        done += n;
+    }
+    return 0;
+}
+
+// Consume the rest of the blob (so the hash covers all of it) and release
+// everything. Returns 0 if the stream and the helper both ended cleanly.
+int layer_reader_close(struct layer_reader *r)
+{
+    int ret = 0;
+    char *buf = malloc(LAYER_IO_SIZE);
+
+    if (buf)
+    {
+        ssize_t n;
+        while ((n = layer_read(r, buf, LAYER_IO_SIZE)) > 0)
+            ;
+        if (n < 0)
+            ret = n;
+
+        // Anything after the last gzip member still belongs to the blob
+        if (r->kind == LAYER_GZIP)
+            while ((n = layer_raw_read(r, buf, LAYER_IO_SIZE)) > 0)
+                ;
+        free(buf);
+    }
+
+    if (r->kind == LAYER_GZIP)
+    {
+        inflateEnd(&r->z);
+        free(r->in);
+    }
+
+    if (r->fd != r->blob_fd)
+        close(r->fd);
+    close(r->blob_fd);
+
+    if (r->helper > 0)
+    {
+        int status;
+        if (waitpid(r->helper, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+        {
+            fprintf(stderr, "layer: zstd failed\n");
+            ret = -EIO;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * ============================================================
+ * PART 2: TAR EXTRACTION
+ *
+ * Handles ustar, GNU long names (L/K) and pax path/linkpath/size.
+ * All paths are resolved with openat2(RESOLVE_IN_ROOT) against the layer
+ * directory, so neither "../" nor symlinks inside the layer can make us
+ * write outside it.
+ *
+ * OCI whiteouts are turned into overlayfs ones, so an extracted layer
+ * can be used directly as an overlay lower dir:
+ *   .wh.<name>     -> 0/0 character device <name>
+ *   .wh..wh..opq   -> trusted.overlay.opaque=y on the directory
+ * ============================================================
+ */
+
+struct tar_header {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+
+// Octal, or base-256 when the top bit of the first byte is set
+static unsigned long long tar_num(const char *p, size_t len)
+{
+    unsigned long long v = 0;
+
+    if ((unsigned char)p[0] & 0x80)
+    {
+        v = (unsigned char)p[0] & 0x7f;
+        for (size_t i = 1; i < len; i++)
+            v = (v << 8) | (unsigned char)p[i];
+        return v;
+    }
+
+    for (size_t i = 0; i < len && p[i]; i++)
+    {
+        if (p[i] >= '0' && p[i] <= '7')
+            v = (v << 3) | (p[i] - '0');
+        else if (p[i] != ' ')
+            break;
+    }
+    return v;
+}
+
+static int tar_checksum_ok(const struct tar_header *h)
+{
+    const unsigned char *p = (const unsigned char *)h;
+    unsigned long sum = 0;
+
+    for (size_t i = 0; i < sizeof(*h); i++)
+    {
+        if (i >= offsetof(struct tar_header, chksum) &&
+            i < offsetof(struct tar_header, chksum) + sizeof(h->chksum))
+            sum += ' ';
+        else
+            sum += p[i];
+    }
+    return sum == tar_num(h->chksum, sizeof(h->chksum));
+}
+
+// Strip leading "/" and "./" and trailing "/"; refuse ".." components
+static char *tar_clean_path(char *path)
+{
+    while (*path == '/' || (path[0] == '.' && path[1] == '/'))
+        path += (*path == '/') ? 1 : 2;
+
+    size_t len = strlen(path);
+    while (len > 0 && path[len - 1] == '/')
+        path[--len] = '\0';
+
+    for (char *p = path; *p; )
+    {
+        char *slash = strchr(p, '/');
+        size_t n = slash ? (size_t)(slash - p) : strlen(p);
+        if (n == 2 && p[0] == '.' && p[1] == '.')
+            return NULL;
+        p += n + (slash ? 1 : 0);
+    }
+
+    return path;
+}
+
+static int tar_openat2(int rootfd, const char *path, int flags)
+{
+    struct open_how how = {
+        .flags = flags | O_CLOEXEC,
+        .resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS,
+    };
+    return syscall(SYS_openat2, rootfd, *path ? path : ".", &how, sizeof(how));
+}
+
+// Open a directory inside the layer, creating missing components
+static int tar_open_dir(int rootfd, const char *dir)
+{
+    int fd = tar_openat2(rootfd, dir, O_RDONLY | O_DIRECTORY);
+    if (fd >= 0 || errno != ENOENT)
+        return fd;
+
+    // Create the missing parent first, then this directory inside it
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s", dir);
+
+    const char *name = tmp;
+    int pfd;
+    char *slash = strrchr(tmp, '/');
+    if (slash)
+    {
+        *slash = '\0';
+        name = slash + 1;
+        pfd = tar_open_dir(rootfd, tmp);
+    }
+    else
+    {
+        pfd = tar_openat2(rootfd, "", O_RDONLY | O_DIRECTORY);
+    }
+    if (pfd < 0)
+        return -1;
+
+    if (mkdirat(pfd, name, 0755) && errno != EEXIST)
+    {
+        close(pfd);
+        return -1;
+    }
+    close(pfd);
+
+    return tar_openat2(rootfd, dir, O_RDONLY | O_DIRECTORY);
+}
+
+static int tar_copy_data(struct layer_reader *r, int fd, unsigned long long size, char *buf)
+{
+    while (size > 0)
+    {
+        size_t chunk = size < LAYER_IO_SIZE ? size : LAYER_IO_SIZE;
+        int ret = layer_read_full(r, buf, chunk);
+        if (ret < 0)
+            return ret;
+        if (fd >= 0 && write(fd, buf, chunk) != (ssize_t)chunk)
+            return -errno;
+        size -= chunk;
+    }
+    return 0;
+}
+
+// pax extended header: "<len> key=value\n" records
+static void tar_parse_pax(char *data, size_t len, char *path, char *linkpath,
+                          unsigned long long *size, int *have_size)
+{
+    char *p = data, *end = data + len;
+
+    while (p < end)
+    {
+        char *sp;
+        unsigned long reclen = strtoul(p, &sp, 10);
+        if (reclen == 0 || *sp != ' ' || p + reclen > end)
+            break;
+
+        char *key = sp + 1;
+        char *rec_end = p + reclen - 1;   // the '\n'
+        char *eq = memchr(key, '=', rec_end - key);
+        if (eq)
+        {
+            *eq = '\0';
+            *rec_end = '\0';
+            const char *val = eq + 1;
+            if (strcmp(key, "path") == 0)
+                snprintf(path, PATH_MAX, "%s", val);
+            else if (strcmp(key, "linkpath") == 0)
+                snprintf(linkpath, PATH_MAX, "%s", val);
+            else if (strcmp(key, "size") == 0)
+            {
+                *size = strtoull(val, NULL, 10);
+                *have_size = 1;
+            }
+        }
+        p += reclen;
+    }
+}
+
+static int tar_whiteout(int pfd, const char *base)
+{
+    if (strcmp(base, ".wh..wh..opq") == 0)
+    {
+        if (fsetxattr(pfd, "trusted.overlay.opaque", "y", 1, 0) != 0)
+        {
+            perror("setxattr opaque");
+            return -1;
+        }
+        return 0;
+    }
+
+    const char *name = base + 4;
+    unlinkat(pfd, name, 0);
+    if (mknodat(pfd, name, S_IFCHR | 0000, makedev(0, 0)) != 0)
+    {
+        perror("mknod whiteout");
+        return -1;
+    }
+    return 0;
+}
+
+// Owner and mode of the node just made at base, through an fd on it, so
+// a symlink put there by an earlier entry is never followed. Devices and
+// FIFOs can't be opened for fchmod() without side effects: their O_PATH
+// fd is reached through /proc instead.
+static void tar_set_owner_mode(int pfd, const char *base, uid_t uid, gid_t gid, mode_t mode)
+{
+    int fd = openat(pfd, base, O_PATH | O_NOFOLLOW | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || S_ISLNK(st.st_mode))
+    {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    fchownat(fd, "", uid, gid, AT_EMPTY_PATH);
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    chmod(path, mode);
+    close(fd);
+}
+
+// Create one entry (data already positioned in r for regular files)
+static int tar_create(struct layer_reader *r, int rootfd, int pfd, const char *base,
+                      const struct tar_header *h, const char *linkpath,
+                      unsigned long long size, char *buf)
+{
+    mode_t mode = tar_num(h->mode, sizeof(h->mode)) & 07777;
+    uid_t uid = tar_num(h->uid, sizeof(h->uid));
+    gid_t gid = tar_num(h->gid, sizeof(h->gid));
+    struct timespec times[2] = {
+        { .tv_nsec = UTIME_OMIT },
+        { .tv_sec = tar_num(h->mtime, sizeof(h->mtime)) },
+    };
+
+    if (h->typeflag != '5')
+        unlinkat(pfd, base, 0);   // later entries replace earlier ones
+
+    switch (h->typeflag)
+    {
+    case '0':
+    case '\0':
+    case '7':
+    {
+        int fd = openat(pfd, base, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (fd < 0)
+        {
+            perror(base);
+            return tar_copy_data(r, -1, size, buf) ? -1 : 0;
+        }
+        int ret = tar_copy_data(r, fd, size, buf);
+        fchown(fd, uid, gid);
+        fchmod(fd, mode);
+        futimens(fd, times);
+        close(fd);
+        return ret;
+    }
+
+    case '1':
+    {
+        char target[PATH_MAX];
+        snprintf(target, sizeof(target), "%s", linkpath);
+        char *clean = tar_clean_path(target);
+        int tfd = clean ? tar_openat2(rootfd, clean, O_PATH | O_NOFOLLOW) : -1;
+        if (tfd < 0 || linkat(tfd, "", pfd, base, AT_EMPTY_PATH) != 0)
+            fprintf(stderr, "layer: hardlink %s -> %s: %s\n", base, linkpath, strerror(errno));
+        if (tfd >= 0)
+            close(tfd);
+        return 0;
+    }
+
+    case '2':
+        if (symlinkat(linkpath, pfd, base) != 0)
+        {
+            perror(base);
+            return 0;
+        }
+        fchownat(pfd, base, uid, gid, AT_SYMLINK_NOFOLLOW);
+        utimensat(pfd, base, times, AT_SYMLINK_NOFOLLOW);
+        return 0;
+
+    case '3':
+    case '4':
+    case '6':
+    {
+        mode_t type = h->typeflag == '3' ? S_IFCHR : h->typeflag == '4' ? S_IFBLK : S_IFIFO;
+        dev_t dev = makedev(tar_num(h->devmajor, sizeof(h->devmajor)),
+                            tar_num(h->devminor, sizeof(h->devminor)));
+        if (mknodat(pfd, base, type | mode, dev) != 0)
+        {
+            perror(base);
+            return 0;
+        }
+        tar_set_owner_mode(pfd, base, uid, gid, mode);
+        return 0;
+    }
+
+    case '5':
+    {
+        // An earlier entry by the same name that isn't a directory (a
+        // symlink out of the layer, say) is replaced, not followed
+        struct stat st;
+        if (fstatat(pfd, base, &st, AT_SYMLINK_NOFOLLOW) == 0 && !S_ISDIR(st.st_mode))
+            unlinkat(pfd, base, 0);
+        if (mkdirat(pfd, base, mode) != 0 && errno != EEXIST)
+        {
+            perror(base);
+            return 0;
+        }
+        int fd = openat(pfd, base, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0)
+        {
+            perror(base);
+            return 0;
+        }
+        fchown(fd, uid, gid);
+        fchmod(fd, mode);
+        close(fd);
+        return 0;
+    }
+
+    default:
+        // Unknown entry type: skip its data
+        return tar_copy_data(r, -1, size, buf);
+    }
+}
+
+// Extract the tar stream in r into the directory rootfd.
+// Returns 0 on success, < 0 if the stream is corrupt or unreadable.
+int tar_extract(struct layer_reader *r, int rootfd)
+{
+    struct tar_header h;
+    char *buf = malloc(LAYER_IO_SIZE);
+    char *path = malloc(PATH_MAX);
+    char *linkpath = malloc(PATH_MAX);
+    char *long_name = malloc(PATH_MAX);
+    char *long_link = malloc(PATH_MAX);
+    if (!buf || !path || !linkpath || !long_name || !long_link)
+    {
+        free(buf); free(path); free(linkpath); free(long_name); free(long_link);
+        return -ENOMEM;
+    }
+
+    long_name[0] = long_link[0] = '\0';
+    unsigned long long pax_size = 0;
+    int have_pax_size = 0;
+    int ret = 0;
+
+    for (;;)
+    {
+        ret = layer_read_full(r, &h, sizeof(h));
+        if (ret < 0)
+            break;
+
+        if (h.name[0] == '\0')
+            break;   // end-of-archive block
+
+        if (!tar_checksum_ok(&h))
+        {
+            fprintf(stderr, "layer: bad tar header checksum\n");
+            ret = -EIO;
+            break;
+        }
+
+        unsigned long long size = have_pax_size ? pax_size : tar_num(h.size, sizeof(h.size));
+        unsigned long long padded = (size + 511) & ~511ull;
+
+        // Metadata entries describe the next header
+        if (h.typeflag == 'L' || h.typeflag == 'K' || h.typeflag == 'x' || h.typeflag == 'g')
+        {
+            size = tar_num(h.size, sizeof(h.size));
+            padded = (size + 511) & ~511ull;
+            if (padded > 1024 * 1024)
+            {
+                ret = -EIO;
+                break;
+            }
+
+            char *data = malloc(padded + 1);
+            if (!data || layer_read_full(r, data, padded) < 0)
+            {
+                free(data);
+                ret = -EIO;
+                break;
+            }
+            data[size] = '\0';
+
+            if (h.typeflag == 'L')
+                snprintf(long_name, PATH_MAX, "%s", data);
+            else if (h.typeflag == 'K')
+                snprintf(long_link, PATH_MAX, "%s", data);
+            else if (h.typeflag == 'x')
+                tar_parse_pax(data, size, long_name, long_link, &pax_size, &have_pax_size);
+            free(data);
+            continue;
+        }
+
+        if (long_name[0])
+            snprintf(path, PATH_MAX, "%s", long_name);
+        else if (h.prefix[0] && memcmp(h.magic, "ustar", 5) == 0)
+            snprintf(path, PATH_MAX, "%.155s/%.100s", h.prefix, h.name);
+        else
+            snprintf(path, PATH_MAX, "%.100s", h.name);
+
+        if (long_link[0])
+            snprintf(linkpath, PATH_MAX, "%s", long_link);
+        else
+            snprintf(linkpath, PATH_MAX, "%.100s", h.linkname);
+
+        long_name[0] = long_link[0] = '\0';
+        have_pax_size = 0;
+
+        int is_file = h.typeflag == '0' || h.typeflag == '\0' || h.typeflag == '7';
+        char *clean = tar_clean_path(path);
+        if (!clean || !*clean)
+        {
+            if (clean == NULL)
+                fprintf(stderr, "layer: skipping unsafe path %s\n", path);
+            ret = tar_copy_data(r, -1, padded, buf);
+            if (ret < 0) break;
+            continue;
+        }
+
+        char *slash = strrchr(clean, '/');
+        const char *base = slash ? slash + 1 : clean;
+        if (slash)
+            *slash = '\0';
+
+        int pfd = tar_open_dir(rootfd, slash ? clean : "");
+        if (pfd < 0)
+        {
+            fprintf(stderr, "layer: cannot open parent of %s: %s\n", base, strerror(errno));
+            ret = tar_copy_data(r, -1, padded, buf);
+            if (ret < 0) break;
+            continue;
+        }
+
+        if (strncmp(base, ".wh.", 4) == 0)
+            tar_whiteout(pfd, base);
+        else
+            ret = tar_create(r, rootfd, pfd, base, &h, linkpath, is_file ? size : 0, buf);
+        close(pfd);
+
+        if (ret < 0)
+            break;
+
+        // Regular files consumed their data; skip the padding (or the
+        // whole payload for anything else that carries one)
+        unsigned long long skip = is_file && strncmp(base, ".wh.", 4) != 0 ? padded - size : padded;
+        ret = tar_copy_data(r, -1, skip, buf);
+        if (ret < 0)
+            break;
+    }
+
+    free(buf); free(path); free(linkpath); free(long_name); free(long_link);
+    return ret;
+}
+
+#endif // CDOCKER_TAR_H
@@ -0,0 +1,108 @@
+#ifndef CDOCKER_TIMING_H
+#define CDOCKER_TIMING_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/mman.h>
+
+/*
+ * Launch phase timestamps
+ *
+ * CLOCK_MONOTONIC is the same clock in every process on the host, so the
+ * child can stamp its own phases and the parent can subtract them from
+ * its own. The struct lives in a MAP_SHARED page created before clone(),
+ * which the child keeps sharing after clone() (but not after execv()).
+ */
+
+enum launch_mark {
+    MARK_START,          // parent: about to clone
+    MARK_CLONED,         // parent: clone() returned
+    MARK_CHILD_START,    // child: first instruction in child_func
+    MARK_ROOTFS_DONE,    // child: setup_rootfs() returned
+    MARK_NET_DONE,       // parent: setup_network() returned
+    MARK_SIGNALLED,      // parent: posted the go to the child
+    MARK_CHILD_RESUMED,  // child: its wait for the go returned
+    MARK_EXEC,           // child: about to execv()
+    MARK_COUNT
+};
+
+struct launch_timing {
+    uint64_t ts[MARK_COUNT];   // ns, 0 = never reached
+};
+
+// A span is the time between two marks; these are what get reported
+struct timing_span {
+    const char *name;
+    enum launch_mark from, to;
+};
+
+static const struct timing_span timing_spans[] = {
+    { "clone",   MARK_START,         MARK_CLONED },
+    { "rootfs",  MARK_CHILD_START,   MARK_ROOTFS_DONE },
+    { "network", MARK_CLONED,        MARK_NET_DONE },
+    { "handoff", MARK_SIGNALLED,     MARK_CHILD_RESUMED },
+    { "exec",    MARK_CHILD_RESUMED, MARK_EXEC },
+    { "total",   MARK_START,         MARK_EXEC },
+};
+
+#define TIMING_SPANS (int)(sizeof(timing_spans) / sizeof(timing_spans[0]))
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void timing_mark(struct launch_timing *t, enum launch_mark m)
+{
+    if (t)
+        t->ts[m] = now_ns();
+}
+
+// Span length in ns, or -1 if either end wasn't reached
+static inline int64_t timing_span_ns(const struct launch_timing *t, int span)
+{
+    uint64_t from = t->ts[timing_spans[span].from];
+    uint64_t to = t->ts[timing_spans[span].to];
+    if (!from || !to)
+        return -1;
+    return (int64_t)(to - from);
+}
+
+// Shared between parent and child across clone(); count entries
+struct launch_timing *timing_alloc(int count)
+{
+    void *p = mmap(NULL, sizeof(struct launch_timing) * count,
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+    {
+        perror("mmap timing");
+        return NULL;
+    }
+    return p;
+}
+
+void timing_free(struct launch_timing *t, int count)
+{
+    if (t)
+        munmap(t, sizeof(struct launch_timing) * count);
+}
+
+void timing_print(FILE *out, const struct launch_timing *t)
+{
+    fprintf(out, "launch timing:");
+    for (int i = 0; i < TIMING_SPANS; i++)
+    {
+        int64_t ns = timing_span_ns(t, i);
+        if (ns < 0)
+            fprintf(out, " %s=-", timing_spans[i].name);
+        else
+            fprintf(out, " %s=%.3fms", timing_spans[i].name, ns / 1e6);
+    }
+    fprintf(out, "\n");
+}
+
+#endif // CDOCKER_TIMING_H
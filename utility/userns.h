@@ -0,0 +1,188 @@
+#ifndef CDOCKER_USERNS_H
+#define CDOCKER_USERNS_H
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <signal.h>
+#include <sys/mount.h>
+
+#include "spawn.h"
+
+/*
+ * User namespaces. A container with a uid range runs in a user namespace
+ * of its own that maps its uids and gids 0..count-1 onto base..base+count-1
+ * on the host: root inside, an unprivileged id range outside.
+ *
+ * Its image keeps the owners it has on disk. The root mount is idmapped
+ * (MOUNT_ATTR_IDMAP, 5.12+) through a user namespace with the same
+ * mapping, so a file owned by 0 on disk is owned by root inside. That's
+ * one mount_setattr() per container whatever the image's size, instead
+ * of a chowned copy. The image itself stays read-only: what the container
+ * writes lands in an overlay's upper layer, owned by base.
+ *
+ * The container's own namespace comes with its clone and is empty until
+ * the parent writes its maps, before the go. An idmapped mount needs its
+ * namespace mapped beforehand, so that one is a stand-in's, made once per
+ * mapping and kept.
+ */
+
+#define USERNS_DEFAULT_COUNT 65536
+#define USERNS_CACHE_SLOTS 8
+
+// Container ids 0..count-1 are host ids base..; count 0: no user namespace
+struct userns_map {
+    unsigned int base;
+    unsigned int count;
+};
+
+// --userns's argument: BASE[:COUNT]
+int userns_map_parse(const char *s, struct userns_map *m)
+{
+    char *end;
+    unsigned long base = strtoul(s, &end, 10), count = USERNS_DEFAULT_COUNT;
+    if (end == s || (*end && *end != ':'))
+        return -1;
+    if (*end)
+    {
+        const char *c = end + 1;
+        count = strtoul(c, &end, 10);
+        if (end == c || *end)
+            return -1;
+    }
+    // Host root stays unmapped, and the range has to fit in 32 bits
+    if (base == 0 || count == 0 || base + count - 1 > (unsigned long)(uid_t)-2)
+        return -1;
+    m->base = base;
+    m->count = count;
+    return 0;
+}
+
+static int userns_write_map(pid_t pid, const char *file, const struct userns_map *m)
+{
+    char path[64], line[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, file);
+    int len = snprintf(line, sizeof(line), "0 %u %u\n", m->base, m->count);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    int ok = fd >= 0 && write(fd, line, len) == len;
+    if (!ok)
+        perror(path);
+    if (fd >= 0)
+        close(fd);
+    return ok ? 0 : -1;
+}
+
+// Parent: give pid's user namespace its uid and gid maps. Only once.
+int userns_write_maps(pid_t pid, const struct userns_map *m)
+{
+    if (userns_write_map(pid, "uid_map", m) < 0 || userns_write_map(pid, "gid_map", m) < 0)
+        return -1;
+    return 0;
+}
+
+// Child, once mapped: become its root, the ids it exec's with
+int userns_enter_root(void)
+{
+    if (setgroups(0, NULL) != 0 || setresgid(0, 0, 0) != 0 || setresuid(0, 0, 0) != 0)
+    {
+        perror("userns: become root");
+        return -1;
+    }
+    return 0;
+}
+
+// The stand-in just exists until it's killed
+static int userns_hold(void *arg)
+{
+    (void)arg;
+    for (;;)
+        pause();
+    return 0;
+}
+
+static int userns_create(const struct userns_map *m)
+{
+    int pidfd;
+    pid_t pid = spawn_child(userns_hold, NULL, CLONE_NEWUSER, -1, &pidfd);
+    if (pid < 0)
+    {
+        perror("clone user namespace");
+        return -1;
+    }
+
+    int ns = -1;
+    if (userns_write_maps(pid, m) == 0)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/ns/user", pid);
+        ns = open(path, O_RDONLY | O_CLOEXEC);
+        if (ns < 0)
+            perror(path);
+    }
+    pidfd_send_signal_wrapper(pidfd, SIGKILL);
+    pidfd_reap(pidfd);
+    close(pidfd);
+    return ns;
+}
+
+// This process's user namespaces by mapping; replaced round robin
+static struct {
+    pid_t owner;
+    struct userns_map map[USERNS_CACHE_SLOTS];
+    int fd[USERNS_CACHE_SLOTS];
+    unsigned int next;
+} userns_cache;
+
+// A user namespace with mapping m, to idmap mounts through. Cached; not
+// the caller's to close.
+int userns_get(const struct userns_map *m)
+{
+    if (userns_cache.owner != getpid())
+    {
+        // The parent's; closing our copies leaves its own alone
+        for (int i = 0; userns_cache.owner && i < USERNS_CACHE_SLOTS; i++)
+            if (userns_cache.fd[i] >= 0)
+                close(userns_cache.fd[i]);
+        for (int i = 0; i < USERNS_CACHE_SLOTS; i++)
+            userns_cache.fd[i] = -1;
+        userns_cache.next = 0;
+        userns_cache.owner = getpid();
+    }
+
+    for (int i = 0; i < USERNS_CACHE_SLOTS; i++)
+        if (userns_cache.fd[i] >= 0 && userns_cache.map[i].base == m->base &&
+            userns_cache.map[i].count == m->count)
+            return userns_cache.fd[i];
+
+    int ns = userns_create(m);
+    if (ns < 0)
+        return -1;
+
+    // Mounts already idmapped through an evicted one keep it alive
+    unsigned int slot = userns_cache.next++ % USERNS_CACHE_SLOTS;
+    if (userns_cache.fd[slot] >= 0)
+        close(userns_cache.fd[slot]);
+    userns_cache.fd[slot] = ns;
+    userns_cache.map[slot] = *m;
+    return ns;
+}
+
+// Idmap a detached mount, and everything below it, through userns. Read
+// only: files owned by 0 on disk are owned by 0 on the host too, so
+// through the idmap container root would write to them as host root.
+int mount_idmap(int mnt, int userns)
+{
+    struct mount_attr attr = {
+        .attr_set = MOUNT_ATTR_IDMAP | MOUNT_ATTR_RDONLY,
+        .userns_fd = userns,
+    };
+    return mount_setattr(mnt, "", AT_EMPTY_PATH | AT_RECURSIVE, &attr, sizeof(attr));
+}
+
+#endif // CDOCKER_USERNS_H
@@ -0,0 +1,324 @@
+#ifndef CDOCKER_ZYGOTE_H
+#define CDOCKER_ZYGOTE_H
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <linux/limits.h>
+
+#include "rootfs.h"
+#include "utility/spawn.h"
+#include "utility/fdpass.h"
+
+/*
+ * Zygotes: pre-initialised templates to fork containers from.
+ *
+ * Most of a container's start is the same for every container of one
+ * image: making mounts private, the bind mount, pivot_root, /dev, /proc
+ * and /sys. A zygote is a process that has done all of that once, in its
+ * own mount namespace, and then waits on a socket. Each request makes it
+ * clone a container with fresh PID/net/mount/UTS namespaces (the mount
+ * namespace a copy of its already pivoted one) straight into the
+ * container's cgroup, so what's left per container is a few mounts
+ * instead of the whole rootfs setup.
+ *
+ * The zygote clones with CLONE_PARENT: the container is the requester's
+ * child, not the zygote's, so the requester reaps it through the pidfd
+ * the zygote sends back exactly as if it had cloned it itself.
+ *
+ * The zygote is a fork of the requesting process, so the function to run
+ * is sent as a plain pointer. Only plain images work this way; an
+ * overlay has a writable layer per container, which can't be shared.
+ *
+ * Zygotes are kept per process and per image, like the netlink session,
+ * so each launch_pool worker starts its own on first use. A zygote dies
+ * with the process that started it.
+ */
+
+#define ZYGOTE_MAX      8       // images with a zygote per process
+#define ZYGOTE_MSG_MAX  65536
+
+typedef int (*zygote_fn)(void *arg, const int *fds);
+
+struct zygote {
+    pid_t owner;                // process that started it; 0: slot free
+    pid_t pid;
+    int pidfd;
+    int sock;                   // SOCK_SEQPACKET to the zygote
+    char image[PATH_MAX];       // realpath of the image
+    enum rootfs_dev dev;        // and the /dev it was set up with
+};
+
+struct zygote_req {
+    zygote_fn fn;
+    uint64_t flags;             // CLONE_NEW* for the container
+    int32_t cgroup;             // 1: fds[0] is the cgroup to clone into
+    int32_t nfds;               // fds after the cgroup, for fn
+    // followed by the argument fn gets a copy of
+};
+
+struct zygote_resp {
+    int32_t pid;                // -1 on failure
+    int32_t error;              // errno then
+    // the pidfd is attached
+};
+
+// What the zygote's clone runs: fn with its copy of the argument
+struct zygote_call {
+    zygote_fn fn;
+    void *arg;
+    int fds[FDPASS_MAX];
+};
+
+static int zygote_trampoline(void *arg)
+{
+    struct zygote_call *call = arg;
+    return call->fn(call->arg, call->fds);
+}
+
+static void zygote_reply(int sock, pid_t pid, int error, int pidfd)
+{
+    struct zygote_resp resp = { .pid = pid, .error = error };
+    struct iovec iov = { .iov_base = &resp, .iov_len = sizeof(resp) };
+    fd_sendmsg(sock, &iov, 1, &pidfd, pidfd >= 0 ? 1 : 0);
+}
+
+struct zygote_boot {
+    struct rootfs_opts rootfs;
+    int sock;                   // the zygote's end
+    int peer;                   // the requester's end, closed in the zygote
+};
+
+// The zygote itself: set up the rootfs, then clone containers on request
+// until the requester goes away
+static int zygote_main(void *arg)
+{
+    struct zygote_boot *boot = arg;
+    static char buf[ZYGOTE_MSG_MAX];
+
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    close(boot->peer);
+
+    int pidns = open("/proc/self/ns/pid", O_RDONLY | O_CLOEXEC);
+
+    // Whatever the requester had blocked is restored per container
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    struct rootfs_mounts mounts;
+    rootfs_mounts_init(&mounts);
+    if (setup_rootfs(&boot->rootfs, &mounts) != 0)
+    {
+        zygote_reply(boot->sock, -1, errno ? errno : EIO, -1);
+        return 1;
+    }
+    zygote_reply(boot->sock, 0, 0, -1);
+
+    for (;;)
+    {
+        int fds[FDPASS_MAX];
+        ssize_t n = fd_recvmsg(boot->sock, buf, sizeof(buf), fds, FDPASS_MAX);
+        if (n <= 0)
+            _exit(0);
+
+        struct zygote_req *req = (struct zygote_req *)buf;
+        if ((size_t)n < sizeof(*req) || req->nfds + req->cgroup > FDPASS_MAX)
+        {
+            for (int i = 0; i < FDPASS_MAX; i++)
+                if (fds[i] >= 0)
+                    close(fds[i]);
+            zygote_reply(boot->sock, -1, EPROTO, -1);
+            continue;
+        }
+
+        struct zygote_call call = { .fn = req->fn, .arg = req + 1 };
+        int cgroup_fd = req->cgroup ? fds[0] : -1;
+        memcpy(call.fds, fds + req->cgroup, sizeof(int) * (FDPASS_MAX - req->cgroup));
+
+        // clone() refuses CLONE_NEWPID together with CLONE_PARENT, but
+        // unshare(CLONE_NEWPID) right before the clone does the same: the
+        // next child is PID 1 of a new namespace. unshare only works from
+        // our own namespace, so step back into it first.
+        uint64_t flags = req->flags;
+        int pidfd = -1, err = 0;
+        pid_t pid = -1;
+        if ((flags & CLONE_NEWPID) &&
+            (setns(pidns, CLONE_NEWPID) != 0 || unshare(CLONE_NEWPID) != 0))
+            err = errno;
+        else
+        {
+            flags &= ~(uint64_t)CLONE_NEWPID;
+            pid = spawn_child(zygote_trampoline, &call, flags | CLONE_PARENT, cgroup_fd, &pidfd);
+            err = errno;
+        }
+
+        for (int i = 0; i < FDPASS_MAX; i++)
+            if (fds[i] >= 0)
+                close(fds[i]);
+        zygote_reply(boot->sock, pid, pid < 0 ? err : 0, pid < 0 ? -1 : pidfd);
+        if (pidfd >= 0)
+            close(pidfd);
+    }
+}
+
+static void zygote_stop(struct zygote *z)
+{
+    if (z->sock >= 0)
+        close(z->sock);
+    if (z->pidfd >= 0)
+    {
+        pidfd_send_signal_wrapper(z->pidfd, SIGKILL);
+        pidfd_reap(z->pidfd);
+        close(z->pidfd);
+    }
+    memset(z, 0, sizeof(*z));
+    z->sock = z->pidfd = -1;
+}
+
+static int zygote_start(struct zygote *z, const struct rootfs_opts *rootfs, const char *image)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0)
+    {
+        perror("socketpair zygote");
+        return -1;
+    }
+
+    struct zygote_boot boot = { .rootfs = *rootfs, .sock = sv[1], .peer = sv[0] };
+    boot.rootfs.image = image;
+
+    z->owner = getpid();
+    z->sock = sv[0];
+    snprintf(z->image, sizeof(z->image), "%s", image);
+    z->dev = rootfs->dev;
+    z->pid = spawn_child(zygote_main, &boot, CLONE_NEWNS, -1, &z->pidfd);
+    close(sv[1]);
+    if (z->pid < 0)
+    {
+        perror("clone zygote");
+        close(sv[0]);
+        memset(z, 0, sizeof(*z));
+        return -1;
+    }
+
+    // Wait for the rootfs to be ready
+    struct zygote_resp resp;
+    int fds[1];
+    if (fd_recvmsg(z->sock, &resp, sizeof(resp), fds, 1) != sizeof(resp) || resp.pid < 0)
+    {
+        fprintf(stderr, "zygote for %s failed to start\n", image);
+        zygote_stop(z);
+        return -1;
+    }
+    return 0;
+}
+
+// This process's zygote for the image, started on first use (or again
+// if the previous one died)
+struct zygote *zygote_get(const struct rootfs_opts *rootfs)
+{
+    static struct zygote zygotes[ZYGOTE_MAX];
+
+    char image[PATH_MAX];
+    if (!realpath(rootfs->image ? rootfs->image : "./rootfs", image))
+    {
+        perror("realpath image");
+        return NULL;
+    }
+
+    struct zygote *free_slot = NULL;
+    for (int i = 0; i < ZYGOTE_MAX; i++)
+    {
+        struct zygote *z = &zygotes[i];
+
+        // Inherited over fork: the zygote isn't ours to talk to
+        if (z->owner && z->owner != getpid())
+        {
+            close(z->sock);
+            close(z->pidfd);
+            memset(z, 0, sizeof(*z));
+        }
+
+        if (!z->owner)
+        {
+            if (!free_slot)
+                free_slot = z;
+            continue;
+        }
+        if (strcmp(z->image, image) != 0 || z->dev != rootfs->dev)
+            continue;
+
+        struct pollfd pfd = { .fd = z->pidfd, .events = POLLIN };
+        if (poll(&pfd, 1, 0) == 0)
+            return z;
+        zygote_stop(z);
+        free_slot = z;
+        break;
+    }
+
+    if (!free_slot)
+    {
+        fprintf(stderr, "zygote: more than %d images\n", ZYGOTE_MAX);
+        return NULL;
+    }
+    return zygote_start(free_slot, rootfs, image) == 0 ? free_slot : NULL;
+}
+
+// Have the zygote clone fn(copy of arg, fds) with the given CLONE_NEW*
+// flags, inside cgroup_fd if >= 0. The new process is our child. Returns
+// its pid and fills *pidfd, or -1 with errno set.
+pid_t zygote_spawn(struct zygote *z, zygote_fn fn, const void *arg, size_t len,
+                   uint64_t flags, int cgroup_fd, const int *fds, int nfds, int *pidfd)
+{
+    struct zygote_req req = {
+        .fn = fn, .flags = flags, .cgroup = cgroup_fd >= 0, .nfds = nfds,
+    };
+    int pass[FDPASS_MAX], npass = 0;
+    if (sizeof(req) + len > ZYGOTE_MSG_MAX || nfds + req.cgroup > FDPASS_MAX)
+    {
+        errno = E2BIG;
+        return -1;
+    }
+    if (cgroup_fd >= 0)
+        pass[npass++] = cgroup_fd;
+    for (int i = 0; i < nfds; i++)
+        pass[npass++] = fds[i];
+
+    struct iovec iov[2] = {
+        { .iov_base = &req, .iov_len = sizeof(req) },
+        { .iov_base = (void *)arg, .iov_len = len },
+    };
+    if (fd_sendmsg(z->sock, iov, 2, pass, npass) < 0)
+        return -1;
+
+    struct zygote_resp resp;
+    int got[1];
+    if (fd_recvmsg(z->sock, &resp, sizeof(resp), got, 1) != sizeof(resp))
+    {
+        errno = errno ? errno : EPROTO;
+        return -1;
+    }
+    if (resp.pid < 0 || got[0] < 0)
+    {
+        if (got[0] >= 0)
+            close(got[0]);
+        errno = resp.pid < 0 ? resp.error : EPROTO;
+        return -1;
+    }
+    *pidfd = got[0];
+    return resp.pid;
+}
+
+#endif // CDOCKER_ZYGOTE_H